@@ -70,7 +70,12 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEventHeap = NULL;
+    eventLoop->timeEventHeapLen = 0;
+    eventLoop->timeEventHeapSize = 0;
+    eventLoop->timeEventTable = NULL;
+    eventLoop->timeEventTableSize = 0;
+    eventLoop->timeEventCount = 0;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
@@ -123,6 +128,12 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 }
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    int j;
+
+    for (j = 0; j < eventLoop->timeEventHeapLen; j++)
+        zfree(eventLoop->timeEventHeap[j]);
+    zfree(eventLoop->timeEventHeap);
+    zfree(eventLoop->timeEventTable);
     aeApiFree(eventLoop);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
@@ -182,30 +193,144 @@ int aeGetFileEvents(aeEventLoop *eventLoop, int fd) {
     return fe->mask;
 }
 
-static void aeGetTime(long *seconds, long *milliseconds)
-{
+/* Return the UNIX time in microseconds. */
+static long long aeUstime(void) {
     struct timeval tv;
 
     gettimeofday(&tv, NULL);
-    *seconds = tv.tv_sec;
-    *milliseconds = tv.tv_usec/1000;
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
 }
 
-static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms) {
-    long cur_sec, cur_ms, when_sec, when_ms;
+/* Time events are kept in a binary min-heap ordered by firing time, so that
+ * the nearest one is always the root: finding it is O(1), while adding and
+ * removing events is O(log(N)). In order to find events by id they are also
+ * hashed in a chained table indexed by the low bits of the id: since ids are
+ * assigned incrementally, chains are very short. */
+
+static void aeHeapSet(aeEventLoop *eventLoop, int index, aeTimeEvent *te) {
+    eventLoop->timeEventHeap[index] = te;
+    te->heapIndex = index;
+}
 
-    aeGetTime(&cur_sec, &cur_ms);
-    when_sec = cur_sec + milliseconds/1000;
-    when_ms = cur_ms + milliseconds%1000;
-    if (when_ms >= 1000) {
-        when_sec ++;
-        when_ms -= 1000;
+/* Move the event at 'index' towards the root while it fires before its
+ * parent. */
+static void aeHeapUp(aeEventLoop *eventLoop, int index) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *te = heap[index];
+
+    while (index > 0) {
+        int parent = (index-1)/2;
+
+        if (heap[parent]->when <= te->when) break;
+        aeHeapSet(eventLoop,index,heap[parent]);
+        index = parent;
     }
-    *sec = when_sec;
-    *ms = when_ms;
+    aeHeapSet(eventLoop,index,te);
 }
 
-long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
+/* Move the event at 'index' towards the leaves while one of its children
+ * fires before it. */
+static void aeHeapDown(aeEventLoop *eventLoop, int index) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *te = heap[index];
+    int len = eventLoop->timeEventHeapLen;
+
+    while (1) {
+        int child = index*2+1;
+
+        if (child >= len) break;
+        if (child+1 < len && heap[child+1]->when < heap[child]->when) child++;
+        if (te->when <= heap[child]->when) break;
+        aeHeapSet(eventLoop,index,heap[child]);
+        index = child;
+    }
+    aeHeapSet(eventLoop,index,te);
+}
+
+static void aeHeapInsert(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timeEventHeapLen == eventLoop->timeEventHeapSize) {
+        eventLoop->timeEventHeapSize = eventLoop->timeEventHeapSize ?
+                                       eventLoop->timeEventHeapSize*2 : 16;
+        eventLoop->timeEventHeap = zrealloc(eventLoop->timeEventHeap,
+            sizeof(aeTimeEvent*)*eventLoop->timeEventHeapSize);
+    }
+    aeHeapSet(eventLoop,eventLoop->timeEventHeapLen++,te);
+    aeHeapUp(eventLoop,te->heapIndex);
+}
+
+static void aeHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    aeTimeEvent **heap = eventLoop->timeEventHeap;
+    aeTimeEvent *last = heap[--eventLoop->timeEventHeapLen];
+    int index = te->heapIndex;
+
+    te->heapIndex = -1;
+    if (last == te) return;
+    aeHeapSet(eventLoop,index,last);
+    if (index > 0 && heap[(index-1)/2]->when > last->when)
+        aeHeapUp(eventLoop,index);
+    else
+        aeHeapDown(eventLoop,index);
+}
+
+static unsigned long aeTableBucket(aeEventLoop *eventLoop, long long id) {
+    return (unsigned long)id & (eventLoop->timeEventTableSize-1);
+}
+
+static void aeTableAdd(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    unsigned long b;
+
+    /* Double the table when there is an event per bucket on average. */
+    if (eventLoop->timeEventCount >= eventLoop->timeEventTableSize) {
+        aeTimeEvent **old = eventLoop->timeEventTable;
+        unsigned long oldsize = eventLoop->timeEventTableSize, j;
+
+        eventLoop->timeEventTableSize = oldsize ? oldsize*2 : 16;
+        eventLoop->timeEventTable = zcalloc(sizeof(aeTimeEvent*)*
+                                            eventLoop->timeEventTableSize);
+        for (j = 0; j < oldsize; j++) {
+            aeTimeEvent *cur = old[j], *next;
+
+            while (cur) {
+                next = cur->hnext;
+                b = aeTableBucket(eventLoop,cur->id);
+                cur->hnext = eventLoop->timeEventTable[b];
+                eventLoop->timeEventTable[b] = cur;
+                cur = next;
+            }
+        }
+        zfree(old);
+    }
+    b = aeTableBucket(eventLoop,te->id);
+    te->hnext = eventLoop->timeEventTable[b];
+    eventLoop->timeEventTable[b] = te;
+    eventLoop->timeEventCount++;
+}
+
+static aeTimeEvent *aeTableFind(aeEventLoop *eventLoop, long long id) {
+    aeTimeEvent *te;
+
+    if (eventLoop->timeEventTableSize == 0 || id < 0) return NULL;
+    te = eventLoop->timeEventTable[aeTableBucket(eventLoop,id)];
+    while (te && te->id != id) te = te->hnext;
+    return te;
+}
+
+static void aeTableDelete(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    aeTimeEvent **p =
+        &eventLoop->timeEventTable[aeTableBucket(eventLoop,te->id)];
+
+    while (*p != te) p = &(*p)->hnext;
+    *p = te->hnext;
+    eventLoop->timeEventCount--;
+}
+
+/* Create a time event firing in the specified number of microseconds. The
+ * value returned by the time proc, when not AE_NOMORE, is still the number of
+ * milliseconds after which the event should fire again, so this is mostly
+ * useful for one-shot high resolution timers. Note that how close to the
+ * deadline the event fires depends on the timeout resolution of the
+ * multiplexing API: with epoll it may fire up to a millisecond late. */
+long long aeCreateTimeEventUs(aeEventLoop *eventLoop, long long microseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
 {
@@ -215,29 +340,53 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te = zmalloc(sizeof(*te));
     if (te == NULL) return AE_ERR;
     te->id = id;
-    aeAddMillisecondsToNow(milliseconds,&te->when_sec,&te->when_ms);
+    te->when = aeUstime()+microseconds;
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->prev = NULL;
-    te->next = eventLoop->timeEventHead;
-    if (te->next)
-        te->next->prev = te;
-    eventLoop->timeEventHead = te;
+    te->heapIndex = -1;
+    te->next = NULL;
+    aeTableAdd(eventLoop,te);
+    aeHeapInsert(eventLoop,te);
     return id;
 }
 
+long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
+        aeTimeProc *proc, void *clientData,
+        aeEventFinalizerProc *finalizerProc)
+{
+    return aeCreateTimeEventUs(eventLoop,milliseconds*1000,proc,clientData,
+                               finalizerProc);
+}
+
+/* Delete a time event. The finalizer, if any, is called ASAP: immediately
+ * if the event is waiting in the heap, or when its time proc returns if the
+ * event is being processed. */
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            te->id = AE_DELETED_EVENT_ID;
-            return AE_OK;
-        }
-        te = te->next;
+    aeTimeEvent *te = aeTableFind(eventLoop,id);
+
+    if (te == NULL) return AE_ERR; /* NO event with the specified ID found */
+    aeTableDelete(eventLoop,te);
+    te->id = AE_DELETED_EVENT_ID;
+    if (te->heapIndex != -1) {
+        aeHeapRemove(eventLoop,te);
+        if (te->finalizerProc)
+            te->finalizerProc(eventLoop, te->clientData);
+        zfree(te);
     }
-    return AE_ERR; /* NO event with the specified ID found */
+    return AE_OK;
+}
+
+/* Return the microseconds remaining before the specified time event fires
+ * (zero if it is already due), or -1 if no such event exists. */
+long long aeTimeEventRemainingUs(aeEventLoop *eventLoop, long long id) {
+    aeTimeEvent *te = aeTableFind(eventLoop,id);
+    long long remaining;
+
+    if (te == NULL) return -1;
+    remaining = te->when - aeUstime();
+    return remaining > 0 ? remaining : 0;
 }
 
 /* Search the first timer to fire.
@@ -245,32 +394,18 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * This is O(1) since the nearest timer is the root of the heap. */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    if (eventLoop->timeEventHeapLen == 0) return NULL;
+    return eventLoop->timeEventHeap[0];
 }
 
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
-    aeTimeEvent *te;
-    long long maxId;
+    int processed = 0, j;
+    aeTimeEvent *te, *due = NULL, **tail = &due;
+    long long now_us;
     time_t now = time(NULL);
 
     /* If the system clock is moved to the future, and then set back to the
@@ -280,63 +415,50 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * Here we try to detect system clock skews, and force all the time
      * events to be processed ASAP when this happens: the idea is that
      * processing events earlier is less dangerous than delaying them
-     * indefinitely, and practice suggests it is. */
+     * indefinitely, and practice suggests it is. Setting every event to the
+     * same time keeps the heap valid. */
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
-            te->when_sec = 0;
-            te = te->next;
-        }
+        for (j = 0; j < eventLoop->timeEventHeapLen; j++)
+            eventLoop->timeEventHeap[j]->when = 0;
     }
     eventLoop->lastTime = now;
 
-    te = eventLoop->timeEventHead;
-    maxId = eventLoop->timeEventNextId-1;
-    while(te) {
-        long now_sec, now_ms;
-        long long id;
-
-        /* Remove events scheduled for deletion. */
-        if (te->id == AE_DELETED_EVENT_ID) {
-            aeTimeEvent *next = te->next;
-            if (te->prev)
-                te->prev->next = te->next;
-            else
-                eventLoop->timeEventHead = te->next;
-            if (te->next)
-                te->next->prev = te->prev;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            te = next;
-            continue;
-        }
+    /* Take every due event out of the heap before calling any of them, so
+     * that we don't process time events created or rescheduled by time
+     * events in this iteration. */
+    now_us = aeUstime();
+    while (eventLoop->timeEventHeapLen &&
+           eventLoop->timeEventHeap[0]->when <= now_us)
+    {
+        te = eventLoop->timeEventHeap[0];
+        aeHeapRemove(eventLoop,te);
+        te->next = NULL;
+        *tail = te;
+        tail = &te->next;
+    }
+
+    while (due) {
+        te = due;
+        due = te->next;
+
+        /* The event may have been deleted by a previous time proc, or by its
+         * own time proc. */
+        if (te->id != AE_DELETED_EVENT_ID) {
+            int retval = te->timeProc(eventLoop, te->id, te->clientData);
 
-        /* Make sure we don't process time events created by time events in
-         * this iteration. Note that this check is currently useless: we always
-         * add new timers on the head, however if we change the implementation
-         * detail, this check may be useful again: we keep it here for future
-         * defense. */
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
-        aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
-
-            id = te->id;
-            retval = te->timeProc(eventLoop, id, te->clientData);
             processed++;
-            if (retval != AE_NOMORE) {
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                te->id = AE_DELETED_EVENT_ID;
+            if (te->id != AE_DELETED_EVENT_ID) {
+                if (retval != AE_NOMORE) {
+                    te->when = aeUstime()+(long long)retval*1000;
+                    aeHeapInsert(eventLoop,te);
+                    continue;
+                }
+                aeTableDelete(eventLoop,te);
             }
         }
-        te = te->next;
+        if (te->finalizerProc)
+            te->finalizerProc(eventLoop, te->clientData);
+        zfree(te);
     }
     return processed;
 }
@@ -375,20 +497,15 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
         if (flags & AE_TIME_EVENTS && !(flags & AE_DONT_WAIT))
             shortest = aeSearchNearestTimer(eventLoop);
         if (shortest) {
-            long now_sec, now_ms;
-
-            aeGetTime(&now_sec, &now_ms);
             tvp = &tv;
 
-            /* How many milliseconds we need to wait for the next
+            /* How many microseconds we need to wait for the next
              * time event to fire? */
-            long long ms =
-                (shortest->when_sec - now_sec)*1000 +
-                shortest->when_ms - now_ms;
+            long long us = shortest->when - aeUstime();
 
-            if (ms > 0) {
-                tvp->tv_sec = ms/1000;
-                tvp->tv_usec = (ms % 1000)*1000;
+            if (us > 0) {
+                tvp->tv_sec = us/1000000;
+                tvp->tv_usec = us % 1000000;
             } else {
                 tvp->tv_sec = 0;
                 tvp->tv_usec = 0;
@@ -78,13 +78,13 @@ typedef struct aeFileEvent {
 /* Time event structure */
 typedef struct aeTimeEvent {
     long long id; /* time event identifier. */
-    long when_sec; /* seconds */
-    long when_ms; /* milliseconds */
+    long long when; /* unix time in microseconds */
     aeTimeProc *timeProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *prev;
-    struct aeTimeEvent *next;
+    int heapIndex; /* position in the timers heap, -1 if not there. */
+    struct aeTimeEvent *hnext; /* next event in the same id table bucket. */
+    struct aeTimeEvent *next; /* next event in the list of due events. */
 } aeTimeEvent;
 
 /* A fired event */
@@ -101,7 +101,12 @@ typedef struct aeEventLoop {
     time_t lastTime;     /* Used to detect system clock skew */
     aeFileEvent *events; /* Registered events */
     aeFiredEvent *fired; /* Fired events */
-    aeTimeEvent *timeEventHead;
+    aeTimeEvent **timeEventHeap; /* Min-heap of time events by 'when'. */
+    int timeEventHeapLen; /* Number of time events in the heap. */
+    int timeEventHeapSize; /* Allocated heap slots. */
+    aeTimeEvent **timeEventTable; /* Time events hashed by id. */
+    unsigned long timeEventTableSize; /* Power of two, or zero. */
+    unsigned long timeEventCount; /* Number of time events in the table. */
     int stop;
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
@@ -119,7 +124,11 @@ int aeGetFileEvents(aeEventLoop *eventLoop, int fd);
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc);
+long long aeCreateTimeEventUs(aeEventLoop *eventLoop, long long microseconds,
+        aeTimeProc *proc, void *clientData,
+        aeEventFinalizerProc *finalizerProc);
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id);
+long long aeTimeEventRemainingUs(aeEventLoop *eventLoop, long long id);
 int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
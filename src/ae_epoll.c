@@ -109,8 +109,10 @@ static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
     aeApiState *state = eventLoop->apidata;
     int retval, numevents = 0;
 
+    /* The timeout is rounded up to the millisecond, otherwise we would spin
+     * when the nearest timer is less than a millisecond away. */
     retval = epoll_wait(state->epfd,state->events,eventLoop->setsize,
-            tvp ? (tvp->tv_sec*1000 + tvp->tv_usec/1000) : -1);
+            tvp ? (tvp->tv_sec*1000 + (tvp->tv_usec+999)/1000) : -1);
     if (retval > 0) {
         int j;
 
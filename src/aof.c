@@ -865,6 +865,12 @@ int rioWriteBulkObject(rio *r, robj *obj) {
         return rioWriteBulkLongLong(r,(long)obj->ptr);
     } else if (sdsEncodedObject(obj)) {
         return rioWriteBulkString(r,obj->ptr,sdslen(obj->ptr));
+    } else if (obj->encoding == OBJ_ENCODING_COMPRESSED) {
+        sds s = compressionDecode(obj);
+        int retval = rioWriteBulkString(r,s,sdslen(s));
+
+        sdsfree(s);
+        return retval;
     } else {
         serverPanic("Unknown string encoding");
     }
@@ -1050,8 +1056,16 @@ static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
  * The function returns 0 on error, 1 on success. */
 int rewriteHashObject(rio *r, robj *key, robj *o) {
     hashTypeIterator *hi;
-    long long count = 0, items = hashTypeLength(o);
+    long long count = 0, items;
+
+    if (o->encoding == OBJ_ENCODING_COMPRESSED) {
+        robj *d = compressionDecodeObject(o);
+        int retval = rewriteHashObject(r,key,d);
 
+        decrRefCount(d);
+        return retval;
+    }
+    items = hashTypeLength(o);
     hi = hashTypeInitIterator(o);
     while (hashTypeNext(hi) != C_ERR) {
         if (count == 0) {
@@ -1382,6 +1396,7 @@ int rewriteAppendOnlyFileBackground(void) {
     long long start;
 
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    lazyLoadFinish();
     if (aofCreatePipes() != C_OK) return C_ERR;
     openChildInfoPipe();
     start = ustime();
@@ -27,6 +27,10 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+/* Make sure we have enough stack to perform all the things we do in the
+ * main thread. Also used for the module thread pools. */
+#define REDIS_THREAD_STACK_SIZE (1024*1024*4)
+
 /* Exported API */
 void bioInit(void);
 void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3);
@@ -556,7 +556,7 @@ void setbitCommand(client *c) {
     ((uint8_t*)o->ptr)[byte] = byteval;
     signalModifiedKey(c->db,c->argv[1]);
     notifyKeyspaceEvent(NOTIFY_STRING,"setbit",c->argv[1],c->db->id);
-    server.dirty++;
+    incrDirty(1);
     addReply(c, bitval ? shared.cone : shared.czero);
 }
 
@@ -761,7 +761,7 @@ void bitopCommand(client *c) {
         signalModifiedKey(c->db,targetkey);
         notifyKeyspaceEvent(NOTIFY_GENERIC,"del",targetkey,c->db->id);
     }
-    server.dirty++;
+    incrDirty(1);
     addReplyLongLong(c,maxlen); /* Return the output string length in bytes. */
 }
 
@@ -1119,7 +1119,7 @@ void bitfieldCommand(client *c) {
     if (changes) {
         signalModifiedKey(c->db,c->argv[1]);
         notifyKeyspaceEvent(NOTIFY_STRING,"setbit",c->argv[1],c->db->id);
-        server.dirty += changes;
+        incrDirty(changes);
     }
     zfree(ops);
 }
@@ -51,11 +51,20 @@
  * to process the query buffer from unblocked clients and remove the clients
  * from the blocked_clients queue.
  *
- * replyToBlockedClientTimedOut() is called by the cron function when
- * a client blocked reaches the specified timeout (if the timeout is set
+ * replyToBlockedClientTimedOut() is called by handleBlockedClientsTimeout()
+ * when a client blocked reaches the specified timeout (if the timeout is set
  * to 0, no timeout is processed).
  * It usually just needs to send a reply to the client.
  *
+ * Clients blocked with BLOCKED_THREAD are not waiting for an event: their
+ * command is being executed by another thread (shard.c, readthreads.c).
+ * When the thread is done the client is passed to unblockClientFromThread()
+ * in the main thread.
+ *
+ * Clients blocked with BLOCKED_KEYLOCK wait for the offloaded commands
+ * locking their keys to complete, and then process again their command,
+ * see offload.c.
+ *
  * When implementing a new type of blocking opeation, the implementation
  * should modify unblockClient() and replyToBlockedClientTimedOut() in order
  * to handle the btype-specific behavior of this two functions.
@@ -64,6 +73,7 @@
  */
 
 #include "server.h"
+#include "slowlog.h"
 
 /* Get a timeout value from an object and store it into 'timeout'.
  * The final timeout is always stored as milliseconds as a time where the
@@ -94,13 +104,102 @@ int getTimeoutFromObjectOrReply(client *c, robj *object, mstime_t *timeout, int
     return C_OK;
 }
 
+/* Blocked clients with a timeout are indexed in server.clients_timeout_table,
+ * a radix tree keyed by the timeout followed by the client ID, both stored
+ * big endian so that the order of the keys is the order of the deadlines.
+ * This way the clients timing out are found without scanning all the
+ * clients, and the event loop is woken up exactly at the nearest deadline,
+ * instead of serving timeouts only when clientsCron() reaches the client. */
+#define CLIENT_TIMEOUT_KEY_LEN 16
+
+static void encodeTimeoutKey(unsigned char *buf, mstime_t timeout, client *c) {
+    uint64_t t = htonu64((uint64_t)timeout), id = htonu64(c->id);
+
+    memcpy(buf,&t,sizeof(t));
+    memcpy(buf+8,&id,sizeof(id));
+}
+
+static mstime_t decodeTimeoutKey(unsigned char *buf) {
+    uint64_t t;
+
+    memcpy(&t,buf,sizeof(t));
+    return (mstime_t)ntohu64(t);
+}
+
+/* Add the client to the timeout table, if it is blocked with a timeout. */
+static void addClientToTimeoutTable(client *c) {
+    unsigned char buf[CLIENT_TIMEOUT_KEY_LEN];
+
+    if (c->bpop.timeout == 0) return;
+    encodeTimeoutKey(buf,c->bpop.timeout,c);
+    raxInsert(server.clients_timeout_table,buf,sizeof(buf),c,NULL);
+}
+
+static void removeClientFromTimeoutTable(client *c) {
+    unsigned char buf[CLIENT_TIMEOUT_KEY_LEN];
+
+    if (c->bpop.timeout == 0) return;
+    encodeTimeoutKey(buf,c->bpop.timeout,c);
+    raxRemove(server.clients_timeout_table,buf,sizeof(buf),NULL);
+}
+
+/* Time proc of the timer armed for the nearest timeout. The timeouts are
+ * handled by handleBlockedClientsTimeout() in beforeSleep(): the timer just
+ * makes sure the event loop wakes up in time. */
+static int blockedClientsTimeoutProc(struct aeEventLoop *eventLoop,
+                                     long long id, void *clientData)
+{
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    server.clients_timeout_timer = -1;
+    return AE_NOMORE;
+}
+
+/* Reply to and unblock the clients whose timeout is reached, then arm a
+ * timer for the nearest timeout still pending, so that the event loop does
+ * not sleep past it. Called by beforeSleep(). */
+void handleBlockedClientsTimeout(void) {
+    mstime_t now = mstime(), nearest = 0;
+    raxIterator ri;
+    client *c;
+
+    if (raxSize(server.clients_timeout_table) == 0) return;
+    raxStart(&ri,server.clients_timeout_table);
+    while (1) {
+        raxSeek(&ri,"^",NULL,0);
+        if (!raxNext(&ri)) break;
+        nearest = decodeTimeoutKey(ri.key);
+        if (nearest > now) break;
+        nearest = 0;
+
+        /* unblockClient() removes the client from the table. */
+        c = ri.data;
+        replyToBlockedClientTimedOut(c);
+        unblockClient(c);
+    }
+    raxStop(&ri);
+
+    if (nearest == 0) return;
+    if (server.clients_timeout_timer != -1) {
+        if (server.clients_timeout_timer_when <= nearest) return;
+        aeDeleteTimeEvent(server.el,server.clients_timeout_timer);
+    }
+    server.clients_timeout_timer = aeCreateTimeEvent(server.el,nearest-now,
+        blockedClientsTimeoutProc,NULL,NULL);
+    server.clients_timeout_timer_when = nearest;
+}
+
 /* Block a client for the specific operation type. Once the CLIENT_BLOCKED
  * flag is set client query buffer is not longer processed, but accumulated,
- * and will be processed when the client is unblocked. */
+ * and will be processed when the client is unblocked. The client timeout,
+ * if any, must be set in c->bpop.timeout before calling this function. */
 void blockClient(client *c, int btype) {
     c->flags |= CLIENT_BLOCKED;
     c->btype = btype;
     server.bpop_blocked_clients++;
+    addClientToTimeoutTable(c);
 }
 
 /* This function is called in the beforeSleep() function of the event loop
@@ -138,9 +237,12 @@ void unblockClient(client *c) {
         unblockClientWaitingReplicas(c);
     } else if (c->btype == BLOCKED_MODULE) {
         unblockClientFromModule(c);
+    } else if (c->btype == BLOCKED_KEYLOCK) {
+        unblockClientWaitingKeyLock(c);
     } else {
         serverPanic("Unknown btype in unblockClient().");
     }
+    removeClientFromTimeoutTable(c);
     /* Clear the flags, and put the client in the unblocked list so that
      * we'll process new commands in its query buffer ASAP. */
     c->flags &= ~CLIENT_BLOCKED;
@@ -184,7 +286,7 @@ void disconnectAllBlockedClients(void) {
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
 
-        if (c->flags & CLIENT_BLOCKED) {
+        if (c->flags & CLIENT_BLOCKED && c->btype != BLOCKED_THREAD) {
             addReplySds(c,sdsnew(
                 "-UNBLOCKED force unblock from blocking operation, "
                 "instance state changed (master -> slave?)\r\n"));
@@ -193,3 +295,62 @@ void disconnectAllBlockedClients(void) {
         }
     }
 }
+
+/* Flag the client as blocked while its command is executed by another
+ * thread. The client can't be written or released until the thread hands
+ * it back: stop serving writes, pending replies are scheduled again by
+ * unblockClientFromThread(). */
+void blockClientForThread(client *c) {
+    c->flags |= CLIENT_BLOCKED;
+    c->btype = BLOCKED_THREAD;
+    c->bpop.thread_close = 0;
+    aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+}
+
+/* Called in the main thread when a thread hands back a client: update the
+ * statistics call() would update for a local command, schedule the reply
+ * and resume the processing of the pipelined commands. */
+void unblockClientFromThread(client *c) {
+    long long duration = c->bpop.thread_usec;
+
+    c->flags &= ~CLIENT_BLOCKED;
+    c->btype = BLOCKED_NONE;
+
+    latencyAddSampleIfNeeded((c->cmd->flags & CMD_FAST) ?
+        "fast-command" : "command", duration/1000);
+    slowlogPushEntryIfNeeded(c,c->argv,c->argc,duration);
+    c->lastcmd->microseconds += duration;
+    c->lastcmd->calls++;
+    latencyHistogramAdd(&c->lastcmd->latency_histogram,duration);
+    server.stat_numcommands++;
+    mergeThreadStats(&c->bpop.thread_stats);
+
+    if (c->bpop.thread_close) {
+        freeClient(c);
+        return;
+    }
+    if (c->flags & CLIENT_TRACKING && !(c->flags & CLIENT_TRACKING_BCAST) &&
+        c->cmd->flags & CMD_READONLY)
+    {
+        trackingRememberKeys(c);
+    }
+    resetClient(c);
+
+    if (clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_WRITE)) {
+        c->flags |= CLIENT_PENDING_WRITE;
+        listAddNodeHead(server.clients_pending_write,c);
+    }
+    asyncCloseClientOnOutputBufferLimitReached(c);
+
+    /* Dispatch the next pipelined command ASAP: the other threads keep
+     * executing the commands of the other clients in the meantime. */
+    if (sdslen(c->querybuf)) processInputBuffer(c);
+}
+
+/* Return true if the caller is not the main thread but a thread executing
+ * a command on behalf of a client, see blockClientForThread(). */
+int inCommandThread(void) {
+    return (server.shard_threads && shardIsShardThread()) ||
+           (server.read_threads && readThreadsIsReader()) ||
+           (server.offload_threads && offloadIsOffloadThread());
+}
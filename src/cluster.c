@@ -4787,7 +4787,7 @@ void restoreCommand(client *c) {
     if (ttl) setExpire(c,c->db,c->argv[1],mstime()+ttl);
     signalModifiedKey(c->db,c->argv[1]);
     addReply(c,shared.ok);
-    server.dirty++;
+    incrDirty(1);
 }
 
 /* MIGRATE socket cache implementation.
@@ -5118,7 +5118,7 @@ try_again:
                 /* No COPY option: remove the local key, signal the change. */
                 dbDelete(c->db,kv[j]);
                 signalModifiedKey(c->db,kv[j]);
-                server.dirty++;
+                incrDirty(1);
 
                 /* Populate the argument vector to replace the old one. */
                 newargv[del_idx++] = kv[j];
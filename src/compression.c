@@ -0,0 +1,1070 @@
+/* Transparent compression of string values and small hashes.
+ *
+ * When "value-compression" is enabled, string values of at least
+ * "value-compression-min-size" bytes are stored compressed with LZF, with
+ * the OBJ_ENCODING_COMPRESSED encoding, if this saves at least
+ * "value-compression-min-savings" percent of their size. Compressed values
+ * are never seen by the commands: lookupKey() decompresses a value in
+ * place the first time it is accessed, so the commands always get a plain
+ * sds string.
+ *
+ * Smaller values, from "value-compression-dict-min-size" bytes, are too
+ * short for LZF to find repetitions inside them, but many values of the
+ * same application usually share most of their structure (the same JSON
+ * field names, key prefixes, and so forth). Such values are compressed
+ * against a dictionary of "value-compression-dict-size" bytes trained from
+ * a sample of the dataset: the compressed data uses the LZF format, with
+ * back references that may point inside the dictionary, as if it was
+ * prepended to the value. The same applies to the ziplist of small hashes,
+ * that are compressed as a whole and get back their ziplist encoding when
+ * decompressed.
+ *
+ * The keyspace scan described below collects the samples, and the
+ * dictionary is trained as soon as enough samples are available, and again
+ * every "value-compression-dict-train-period" seconds. Every dictionary
+ * has a version number, and is referenced by the values compressed with
+ * it, so that the old versions are released once the scan has compressed
+ * again all their values with the current one. RDB files store these
+ * values uncompressed, so that they can be loaded by any Redis version,
+ * and save the current dictionary in the "vc-dict" AUX field, before the
+ * keys, so that values are compressed with it again as soon as they are
+ * loaded.
+ *
+ * The values that were just written or decompressed are kept uncompressed
+ * in a cache of hot values, bounded by "value-compression-cache-memory".
+ * Entries are indexed by "<dbid>:<key>" and remember the value object,
+ * without holding a reference to it, exactly like the reply cache does.
+ * When the cache is full, beforeSleep() compresses its least recently
+ * added values, giving a second chance to the ones accessed again in the
+ * meantime (their LRU or LFU field changed). Compressing values there,
+ * and not while commands execute, guarantees they are not referenced by
+ * the arguments of a client, or by the command propagation.
+ *
+ * The values not tracked by the cache (written before the feature was
+ * enabled, or loaded uncompressed) are found by an incremental scan of
+ * the keyspace performed by serverCron() while no child is saving.
+ *
+ * RDB files, and so replication and DUMP/RESTORE, store big compressed
+ * strings as LZF compressed strings: saving uses the compressed data as it
+ * is, and loading keeps it compressed after validating it, so that values
+ * are not compressed again when a replica or a restarted server loads
+ * them.
+ *
+ * Only the main thread compresses and decompresses values: read threads
+ * leave the commands accessing compressed values to the main thread, and
+ * the feature is not available with shard threads. Lookups without side
+ * effects (LOOKUP_NOTOUCH, like TYPE) may return compressed values, that
+ * only support stringObjectLen() and getDecodedObject() for strings, and
+ * compressionDecodeObject() for any type. Module threads holding the lock
+ * in shared mode get a private uncompressed copy of such values.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "atomicvar.h"
+#include "lzf.h"
+
+/* Number of buckets of the keyspace visited by every compressionCron(),
+ * and the max time spent compressing the values found. */
+#define COMPRESSION_CRON_BUCKETS 100
+#define COMPRESSION_CRON_MAX_USEC 1000
+
+/* Dictionary compression. The max dictionary size plus the max size of the
+ * values compressed with it must fit the 8k window of the LZF format. */
+#define COMPRESSION_DICT_MAX_VALUE 2048
+#define COMPRESSION_DICT_MIN_SIZE 64
+#define COMPRESSION_DICT_HASH_LOG 13
+#define COMPRESSION_DICT_EMPTY 0xffff
+#define COMPRESSION_DICT_MAX_OFF 8192
+#define COMPRESSION_DICT_MAX_REF 264
+
+/* Training: samples kept, samples needed to train a dictionary, length of
+ * the k-mers counted, and length of the segments the dictionary is made of. */
+#define COMPRESSION_DICT_SAMPLES 1024
+#define COMPRESSION_DICT_MIN_SAMPLES 256
+#define COMPRESSION_DICT_KMER 6
+#define COMPRESSION_DICT_SEGMENT 48
+#define COMPRESSION_DICT_TRAIN_HASH_LOG 18
+
+typedef struct hotValue {
+    int dbid;
+    sds key;
+    robj *val;          /* Uncompressed value, not owned. */
+    size_t size;        /* Length of the value when it was added. */
+    unsigned lru;       /* LRU field of the value when it was added. */
+    listNode *node;     /* Node in 'hot_order'. */
+} hotValue;
+
+typedef struct compressionDict {
+    unsigned int id;    /* Version number. */
+    size_t len;
+    size_t refcount;    /* Values compressed with it, updated atomically. */
+    unsigned char data[];
+} compressionDict;
+
+static void hotValueDestructor(void *privdata, void *val);
+
+/* "<dbid>:<key>" -> hotValue. */
+static dictType hotValuesDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    hotValueDestructor          /* val destructor */
+};
+
+static dict *hot_values = NULL;
+static list *hot_order = NULL;  /* Least recently added values first. */
+static size_t hot_memory = 0;
+
+/* Compressed values and memory they save. Updated atomically, since
+ * values may be freed by the lazyfree thread. */
+static size_t compressed_values = 0;
+static size_t compressed_saved = 0;
+
+/* State of the incremental keyspace scan. */
+static int scan_dbid = 0;
+static unsigned long scan_cursor = 0;
+
+/* The dictionary new values are compressed with, and the old versions
+ * still referenced by some value. */
+static compressionDict *current_dict = NULL;
+static list *old_dicts = NULL;
+static unsigned int next_dict_id = 1;
+static time_t dict_trained_time = 0;
+
+/* Reservoir of samples of the small values, for the next training. */
+static sds dict_samples[COMPRESSION_DICT_SAMPLES];
+static int dict_samples_count = 0;
+static long long dict_samples_seen = 0;
+
+/* Compressor state: 'window' holds the dictionary 'window_dict' followed
+ * by the value being compressed, 'dict_htab' maps the hash of three bytes
+ * to their last position in the dictionary, and 'htab' is the same table
+ * updated with the positions of the value. The slots modified while
+ * compressing a value are restored from 'dict_htab' at the end. */
+static compressionDict *window_dict = NULL;
+static unsigned char window[COMPRESSION_DICT_MAX_SIZE+COMPRESSION_DICT_MAX_VALUE];
+static uint16_t dict_htab[1<<COMPRESSION_DICT_HASH_LOG];
+static uint16_t htab[1<<COMPRESSION_DICT_HASH_LOG];
+static uint16_t htab_undo[COMPRESSION_DICT_MAX_VALUE];
+
+static void hotValueDestructor(void *privdata, void *val) {
+    hotValue *hv = val;
+    UNUSED(privdata);
+
+    sdsfree(hv->key);
+    zfree(hv);
+}
+
+/* Compression is not available when the shard threads own the dataset. */
+static int compressionEnabled(void) {
+    return server.value_compression && !server.shard_threads;
+}
+
+/* ------------------------- Dictionary compression ------------------------ */
+
+#define DICT_HASH(p) \
+    ((((uint32_t)(p)[0]<<16 | (uint32_t)(p)[1]<<8 | (p)[2])*2654435761U) >> \
+     (32-COMPRESSION_DICT_HASH_LOG))
+
+static void compressionLoadWindow(compressionDict *d) {
+    size_t j;
+
+    memcpy(window,d->data,d->len);
+    memset(dict_htab,0xff,sizeof(dict_htab));
+    for (j = 0; j+2 < d->len; j++) dict_htab[DICT_HASH(window+j)] = j;
+    memcpy(htab,dict_htab,sizeof(htab));
+    window_dict = d;
+}
+
+/* Append to 'dst' the literal runs of the 'len' bytes at 'p'. */
+static int compressionEmitLiterals(const unsigned char *p, size_t len,
+                                   unsigned char *dst, size_t *op,
+                                   size_t maxclen)
+{
+    while (len) {
+        size_t run = len > 32 ? 32 : len;
+
+        if (*op+1+run > maxclen) return 0;
+        dst[(*op)++] = run-1;
+        memcpy(dst+*op,p,run);
+        *op += run;
+        p += run;
+        len -= run;
+    }
+    return 1;
+}
+
+/* Compress the 'len' bytes at 'src' against the dictionary 'd', writing at
+ * most 'maxclen' bytes to 'dst'. Returns the length of the compressed data,
+ * or 0 if it does not fit 'maxclen'. The output uses the LZF format, with
+ * back references that may point inside the dictionary. */
+static size_t compressionDictCompress(compressionDict *d,
+                                      const unsigned char *src, size_t len,
+                                      unsigned char *dst, size_t maxclen)
+{
+    size_t ip, lit, end, op = 0, undo = 0, j;
+    int fits = 1;
+
+    if (window_dict != d) compressionLoadWindow(d);
+    memcpy(window+d->len,src,len);
+    ip = lit = d->len;
+    end = d->len+len;
+    while (ip+2 < end) {
+        uint32_t h = DICT_HASH(window+ip);
+        size_t ref = htab[h], mlen = 3, maxlen, off;
+
+        htab[h] = ip;
+        htab_undo[undo++] = h;
+        if (ref == COMPRESSION_DICT_EMPTY ||
+            ip-ref > COMPRESSION_DICT_MAX_OFF ||
+            memcmp(window+ref,window+ip,3) != 0)
+        {
+            ip++;
+            continue;
+        }
+        maxlen = end-ip;
+        if (maxlen > COMPRESSION_DICT_MAX_REF) maxlen = COMPRESSION_DICT_MAX_REF;
+        while (mlen < maxlen && window[ref+mlen] == window[ip+mlen]) mlen++;
+
+        if (!compressionEmitLiterals(window+lit,ip-lit,dst,&op,maxclen) ||
+            op+3 > maxclen)
+        {
+            fits = 0;
+            break;
+        }
+        off = ip-ref-1;
+        if (mlen-2 < 7) {
+            dst[op++] = ((mlen-2) << 5) | (off >> 8);
+        } else {
+            dst[op++] = (7 << 5) | (off >> 8);
+            dst[op++] = mlen-2-7;
+        }
+        dst[op++] = off & 0xff;
+
+        /* Index the positions inside the match as well. */
+        for (j = ip+1; j < ip+mlen && j+2 < end; j++) {
+            h = DICT_HASH(window+j);
+            htab[h] = j;
+            htab_undo[undo++] = h;
+        }
+        ip += mlen;
+        lit = ip;
+    }
+    if (fits) fits = compressionEmitLiterals(window+lit,end-lit,dst,&op,maxclen);
+
+    for (j = 0; j < undo; j++) htab[htab_undo[j]] = dict_htab[htab_undo[j]];
+    return fits ? op : 0;
+}
+
+/* Decompress the output of compressionDictCompress(). Returns 0 if the data
+ * is corrupted. */
+static int compressionDictDecompress(compressionDict *d,
+                                     const unsigned char *src, size_t clen,
+                                     unsigned char *dst, size_t len)
+{
+    size_t ip = 0, op = 0;
+
+    while (ip < clen) {
+        unsigned int ctrl = src[ip++];
+
+        if (ctrl < 32) {
+            ctrl++;
+            if (ip+ctrl > clen || op+ctrl > len) return 0;
+            memcpy(dst+op,src+ip,ctrl);
+            ip += ctrl;
+            op += ctrl;
+        } else {
+            size_t mlen = ctrl >> 5, off;
+            long long ref;
+
+            if (mlen == 7) {
+                if (ip >= clen) return 0;
+                mlen += src[ip++];
+            }
+            if (ip >= clen) return 0;
+            off = (((ctrl & 0x1f) << 8) | src[ip++])+1;
+            mlen += 2;
+            ref = (long long)op-(long long)off;
+            if (ref < -(long long)d->len || op+mlen > len) return 0;
+            while (mlen--) {
+                dst[op++] = ref < 0 ? d->data[d->len+ref] : dst[ref];
+                ref++;
+            }
+        }
+    }
+    return op == len;
+}
+
+static compressionDict *compressionCreateDict(unsigned int id,
+                                              const void *data, size_t len)
+{
+    compressionDict *d = zmalloc(sizeof(*d)+len);
+
+    d->id = id;
+    d->len = len;
+    d->refcount = 0;
+    memcpy(d->data,data,len);
+    if (id >= next_dict_id) next_dict_id = id+1;
+    return d;
+}
+
+/* Make 'd' the current dictionary. The previous one is released, or kept
+ * until no value references it. */
+static void compressionSetDict(compressionDict *d) {
+    compressionDict *old = current_dict;
+    size_t refcount;
+
+    current_dict = d;
+    if (old == NULL) return;
+    if (window_dict == old) window_dict = NULL;
+    atomicGet(old->refcount,refcount);
+    if (refcount == 0) {
+        zfree(old);
+    } else {
+        if (old_dicts == NULL) old_dicts = listCreate();
+        listAddNodeTail(old_dicts,old);
+    }
+}
+
+/* Release the old dictionaries no longer referenced by any value. */
+static void compressionReleaseOldDicts(void) {
+    listIter li;
+    listNode *ln;
+
+    if (old_dicts == NULL) return;
+    listRewind(old_dicts,&li);
+    while((ln = listNext(&li)) != NULL) {
+        compressionDict *d = listNodeValue(ln);
+        size_t refcount;
+
+        atomicGet(d->refcount,refcount);
+        if (refcount == 0) {
+            zfree(d);
+            listDelNode(old_dicts,ln);
+        }
+    }
+}
+
+/* Can a value of 'len' bytes be compressed with the current dictionary? */
+static int compressionDictUsable(size_t len) {
+    return current_dict && server.value_compression_dict_size &&
+           len >= (size_t)server.value_compression_dict_min_size &&
+           len <= COMPRESSION_DICT_MAX_VALUE;
+}
+
+/* ----------------------------- Compressed values -------------------------- */
+
+/* Return true if a string of 'len' bytes compressed to 'clen' bytes should
+ * be kept compressed. */
+int compressionIsWorthwhile(size_t len, size_t clen) {
+    if (!compressionEnabled() ||
+        len < (size_t)server.value_compression_min_size ||
+        len > UINT32_MAX) return 0;
+    return clen <= len-len*server.value_compression_min_savings/100;
+}
+
+/* Create a string object holding the LZF compressed data 'data' of 'clen'
+ * bytes, of a string of 'len' bytes. */
+robj *createCompressedStringObject(const void *data, size_t clen, size_t len) {
+    compressedString *cs = zmalloc(sizeof(*cs)+clen);
+    robj *o;
+
+    cs->len = len;
+    cs->clen = clen;
+    cs->dict = NULL;
+    cs->method = COMPRESSION_LZF;
+    memcpy(cs->data,data,clen);
+    o = createObject(OBJ_STRING,cs);
+    o->encoding = OBJ_ENCODING_COMPRESSED;
+    atomicIncr(compressed_values,1);
+    atomicIncr(compressed_saved,len-clen);
+    return o;
+}
+
+/* Called by dupStringObject(). */
+robj *dupCompressedObject(const robj *o) {
+    compressedString *cs = o->ptr, *copy;
+    robj *d;
+
+    copy = zmalloc(sizeof(*cs)+cs->clen);
+    memcpy(copy,cs,sizeof(*cs)+cs->clen);
+    if (copy->dict) atomicIncr(copy->dict->refcount,1);
+    d = createObject(o->type,copy);
+    d->encoding = OBJ_ENCODING_COMPRESSED;
+    atomicIncr(compressed_values,1);
+    atomicIncr(compressed_saved,cs->len-cs->clen);
+    return d;
+}
+
+/* Called by freeStringObject() and freeHashObject(). */
+void freeCompressedObject(robj *o) {
+    compressedString *cs = o->ptr;
+
+    atomicDecr(compressed_values,1);
+    atomicDecr(compressed_saved,cs->len-cs->clen);
+    if (cs->dict) atomicDecr(cs->dict->refcount,1);
+    zfree(cs);
+}
+
+/* Decompress 'cs' into the 'cs->len' bytes at 'dst'. */
+static void compressionDecodeData(compressedString *cs, unsigned char *dst) {
+    int ok;
+
+    if (cs->method == COMPRESSION_DICT)
+        ok = compressionDictDecompress(cs->dict,cs->data,cs->clen,dst,cs->len);
+    else
+        ok = lzf_decompress(cs->data,cs->clen,dst,cs->len) == cs->len;
+    if (!ok) serverPanic("Corrupted compressed value");
+}
+
+/* Return a new sds string with the uncompressed content of the string
+ * 'o'. */
+sds compressionDecode(robj *o) {
+    compressedString *cs = o->ptr;
+    sds s = sdsnewlen(NULL,cs->len);
+
+    compressionDecodeData(cs,(unsigned char*)s);
+    return s;
+}
+
+/* Return the uncompressed content of 'o': an sds string for strings, a
+ * ziplist for hashes. */
+static void *compressionDecodePtr(robj *o) {
+    compressedString *cs = o->ptr;
+    unsigned char *zl;
+
+    if (o->type == OBJ_STRING) return compressionDecode(o);
+    zl = zmalloc(cs->len);
+    compressionDecodeData(cs,zl);
+    return zl;
+}
+
+static int compressionDecodedEncoding(robj *o) {
+    return o->type == OBJ_STRING ? OBJ_ENCODING_RAW : OBJ_ENCODING_ZIPLIST;
+}
+
+/* Return a new uncompressed copy of the compressed object 'o'. Used to
+ * serialize compressed values of any type without modifying them. */
+robj *compressionDecodeObject(robj *o) {
+    robj *d = createObject(o->type,compressionDecodePtr(o));
+
+    d->encoding = compressionDecodedEncoding(o);
+    return d;
+}
+
+size_t compressionValueLength(robj *o) {
+    return ((compressedString*)o->ptr)->len;
+}
+
+/* Return the data that compressing the uncompressed value 'o' would
+ * replace, and its length. */
+static unsigned char *compressionValueData(robj *o, size_t *len) {
+    if (o->type == OBJ_STRING && o->encoding == OBJ_ENCODING_RAW) {
+        *len = sdslen(o->ptr);
+        return o->ptr;
+    } else if (o->type == OBJ_HASH && o->encoding == OBJ_ENCODING_ZIPLIST) {
+        *len = ziplistBlobLen(o->ptr);
+        return o->ptr;
+    }
+    *len = 0;
+    return NULL;
+}
+
+/* Is 'o' a value that may be compressed, with LZF or with the current
+ * dictionary? */
+static int compressionIsCandidate(robj *o) {
+    size_t len;
+
+    if (compressionValueData(o,&len) == NULL) return 0;
+    return len >= (size_t)server.value_compression_min_size ||
+           compressionDictUsable(len);
+}
+
+/* Replace the content of 'o' with 'cs'. */
+static void compressionSetValue(robj *o, compressedString *cs) {
+    if (o->type == OBJ_STRING) sdsfree(o->ptr);
+    else zfree(o->ptr);
+    o->ptr = cs;
+    o->encoding = OBJ_ENCODING_COMPRESSED;
+    if (cs->dict) atomicIncr(cs->dict->refcount,1);
+    atomicIncr(compressed_values,1);
+    atomicIncr(compressed_saved,cs->len-cs->clen);
+    server.stat_compressions++;
+}
+
+/* Compress the 'len' bytes at 'data' with LZF, or with the dictionary 'd'
+ * if not NULL. Returns NULL if they do not compress enough. */
+static compressedString *compressionCompressData(compressionDict *d,
+                                                 const unsigned char *data,
+                                                 size_t len)
+{
+    size_t maxlen = len-len*server.value_compression_min_savings/100, clen;
+    long long start = ustime();
+    compressedString *cs = zmalloc(sizeof(*cs)+maxlen);
+
+    if (d)
+        clen = compressionDictCompress(d,data,len,cs->data,maxlen);
+    else
+        clen = lzf_compress(data,len,cs->data,maxlen);
+    server.stat_compression_usec += ustime()-start;
+    if (clen == 0) {
+        zfree(cs);
+        return NULL;
+    }
+    cs = zrealloc(cs,sizeof(*cs)+clen);
+    cs->len = len;
+    cs->clen = clen;
+    cs->dict = d;
+    cs->method = d ? COMPRESSION_DICT : COMPRESSION_LZF;
+    return cs;
+}
+
+/* Compress in place the value 'o': big values with LZF, small ones with
+ * the current dictionary. Returns 1 if the value was compressed, 0 if it
+ * does not compress enough. */
+static int compressionCompressValue(robj *o) {
+    compressionDict *d = NULL;
+    compressedString *cs;
+    unsigned char *data;
+    size_t len;
+
+    if ((data = compressionValueData(o,&len)) == NULL) return 0;
+    if (len >= (size_t)server.value_compression_min_size) {
+        if (len > UINT32_MAX) return 0;
+    } else if (compressionDictUsable(len)) {
+        d = current_dict;
+    } else {
+        return 0;
+    }
+    if ((cs = compressionCompressData(d,data,len)) == NULL) return 0;
+    compressionSetValue(o,cs);
+    return 1;
+}
+
+/* Compress again with the current dictionary the value 'o', compressed
+ * with an older one, so that the old version can be released. */
+static void compressionRecompressValue(robj *o) {
+    compressedString *old = o->ptr, *cs;
+    unsigned char *data = zmalloc(old->len);
+
+    compressionDecodeData(old,data);
+    cs = compressionCompressData(current_dict,data,old->len);
+    zfree(data);
+    if (cs == NULL) return;
+    freeCompressedObject(o);
+    o->ptr = cs;
+    atomicIncr(cs->dict->refcount,1);
+    atomicIncr(compressed_values,1);
+    atomicIncr(compressed_saved,cs->len-cs->clen);
+}
+
+/* Called by rdbLoadObject(): compress the small values with the current
+ * dictionary as soon as they are loaded. Bigger values are loaded LZF
+ * compressed, or found later by the keyspace scan. */
+void compressionCompressLoadedValue(robj *o) {
+    size_t len;
+
+    if (!compressionEnabled() || inCommandThread() || o->refcount != 1 ||
+        compressionValueData(o,&len) == NULL ||
+        len >= (size_t)server.value_compression_min_size ||
+        !compressionDictUsable(len)) return;
+    compressionCompressValue(o);
+}
+
+/* Can the value 'val' of 'key' be compressed in place right now? */
+static int compressionCanCompress(redisDb *db, sds key, robj *val) {
+    return val->refcount == 1 && compressionIsCandidate(val) &&
+           !(server.offload_jobs && offloadKeyIsLocked(db,key));
+}
+
+/* ------------------------------- Hot values ------------------------------- */
+
+static void hotValueDelete(hotValue *hv) {
+    sds name = sideTableName(hv->dbid,hv->key);
+
+    hot_memory -= hv->size;
+    listDelNode(hot_order,hv->node);
+    dictDelete(hot_values,name);
+    sdsfree(name);
+}
+
+/* Add the uncompressed value 'val' of 'key' to the hot values, or move it
+ * at the end of the queue if it is already there. */
+static void hotValueAdd(redisDb *db, sds key, robj *val) {
+    sds name = sideTableName(db->id,key);
+    dictEntry *de;
+    hotValue *hv;
+
+    if (hot_values == NULL) {
+        hot_values = dictCreate(&hotValuesDictType,NULL);
+        hot_order = listCreate();
+    }
+    if ((de = dictFind(hot_values,name)) != NULL) {
+        hv = dictGetVal(de);
+        hot_memory -= hv->size;
+        listDelNode(hot_order,hv->node);
+        sdsfree(name);
+    } else {
+        hv = zmalloc(sizeof(*hv));
+        hv->dbid = db->id;
+        hv->key = sdsdup(key);
+        dictAdd(hot_values,name,hv);
+    }
+    hv->val = val;
+    compressionValueData(val,&hv->size);
+    hv->lru = val->lru;
+    listAddNodeTail(hot_order,hv);
+    hv->node = listLast(hot_order);
+    hot_memory += hv->size;
+}
+
+static void hotValueDeleteEntry(dictEntry *de) {
+    hotValueDelete(dictGetVal(de));
+}
+
+static int hotValueExists(int dbid, sds key) {
+    sds name;
+    int exists;
+
+    if (hot_values == NULL || dictSize(hot_values) == 0) return 0;
+    name = sideTableName(dbid,key);
+    exists = dictFind(hot_values,name) != NULL;
+    sdsfree(name);
+    return exists;
+}
+
+/* Called by lookupKey() in the main thread when 'val', the value of 'key',
+ * is compressed: decompress it in place and track it as hot. */
+void compressionDecompressValue(redisDb *db, robj *key, robj *val) {
+    long long start = ustime();
+    void *ptr = compressionDecodePtr(val);
+
+    server.stat_decompression_usec += ustime()-start;
+    server.stat_decompressions++;
+    freeCompressedObject(val);
+    val->ptr = ptr;
+    val->encoding = compressionDecodedEncoding(val);
+    if (compressionEnabled() && db == server.db+db->id)
+        hotValueAdd(db,key->ptr,val);
+}
+
+/* Called by signalModifiedKey(): track the new value of 'key' if it may be
+ * compressed, so that it gets compressed once it is no longer hot,
+ * otherwise forget the old one. */
+void compressionTrackKey(redisDb *db, robj *key) {
+    dictEntry *de;
+    robj *val;
+
+    if (!compressionEnabled() || inCommandThread() ||
+        db != server.db+db->id) return;
+    de = dictFind(db->dict,key->ptr);
+    val = de ? dictGetVal(de) : NULL;
+    if (val && compressionIsCandidate(val)) {
+        hotValueAdd(db,key->ptr,val);
+    } else if (hot_values && dictSize(hot_values)) {
+        sds name = sideTableName(db->id,key->ptr);
+
+        if ((de = dictFind(hot_values,name)) != NULL)
+            hotValueDelete(dictGetVal(de));
+        sdsfree(name);
+    }
+}
+
+/* Called by beforeSleep(): compress the least recently added hot values
+ * until the cache fits "value-compression-cache-memory". */
+void compressionBeforeSleep(void) {
+    unsigned long second_chances;
+
+    if (hot_values == NULL || dictSize(hot_values) == 0) return;
+    if (!compressionEnabled()) {
+        compressionCacheFlush(-1);
+        return;
+    }
+    second_chances = listLength(hot_order);
+    while (listLength(hot_order) &&
+           hot_memory > (size_t)server.value_compression_cache_memory)
+    {
+        hotValue *hv = listNodeValue(listFirst(hot_order));
+        redisDb *db = server.db+hv->dbid;
+        dictEntry *de = dictFind(db->dict,hv->key);
+
+        /* Values accessed since they were added go back to the end of the
+         * queue, once. */
+        if (de && dictGetVal(de) == hv->val && hv->val->lru != hv->lru &&
+            second_chances)
+        {
+            second_chances--;
+            hotValueAdd(db,hv->key,hv->val);
+            continue;
+        }
+        if (de && dictGetVal(de) == hv->val &&
+            compressionCanCompress(db,hv->key,hv->val))
+        {
+            compressionCompressValue(hv->val);
+        }
+        hotValueDelete(hv);
+    }
+}
+
+/* Drop the hot values of the database 'dbid', or of all the databases if
+ * 'dbid' is -1. The values stay uncompressed until the keyspace scan
+ * finds them. */
+void compressionCacheFlush(int dbid) {
+    sideTableFlush(hot_values,dbid,hotValueDeleteEntry);
+}
+
+/* ------------------------------- Training -------------------------------- */
+
+/* Are samples needed for a next training? */
+static int compressionDictNeedsSamples(void) {
+    return server.value_compression_dict_size &&
+           (current_dict == NULL || server.value_compression_dict_train_period);
+}
+
+/* Add the value 'val' to the reservoir of samples, if it is small enough
+ * to be compressed with a dictionary. */
+static void compressionDictSample(robj *val) {
+    compressedString *cs = NULL;
+    unsigned char *data = NULL;
+    size_t len;
+    int j;
+
+    if (val->encoding == OBJ_ENCODING_COMPRESSED) {
+        cs = val->ptr;
+        if (cs->method != COMPRESSION_DICT) return;
+        len = cs->len;
+    } else if ((data = compressionValueData(val,&len)) == NULL) {
+        return;
+    }
+    if (len < (size_t)server.value_compression_dict_min_size ||
+        len > COMPRESSION_DICT_MAX_VALUE) return;
+
+    dict_samples_seen++;
+    if (dict_samples_count < COMPRESSION_DICT_SAMPLES) {
+        j = dict_samples_count++;
+    } else {
+        long long r = random() % dict_samples_seen;
+
+        if (r >= COMPRESSION_DICT_SAMPLES) return;
+        j = r;
+        sdsfree(dict_samples[j]);
+    }
+    if (cs) {
+        dict_samples[j] = sdsnewlen(NULL,len);
+        compressionDecodeData(cs,(unsigned char*)dict_samples[j]);
+    } else {
+        dict_samples[j] = sdsnewlen(data,len);
+    }
+}
+
+static void compressionDictFreeSamples(void) {
+    int j;
+
+    for (j = 0; j < dict_samples_count; j++) sdsfree(dict_samples[j]);
+    dict_samples_count = 0;
+    dict_samples_seen = 0;
+}
+
+static uint32_t compressionKmerHash(const unsigned char *p) {
+    uint64_t v = 0;
+
+    memcpy(&v,p,COMPRESSION_DICT_KMER);
+    return (v*0x9E3779B97F4A7C15ULL) >> (64-COMPRESSION_DICT_TRAIN_HASH_LOG);
+}
+
+/* Build a dictionary of at most 'size' bytes out of the samples, with a
+ * simplified version of the COVER algorithm: the dictionary is made of the
+ * segments of the samples containing most of the k-mers that are common to
+ * many samples. The samples are split in groups, and the best segment of
+ * every group is added to the dictionary; the k-mers of the segments
+ * already added no longer count, so that every segment adds new content.
+ * The best segments are placed at the end of the dictionary, that is, near
+ * the data, where the back references are cheaper. Returns the length of
+ * the dictionary written to 'buf', at its end. */
+static size_t compressionDictTrain(unsigned char *buf, size_t size) {
+    size_t hsize = (size_t)1 << COMPRESSION_DICT_TRAIN_HASH_LOG;
+    uint32_t *freq = zcalloc(hsize*sizeof(uint32_t));
+    int *seen = zmalloc(hsize*sizeof(int));
+    unsigned char *active = zcalloc(hsize);
+    const size_t nk = COMPRESSION_DICT_SEGMENT-COMPRESSION_DICT_KMER+1;
+    size_t tail = size, p;
+    int groups, g, j;
+
+    /* Number of samples containing every k-mer. */
+    memset(seen,0xff,hsize*sizeof(int));
+    for (j = 0; j < dict_samples_count; j++) {
+        unsigned char *s = (unsigned char*)dict_samples[j];
+
+        for (p = 0; p+COMPRESSION_DICT_KMER <= sdslen(dict_samples[j]); p++) {
+            uint32_t h = compressionKmerHash(s+p);
+
+            if (seen[h] != j) {
+                seen[h] = j;
+                freq[h]++;
+            }
+        }
+    }
+
+    groups = size/COMPRESSION_DICT_SEGMENT;
+    if (groups > dict_samples_count) groups = dict_samples_count;
+    for (g = 0; g < groups && tail >= COMPRESSION_DICT_SEGMENT; g++) {
+        int first = (long long)dict_samples_count*g/groups;
+        int last = (long long)dict_samples_count*(g+1)/groups;
+        unsigned char *best = NULL;
+        uint64_t best_score = 0;
+
+        for (j = first; j < last; j++) {
+            unsigned char *s = (unsigned char*)dict_samples[j];
+            size_t len = sdslen(dict_samples[j]);
+            uint64_t score = 0;
+
+            if (len < COMPRESSION_DICT_SEGMENT) continue;
+            /* Slide a window of 'nk' k-mers over the sample, counting
+             * the k-mers repeated inside the window once. */
+            for (p = 0; p+COMPRESSION_DICT_KMER <= len; p++) {
+                uint32_t h = compressionKmerHash(s+p);
+
+                if (active[h]++ == 0) score += freq[h];
+                if (p >= nk) {
+                    h = compressionKmerHash(s+p-nk);
+                    if (--active[h] == 0) score -= freq[h];
+                }
+                if (p+1 >= nk && score > best_score) {
+                    best_score = score;
+                    best = s+p+1-nk;
+                }
+            }
+            for (p = len-COMPRESSION_DICT_KMER+1-nk;
+                 p+COMPRESSION_DICT_KMER <= len; p++)
+            {
+                active[compressionKmerHash(s+p)]--;
+            }
+        }
+        if (best == NULL) continue;
+        tail -= COMPRESSION_DICT_SEGMENT;
+        memcpy(buf+tail,best,COMPRESSION_DICT_SEGMENT);
+        for (p = 0; p < nk; p++) freq[compressionKmerHash(best+p)] = 0;
+    }
+    zfree(freq);
+    zfree(seen);
+    zfree(active);
+    return size-tail;
+}
+
+/* Train a new dictionary from the samples collected, when due. */
+static void compressionDictTrainIfNeeded(void) {
+    size_t size = server.value_compression_dict_size, len;
+    unsigned char *buf;
+    long long start;
+
+    if (!compressionDictNeedsSamples() ||
+        dict_samples_count < COMPRESSION_DICT_MIN_SAMPLES ||
+        (current_dict && server.unixtime-dict_trained_time <
+                         server.value_compression_dict_train_period)) return;
+
+    start = ustime();
+    if (size > COMPRESSION_DICT_MAX_SIZE) size = COMPRESSION_DICT_MAX_SIZE;
+    buf = zmalloc(size);
+    len = compressionDictTrain(buf,size);
+    if (len >= COMPRESSION_DICT_MIN_SIZE) {
+        long long usec = ustime()-start;
+
+        compressionSetDict(compressionCreateDict(next_dict_id,buf+size-len,len));
+        server.stat_compression_dict_trainings++;
+        latencyAddSampleIfNeeded("value-compression-training",usec/1000);
+        serverLog(LL_NOTICE,
+            "Value compression dictionary %u trained from %d samples in %.2f ms",
+            current_dict->id, dict_samples_count, (float)usec/1000);
+    }
+    zfree(buf);
+    dict_trained_time = server.unixtime;
+    compressionDictFreeSamples();
+}
+
+/* ---------------------------- Keyspace scan ------------------------------ */
+
+static void compressionScanCallback(void *privdata, const dictEntry *de) {
+    redisDb *db = privdata;
+    sds key = dictGetKey(de);
+    robj *val = dictGetVal(de);
+
+    if (compressionDictNeedsSamples()) compressionDictSample(val);
+    if (compressionCanCompress(db,key,val) && !hotValueExists(db->id,key)) {
+        compressionCompressValue(val);
+    } else if (val->encoding == OBJ_ENCODING_COMPRESSED &&
+               ((compressedString*)val->ptr)->dict &&
+               ((compressedString*)val->ptr)->dict != current_dict &&
+               current_dict && val->refcount == 1 &&
+               !(server.offload_jobs && offloadKeyIsLocked(db,key)))
+    {
+        compressionRecompressValue(val);
+    }
+}
+
+/* Called by serverCron(): compress the values that are not hot, visiting
+ * a few buckets of the keyspace, and train the dictionary when due. */
+void compressionCron(void) {
+    long long start = ustime();
+    int buckets = 0, dbs = 0;
+
+    if (!compressionEnabled()) return;
+    if (server.value_compression_dict_size == 0 && current_dict) {
+        compressionSetDict(NULL);
+        compressionDictFreeSamples();
+    }
+    compressionReleaseOldDicts();
+    if (server.rdb_child_pid != -1 || server.aof_child_pid != -1) return;
+    while (buckets < COMPRESSION_CRON_BUCKETS && dbs <= server.dbnum) {
+        redisDb *db = server.db+scan_dbid;
+
+        if (dictSize(db->dict) != 0) {
+            scan_cursor = dictScan(db->dict,scan_cursor,
+                                   compressionScanCallback,NULL,db);
+            buckets++;
+        } else {
+            scan_cursor = 0;
+        }
+        if (scan_cursor == 0) {
+            scan_dbid = (scan_dbid+1) % server.dbnum;
+            dbs++;
+        }
+        if (ustime()-start > COMPRESSION_CRON_MAX_USEC) break;
+    }
+    compressionDictTrainIfNeeded();
+}
+
+/* ------------------------------ Persistence ------------------------------ */
+
+/* Called by rdbSaveInfoAuxFields(): save the current dictionary as the
+ * "vc-dict" AUX field, made of its 32 bit little endian version number
+ * followed by its content. */
+int compressionSaveDict(rio *rdb) {
+    unsigned char *buf;
+    uint32_t id;
+    ssize_t retval;
+
+    if (current_dict == NULL) return 0;
+    buf = zmalloc(4+current_dict->len);
+    id = current_dict->id;
+    memrev32ifbe(&id);
+    memcpy(buf,&id,4);
+    memcpy(buf+4,current_dict->data,current_dict->len);
+    retval = rdbSaveAuxField(rdb,"vc-dict",7,buf,4+current_dict->len);
+    zfree(buf);
+    return retval == -1 ? -1 : 0;
+}
+
+/* Called by rdbLoadAuxField() with the content of the "vc-dict" field:
+ * make it the current dictionary, unless it is the current one already. */
+int compressionLoadDict(sds data) {
+    size_t len = sdslen(data);
+    uint32_t id;
+
+    if (len < 4+COMPRESSION_DICT_MIN_SIZE || len > 4+COMPRESSION_DICT_MAX_SIZE)
+        return C_ERR;
+    memcpy(&id,data,4);
+    memrev32ifbe(&id);
+    len -= 4;
+    if (current_dict && current_dict->id == id && current_dict->len == len &&
+        memcmp(current_dict->data,data+4,len) == 0) return C_OK;
+    compressionSetDict(compressionCreateDict(id,data+4,len));
+    dict_trained_time = server.unixtime;
+    return C_OK;
+}
+
+/* ---------------------------------- Misc --------------------------------- */
+
+/* Called by readThreadsCanExecute(): return true if some key of the
+ * command of 'c' holds a compressed value, that needs to be decompressed
+ * by the main thread. */
+int compressionCommandKeysCompressed(client *c) {
+    int *keys, numkeys, j, found = 0;
+    size_t count;
+
+    atomicGet(compressed_values,count);
+    if (count == 0) return 0;
+    keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys && !found; j++) {
+        dictEntry *de = dictFind(c->db->dict,c->argv[keys[j]]->ptr);
+        robj *val = de ? dictGetVal(de) : NULL;
+
+        if (val && val->encoding == OBJ_ENCODING_COMPRESSED) found = 1;
+    }
+    getKeysFreeResult(keys);
+    return found;
+}
+
+size_t compressionCacheMemory(void) {
+    return hot_memory;
+}
+
+size_t compressionValuesCount(void) {
+    size_t count;
+
+    atomicGet(compressed_values,count);
+    return count;
+}
+
+size_t compressionSavedMemory(void) {
+    size_t saved;
+
+    atomicGet(compressed_saved,saved);
+    return saved;
+}
+
+unsigned int compressionDictVersion(void) {
+    return current_dict ? current_dict->id : 0;
+}
+
+size_t compressionDictsCount(void) {
+    return (current_dict != NULL)+(old_dicts ? listLength(old_dicts) : 0);
+}
+
+/* Memory used by the dictionaries and by the samples of the next
+ * training. */
+size_t compressionDictsMemory(void) {
+    size_t mem = current_dict ? zmalloc_size(current_dict) : 0;
+    listIter li;
+    listNode *ln;
+    int j;
+
+    if (old_dicts) {
+        listRewind(old_dicts,&li);
+        while((ln = listNext(&li)) != NULL)
+            mem += zmalloc_size(listNodeValue(ln));
+    }
+    for (j = 0; j < dict_samples_count; j++)
+        mem += sdsAllocSize(dict_samples[j]);
+    return mem;
+}
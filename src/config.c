@@ -344,6 +344,45 @@ void loadServerConfigFromString(char *config) {
                 err = "lfu-decay-time must be 0 or greater";
                 goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"hotkeys-tracking") && argc == 2) {
+            if ((server.hotkeys_tracking = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"hotkeys-sample-rate") && argc == 2) {
+            server.hotkeys_sample_rate = atoi(argv[1]);
+            if (server.hotkeys_sample_rate < 1) {
+                err = "hotkeys-sample-rate must be 1 or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"hotkeys-max-keys") && argc == 2) {
+            server.hotkeys_max_keys = atoi(argv[1]);
+            if (server.hotkeys_max_keys < 1 ||
+                server.hotkeys_max_keys > 10000)
+            {
+                err = "hotkeys-max-keys must be between 1 and 10000";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"memory-report-period") && argc == 2) {
+            server.memory_report_period = atoi(argv[1]);
+            if (server.memory_report_period < 0) {
+                err = "memory-report-period must be 0 or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"memory-report-delimiter") && argc == 2) {
+            if (argv[1][0] == '\0') {
+                err = "memory-report-delimiter can't be empty";
+                goto loaderr;
+            }
+            zfree(server.memory_report_delimiter);
+            server.memory_report_delimiter = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"memory-report-top-keys") && argc == 2) {
+            server.memory_report_top_keys = atoi(argv[1]);
+            if (server.memory_report_top_keys < 0 ||
+                server.memory_report_top_keys > 1000)
+            {
+                err = "memory-report-top-keys must be between 0 and 1000";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"slaveof") && argc == 3) {
             slaveof_linenum = linenum;
             server.masterhost = sdsnew(argv[1]);
@@ -407,6 +446,18 @@ void loadServerConfigFromString(char *config) {
             if ((server.rdb_checksum = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
             }
+        } else if (!strcasecmp(argv[0],"rdb-lazy-load") && argc == 2) {
+            if ((server.rdb_lazy_load = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rdb-lazy-load-cycle-us") &&
+                   argc == 2)
+        {
+            server.rdb_lazy_load_cycle_us = strtoll(argv[1],NULL,10);
+            if (server.rdb_lazy_load_cycle_us < 0) {
+                err = "rdb-lazy-load-cycle-us can't be negative";
+                goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"activerehashing") && argc == 2) {
             if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
                 err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -659,6 +710,105 @@ void loadServerConfigFromString(char *config) {
             }
         } else if (!strcasecmp(argv[0],"slowlog-max-len") && argc == 2) {
             server.slowlog_max_len = strtoll(argv[1],NULL,10);
+        } else if (!strcasecmp(argv[0],"trace-sample-rate") && argc == 2) {
+            server.trace_sample_rate = strtoll(argv[1],NULL,10);
+            if (server.trace_sample_rate < 0) {
+                err = "trace-sample-rate can't be negative";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"trace-max-len") && argc == 2) {
+            server.trace_max_len = strtoll(argv[1],NULL,10);
+        } else if (!strcasecmp(argv[0],"shard-threads") && argc == 2) {
+            server.shard_threads = atoi(argv[1]);
+            if (server.shard_threads < 0 ||
+                server.shard_threads > CONFIG_MAX_SHARD_THREADS)
+            {
+                err = "Invalid number of shard threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"read-threads") && argc == 2) {
+            server.read_threads = atoi(argv[1]);
+            if (server.read_threads < 0 ||
+                server.read_threads > CONFIG_MAX_READ_THREADS)
+            {
+                err = "Invalid number of read threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"offload-threads") && argc == 2) {
+            server.offload_threads = atoi(argv[1]);
+            if (server.offload_threads < 0 ||
+                server.offload_threads > CONFIG_MAX_OFFLOAD_THREADS)
+            {
+                err = "Invalid number of offload threads"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"reply-cache-max-memory") &&
+                   argc == 2)
+        {
+            server.reply_cache_max_memory = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"tracking-table-max-keys") &&
+                   argc == 2)
+        {
+            server.tracking_table_max_keys = strtoll(argv[1],NULL,10);
+            if (server.tracking_table_max_keys < 1) {
+                err = "tracking-table-max-keys must be 1 or greater";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"reply-cache-min-size") && argc == 2) {
+            server.reply_cache_min_size = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"value-compression") && argc == 2) {
+            if ((server.value_compression = yesnotoi(argv[1])) == -1) {
+                err = "argument must be 'yes' or 'no'"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"value-compression-min-size") &&
+                   argc == 2)
+        {
+            server.value_compression_min_size = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"value-compression-min-savings") &&
+                   argc == 2)
+        {
+            server.value_compression_min_savings = atoi(argv[1]);
+            if (server.value_compression_min_savings < 0 ||
+                server.value_compression_min_savings > 99)
+            {
+                err = "value-compression-min-savings must be between 0 and 99";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"value-compression-cache-memory") &&
+                   argc == 2)
+        {
+            server.value_compression_cache_memory = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"value-compression-dict-size") &&
+                   argc == 2)
+        {
+            server.value_compression_dict_size = memtoll(argv[1],NULL);
+            if (server.value_compression_dict_size < 0 ||
+                server.value_compression_dict_size > COMPRESSION_DICT_MAX_SIZE)
+            {
+                err = "value-compression-dict-size must be between 0 and 6kb";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"value-compression-dict-min-size") &&
+                   argc == 2)
+        {
+            server.value_compression_dict_min_size = memtoll(argv[1],NULL);
+        } else if (!strcasecmp(argv[0],"value-compression-dict-train-period") &&
+                   argc == 2)
+        {
+            server.value_compression_dict_train_period = atoi(argv[1]);
+            if (server.value_compression_dict_train_period < 0) {
+                err = "Invalid value-compression-dict-train-period";
+                goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"unixsocket-shm-size") && argc == 2) {
+            server.unixsocket_shm_size = memtoll(argv[1],NULL);
+            if (server.unixsocket_shm_size < 0 ||
+                server.unixsocket_shm_size > SHMRING_MAX_SIZE)
+            {
+                err = "Invalid shared memory rings size"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"offload-threshold") && argc == 2) {
+            server.offload_threshold = strtoll(argv[1],NULL,10);
+            if (server.offload_threshold < 0) {
+                err = "offload-threshold can't be negative"; goto loaderr;
+            }
         } else if (!strcasecmp(argv[0],"client-output-buffer-limit") &&
                    argc == 5)
         {
@@ -859,6 +1009,10 @@ void configSetCommand(client *c) {
     } config_set_special_field("masterauth") {
         zfree(server.masterauth);
         server.masterauth = ((char*)o->ptr)[0] ? zstrdup(o->ptr) : NULL;
+    } config_set_special_field("memory-report-delimiter") {
+        if (sdslen(o->ptr) == 0) goto badfmt;
+        zfree(server.memory_report_delimiter);
+        server.memory_report_delimiter = zstrdup(o->ptr);
     } config_set_special_field("cluster-announce-ip") {
         zfree(server.cluster_announce_ip);
         server.cluster_announce_ip = ((char*)o->ptr)[0] ? zstrdup(o->ptr) : NULL;
@@ -892,6 +1046,10 @@ void configSetCommand(client *c) {
         int enable = yesnotoi(o->ptr);
 
         if (enable == -1) goto badfmt;
+        if (enable && server.shard_threads) {
+            addReplyError(c,"AOF is not supported when shard-threads is enabled");
+            return;
+        }
         if (enable == 0 && server.aof_state != AOF_OFF) {
             stopAppendOnly();
         } else if (enable && server.aof_state == AOF_OFF) {
@@ -990,6 +1148,11 @@ void configSetCommand(client *c) {
         int flags = keyspaceEventsStringToFlags(o->ptr);
 
         if (flags == -1) goto badfmt;
+        if (flags && server.shard_threads) {
+            addReplyError(c,"Keyspace notifications are not supported when "
+                            "shard-threads is enabled");
+            return;
+        }
         server.notify_keyspace_events = flags;
     } config_set_special_field("slave-announce-ip") {
         zfree(server.slave_announce_ip);
@@ -999,6 +1162,10 @@ void configSetCommand(client *c) {
      * config_set_bool_field(name,var). */
     } config_set_bool_field(
       "rdbcompression", server.rdb_compression) {
+    } config_set_bool_field(
+      "rdb-lazy-load", server.rdb_lazy_load) {
+    } config_set_bool_field(
+      "value-compression", server.value_compression) {
     } config_set_bool_field(
       "repl-disable-tcp-nodelay",server.repl_disable_tcp_nodelay) {
     } config_set_bool_field(
@@ -1043,6 +1210,8 @@ void configSetCommand(client *c) {
       "lazyfree-lazy-server-del",server.lazyfree_lazy_server_del) {
     } config_set_bool_field(
       "slave-lazy-flush",server.repl_slave_lazy_flush) {
+    } config_set_bool_field(
+      "hotkeys-tracking",server.hotkeys_tracking) {
     } config_set_bool_field(
       "no-appendfsync-on-rewrite",server.aof_no_fsync_on_rewrite) {
 
@@ -1056,6 +1225,14 @@ void configSetCommand(client *c) {
       "lfu-log-factor",server.lfu_log_factor,0,LLONG_MAX) {
     } config_set_numerical_field(
       "lfu-decay-time",server.lfu_decay_time,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "hotkeys-sample-rate",server.hotkeys_sample_rate,1,1000000) {
+    } config_set_numerical_field(
+      "hotkeys-max-keys",server.hotkeys_max_keys,1,10000) {
+    } config_set_numerical_field(
+      "memory-report-period",server.memory_report_period,0,INT_MAX) {
+    } config_set_numerical_field(
+      "memory-report-top-keys",server.memory_report_top_keys,0,1000) {
     } config_set_numerical_field(
       "timeout",server.maxidletime,0,LONG_MAX) {
     } config_set_numerical_field(
@@ -1094,6 +1271,22 @@ void configSetCommand(client *c) {
       "slowlog-max-len",ll,0,LLONG_MAX) {
       /* Cast to unsigned. */
         server.slowlog_max_len = (unsigned)ll;
+    } config_set_numerical_field(
+      "trace-sample-rate",server.trace_sample_rate,0,INT_MAX) {
+    } config_set_numerical_field(
+      "trace-max-len",ll,0,LLONG_MAX) {
+        server.trace_max_len = (unsigned long)ll;
+    } config_set_numerical_field(
+      "tracking-table-max-keys",server.tracking_table_max_keys,1,LLONG_MAX) {
+    } config_set_numerical_field(
+      "rdb-lazy-load-cycle-us",server.rdb_lazy_load_cycle_us,0,LLONG_MAX) {
+    } config_set_numerical_field(
+      "value-compression-min-savings",server.value_compression_min_savings,0,99) {
+    } config_set_numerical_field(
+      "value-compression-dict-train-period",
+      server.value_compression_dict_train_period,0,INT_MAX) {
+    } config_set_numerical_field(
+      "offload-threshold",server.offload_threshold,0,LLONG_MAX) {
     } config_set_numerical_field(
       "latency-monitor-threshold",server.latency_monitor_threshold,0,LLONG_MAX){
     } config_set_numerical_field(
@@ -1140,12 +1333,42 @@ void configSetCommand(client *c) {
     /* Memory fields.
      * config_set_memory_field(name,var) */
     } config_set_memory_field("maxmemory",server.maxmemory) {
+        /* Eviction only samples the global databases, never the ones of
+         * the shards: see shardsInit(). */
+        if (server.maxmemory && server.shard_threads) {
+            server.maxmemory = 0;
+            addReplyError(c,"maxmemory is not supported when shard-threads "
+                            "is enabled");
+            return;
+        }
         if (server.maxmemory) {
             if (server.maxmemory < zmalloc_used_memory()) {
                 serverLog(LL_WARNING,"WARNING: the new maxmemory value set via CONFIG SET is smaller than the current memory usage. This will result in keys eviction and/or inability to accept new write commands depending on the maxmemory-policy.");
             }
             freeMemoryIfNeeded();
         }
+    } config_set_memory_field(
+      "reply-cache-max-memory",server.reply_cache_max_memory) {
+        replyCacheResize();
+    } config_set_memory_field(
+      "reply-cache-min-size",server.reply_cache_min_size) {
+        replyCacheFlush(-1);
+    } config_set_memory_field(
+      "value-compression-min-size",server.value_compression_min_size) {
+    } config_set_memory_field(
+      "value-compression-cache-memory",
+      server.value_compression_cache_memory) {
+    } config_set_memory_field(
+      "value-compression-dict-size",server.value_compression_dict_size) {
+        if (server.value_compression_dict_size > COMPRESSION_DICT_MAX_SIZE)
+            server.value_compression_dict_size = COMPRESSION_DICT_MAX_SIZE;
+    } config_set_memory_field(
+      "value-compression-dict-min-size",
+      server.value_compression_dict_min_size) {
+    } config_set_memory_field(
+      "unixsocket-shm-size",server.unixsocket_shm_size) {
+        if (server.unixsocket_shm_size > SHMRING_MAX_SIZE)
+            server.unixsocket_shm_size = SHMRING_MAX_SIZE;
     } config_set_memory_field(
       "proto-max-bulk-len",server.proto_max_bulk_len) {
     } config_set_memory_field(
@@ -1230,6 +1453,7 @@ void configGetCommand(client *c) {
     config_get_string_field("dbfilename",server.rdb_filename);
     config_get_string_field("requirepass",server.requirepass);
     config_get_string_field("masterauth",server.masterauth);
+    config_get_string_field("memory-report-delimiter",server.memory_report_delimiter);
     config_get_string_field("cluster-announce-ip",server.cluster_announce_ip);
     config_get_string_field("unixsocket",server.unixsocket);
     config_get_string_field("logfile",server.logfile);
@@ -1243,6 +1467,10 @@ void configGetCommand(client *c) {
     config_get_numerical_field("maxmemory-samples",server.maxmemory_samples);
     config_get_numerical_field("lfu-log-factor",server.lfu_log_factor);
     config_get_numerical_field("lfu-decay-time",server.lfu_decay_time);
+    config_get_numerical_field("hotkeys-sample-rate",server.hotkeys_sample_rate);
+    config_get_numerical_field("hotkeys-max-keys",server.hotkeys_max_keys);
+    config_get_numerical_field("memory-report-period",server.memory_report_period);
+    config_get_numerical_field("memory-report-top-keys",server.memory_report_top_keys);
     config_get_numerical_field("timeout",server.maxidletime);
     config_get_numerical_field("active-defrag-threshold-lower",server.active_defrag_threshold_lower);
     config_get_numerical_field("active-defrag-threshold-upper",server.active_defrag_threshold_upper);
@@ -1276,6 +1504,36 @@ void configGetCommand(client *c) {
             server.latency_monitor_threshold);
     config_get_numerical_field("slowlog-max-len",
             server.slowlog_max_len);
+    config_get_numerical_field("trace-sample-rate",
+            server.trace_sample_rate);
+    config_get_numerical_field("trace-max-len",
+            server.trace_max_len);
+    config_get_numerical_field("shard-threads",server.shard_threads);
+    config_get_numerical_field("read-threads",server.read_threads);
+    config_get_numerical_field("offload-threads",server.offload_threads);
+    config_get_numerical_field("offload-threshold",server.offload_threshold);
+    config_get_numerical_field("tracking-table-max-keys",
+            server.tracking_table_max_keys);
+    config_get_numerical_field("rdb-lazy-load-cycle-us",
+            server.rdb_lazy_load_cycle_us);
+    config_get_numerical_field("unixsocket-shm-size",
+            server.unixsocket_shm_size);
+    config_get_numerical_field("reply-cache-max-memory",
+            server.reply_cache_max_memory);
+    config_get_numerical_field("reply-cache-min-size",
+            server.reply_cache_min_size);
+    config_get_numerical_field("value-compression-min-size",
+            server.value_compression_min_size);
+    config_get_numerical_field("value-compression-min-savings",
+            server.value_compression_min_savings);
+    config_get_numerical_field("value-compression-cache-memory",
+            server.value_compression_cache_memory);
+    config_get_numerical_field("value-compression-dict-size",
+            server.value_compression_dict_size);
+    config_get_numerical_field("value-compression-dict-min-size",
+            server.value_compression_dict_min_size);
+    config_get_numerical_field("value-compression-dict-train-period",
+            server.value_compression_dict_train_period);
     config_get_numerical_field("port",server.port);
     config_get_numerical_field("cluster-announce-port",server.cluster_announce_port);
     config_get_numerical_field("cluster-announce-bus-port",server.cluster_announce_bus_port);
@@ -1314,6 +1572,8 @@ void configGetCommand(client *c) {
     config_get_bool_field("daemonize", server.daemonize);
     config_get_bool_field("rdbcompression", server.rdb_compression);
     config_get_bool_field("rdbchecksum", server.rdb_checksum);
+    config_get_bool_field("rdb-lazy-load", server.rdb_lazy_load);
+    config_get_bool_field("value-compression", server.value_compression);
     config_get_bool_field("activerehashing", server.activerehashing);
     config_get_bool_field("activedefrag", server.active_defrag_enabled);
     config_get_bool_field("protected-mode", server.protected_mode);
@@ -1329,6 +1589,8 @@ void configGetCommand(client *c) {
             server.aof_use_rdb_preamble);
     config_get_bool_field("lazyfree-lazy-eviction",
             server.lazyfree_lazy_eviction);
+    config_get_bool_field("hotkeys-tracking",
+            server.hotkeys_tracking);
     config_get_bool_field("lazyfree-lazy-expire",
             server.lazyfree_lazy_expire);
     config_get_bool_field("lazyfree-lazy-server-del",
@@ -1980,6 +2242,7 @@ int rewriteConfig(char *path) {
     rewriteConfigBindOption(state);
     rewriteConfigStringOption(state,"unixsocket",server.unixsocket,NULL);
     rewriteConfigOctalOption(state,"unixsocketperm",server.unixsocketperm,CONFIG_DEFAULT_UNIX_SOCKET_PERM);
+    rewriteConfigBytesOption(state,"unixsocket-shm-size",server.unixsocket_shm_size,CONFIG_DEFAULT_UNIXSOCKET_SHM_SIZE);
     rewriteConfigNumericalOption(state,"timeout",server.maxidletime,CONFIG_DEFAULT_CLIENT_TIMEOUT);
     rewriteConfigNumericalOption(state,"tcp-keepalive",server.tcpkeepalive,CONFIG_DEFAULT_TCP_KEEPALIVE);
     rewriteConfigNumericalOption(state,"slave-announce-port",server.slave_announce_port,CONFIG_DEFAULT_SLAVE_ANNOUNCE_PORT);
@@ -1993,6 +2256,8 @@ int rewriteConfig(char *path) {
     rewriteConfigYesNoOption(state,"stop-writes-on-bgsave-error",server.stop_writes_on_bgsave_err,CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR);
     rewriteConfigYesNoOption(state,"rdbcompression",server.rdb_compression,CONFIG_DEFAULT_RDB_COMPRESSION);
     rewriteConfigYesNoOption(state,"rdbchecksum",server.rdb_checksum,CONFIG_DEFAULT_RDB_CHECKSUM);
+    rewriteConfigYesNoOption(state,"rdb-lazy-load",server.rdb_lazy_load,CONFIG_DEFAULT_RDB_LAZY_LOAD);
+    rewriteConfigNumericalOption(state,"rdb-lazy-load-cycle-us",server.rdb_lazy_load_cycle_us,CONFIG_DEFAULT_RDB_LAZY_LOAD_CYCLE_US);
     rewriteConfigStringOption(state,"dbfilename",server.rdb_filename,CONFIG_DEFAULT_RDB_FILENAME);
     rewriteConfigDirOption(state);
     rewriteConfigSlaveofOption(state);
@@ -2020,6 +2285,12 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"maxmemory-samples",server.maxmemory_samples,CONFIG_DEFAULT_MAXMEMORY_SAMPLES);
     rewriteConfigNumericalOption(state,"lfu-log-factor",server.lfu_log_factor,CONFIG_DEFAULT_LFU_LOG_FACTOR);
     rewriteConfigNumericalOption(state,"lfu-decay-time",server.lfu_decay_time,CONFIG_DEFAULT_LFU_DECAY_TIME);
+    rewriteConfigYesNoOption(state,"hotkeys-tracking",server.hotkeys_tracking,CONFIG_DEFAULT_HOTKEYS_TRACKING);
+    rewriteConfigNumericalOption(state,"hotkeys-sample-rate",server.hotkeys_sample_rate,CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE);
+    rewriteConfigNumericalOption(state,"hotkeys-max-keys",server.hotkeys_max_keys,CONFIG_DEFAULT_HOTKEYS_MAX_KEYS);
+    rewriteConfigNumericalOption(state,"memory-report-period",server.memory_report_period,CONFIG_DEFAULT_MEMORY_REPORT_PERIOD);
+    rewriteConfigStringOption(state,"memory-report-delimiter",server.memory_report_delimiter,CONFIG_DEFAULT_MEMORY_REPORT_DELIMITER);
+    rewriteConfigNumericalOption(state,"memory-report-top-keys",server.memory_report_top_keys,CONFIG_DEFAULT_MEMORY_REPORT_TOP_KEYS);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-lower",server.active_defrag_threshold_lower,CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER);
     rewriteConfigNumericalOption(state,"active-defrag-threshold-upper",server.active_defrag_threshold_upper,CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER);
     rewriteConfigBytesOption(state,"active-defrag-ignore-bytes",server.active_defrag_ignore_bytes,CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES);
@@ -2042,6 +2313,22 @@ int rewriteConfig(char *path) {
     rewriteConfigNumericalOption(state,"slowlog-log-slower-than",server.slowlog_log_slower_than,CONFIG_DEFAULT_SLOWLOG_LOG_SLOWER_THAN);
     rewriteConfigNumericalOption(state,"latency-monitor-threshold",server.latency_monitor_threshold,CONFIG_DEFAULT_LATENCY_MONITOR_THRESHOLD);
     rewriteConfigNumericalOption(state,"slowlog-max-len",server.slowlog_max_len,CONFIG_DEFAULT_SLOWLOG_MAX_LEN);
+    rewriteConfigNumericalOption(state,"trace-sample-rate",server.trace_sample_rate,CONFIG_DEFAULT_TRACE_SAMPLE_RATE);
+    rewriteConfigNumericalOption(state,"trace-max-len",server.trace_max_len,CONFIG_DEFAULT_TRACE_MAX_LEN);
+    rewriteConfigNumericalOption(state,"shard-threads",server.shard_threads,CONFIG_DEFAULT_SHARD_THREADS);
+    rewriteConfigNumericalOption(state,"read-threads",server.read_threads,CONFIG_DEFAULT_READ_THREADS);
+    rewriteConfigNumericalOption(state,"offload-threads",server.offload_threads,CONFIG_DEFAULT_OFFLOAD_THREADS);
+    rewriteConfigNumericalOption(state,"offload-threshold",server.offload_threshold,CONFIG_DEFAULT_OFFLOAD_THRESHOLD);
+    rewriteConfigNumericalOption(state,"tracking-table-max-keys",server.tracking_table_max_keys,CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS);
+    rewriteConfigBytesOption(state,"reply-cache-max-memory",server.reply_cache_max_memory,CONFIG_DEFAULT_REPLY_CACHE_MAX_MEMORY);
+    rewriteConfigBytesOption(state,"reply-cache-min-size",server.reply_cache_min_size,CONFIG_DEFAULT_REPLY_CACHE_MIN_SIZE);
+    rewriteConfigYesNoOption(state,"value-compression",server.value_compression,CONFIG_DEFAULT_VALUE_COMPRESSION);
+    rewriteConfigBytesOption(state,"value-compression-min-size",server.value_compression_min_size,CONFIG_DEFAULT_VALUE_COMPRESSION_MIN_SIZE);
+    rewriteConfigNumericalOption(state,"value-compression-min-savings",server.value_compression_min_savings,CONFIG_DEFAULT_VALUE_COMPRESSION_MIN_SAVINGS);
+    rewriteConfigBytesOption(state,"value-compression-cache-memory",server.value_compression_cache_memory,CONFIG_DEFAULT_VALUE_COMPRESSION_CACHE_MEMORY);
+    rewriteConfigBytesOption(state,"value-compression-dict-size",server.value_compression_dict_size,CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_SIZE);
+    rewriteConfigBytesOption(state,"value-compression-dict-min-size",server.value_compression_dict_min_size,CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_MIN_SIZE);
+    rewriteConfigNumericalOption(state,"value-compression-dict-train-period",server.value_compression_dict_train_period,CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_TRAIN_PERIOD);
     rewriteConfigNotifykeyspaceeventsOption(state);
     rewriteConfigNumericalOption(state,"hash-max-ziplist-entries",server.hash_max_ziplist_entries,OBJ_HASH_MAX_ZIPLIST_ENTRIES);
     rewriteConfigNumericalOption(state,"hash-max-ziplist-value",server.hash_max_ziplist_value,OBJ_HASH_MAX_ZIPLIST_VALUE);
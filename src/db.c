@@ -33,6 +33,10 @@ void updateLFU(robj *val) {
 robj *lookupKey(redisDb *db, robj *key, int flags) {
     //在数据库中查找key对象，返回保存该key的节点地址
     dictEntry *de = dictFind(db->dict,key->ptr);
+
+    /* Keys still in the RDB file after a lazy load are loaded on access. */
+    if (de == NULL && server.lazy_loading && lazyLoadKey(db,key->ptr))
+        de = dictFind(db->dict,key->ptr);
 	//检测对应的键值对结构是否存在
     if (de) {
 		//获取对应的键所对应的值对象
@@ -52,6 +56,19 @@ robj *lookupKey(redisDb *db, robj *key, int flags) {
                 val->lru = LRU_CLOCK();
             }
         }
+        /* Compressed values are decompressed in place when accessed, but
+         * only by the main thread and not by lookups without side effects,
+         * see compression.c. */
+        if (val->encoding == OBJ_ENCODING_COMPRESSED &&
+            !(flags & LOOKUP_NOTOUCH) && !inCommandThread())
+            compressionDecompressValue(db,key,val);
+        /* The hot keys tracking state is not shared with the shard
+         * threads, that perform all the lookups in sharded mode, nor
+         * with the offload threads. */
+        if (server.hotkeys_tracking && !server.shard_threads &&
+            !(server.offload_threads && offloadIsOffloadThread()) &&
+            !(flags & LOOKUP_NOTOUCH))
+            hotkeysTrackLookup(db,key,flags & LOOKUP_WRITE);
 		//返回对应的值对象
         return val;
     } else {
@@ -100,6 +117,10 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
         if (server.masterhost == NULL) 
 			return NULL;
 
+        /* Read threads only execute read only commands, never on behalf
+         * of our master. */
+        if (server.read_threads && readThreadsIsReader()) return NULL;
+
         /* However if we are in the context of a slave, expireIfNeeded() will
          * not really try to expire the key, it only returns information
          * about the "logical" status of the key: key expiring is up to the
@@ -126,13 +147,30 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags) {
     val = lookupKey(db,key,flags);
 	//更新 是否命中 的信息
     if (val == NULL)
-        server.stat_keyspace_misses++;
+        serverStatIncr(stat_keyspace_misses,1);
     else
-        server.stat_keyspace_hits++;
+        serverStatIncr(stat_keyspace_hits,1);
 	//返回对应的值对象
     return val;
 }
 
+/* Lookup a key for read operations without any side effect: logically
+ * expired keys are reported as missing but are not deleted, and neither the
+ * key access time nor the hits/misses stats are updated.
+ *
+ * This is used by module threads holding the GIL in shared mode (see
+ * RM_ThreadSafeContextReadLock()), where multiple threads may look up keys
+ * concurrently while the main thread is sleeping. */
+robj *lookupKeyReadNoSideEffects(redisDb *db, robj *key) {
+    dictEntry *de = dictFind(db->dict,key->ptr);
+    long long when;
+
+    if (de == NULL) return NULL;
+    when = getExpire(db,key);
+    if (when >= 0 && mstime() > when) return NULL;
+    return dictGetVal(de);
+}
+
 /* 以读操作取出key的值对象，会更新是否命中的信息
  * Like lookupKeyReadWithFlags(), but does not use any flag, which is the common case. 
  */
@@ -148,7 +186,7 @@ robj *lookupKeyWrite(redisDb *db, robj *key) {
     //触发检测是否有必要进行过期键进行删除操作处理
     expireIfNeeded(db,key);
 	//进行找到对应的键所对应的值对象
-    return lookupKey(db,key,LOOKUP_NONE);
+    return lookupKey(db,key,LOOKUP_WRITE);
 }
 
 /* 以读操作取出key的值对象，如果key不存在，则发送reply信息，并返回NULL */
@@ -188,6 +226,8 @@ void dbAdd(redisDb *db, robj *key, robj *val) {
     int retval = dictAdd(db->dict, copy, val);
 
     serverAssertWithInfo(NULL,key,retval == DICT_OK);
+    /* The version of the key still in the RDB file is replaced. */
+    if (server.lazy_loading) lazyLoadDiscardKey(db,key->ptr);
 	//特殊检查当前插入的值对象是否是List里边对象-------->这个地方可能引发去堵塞操作处理
     if (val->type == OBJ_LIST) 
 		//发送一个List列表对象已经准备好的信号
@@ -211,6 +251,7 @@ void dbOverwrite(redisDb *db, robj *key, robj *val) {
     dictEntry *de = dictFind(db->dict,key->ptr);
 
     serverAssertWithInfo(NULL,key,de != NULL);
+    moduleNotifyKeyUnlink(key,dictGetVal(de));
 	//查询当前redis中配置的内存清楚策略------>
     if (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) {
 		//获取老的值对象
@@ -261,6 +302,7 @@ void setKey(redisDb *db, robj *key, robj *val) {
 
 /* 检查key是否存在于db中，返回1 表示存在 */
 int dbExists(redisDb *db, robj *key) {
+    if (server.lazy_loading) lazyLoadKey(db,key->ptr);
     //在字典结构中查询对应的键对象
     return dictFind(db->dict,key->ptr) != NULL;
 }
@@ -329,7 +371,11 @@ int dbSyncDelete(redisDb *db, robj *key) {
 		//首先在对应的过期键值对中删除对应的本键值对
 		dictDelete(db->expires,key->ptr);
 	//是否对应的键值对占据的空间
-    if (dictDelete(db->dict,key->ptr) == DICT_OK) {
+    dictEntry *de = dictUnlink(db->dict,key->ptr);
+    if (de) {
+        /* Tell the module about the key being unlinked before freeing it. */
+        moduleNotifyKeyUnlink(key,dictGetVal(de));
+        dictFreeUnlinkedEntry(db->dict,de);
 		//检测是否开启了集群模式
         if (server.cluster_enabled) 
 			//在对应的槽位中删除对应的键
@@ -347,6 +393,7 @@ int dbSyncDelete(redisDb *db, robj *key) {
  * configuration. Deletes the key synchronously or asynchronously. 
  */
 int dbDelete(redisDb *db, robj *key) {
+    if (server.lazy_loading) lazyLoadKey(db,key->ptr);
     return server.lazyfree_lazy_server_del ? dbAsyncDelete(db,key) : dbSyncDelete(db,key);
 }
 
@@ -419,6 +466,10 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
         errno = EINVAL;
         return -1;
     }
+    /* Not every caller goes through processCommand() (the full resync of
+     * a replica for instance): wait for the read threads that may still
+     * be walking the keyspace we are going to free. */
+    if (server.read_threads) readThreadsWait();
 	//循环删除对应索引库的数据处理
     for (j = 0; j < server.dbnum; j++) {
 		//根据参数来进一步确定是否是所有的索引库都进行删除操作处理
@@ -426,6 +477,7 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
 			continue;
 		//获取当前索引库对应的元素个数
         removed += dictSize(server.db[j].dict);
+        moduleNotifyDbUnlink(&server.db[j]);
 		//检测是否是异步删除操作处理
         if (async) {
 			//启动异步删除操作处理
@@ -445,8 +497,12 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*)) {
             slotToKeyFlush();
         }
     }
+    if (server.shard_threads)
+        removed += shardsEmptyDb(dbnum,async,callback);
     if (dbnum == -1) 
 		flushSlaveKeysWithExpireList();
+    flushSideTables(dbnum);
+    lazyLoadEmptyDb(dbnum);
 	//返回删除键值对的数量
     return removed;
 }
@@ -457,7 +513,7 @@ int selectDb(client *c, int id) {
     if (id < 0 || id >= server.dbnum)
         return C_ERR;
 	//获取库索引对应的库
-    c->db = &server.db[id];
+    c->db = server.shard_threads ? shardSelectDb(id) : &server.db[id];
     return C_OK;
 }
 
@@ -472,10 +528,52 @@ int selectDb(client *c, int id) {
 
 void signalModifiedKey(redisDb *db, robj *key) {
     touchWatchedKey(db,key);
+    if (server.reply_cache_max_memory) replyCacheInvalidateKey(db,key);
+    if (server.value_compression) compressionTrackKey(db,key);
+    trackingInvalidateKey(key);
 }
 
 void signalFlushedDb(int dbid) {
     touchWatchedKeysOnFlush(dbid);
+    trackingInvalidateKeysOnFlush(dbid);
+}
+
+/* Side tables, like the reply cache and the hot values of the value
+ * compression, refer to values of the keyspace they don't own, indexed by
+ * "<dbid>:<key>". */
+sds sideTableName(int dbid, sds key) {
+    sds name = sdsfromlonglong(dbid);
+
+    name = sdscatlen(name,":",1);
+    return sdscatsds(name,key);
+}
+
+/* Delete from the side table 'd' the entries of the database 'dbid', or all
+ * the entries if 'dbid' is -1, calling 'del' for every one of them. */
+void sideTableFlush(dict *d, int dbid, void (*del)(dictEntry *de)) {
+    dictIterator *di;
+    dictEntry *de;
+    sds prefix;
+
+    if (d == NULL || dictSize(d) == 0) return;
+    prefix = sdsempty();
+    if (dbid != -1) prefix = sdscatfmt(prefix,"%i:",dbid);
+    di = dictGetSafeIterator(d);
+    while((de = dictNext(di)) != NULL) {
+        sds name = dictGetKey(de);
+
+        if (!strncmp(name,prefix,sdslen(prefix))) del(de);
+    }
+    dictReleaseIterator(di);
+    sdsfree(prefix);
+}
+
+/* Called when the values of the database 'dbid', or of all the databases
+ * if 'dbid' is -1, are released or swapped: drop the entries of the side
+ * tables referring to them. */
+void flushSideTables(int dbid) {
+    replyCacheFlush(dbid);
+    compressionCacheFlush(dbid);
 }
 
 /*-----------------------------------------------------------------------------
@@ -527,7 +625,7 @@ void flushdbCommand(client *c) {
 	//发送清除当前索引所对应的库数据
     signalFlushedDb(c->db->id);
 	//增加对应的脏计数值
-    server.dirty += emptyDb(c->db->id,flags,NULL);
+    incrDirty(emptyDb(c->db->id,flags,NULL));
 	//向客户端返回操作成功标识
     addReply(c,shared.ok);
 }
@@ -548,7 +646,7 @@ void flushallCommand(client *c) {
 	//
     signalFlushedDb(-1);
 	//进行真正的删除数据操作处理
-    server.dirty += emptyDb(-1,flags,NULL);
+    incrDirty(emptyDb(-1,flags,NULL));
 	//向客户端返回操作成功响应
     addReply(c,shared.ok);
 	//检测当前是否处于rdb备份操作
@@ -568,7 +666,7 @@ void flushallCommand(client *c) {
         server.dirty = saved_dirty;
     }
 	//增加对应的脏计数值
-    server.dirty++;
+    incrDirty(1);
 }
 
 /* 对于删除指定键值对的通用操作处理函数 */
@@ -588,7 +686,7 @@ void delGenericCommand(client *c, int lazy) {
 			//发送触发对应命令的通知
             notifyKeyspaceEvent(NOTIFY_GENERIC,"del",c->argv[j],c->db->id);
 		    //增加脏计数值
-            server.dirty++;
+            incrDirty(1);
 			//记录删除键值对的数量
             numdel++;
         }
@@ -703,36 +801,43 @@ void keysCommand(client *c) {
     dictEntry *de;
 	//获取对应的模式参数
     sds pattern = c->argv[1]->ptr;
-    int plen = sdslen(pattern), allkeys;
+    int plen = sdslen(pattern), allkeys, j;
     unsigned long numkeys = 0;
     void *replylen = addDeferredMultiBulkLength(c);
+    /* In sharded mode the keys are spread among the shard databases, that
+     * are stopped while this command runs. */
+    int dbs = server.shard_threads ? server.shard_threads : 1;
 
-    //获取对应的迭代器
-    di = dictGetSafeIterator(c->db->dict);
 	//检测是否进行搜索所有的键
     allkeys = (pattern[0] == '*' && pattern[1] == '\0');
-	//循环遍历所有的键对象
-    while((de = dictNext(di)) != NULL) {
-		//获取对应的键字符串
-        sds key = dictGetKey(de);
-        robj *keyobj;
-	    //对获取到的键字符串进行模式匹配操作处理
-        if (allkeys || stringmatchlen(pattern,plen,key,sdslen(key),0)) {
-			//获取对应的键对象
-            keyobj = createStringObject(key,sdslen(key));
-			//检测对应的键对象是否处于过期状态
-            if (expireIfNeeded(c->db,keyobj) == 0) {
-				//将对应的键对象添加到返回值中
-                addReplyBulk(c,keyobj);
-				//增加返回值计数
-                numkeys++;
+    for (j = 0; j < dbs; j++) {
+        redisDb *db = server.shard_threads ? shardGetDb(j,c->db->id) : c->db;
+
+        //获取对应的迭代器
+        di = dictGetSafeIterator(db->dict);
+        //循环遍历所有的键对象
+        while((de = dictNext(di)) != NULL) {
+            //获取对应的键字符串
+            sds key = dictGetKey(de);
+            robj *keyobj;
+            //对获取到的键字符串进行模式匹配操作处理
+            if (allkeys || stringmatchlen(pattern,plen,key,sdslen(key),0)) {
+                //获取对应的键对象
+                keyobj = createStringObject(key,sdslen(key));
+                //检测对应的键对象是否处于过期状态
+                if (expireIfNeeded(db,keyobj) == 0) {
+                    //将对应的键对象添加到返回值中
+                    addReplyBulk(c,keyobj);
+                    //增加返回值计数
+                    numkeys++;
+                }
+                //减少键对象对应的引用计数值
+                decrRefCount(keyobj);
             }
-			//减少键对象对应的引用计数值
-            decrRefCount(keyobj);
         }
+        //释放对应的迭代器
+        dictReleaseIterator(di);
     }
-	//释放对应的迭代器
-    dictReleaseIterator(di);
 	//向客户端返回对应的键对象
     setDeferredMultiBulkLength(c,replylen,numkeys);
 }
@@ -991,6 +1096,13 @@ void scanCommand(client *c) {
  */
 void dbsizeCommand(client *c) {
     //向客户端返回当前库中键值对的数量
+    if (server.shard_threads) {
+        long long keys, vkeys, avg_ttl;
+
+        shardsGetDbStats(c->db->id,&keys,&vkeys,&avg_ttl);
+        addReplyLongLong(c,keys);
+        return;
+    }
     addReplyLongLong(c,dictSize(c->db->dict));
 }
 
@@ -1062,8 +1174,11 @@ void typeCommand(client *c) {
  *     关闭 redis 服务器(server)
  * 执行 SHUTDOWN SAVE 会强制让数据库执行保存操作，即使没有设定(configure)保存点
  * 执行 SHUTDOWN NOSAVE 会阻止数据库执行保存操作，即使已经设定有一个或多个保存点(你可以将这一用法看作是强制停止服务器的一个假想的 ABORT 命令)
+ * 执行 SHUTDOWN HANDOVER 会重新执行服务器程序，数据集通过内存交给新的进程（见 handover.c）
+ *     和普通的 SHUTDOWN 一样，如果设定了保存点，还会先执行一次 RDB 保存，这样新的程序不接受内存镜像时
+ *     可以从磁盘载入最新的数据，代价是重启前多一次完整的保存
  * 命令格式
- *     SHUTDOWN [NOSAVE] [SAVE]
+ *     SHUTDOWN [NOSAVE] [SAVE] [HANDOVER]
  * 返回值
  *     执行失败时返回错误。 执行成功时不返回任何信息，服务器和客户端的连接断开，客户端自动退出。 
  */
@@ -1080,6 +1195,17 @@ void shutdownCommand(client *c) {
         } else if (!strcasecmp(c->argv[1]->ptr,"save")) {
             //配置进行保存操作处理
             flags |= SHUTDOWN_SAVE;
+        } else if (!strcasecmp(c->argv[1]->ptr,"handover")) {
+            /* Restart handing the dataset over to the new process. */
+            if (server.loading || server.sentinel_mode) {
+                addReplyError(c,"SHUTDOWN HANDOVER is not possible while "
+                                "loading or in Sentinel mode");
+                return;
+            }
+            restartServer(RESTART_SERVER_HANDOVER|RESTART_SERVER_GRACEFULLY|
+                          RESTART_SERVER_CONFIG_REWRITE,0);
+            addReplyError(c,"Errors trying to SHUTDOWN HANDOVER. Check logs.");
+            return;
         } else {
 			//配置其他属性的错误响应
             addReply(c,shared.syntaxerr);
@@ -1164,7 +1290,7 @@ void renameGenericCommand(client *c, int nx) {
     notifyKeyspaceEvent(NOTIFY_GENERIC,"rename_from",c->argv[1],c->db->id);
     notifyKeyspaceEvent(NOTIFY_GENERIC,"rename_to",c->argv[2],c->db->id);
 	//增加脏计数值
-    server.dirty++;
+    incrDirty(1);
 	//向客户端返回对应的响应标识
     addReply(c,nx ? shared.cone : shared.ok);
 }
@@ -1265,7 +1391,7 @@ void moveCommand(client *c) {
 	//从源数据库中将key和关联的值对象删除
     dbDelete(src,c->argv[1]);
 	//更新脏计数值
-    server.dirty++;
+    incrDirty(1);
 	//回复1
     addReply(c,shared.cone);
 }
@@ -1340,6 +1466,10 @@ int dbSwapDatabases(int id1, int id2) {
      * in dbAdd() when a list is created. So here we need to rescan
      * the list of clients blocked on lists and signal lists as ready
      * if needed. */
+    /* The side tables refer to the values of the swapped dictionaries. */
+    flushSideTables(id1);
+    flushSideTables(id2);
+
     //在第一个库上触发监听的List堵塞是否可以开启
     scanDatabaseForReadyLists(db1);
 	//在第二个库上触发监听的List堵塞是否可以开启
@@ -1380,7 +1510,7 @@ void swapdbCommand(client *c) {
         return;
     } else {
 		//增加对应的脏计数值
-        server.dirty++;
+        incrDirty(1);
 		//向客户端回复ok标识
         addReply(c,shared.ok);
     }
@@ -1538,6 +1668,13 @@ int expireIfNeeded(redisDb *db, robj *key) {
 		//从节点只是返回是否过期的标识,但是不会触发对应的删除过期键的处理
 		return now > when;
 
+    /* The same applies to the read threads, that can't modify the
+     * dataset: the key will be expired by the main thread. */
+    if (server.read_threads && readThreadsIsReader()) return now > when;
+
+    /* Keys locked by offloaded commands are expired once released. */
+    if (server.offload_jobs && offloadKeyIsLocked(db,key->ptr)) return 0;
+
     /* Return when this key has not expired */
 	//当键还没有过期时，直接返回0
     if (now <= when) 
@@ -1545,11 +1682,12 @@ int expireIfNeeded(redisDb *db, robj *key) {
 
     /* Delete the key */
 	//增加统计过期的键的数量值
-    server.stat_expiredkeys++;
+    serverStatIncr(stat_expiredkeys,1);
 	//将过期键key传播给AOF文件和从节点
     propagateExpire(db,key,server.lazyfree_lazy_expire);
 	//发送对应的命令通知
     notifyKeyspaceEvent(NOTIFY_EXPIRED,"expired",key,db->id);
+    trackingInvalidateKey(key);
 	//根据服务器配置来确定是同步删除过期键还是异步删除
     return server.lazyfree_lazy_expire ? dbAsyncDelete(db,key) : dbSyncDelete(db,key);
 }
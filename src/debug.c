@@ -224,7 +224,9 @@ void computeDatasetDigest(unsigned char *final) {
                     serverPanic("Unknown sorted set encoding");
                 }
             } else if (o->type == OBJ_HASH) {
-                hashTypeIterator *hi = hashTypeInitIterator(o);
+                robj *h = o->encoding == OBJ_ENCODING_COMPRESSED ?
+                          compressionDecodeObject(o) : o;
+                hashTypeIterator *hi = hashTypeInitIterator(h);
                 while (hashTypeNext(hi) != C_ERR) {
                     unsigned char eledigest[20];
                     sds sdsele;
@@ -239,6 +241,7 @@ void computeDatasetDigest(unsigned char *final) {
                     xorDigest(digest,eledigest,20);
                 }
                 hashTypeReleaseIterator(hi);
+                if (h != o) decrRefCount(h);
             } else if (o->type == OBJ_MODULE) {
                 RedisModuleDigest md;
                 moduleValue *mv = o->ptr;
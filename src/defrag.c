@@ -125,6 +125,12 @@ robj *activeDefragStringOb(robj* ob, int *defragged) {
                 ret->ptr = (void*)((intptr_t)ret + ofs);
                 (*defragged)++;
             }
+        } else if (ob->encoding==OBJ_ENCODING_COMPRESSED) {
+            void *newptr = activeDefragAlloc(ob->ptr);
+            if (newptr) {
+                ob->ptr = newptr;
+                (*defragged)++;
+            }
         } else if (ob->encoding!=OBJ_ENCODING_INT) {
             serverPanic("Unknown string encoding");
         }
@@ -269,6 +275,58 @@ dictEntry* replaceSateliteDictKeyPtrAndOrDefragDictEntry(dict *d, sds oldkey, sd
     return NULL;
 }
 
+/* Module values whose 'defrag' method ran out of time are queued here, and
+ * their defrag is resumed by defragLaterStep() before the scan of the current
+ * db goes on. */
+typedef struct defragLaterItem {
+    sds key;                /* Key name, in the db currently scanned. */
+    unsigned long cursor;   /* Cursor set by the module defrag method. */
+} defragLaterItem;
+
+static list *defrag_later = NULL;
+
+/* Time (in microseconds) at which the current defrag cycle must stop. This
+ * is used to let the module defrag methods know when to yield. */
+static long long defrag_endtime = 0;
+
+void defragLaterAdd(sds key, unsigned long cursor) {
+    defragLaterItem *item = zmalloc(sizeof(*item));
+    item->key = sdsdup(key);
+    item->cursor = cursor;
+    listAddNodeTail(defrag_later,item);
+}
+
+/* Resume the defrag of the module values queued in 'defrag_later'. Keys that
+ * were deleted or replaced by a non module value in the meantime are just
+ * skipped. Returns 1 if the time limit was reached before all the queued
+ * values were processed, otherwise 0. */
+int defragLaterStep(redisDb *db) {
+    while (listLength(defrag_later)) {
+        listNode *ln = listFirst(defrag_later);
+        defragLaterItem *item = ln->value;
+        dictEntry *de = dictFind(db->dict,item->key);
+        int more = 0;
+
+        if (de) {
+            robj *ob = dictGetVal(de), keyobj;
+            long long defragged = 0;
+
+            if (ob->type == OBJ_MODULE) {
+                initStaticStringObject(keyobj,dictGetKey(de));
+                more = moduleDefragValue(&keyobj,ob,&item->cursor,1,
+                                         defrag_endtime,&defragged);
+                server.stat_active_defrag_hits += defragged;
+            }
+        }
+        if (more) return 1;
+        sdsfree(item->key);
+        zfree(item);
+        listDelNode(defrag_later,ln);
+        if (ustime() > defrag_endtime) return 1;
+    }
+    return 0;
+}
+
 /* for each key we scan in the main dict, this function will attempt to defrag
  * all the various pointers it has. Returns a stat of how many pointers were
  * moved. */
@@ -386,7 +444,8 @@ int defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown sorted set encoding");
         }
     } else if (ob->type == OBJ_HASH) {
-        if (ob->encoding == OBJ_ENCODING_ZIPLIST) {
+        if (ob->encoding == OBJ_ENCODING_ZIPLIST ||
+            ob->encoding == OBJ_ENCODING_COMPRESSED) {
             if ((newzl = activeDefragAlloc(ob->ptr)))
                 defragged++, ob->ptr = newzl;
         } else if (ob->encoding == OBJ_ENCODING_HT) {
@@ -407,8 +466,20 @@ int defragKey(redisDb *db, dictEntry *de) {
             serverPanic("Unknown hash encoding");
         }
     } else if (ob->type == OBJ_MODULE) {
-        /* Currently defragmenting modules private data types
-         * is not supported. */
+        /* Module values are defragged by the type 'defrag' method. Large
+         * values may ask for more time: in that case the key is queued and
+         * its defrag continues before the scan goes on. */
+        robj keyobj;
+        unsigned long cursor = 0;
+        long long moduledefragged = 0;
+
+        initStaticStringObject(keyobj,dictGetKey(de));
+        if (moduleDefragValue(&keyobj,ob,&cursor,0,defrag_endtime,
+                              &moduledefragged))
+        {
+            defragLaterAdd(dictGetKey(de),cursor);
+        }
+        defragged += moduledefragged;
     } else {
         serverPanic("Unknown object type");
     }
@@ -486,6 +557,10 @@ void activeDefragCycle(void) {
 
     if (server.aof_child_pid!=-1 || server.rdb_child_pid!=-1)
         return; /* Defragging memory while there's a fork will just do damage. */
+    if (server.offload_jobs)
+        return; /* Values may be in use by the offload threads. */
+
+    if (defrag_later == NULL) defrag_later = listCreate();
 
     /* Once a second, check if we the fragmentation justfies starting a scan
      * or making it more aggressive. */
@@ -525,8 +600,14 @@ void activeDefragCycle(void) {
     start = ustime();
     timelimit = 1000000*server.active_defrag_running/server.hz/100;
     if (timelimit <= 0) timelimit = 1;
+    defrag_endtime = start + timelimit;
 
     do {
+        /* Complete the module values that asked for more time before
+         * resuming the scan or moving to the next db. */
+        if (db && listLength(defrag_later) && defragLaterStep(db))
+            return;
+
         if (!cursor) {
             /* Move on to next database, and stop if we reached the last one. */
             if (++current_db >= server.dbnum) {
@@ -556,6 +637,7 @@ void activeDefragCycle(void) {
 
         do {
             cursor = dictScan(db->dict, cursor, defragScanCallback, defragDictBucketCallback, db);
+            if (listLength(defrag_later)) break;
             /* Once in 16 scan iterations, or 1000 pointer reallocations
              * (if we have a lot of pointers in one hash bucket), check if we
              * reached the tiem limit. */
@@ -576,4 +658,15 @@ void activeDefragCycle(void) {
     /* Not implemented yet. */
 }
 
+void *activeDefragAlloc(void *ptr) {
+    UNUSED(ptr);
+    return NULL;
+}
+
+robj *activeDefragStringOb(robj *ob, int *defragged) {
+    UNUSED(ob);
+    UNUSED(defragged);
+    return NULL;
+}
+
 #endif
@@ -38,6 +38,14 @@ static int dict_can_resize = 1;
 //是否允许进行扩容操作的比例
 static unsigned int dict_force_resize_ratio = 5;
 
+/* Using dictPauseRehashSteps() / dictResumeRehashSteps() the incremental
+ * rehashing step performed by lookups and updates is suspended for all the
+ * dictionaries. Redis does this while the main thread sleeps in the event
+ * loop, so that module threads can perform lookups concurrently without
+ * mutating the hash tables, and while read threads are executing commands.
+ * Calls can be nested. */
+static int dict_rehash_paused = 0;
+
 /* -------------------------- private prototypes ---------------------------- */
 
 static int _dictExpandIfNeeded(dict *ht);
@@ -291,7 +299,7 @@ int dictRehashMilliseconds(dict *d, int ms) {
  */
 static void _dictRehashStep(dict *d) {
     //检测当前字典中是否有安全迭代器
-    if (d->iterators == 0) 
+    if (d->iterators == 0 && !dict_rehash_paused) 
 		//没有的情况下,尝试进行一次重hash处理操作----->即尽量完成一个索引节点的位置移动操作处理------>注意不是一个元素 而是一个索引位置上的所有节点
 		dictRehash(d,1);
 }
@@ -1281,6 +1289,14 @@ void dictDisableResize(void) {
     dict_can_resize = 0;
 }
 
+void dictPauseRehashSteps(void) {
+    dict_rehash_paused++;
+}
+
+void dictResumeRehashSteps(void) {
+    dict_rehash_paused--;
+}
+
 /*获取给定键对象对应的hash值*/
 uint64_t dictGetHash(dict *d, const void *key) {
     return dictHashKey(d, key);
@@ -366,6 +366,8 @@ size_t freeMemoryGetNotCountedMemory(void) {
     if (server.aof_state != AOF_OFF) {
         overhead += sdslen(server.aof_buf)+aofRewriteBufferSize();
     }
+    /* The reply cache is bounded by reply-cache-max-memory. */
+    overhead += replyCacheMemory();
     return overhead;
 }
 
@@ -394,6 +396,9 @@ int freeMemoryIfNeeded(void) {
     /* Check if we are still over the memory limit. */
     if (mem_used <= server.maxmemory) return C_OK;
 
+    /* Read threads can't run while keys are evicted. */
+    if (server.read_threads) readThreadsWait();
+
     /* Compute how much memory we need to free. */
     mem_tofree = mem_used - server.maxmemory;
     mem_freed = 0;
@@ -415,10 +420,15 @@ int freeMemoryIfNeeded(void) {
             server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL)
         {
             struct evictionPoolEntry *pool = EvictionPoolLRU;
+            int locked = 0;
 
             while(bestkey == NULL) {
                 unsigned long total_keys = 0, keys;
 
+                /* Give up if the keys we sampled are locked by offloaded
+                 * commands: they may be the only ones. */
+                if (locked) break;
+
                 /* We don't want to make local-db choices when expiring keys,
                  * so to start populate the eviction pool sampling keys from
                  * every DB. */
@@ -452,6 +462,14 @@ int freeMemoryIfNeeded(void) {
                     pool[k].key = NULL;
                     pool[k].idle = 0;
 
+                    /* Keys locked by offloaded commands can't be evicted. */
+                    if (de && server.offload_jobs &&
+                        offloadKeyIsLocked(server.db+bestdbid,dictGetKey(de)))
+                    {
+                        locked = 1;
+                        continue;
+                    }
+
                     /* If the key exists, is our pick. Otherwise it is
                      * a ghost and we need to try the next element. */
                     if (de) {
@@ -478,6 +496,8 @@ int freeMemoryIfNeeded(void) {
                         db->dict : db->expires;
                 if (dictSize(dict) != 0) {
                     de = dictGetRandomKey(dict);
+                    if (server.offload_jobs &&
+                        offloadKeyIsLocked(db,dictGetKey(de))) continue;
                     bestkey = dictGetKey(de);
                     bestdbid = j;
                     break;
@@ -512,6 +532,7 @@ int freeMemoryIfNeeded(void) {
             server.stat_evictedkeys++;
             notifyKeyspaceEvent(NOTIFY_EVICTED, "evicted",
                 keyobj, db->id);
+            trackingInvalidateKey(keyobj);
             decrRefCount(keyobj);
             keys_freed++;
 
@@ -0,0 +1,242 @@
+/* Warm restart handing the dataset over to the new process.
+ *
+ * SHUTDOWN HANDOVER restarts the server executing again its executable
+ * (that may have been upgraded in the meantime) without loading the dataset
+ * from disk: the dataset is serialized into an anonymous memory file
+ * (memfd) that is inherited across execve(), and the new process loads it
+ * before anything else, serving again after a memory to memory copy instead
+ * of a full AOF or RDB reload.
+ *
+ * The image is a small header followed by the dataset in the RDB format,
+ * written without LZF compression and without checksum: ziplists, intsets
+ * and the other compact encodings are copied as they are, so both producing
+ * and loading the image mostly amount to memcpy(). The header carries the
+ * handover format version and the RDB version: when the new executable
+ * does not understand the image, it is discarded and the server falls back
+ * to the normal AOF / RDB loading. For this reason the old process still
+ * performs the usual shutdown, saving the RDB if save points are configured
+ * (the AOF is always up to date): SHUTDOWN HANDOVER costs the same as
+ * SHUTDOWN plus the image, only the restart is faster. Without AOF and
+ * save points the data does not survive such an upgrade.
+ *
+ * The old process releases every other resource before execve() (listening
+ * sockets included, the clients are disconnected), so the PID of the server
+ * is retained but the clients need to reconnect. While the image exists, it
+ * takes as much memory as its size.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define HANDOVER_MAGIC "REDISHND"
+#define HANDOVER_VERSION 1
+#define HANDOVER_ENV "REDIS_HANDOVER_FD"
+#define HANDOVER_IO_BUF (1024*1024)
+
+/* Header at the start of the image, followed by 'size' bytes of RDB. */
+typedef struct handoverHeader {
+    char magic[8];              /* HANDOVER_MAGIC, not null terminated. */
+    uint32_t version;           /* HANDOVER_VERSION. */
+    uint32_t rdb_version;       /* RDB_VERSION of the producer. */
+    uint64_t size;              /* Length of the RDB payload. */
+    long long ctime;            /* Unix time in milliseconds of creation. */
+    char redis_version[32];     /* Version of the producer, for logging. */
+} handoverHeader;
+
+/* Create the file holding the image. A memfd is used where available,
+ * otherwise a file in the working directory that is unlinked immediately.
+ * The descriptor is not close-on-exec, the new process inherits it. */
+static int handoverCreateFile(void) {
+    char tmpfile[256];
+    int fd;
+
+#if defined(__linux__) && defined(__NR_memfd_create)
+    fd = syscall(__NR_memfd_create,"redis-handover",0);
+    if (fd != -1) return fd;
+#endif
+    snprintf(tmpfile,sizeof(tmpfile),"temp-handover-%d.rdb",(int) getpid());
+    fd = open(tmpfile,O_RDWR|O_CREAT|O_TRUNC,0600);
+    if (fd != -1) unlink(tmpfile);
+    return fd;
+}
+
+/* Serialize the dataset into a new image. On success the file descriptor
+ * of the image is returned, and HANDOVER_ENV is set so that the process
+ * executed next finds it. On error -1 is returned. */
+int handoverSave(void) {
+    int fd, fd2, error = 0, retval;
+    int compression = server.rdb_compression, checksum = server.rdb_checksum;
+    long long start = ustime();
+    handoverHeader hdr;
+    rdbSaveInfo rsi, *rsiptr;
+    char fdstr[32];
+    FILE *fp;
+    rio rdb;
+
+    lazyLoadFinish();
+    if ((fd = handoverCreateFile()) == -1) {
+        serverLog(LL_WARNING,"Can't create the handover image: %s",
+            strerror(errno));
+        return -1;
+    }
+    if (lseek(fd,sizeof(hdr),SEEK_SET) == -1 ||
+        (fd2 = dup(fd)) == -1)
+    {
+        error = errno;
+        close(fd);
+        errno = error;
+        goto werr_nofp;
+    }
+    if ((fp = fdopen(fd2,"w")) == NULL) {
+        error = errno;
+        close(fd2);
+        close(fd);
+        errno = error;
+        goto werr_nofp;
+    }
+    setvbuf(fp,NULL,_IOFBF,HANDOVER_IO_BUF);
+    rioInitWithFile(&rdb,fp);
+
+    server.rdb_compression = 0;
+    server.rdb_checksum = 0;
+    rsiptr = rdbPopulateSaveInfo(&rsi);
+    shardsPause();
+    retval = rdbSaveRio(&rdb,&error,RDB_SAVE_NONE,rsiptr);
+    shardsResume();
+    server.rdb_compression = compression;
+    server.rdb_checksum = checksum;
+    if (retval == C_ERR) errno = error;
+    if (retval == C_ERR || fflush(fp) == EOF) goto werr;
+    fclose(fp);
+
+    memset(&hdr,0,sizeof(hdr));
+    memcpy(hdr.magic,HANDOVER_MAGIC,sizeof(hdr.magic));
+    hdr.version = HANDOVER_VERSION;
+    hdr.rdb_version = RDB_VERSION;
+    hdr.size = rdb.processed_bytes;
+    hdr.ctime = mstime();
+    strncpy(hdr.redis_version,REDIS_VERSION,sizeof(hdr.redis_version)-1);
+    if (pwrite(fd,&hdr,sizeof(hdr),0) != sizeof(hdr)) {
+        if (errno == 0) errno = EIO;
+        close(fd);
+        goto werr_nofp;
+    }
+
+    snprintf(fdstr,sizeof(fdstr),"%d",fd);
+    setenv(HANDOVER_ENV,fdstr,1);
+    serverLog(LL_NOTICE,"Dataset handed over: %llu bytes in %.3f seconds",
+        (unsigned long long) hdr.size, (float)(ustime()-start)/1000000);
+    return fd;
+
+werr:
+    error = errno;
+    fclose(fp);
+    close(fd);
+    errno = error;
+werr_nofp:
+    serverLog(LL_WARNING,"Error writing the handover image: %s",
+        strerror(errno));
+    return -1;
+}
+
+/* Release an image created by handoverSave() when the restart is aborted. */
+void handoverDiscard(int fd) {
+    close(fd);
+    unsetenv(HANDOVER_ENV);
+}
+
+/* Load the dataset from the image handed over by the previous process, if
+ * any. Returns C_OK if the dataset was loaded, filling 'rsi' with the
+ * replication info stored in the image. Otherwise C_ERR is returned, the
+ * dataset is empty, and the caller loads it from disk as usual. */
+int handoverLoad(rdbSaveInfo *rsi) {
+    char *env = getenv(HANDOVER_ENV);
+    handoverHeader hdr;
+    struct redis_stat sb;
+    int fd, retval;
+    FILE *fp;
+    rio rdb;
+
+    if (env == NULL) return C_ERR;
+    fd = atoi(env);
+    unsetenv(HANDOVER_ENV);
+
+    if (fd < 3 || redis_fstat(fd,&sb) == -1) {
+        serverLog(LL_WARNING,"The handover image is not available, "
+                             "loading the dataset from disk");
+        return C_ERR;
+    }
+    if (pread(fd,&hdr,sizeof(hdr),0) != sizeof(hdr) ||
+        memcmp(hdr.magic,HANDOVER_MAGIC,sizeof(hdr.magic)) != 0 ||
+        (off_t)(hdr.size + sizeof(hdr)) != sb.st_size)
+    {
+        serverLog(LL_WARNING,"The handover image is invalid, "
+                             "loading the dataset from disk");
+        close(fd);
+        return C_ERR;
+    }
+    hdr.redis_version[sizeof(hdr.redis_version)-1] = '\0';
+    if (hdr.version != HANDOVER_VERSION || hdr.rdb_version > RDB_VERSION) {
+        serverLog(LL_WARNING,"The handover image of Redis %s has an "
+            "unsupported format (version %u, RDB version %u), "
+            "loading the dataset from disk",
+            hdr.redis_version, hdr.version, hdr.rdb_version);
+        close(fd);
+        return C_ERR;
+    }
+
+    if (lseek(fd,sizeof(hdr),SEEK_SET) == -1 ||
+        (fp = fdopen(fd,"r")) == NULL)
+    {
+        serverLog(LL_WARNING,"Can't read the handover image: %s, "
+            "loading the dataset from disk", strerror(errno));
+        close(fd);
+        return C_ERR;
+    }
+    setvbuf(fp,NULL,_IOFBF,HANDOVER_IO_BUF);
+    startLoading(fp);
+    rioInitWithFile(&rdb,fp);
+    retval = rdbLoadRio(&rdb,rsi,0);
+    fclose(fp);
+    stopLoading();
+
+    if (retval != C_OK) {
+        serverLog(LL_WARNING,"Error loading the handover image, "
+                             "loading the dataset from disk");
+        emptyDb(-1,EMPTYDB_NO_FLAGS,NULL);
+        *rsi = (rdbSaveInfo) RDB_SAVE_INFO_INIT;
+        return C_ERR;
+    }
+    return C_OK;
+}
@@ -783,8 +783,8 @@ struct commandHelp {
     1,
     "2.2.0" },
     { "SHUTDOWN",
-    "[NOSAVE|SAVE]",
-    "Synchronously save the dataset to disk and then shut down the server",
+    "[NOSAVE|SAVE|HANDOVER]",
+    "Synchronously save the dataset to disk and then shut down the server, or restart it handing the dataset over in memory (HANDOVER, still saving the RDB when save points are configured)",
     9,
     "1.0.0" },
     { "SINTER",
@@ -0,0 +1,323 @@
+/* Hot keys tracking.
+ *
+ * When "hotkeys-tracking" is enabled, a sample of the key lookups performed
+ * by commands is fed into two bounded heavy hitters trackers, one for read
+ * accesses and one for write accesses. Every tracker is composed of:
+ *
+ * 1) A count-min sketch estimating the number of (sampled) accesses of any
+ *    key using a fixed amount of memory, regardless of the number of keys.
+ * 2) A min-heap holding the top "hotkeys-max-keys" keys by estimated
+ *    accesses, plus a dictionary mapping every key in the heap to its
+ *    position, so that updates are O(log K).
+ *
+ * The counters are halved every HOTKEYS_DECAY_PERIOD milliseconds so that the
+ * report reflects the recent workload and not the whole instance lifetime.
+ * The HOTKEYS command exposes the current top-K.
+ *
+ * Unlike redis-cli --hotkeys, which needs to SCAN the whole keyspace and call
+ * OBJECT FREQ for every key, the report is available instantly and its cost
+ * does not depend on the number of keys in the dataset.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+#define HOTKEYS_SKETCH_DEPTH 4
+#define HOTKEYS_SKETCH_WIDTH 2048   /* Must be a power of two. */
+
+#define HOTKEYS_READS 0
+#define HOTKEYS_WRITES 1
+
+typedef struct hotkeysEntry {
+    sds name;           /* "<dbid>:<key>", used as key of the index dict. */
+    size_t keyoff;      /* Offset of the key name inside 'name'. */
+    int dbid;
+    uint32_t count;     /* Estimated number of sampled accesses. */
+    int pos;            /* Position inside the heap. */
+} hotkeysEntry;
+
+typedef struct hotkeysTracker {
+    uint32_t sketch[HOTKEYS_SKETCH_DEPTH][HOTKEYS_SKETCH_WIDTH];
+    hotkeysEntry **heap;    /* Min-heap by 'count', heap[0] is the coldest. */
+    int len;                /* Number of entries in the heap. */
+    int size;               /* Max number of entries (hotkeys-max-keys). */
+    dict *index;            /* name -> hotkeysEntry. */
+} hotkeysTracker;
+
+/* Names are owned by the entries, so the dictionary has no destructors. */
+dictType hotkeysIndexDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+static hotkeysTracker *hotkeys[2] = {NULL,NULL};
+static long long hotkeys_countdown = 0;
+
+/* ----------------------------- Tracker handling -------------------------- */
+
+static hotkeysTracker *hotkeysCreateTracker(int size) {
+    hotkeysTracker *t = zcalloc(sizeof(*t));
+    t->heap = zmalloc(sizeof(hotkeysEntry*)*size);
+    t->size = size;
+    t->index = dictCreate(&hotkeysIndexDictType,NULL);
+    return t;
+}
+
+static void hotkeysFreeTracker(hotkeysTracker *t) {
+    int j;
+
+    if (t == NULL) return;
+    for (j = 0; j < t->len; j++) {
+        sdsfree(t->heap[j]->name);
+        zfree(t->heap[j]);
+    }
+    dictRelease(t->index);
+    zfree(t->heap);
+    zfree(t);
+}
+
+static void hotkeysHeapSwap(hotkeysTracker *t, int a, int b) {
+    hotkeysEntry *tmp = t->heap[a];
+    t->heap[a] = t->heap[b];
+    t->heap[b] = tmp;
+    t->heap[a]->pos = a;
+    t->heap[b]->pos = b;
+}
+
+static void hotkeysHeapUp(hotkeysTracker *t, int j) {
+    while (j > 0) {
+        int parent = (j-1)/2;
+        if (t->heap[parent]->count <= t->heap[j]->count) break;
+        hotkeysHeapSwap(t,parent,j);
+        j = parent;
+    }
+}
+
+static void hotkeysHeapDown(hotkeysTracker *t, int j) {
+    while (1) {
+        int min = j, l = j*2+1, r = j*2+2;
+        if (l < t->len && t->heap[l]->count < t->heap[min]->count) min = l;
+        if (r < t->len && t->heap[r]->count < t->heap[min]->count) min = r;
+        if (min == j) break;
+        hotkeysHeapSwap(t,min,j);
+        j = min;
+    }
+}
+
+/* Add one access of 'key' in the DB 'dbid' to the sketch, using the
+ * conservative update rule (only the counters equal to the current minimum
+ * are incremented, which reduces over-estimation). Returns the new estimate. */
+static uint32_t hotkeysSketchIncr(hotkeysTracker *t, int dbid, sds key) {
+    uint64_t hash = dictGenHashFunction(key,sdslen(key));
+    uint32_t h1, h2, *slot[HOTKEYS_SKETCH_DEPTH], min = UINT32_MAX;
+    int j;
+
+    hash ^= (uint64_t)dbid * 0x9E3779B97F4A7C15ULL;
+    h1 = hash & 0xffffffff;
+    h2 = (hash >> 32) | 1;
+    for (j = 0; j < HOTKEYS_SKETCH_DEPTH; j++) {
+        slot[j] = &t->sketch[j][(h1 + j*h2) & (HOTKEYS_SKETCH_WIDTH-1)];
+        if (*slot[j] < min) min = *slot[j];
+    }
+    if (min == UINT32_MAX) return min;
+    for (j = 0; j < HOTKEYS_SKETCH_DEPTH; j++)
+        if (*slot[j] == min) (*slot[j])++;
+    return min+1;
+}
+
+static void hotkeysTrackerAdd(hotkeysTracker *t, int dbid, sds key) {
+    uint32_t count = hotkeysSketchIncr(t,dbid,key);
+    hotkeysEntry *he;
+    sds name;
+    dictEntry *de;
+
+    /* Fast path: the key is not hot enough to enter the top-K. Note that
+     * the estimate of keys already in the heap can't be smaller than their
+     * stored count, so we can't miss an update here. */
+    if (t->len == t->size && count <= t->heap[0]->count) return;
+
+    name = sdscatfmt(sdsempty(),"%i:",dbid);
+    name = sdscatsds(name,key);
+    de = dictFind(t->index,name);
+    if (de) {
+        sdsfree(name);
+        he = dictGetVal(de);
+        he->count = count;
+        hotkeysHeapDown(t,he->pos);
+        return;
+    }
+
+    if (t->len == t->size) {
+        /* Evict the coldest key, recycling its entry. */
+        he = t->heap[0];
+        dictDelete(t->index,he->name);
+        sdsfree(he->name);
+    } else {
+        he = zmalloc(sizeof(*he));
+        he->pos = t->len;
+        t->heap[t->len++] = he;
+    }
+    he->name = name;
+    he->keyoff = sdslen(name)-sdslen(key);
+    he->dbid = dbid;
+    he->count = count;
+    dictAdd(t->index,he->name,he);
+    /* The new entry may be either at the root (eviction) or at the
+     * bottom of the heap (insertion): fix the heap in both directions. */
+    hotkeysHeapUp(t,he->pos);
+    hotkeysHeapDown(t,he->pos);
+}
+
+/* ------------------------------- Public API ------------------------------ */
+
+/* Called by lookupKey() for every successful lookup when hot keys tracking
+ * is enabled. Only one lookup every 'hotkeys-sample-rate' (on average) is
+ * actually accounted, the countdown is randomized in order to avoid aliasing
+ * with periodic access patterns. */
+void hotkeysTrackLookup(redisDb *db, robj *key, int write) {
+    hotkeysTracker **t = &hotkeys[write ? HOTKEYS_WRITES : HOTKEYS_READS];
+
+    if (--hotkeys_countdown > 0) return;
+    hotkeys_countdown = 1;
+    if (server.hotkeys_sample_rate > 1)
+        hotkeys_countdown += random() % (server.hotkeys_sample_rate*2-1);
+
+    /* Recreate the tracker if "hotkeys-max-keys" changed in the meantime. */
+    if (*t && (*t)->size != server.hotkeys_max_keys) {
+        hotkeysFreeTracker(*t);
+        *t = NULL;
+    }
+    if (*t == NULL) *t = hotkeysCreateTracker(server.hotkeys_max_keys);
+    hotkeysTrackerAdd(*t,db->id,key->ptr);
+}
+
+/* Halve all the counters, so that keys that are no longer accessed
+ * eventually leave the top-K. Halving preserves the heap property.
+ * Called by serverCron() every HOTKEYS_DECAY_PERIOD milliseconds. */
+void hotkeysDecay(void) {
+    int i, j, k;
+
+    for (i = 0; i < 2; i++) {
+        hotkeysTracker *t = hotkeys[i];
+        if (t == NULL) continue;
+        for (j = 0; j < HOTKEYS_SKETCH_DEPTH; j++)
+            for (k = 0; k < HOTKEYS_SKETCH_WIDTH; k++)
+                t->sketch[j][k] >>= 1;
+        for (j = 0; j < t->len; j++) t->heap[j]->count >>= 1;
+    }
+}
+
+void hotkeysReset(void) {
+    hotkeysFreeTracker(hotkeys[HOTKEYS_READS]);
+    hotkeysFreeTracker(hotkeys[HOTKEYS_WRITES]);
+    hotkeys[HOTKEYS_READS] = hotkeys[HOTKEYS_WRITES] = NULL;
+}
+
+/* ---------------------------- HOTKEYS command ---------------------------- */
+
+static int hotkeysCompareEntries(const void *a, const void *b) {
+    const hotkeysEntry *ea = *(hotkeysEntry**)a, *eb = *(hotkeysEntry**)b;
+    if (ea->count == eb->count) return 0;
+    return ea->count > eb->count ? -1 : 1;
+}
+
+/* Reply with the hottest 'count' keys of the tracker, from the hottest to
+ * the coldest. Every element is a three elements array: key name, DB id,
+ * and the estimated number of accesses (scaled by the sample rate). */
+static void hotkeysReplyWithTopK(client *c, hotkeysTracker *t, long count) {
+    hotkeysEntry **sorted;
+    int j;
+
+    if (t == NULL || t->len == 0) {
+        addReply(c,shared.emptymultibulk);
+        return;
+    }
+    sorted = zmalloc(sizeof(hotkeysEntry*)*t->len);
+    memcpy(sorted,t->heap,sizeof(hotkeysEntry*)*t->len);
+    qsort(sorted,t->len,sizeof(hotkeysEntry*),hotkeysCompareEntries);
+    /* Entries decayed to zero are not hot keys anymore. */
+    if (count > t->len) count = t->len;
+    while (count > 0 && sorted[count-1]->count == 0) count--;
+
+    addReplyMultiBulkLen(c,count);
+    for (j = 0; j < count; j++) {
+        hotkeysEntry *he = sorted[j];
+        addReplyMultiBulkLen(c,3);
+        addReplyBulkCBuffer(c,he->name+he->keyoff,
+                            sdslen(he->name)-he->keyoff);
+        addReplyLongLong(c,he->dbid);
+        addReplyLongLong(c,(long long)he->count*server.hotkeys_sample_rate);
+    }
+    zfree(sorted);
+}
+
+/* HOTKEYS READS [count]
+ * HOTKEYS WRITES [count]
+ * HOTKEYS RESET
+ * HOTKEYS HELP */
+void hotkeysCommand(client *c) {
+    if ((!strcasecmp(c->argv[1]->ptr,"reads") ||
+         !strcasecmp(c->argv[1]->ptr,"writes")) && c->argc <= 3)
+    {
+        int type = !strcasecmp(c->argv[1]->ptr,"reads") ?
+                   HOTKEYS_READS : HOTKEYS_WRITES;
+        long count = 10;
+
+        if (c->argc == 3) {
+            if (getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != C_OK)
+                return;
+            if (count <= 0) {
+                addReplyError(c,"count should be greater than 0");
+                return;
+            }
+        }
+        hotkeysReplyWithTopK(c,hotkeys[type],count);
+    } else if (!strcasecmp(c->argv[1]->ptr,"reset") && c->argc == 2) {
+        hotkeysReset();
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"help") && c->argc == 2) {
+        addReplyMultiBulkLen(c,4);
+        addReplyBulkCString(c,
+"HOTKEYS READS [<count>]  - Show the most read keys (default 10)");
+        addReplyBulkCString(c,
+"HOTKEYS WRITES [<count>] - Show the most written keys (default 10)");
+        addReplyBulkCString(c,
+"HOTKEYS RESET            - Forget all the tracked keys");
+        addReplyBulkCString(c,
+"HOTKEYS HELP             - Show this help");
+    } else {
+        addReplyError(c,"Syntax error. Try HOTKEYS HELP");
+    }
+}
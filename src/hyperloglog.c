@@ -1197,7 +1197,7 @@ void pfaddCommand(client *c) {
     if (updated) {
         signalModifiedKey(c->db,c->argv[1]);
         notifyKeyspaceEvent(NOTIFY_STRING,"pfadd",c->argv[1],c->db->id);
-        server.dirty++;
+        incrDirty(1);
         HLL_INVALIDATE_CACHE(hdr);
     }
     addReply(c, updated ? shared.cone : shared.czero);
@@ -1287,7 +1287,7 @@ void pfcountCommand(client *c) {
              * may be modified and given that the HLL is a Redis string
              * we need to propagate the change. */
             signalModifiedKey(c->db,c->argv[1]);
-            server.dirty++;
+            incrDirty(1);
         }
         addReplyLongLong(c,card);
     }
@@ -1363,7 +1363,7 @@ void pfmergeCommand(client *c) {
     /* We generate a PFADD event for PFMERGE for semantical simplicity
      * since in theory this is a mass-add of elements. */
     notifyKeyspaceEvent(NOTIFY_STRING,"pfadd",c->argv[1],c->db->id);
-    server.dirty++;
+    incrDirty(1);
     addReply(c,shared.ok);
 }
 
@@ -1501,7 +1501,7 @@ void pfdebugCommand(client *c) {
                 addReplySds(c,sdsnew(invalid_hll_err));
                 return;
             }
-            server.dirty++; /* Force propagation on encoding change. */
+            incrDirty(1); /* Force propagation on encoding change. */
         }
 
         hdr = o->ptr;
@@ -1566,7 +1566,7 @@ void pfdebugCommand(client *c) {
                 return;
             }
             conv = 1;
-            server.dirty++; /* Force propagation on encoding change. */
+            incrDirty(1); /* Force propagation on encoding change. */
         }
         addReply(c,conv ? shared.cone : shared.czero);
     } else {
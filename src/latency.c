@@ -34,6 +34,7 @@
  */
 
 #include "server.h"
+#include <math.h>
 
 /* Dictionary type for latency events. */
 int dictStringKeyCompare(void *privdata, const void *key1, const void *key2) {
@@ -558,6 +559,129 @@ sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
     return graph;
 }
 
+/* ---------------------- Per command latency histograms ------------------- */
+
+static inline int latencyHistogramIndex(uint64_t usec) {
+    int msb;
+
+    if (usec < LATENCY_HIST_SUB_BUCKETS*2) return usec;
+    msb = 63 - __builtin_clzll(usec);
+    if (msb > LATENCY_HIST_MAX_BIT) return LATENCY_HIST_BUCKETS-1;
+    return ((msb-LATENCY_HIST_SUB_BITS+1) << LATENCY_HIST_SUB_BITS) +
+           ((usec >> (msb-LATENCY_HIST_SUB_BITS)) &
+            (LATENCY_HIST_SUB_BUCKETS-1));
+}
+
+/* Return the highest value accounted in the specified bucket. */
+static uint64_t latencyHistogramBucketValue(int idx) {
+    uint64_t sub;
+    int shift;
+
+    if (idx < LATENCY_HIST_SUB_BUCKETS*2) return idx;
+    shift = (idx >> LATENCY_HIST_SUB_BITS) - 1;
+    sub = LATENCY_HIST_SUB_BUCKETS + (idx & (LATENCY_HIST_SUB_BUCKETS-1));
+    return ((sub+1) << shift) - 1;
+}
+
+/* Add a sample to the histogram pointed by 'hp', that is allocated on the
+ * first call, so that commands never called don't use memory. */
+void latencyHistogramAdd(struct latencyHistogram **hp, uint64_t usec) {
+    if (*hp == NULL) *hp = zcalloc(sizeof(struct latencyHistogram));
+    (*hp)->buckets[latencyHistogramIndex(usec)]++;
+    (*hp)->count++;
+}
+
+/* Return the value at the specified percentile (0-100). The returned value
+ * is the highest value of the bucket the percentile falls into. */
+uint64_t latencyHistogramPercentile(struct latencyHistogram *h, double perc) {
+    uint64_t target, seen = 0;
+    int j;
+
+    if (h == NULL || h->count == 0) return 0;
+    target = (uint64_t)ceil(h->count*perc/100);
+    if (target == 0) target = 1;
+    for (j = 0; j < LATENCY_HIST_BUCKETS; j++) {
+        seen += h->buckets[j];
+        if (seen >= target) return latencyHistogramBucketValue(j);
+    }
+    return latencyHistogramBucketValue(LATENCY_HIST_BUCKETS-1);
+}
+
+/* Halve all the buckets, so that the percentiles reflect the recent
+ * samples more than the old ones. */
+void latencyHistogramDecay(struct latencyHistogram *h) {
+    int j;
+
+    if (h == NULL) return;
+    h->count = 0;
+    for (j = 0; j < LATENCY_HIST_BUCKETS; j++) {
+        h->buckets[j] >>= 1;
+        h->count += h->buckets[j];
+    }
+}
+
+/* --------------------------- Event loop profiler ------------------------- */
+
+static char *eventLoopPhaseNames[EL_PHASE_NUM] = {
+    "cycle", "poll", "module_gil", "file_events", "commands", "cron",
+    "before_sleep", "cluster", "fast_expire", "unblocked_clients",
+    "aof_flush", "pending_writes"
+};
+
+void eventLoopPhaseAdd(int phase, long long usec) {
+    struct eventLoopPhase *p = server.el_phases+phase;
+
+    p->calls++;
+    p->usec += usec;
+    if (usec > p->max_usec) p->max_usec = usec;
+    latencyHistogramAdd(&p->hist,usec);
+}
+
+/* Account the time elapsed from 'start' to the specified phase, and return
+ * the current time, so that it can be used as start of the next phase. */
+long long eventLoopPhaseEnd(int phase, long long start) {
+    long long now = ustime();
+    eventLoopPhaseAdd(phase,now-start);
+    return now;
+}
+
+/* Called by serverCron() every EL_PROFILER_DECAY_PERIOD milliseconds. */
+void eventLoopProfilerDecay(void) {
+    int j;
+
+    for (j = 0; j < EL_PHASE_NUM; j++)
+        latencyHistogramDecay(server.el_phases[j].hist);
+}
+
+void eventLoopProfilerReset(void) {
+    int j;
+
+    for (j = 0; j < EL_PHASE_NUM; j++) {
+        zfree(server.el_phases[j].hist);
+        memset(server.el_phases+j,0,sizeof(struct eventLoopPhase));
+    }
+}
+
+/* Generate the INFO eventloop section: totals since the last reset, and
+ * percentiles of the recent samples. */
+sds genEventLoopInfoString(sds info) {
+    int j;
+
+    for (j = 0; j < EL_PHASE_NUM; j++) {
+        struct eventLoopPhase *p = server.el_phases+j;
+        if (p->calls == 0) continue;
+        info = sdscatprintf(info,
+            "eventloop_%s:calls=%lld,usec=%lld,usec_per_call=%.2f,"
+            "max_usec=%lld,p50=%llu,p99=%llu,p99.9=%llu\r\n",
+            eventLoopPhaseNames[j], p->calls, p->usec,
+            (float)p->usec/p->calls, p->max_usec,
+            (unsigned long long) latencyHistogramPercentile(p->hist,50),
+            (unsigned long long) latencyHistogramPercentile(p->hist,99),
+            (unsigned long long) latencyHistogramPercentile(p->hist,99.9));
+    }
+    return info;
+}
+
 /* LATENCY command implementations.
  *
  * LATENCY SAMPLES: return time-latency samples for the specified event.
@@ -65,6 +65,55 @@ void latencyMonitorInit(void);
 void latencyAddSample(char *event, mstime_t latency);
 int THPIsEnabled(void);
 
+/* Log-bucketed latency histogram, in the spirit of HDR histograms: values
+ * (microseconds) smaller than 2*LATENCY_HIST_SUB_BUCKETS have their own
+ * bucket, bigger values are split into LATENCY_HIST_SUB_BUCKETS buckets for
+ * every power of two, so the relative error is at most 1/8. Values greater
+ * than 2^(LATENCY_HIST_MAX_BIT+1) are accounted in the last bucket. */
+#define LATENCY_HIST_SUB_BITS 3
+#define LATENCY_HIST_SUB_BUCKETS (1<<LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BIT 31
+#define LATENCY_HIST_BUCKETS \
+    ((LATENCY_HIST_MAX_BIT-LATENCY_HIST_SUB_BITS+2)*LATENCY_HIST_SUB_BUCKETS)
+
+struct latencyHistogram {
+    uint64_t count;                         /* Total number of samples. */
+    uint64_t buckets[LATENCY_HIST_BUCKETS];
+};
+
+void latencyHistogramAdd(struct latencyHistogram **hp, uint64_t usec);
+uint64_t latencyHistogramPercentile(struct latencyHistogram *h, double perc);
+void latencyHistogramDecay(struct latencyHistogram *h);
+
+/* Event loop profiler: phases of every event loop iteration. */
+#define EL_PHASE_CYCLE 0            /* Whole iteration, poll excluded. */
+#define EL_PHASE_POLL 1             /* Waiting in aeApiPoll(). */
+#define EL_PHASE_MODULE_GIL 2       /* Waiting for module threads. */
+#define EL_PHASE_FILE_EVENTS 3      /* File events, commands included. */
+#define EL_PHASE_COMMANDS 4         /* Commands execution. */
+#define EL_PHASE_CRON 5             /* serverCron(). */
+#define EL_PHASE_BEFORE_SLEEP 6     /* beforeSleep(), whole. */
+#define EL_PHASE_CLUSTER 7          /* beforeSleep(): clusterBeforeSleep(). */
+#define EL_PHASE_FAST_EXPIRE 8      /* beforeSleep(): fast expire cycle. */
+#define EL_PHASE_UNBLOCKED 9        /* beforeSleep(): unblocked clients. */
+#define EL_PHASE_AOF_FLUSH 10       /* beforeSleep(): flushAppendOnlyFile(). */
+#define EL_PHASE_PENDING_WRITES 11  /* beforeSleep(): pending writes. */
+#define EL_PHASE_NUM 12
+#define EL_PROFILER_DECAY_PERIOD 60000 /* Halve the histograms every minute. */
+
+struct eventLoopPhase {
+    long long calls;                /* Samples since the last reset. */
+    long long usec;                 /* Total time since the last reset. */
+    long long max_usec;             /* Max time since the last reset. */
+    struct latencyHistogram *hist;  /* Decayed histogram of recent samples. */
+};
+
+void eventLoopPhaseAdd(int phase, long long usec);
+long long eventLoopPhaseEnd(int phase, long long start);
+void eventLoopProfilerDecay(void);
+void eventLoopProfilerReset(void);
+sds genEventLoopInfoString(sds info);
+
 /* Latency monitoring macros. */
 
 /* Start monitoring an event. We just set the current time. */
@@ -27,8 +27,10 @@ size_t lazyfreeGetPendingObjectsCount(void) {
  * elements.
  *
  * For lists the funciton returns the number of elements in the quicklist
- * representing the list. */
-size_t lazyfreeGetFreeEffort(robj *obj) {
+ * representing the list.
+ *
+ * For module values the type 'free_effort' method is used, if any. */
+size_t lazyfreeGetFreeEffort(robj *key, robj *obj) {
     if (obj->type == OBJ_LIST) {
         quicklist *ql = obj->ptr;
         return ql->len;
@@ -41,6 +43,8 @@ size_t lazyfreeGetFreeEffort(robj *obj) {
     } else if (obj->type == OBJ_HASH && obj->encoding == OBJ_ENCODING_HT) {
         dict *ht = obj->ptr;
         return dictSize(ht);
+    } else if (obj->type == OBJ_MODULE) {
+        return moduleGetFreeEffort(key,obj);
     } else {
         return 1; /* Everything else is a single allocation. */
     }
@@ -65,7 +69,11 @@ int dbAsyncDelete(redisDb *db, robj *key) {
     dictEntry *de = dictUnlink(db->dict,key->ptr);
     if (de) {
         robj *val = dictGetVal(de);
-        size_t free_effort = lazyfreeGetFreeEffort(val);
+        size_t free_effort = lazyfreeGetFreeEffort(key,val);
+
+        /* Tell the module about the key being unlinked, while the value
+         * is still accessible from the main thread. */
+        moduleNotifyKeyUnlink(key,val);
 
         /* If releasing the object is too much work, do it in the background
          * by adding the object to the lazy free list.
@@ -0,0 +1,534 @@
+/* Lazy loading of the RDB file at startup.
+ *
+ * When "rdb-lazy-load" is enabled, the RDB files are saved with an index
+ * of the keys appended after the checksum (see RDB_SAVE_KEY_INDEX in
+ * rdb.h), that gives the file offset of every key. At startup, if the RDB
+ * file has such an index, only the index and the non key data (AUX fields,
+ * Lua scripts) are read, and the server starts serving immediately:
+ *
+ * 1) Before a command is executed, the keys it accesses that are still
+ *    only on disk are loaded, seeking to their offset. The same happens
+ *    on lookup misses and deletions, for the keys that are not declared
+ *    by the command (SORT BY, modules, ...).
+ * 2) A time event streams the rest of the file in the background, spending
+ *    at most "rdb-lazy-load-cycle-us" microseconds per event loop
+ *    iteration, so that the latency of the clients stays bounded.
+ * 3) The commands that need the whole keyspace (KEYS, SCAN, DBSIZE, ...)
+ *    and the ones producing a copy of the dataset (saves, AOF rewrites,
+ *    full resyncs, SHUTDOWN HANDOVER) load all the remaining keys first.
+ *
+ * Flushing a DB discards its pending keys, and a key created while its
+ * old version is still on disk replaces it. Expired keys are skipped when
+ * loaded by a master, exactly like the normal loading does. Since the file
+ * is not read as a whole before serving, its checksum is not verified, and
+ * a corrupted key is only detected when it is loaded, aborting the server
+ * like a corrupted RDB file does.
+ *
+ * While keys are pending the commands are executed by the main thread
+ * (no read threads nor offloading). Lazy loading is not used in cluster
+ * and sharded mode, nor when the AOF is enabled.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "endianconv.h"
+
+#include <sys/stat.h>
+
+/* A key of the RDB file. The key name points into the index read from the
+ * file, that is kept in memory while loading. */
+typedef struct lazyKey {
+    char *key;
+    size_t len;
+    off_t offset;               /* Offset of the key in the file. */
+    uint64_t hash;              /* See lazyLoadHash(). */
+    int dbid;
+    int pending;                /* Still on disk? */
+} lazyKey;
+
+/* The keys are stored in file order, grouped by DB, and are looked up with
+ * a static hash table: the keys[] indexes are sorted by hash bucket into
+ * slots[], the keys of bucket 'b' being the ones from slots[buckets[b]] to
+ * slots[buckets[b+1]-1]. Building it takes two sequential passes, while
+ * inserting millions of keys into a dict at startup would cost about as
+ * much as loading them. */
+static struct {
+    FILE *fp;                   /* The RDB file. */
+    off_t pos;                  /* Current offset of 'fp', -1 if unknown. */
+    sds index;                  /* The key index read from the file. */
+    lazyKey *keys;              /* Every key of the index, in file order. */
+    uint64_t numkeys;
+    uint64_t *slots;
+    uint64_t *buckets;
+    uint64_t mask;              /* Number of buckets - 1. */
+    uint64_t *dbfirst;          /* Keys of DB j: dbfirst[j] to dbfirst[j+1]-1 */
+    uint64_t cursor;            /* Next key for the background loader. */
+    uint64_t pending_keys;      /* Keys still on disk. */
+    uint64_t on_demand_keys;    /* Keys loaded because they were accessed. */
+    long long start;            /* Start time in microseconds. */
+} lazy;
+
+static uint64_t lazyLoadHash(int dbid, const char *key, size_t len) {
+    return dictGenHashFunction(key,len) ^ ((uint64_t)dbid*0x9E3779B97F4A7C15ULL);
+}
+
+/* Return the pending entry of 'key' in the DB 'dbid', or NULL. */
+static lazyKey *lazyLoadLookup(int dbid, sds key) {
+    size_t len = sdslen(key);
+    uint64_t hash = lazyLoadHash(dbid,key,len), b = hash & lazy.mask, j;
+
+    for (j = lazy.buckets[b]; j < lazy.buckets[b+1]; j++) {
+        lazyKey *lk = lazy.keys+lazy.slots[j];
+
+        if (lk->hash == hash && lk->pending && lk->dbid == dbid &&
+            lk->len == len && memcmp(lk->key,key,len) == 0) return lk;
+    }
+    return NULL;
+}
+
+static void lazyLoadCorrupted(char *reason) {
+    serverLog(LL_WARNING,"Error loading lazily the DB: %s. "
+                         "Unrecoverable error, aborting now.", reason);
+    exit(1);
+}
+
+/* Release everything once the last key was loaded or discarded. */
+static void lazyLoadCheckDone(void) {
+    if (lazy.pending_keys) return;
+    fclose(lazy.fp);
+    sdsfree(lazy.index);
+    zfree(lazy.keys);
+    zfree(lazy.slots);
+    zfree(lazy.buckets);
+    zfree(lazy.dbfirst);
+    lazy.fp = NULL;
+    lazy.index = NULL;
+    lazy.keys = NULL;
+    lazy.slots = NULL;
+    lazy.buckets = NULL;
+    lazy.dbfirst = NULL;
+    server.lazy_loading = 0;
+    serverLog(LL_NOTICE,"DB lazy loading completed: %llu keys "
+        "(%llu loaded on demand) in %.3f seconds",
+        (unsigned long long) lazy.numkeys,
+        (unsigned long long) lazy.on_demand_keys,
+        (float)(ustime()-lazy.start)/1000000);
+}
+
+/* Load the key 'lk', that must be pending, into its DB. */
+static void lazyLoadEntry(lazyKey *lk) {
+    redisDb *db = server.db+lk->dbid;
+    long long expiretime = -1;
+    robj *key, *val;
+    int type;
+    rio rdb;
+
+    lk->pending = 0;
+    lazy.pending_keys--;
+
+    if (lk->offset != lazy.pos) {
+        if (fseeko(lazy.fp,lk->offset,SEEK_SET) == -1)
+            lazyLoadCorrupted(strerror(errno));
+    }
+    rioInitWithFile(&rdb,lazy.fp);
+    if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+    if (type == RDB_OPCODE_EXPIRETIME_MS) {
+        if ((expiretime = rdbLoadMillisecondTime(&rdb)) == -1) goto eoferr;
+        if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+    } else if (type == RDB_OPCODE_EXPIRETIME) {
+        if ((expiretime = rdbLoadTime(&rdb)) == -1) goto eoferr;
+        expiretime *= 1000;
+        if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+    }
+    if (!rdbIsObjectType(type)) lazyLoadCorrupted("wrong key offset");
+    if ((key = rdbLoadStringObject(&rdb)) == NULL) goto eoferr;
+    if (sdslen(key->ptr) != lk->len || memcmp(key->ptr,lk->key,lk->len))
+        lazyLoadCorrupted("wrong key offset");
+    if ((val = rdbLoadObject(type,&rdb)) == NULL) goto eoferr;
+    lazy.pos = lk->offset + rdb.processed_bytes;
+
+    /* Like rdbLoadRio(), only masters skip the expired keys. */
+    if (server.masterhost == NULL && expiretime != -1 &&
+        expiretime < mstime())
+    {
+        decrRefCount(key);
+        decrRefCount(val);
+        return;
+    }
+    dbAdd(db,key,val);
+    if (expiretime != -1) setExpire(NULL,db,key,expiretime);
+    decrRefCount(key);
+    return;
+
+eoferr:
+    lazyLoadCorrupted("short read");
+}
+
+/* Read the opcodes that are not keys from the current position of 'rdb',
+ * up to offset 'end' or the EOF opcode. Returns -1 on error. */
+static int lazyLoadReadMeta(rio *rdb, off_t start, off_t end,
+                            rdbSaveInfo *rsi)
+{
+    int type;
+
+    while (start + (off_t)rdb->processed_bytes < end) {
+        if ((type = rdbLoadType(rdb)) == -1) return -1;
+        if (type == RDB_OPCODE_EOF) {
+            break;
+        } else if (type == RDB_OPCODE_AUX) {
+            if (rdbLoadAuxField(rdb,rsi) == -1) return -1;
+        } else if (type == RDB_OPCODE_SELECTDB) {
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) return -1;
+        } else if (type == RDB_OPCODE_RESIZEDB) {
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) return -1;
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) return -1;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Decode a length in the RDB encoding from the buffer at '*p', not going
+ * past 'end'. Returns -1 on error. */
+static int lazyLoadDecodeLen(unsigned char **p, unsigned char *end,
+                             uint64_t *len)
+{
+    unsigned char *s = *p;
+    int type;
+
+    if (s >= end) return -1;
+    type = (s[0]&0xC0)>>6;
+    if (type == RDB_6BITLEN) {
+        *len = s[0]&0x3F;
+        *p = s+1;
+    } else if (type == RDB_14BITLEN) {
+        if (end-s < 2) return -1;
+        *len = ((s[0]&0x3F)<<8)|s[1];
+        *p = s+2;
+    } else if (s[0] == RDB_32BITLEN) {
+        uint32_t len32;
+
+        if (end-s < 5) return -1;
+        memcpy(&len32,s+1,4);
+        *len = ntohl(len32);
+        *p = s+5;
+    } else if (s[0] == RDB_64BITLEN) {
+        uint64_t len64;
+
+        if (end-s < 9) return -1;
+        memcpy(&len64,s+1,8);
+        *len = ntohu64(len64);
+        *p = s+9;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Build the hash table of the keys, see the 'lazy' structure. */
+static void lazyLoadBuildTable(void) {
+    uint64_t nb = 1, b, j;
+
+    while (nb < lazy.numkeys) nb <<= 1;
+    lazy.mask = nb-1;
+    lazy.buckets = zcalloc(sizeof(uint64_t)*(nb+1));
+    lazy.slots = zmalloc(sizeof(uint64_t)*(lazy.numkeys ? lazy.numkeys : 1));
+
+    /* Count the keys of every bucket, turn the counts into start offsets,
+     * then place the keys advancing the offsets, that end up being the
+     * start offsets of the next bucket. */
+    for (j = 0; j < lazy.numkeys; j++)
+        lazy.buckets[(lazy.keys[j].hash & lazy.mask)+1]++;
+    for (b = 1; b <= nb; b++) lazy.buckets[b] += lazy.buckets[b-1];
+    for (j = 0; j < lazy.numkeys; j++)
+        lazy.slots[lazy.buckets[lazy.keys[j].hash & lazy.mask]++] = j;
+    for (b = nb; b > 0; b--) lazy.buckets[b] = lazy.buckets[b-1];
+    lazy.buckets[0] = 0;
+}
+
+/* Read the key index of the RDB file 'fp' of 'size' bytes. Returns -1 if
+ * the file has no valid index, otherwise the number of keys, with the
+ * index stored in 'lazy' and the offset of the data that follows the keys
+ * stored in '*tail'. */
+static long long lazyLoadReadIndex(FILE *fp, off_t size, off_t *tail) {
+    unsigned char trailer[RDB_KEY_INDEX_TRAILER_LEN], *p, *end;
+    uint64_t offsets[3], numkeys, j;
+    sds buf;
+
+    if (size < 9+RDB_KEY_INDEX_TRAILER_LEN ||
+        fseeko(fp,size-RDB_KEY_INDEX_TRAILER_LEN,SEEK_SET) == -1 ||
+        fread(trailer,sizeof(trailer),1,fp) != 1 ||
+        memcmp(trailer+24,RDB_KEY_INDEX_MAGIC,8) != 0) return -1;
+    memcpy(offsets,trailer,sizeof(offsets));
+    memrev64ifbe(&offsets[0]);
+    memrev64ifbe(&offsets[1]);
+    memrev64ifbe(&offsets[2]);
+    numkeys = offsets[2];
+    /* Every entry takes at least three bytes. */
+    if (offsets[1] < 9 || offsets[1] >= offsets[0] ||
+        offsets[0] > (uint64_t)size-RDB_KEY_INDEX_TRAILER_LEN ||
+        numkeys > (size-RDB_KEY_INDEX_TRAILER_LEN-offsets[0])/3)
+        goto invalid;
+
+    buf = sdsnewlen(NULL,size-RDB_KEY_INDEX_TRAILER_LEN-offsets[0]);
+    if (fseeko(fp,offsets[0],SEEK_SET) == -1 ||
+        (sdslen(buf) && fread(buf,sdslen(buf),1,fp) != 1))
+    {
+        sdsfree(buf);
+        goto invalid;
+    }
+
+    lazy.keys = zmalloc(sizeof(lazyKey)*(numkeys ? numkeys : 1));
+    lazy.dbfirst = zcalloc(sizeof(uint64_t)*(server.dbnum+1));
+    p = (unsigned char*)buf;
+    end = p+sdslen(buf);
+    for (j = 0; j < numkeys; j++) {
+        lazyKey *lk = lazy.keys+j;
+        uint64_t dbid, len, offset;
+
+        if (lazyLoadDecodeLen(&p,end,&dbid) == -1 ||
+            dbid >= (uint64_t)server.dbnum ||
+            (j && (int)dbid < lk[-1].dbid) ||
+            lazyLoadDecodeLen(&p,end,&len) == -1 ||
+            len > (uint64_t)(end-p)) goto freeindex;
+        lk->key = (char*)p;
+        lk->len = len;
+        p += len;
+        if (lazyLoadDecodeLen(&p,end,&offset) == -1 ||
+            offset >= offsets[1] ||
+            (j && (off_t)offset <= lk[-1].offset)) goto freeindex;
+        lk->offset = offset;
+        lk->dbid = dbid;
+        lk->hash = lazyLoadHash(dbid,lk->key,len);
+        lk->pending = 1;
+        lazy.dbfirst[dbid+1]++;
+    }
+    for (j = 1; j <= (uint64_t)server.dbnum; j++)
+        lazy.dbfirst[j] += lazy.dbfirst[j-1];
+    lazy.index = buf;
+    lazy.numkeys = numkeys;
+    lazyLoadBuildTable();
+    *tail = offsets[1];
+    return numkeys;
+
+freeindex:
+    sdsfree(buf);
+    zfree(lazy.keys);
+    zfree(lazy.dbfirst);
+    lazy.keys = NULL;
+    lazy.dbfirst = NULL;
+invalid:
+    serverLog(LL_WARNING,"The key index of the RDB file is invalid, "
+                         "loading the whole file");
+    return -1;
+}
+
+/* Background loader: load the keys in file order for at most
+ * "rdb-lazy-load-cycle-us" microseconds. */
+static int lazyLoadCron(struct aeEventLoop *eventLoop, long long id,
+                        void *clientData)
+{
+    long long start = ustime();
+    int iterations = 0;
+    UNUSED(eventLoop);
+    UNUSED(id);
+    UNUSED(clientData);
+
+    if (!server.lazy_loading) return AE_NOMORE;
+    if (server.rdb_lazy_load_cycle_us == 0) return 100;
+    while (lazy.cursor < lazy.numkeys) {
+        lazyKey *lk = lazy.keys+lazy.cursor++;
+
+        if (lk->pending) lazyLoadEntry(lk);
+        if ((++iterations & 15) == 0 &&
+            ustime()-start > server.rdb_lazy_load_cycle_us) break;
+    }
+    lazyLoadCheckDone();
+    return server.lazy_loading ? 0 : AE_NOMORE;
+}
+
+/* Start the lazy loading of the RDB file 'filename'. Returns C_ERR without
+ * touching the dataset if the file can't be loaded lazily (no key index)
+ * so that the caller loads it as usual. Otherwise the non key data is
+ * loaded, filling 'rsi' with the replication info, and C_OK is returned
+ * with the keys scheduled for loading. */
+int lazyLoadStart(char *filename, rdbSaveInfo *rsi) {
+    struct redis_stat sb;
+    off_t tail;
+    long long numkeys;
+    char magic[10];
+    int j, rdbver;
+    FILE *fp;
+    rio rdb;
+
+    if (server.cluster_enabled || server.shard_threads) return C_ERR;
+    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
+    if (redis_fstat(fileno(fp),&sb) == -1 ||
+        fread(magic,9,1,fp) != 1 || memcmp(magic,"REDIS",5) != 0)
+    {
+        fclose(fp);
+        return C_ERR;
+    }
+    magic[9] = '\0';
+    rdbver = atoi(magic+5);
+    lazy.start = ustime();
+    if (rdbver < 1 || rdbver > RDB_VERSION ||
+        (numkeys = lazyLoadReadIndex(fp,sb.st_size,&tail)) == -1)
+    {
+        fclose(fp);
+        return C_ERR;
+    }
+
+    /* The AUX fields before the first key, and the ones after the last
+     * key, where the Lua scripts are. */
+    if (fseeko(fp,9,SEEK_SET) == -1) lazyLoadCorrupted(strerror(errno));
+    rioInitWithFile(&rdb,fp);
+    if (lazyLoadReadMeta(&rdb,9,numkeys ? lazy.keys[0].offset : tail,
+                         rsi) == -1)
+        lazyLoadCorrupted("short read");
+    if (fseeko(fp,tail,SEEK_SET) == -1) lazyLoadCorrupted(strerror(errno));
+    rioInitWithFile(&rdb,fp);
+    if (lazyLoadReadMeta(&rdb,tail,sb.st_size,rsi) == -1)
+        lazyLoadCorrupted("short read");
+
+    for (j = 0; j < server.dbnum; j++)
+        dictExpand(server.db[j].dict,lazy.dbfirst[j+1]-lazy.dbfirst[j]);
+    lazy.fp = fp;
+    lazy.pos = -1;
+    lazy.cursor = 0;
+    lazy.pending_keys = numkeys;
+    lazy.on_demand_keys = 0;
+    server.lazy_loading = 1;
+    serverLog(LL_NOTICE,"RDB key index loaded: %lld keys will be loaded "
+                        "lazily", numkeys);
+    lazyLoadCheckDone();
+    if (server.lazy_loading &&
+        aeCreateTimeEvent(server.el,1,lazyLoadCron,NULL,NULL) == AE_ERR)
+    {
+        serverPanic("Can't create the lazy loading timer.");
+    }
+    return C_OK;
+}
+
+/* Load 'key' of 'db' if it is still on disk. Returns 1 if it was. */
+int lazyLoadKey(redisDb *db, sds key) {
+    lazyKey *lk;
+
+    /* Only the main thread loads keys, into the real DBs. */
+    if (!server.lazy_loading || db != server.db+db->id) return 0;
+    if ((lk = lazyLoadLookup(db->id,key)) == NULL) return 0;
+    lazyLoadEntry(lk);
+    lazy.on_demand_keys++;
+    lazyLoadCheckDone();
+    return 1;
+}
+
+/* Discard the version on disk of 'key', that is being created. */
+void lazyLoadDiscardKey(redisDb *db, sds key) {
+    lazyKey *lk;
+
+    if (!server.lazy_loading || db != server.db+db->id) return;
+    if ((lk = lazyLoadLookup(db->id,key)) != NULL) {
+        lk->pending = 0;
+        lazy.pending_keys--;
+        lazyLoadCheckDone();
+    }
+}
+
+/* Discard the keys on disk of 'dbnum', or of every DB if it is -1. */
+void lazyLoadEmptyDb(int dbnum) {
+    uint64_t j;
+
+    if (!server.lazy_loading) return;
+    for (j = 0; j < lazy.numkeys; j++) {
+        lazyKey *lk = lazy.keys+j;
+
+        if (dbnum != -1 && lk->dbid != dbnum) continue;
+        if (lk->pending) {
+            lk->pending = 0;
+            lazy.pending_keys--;
+        }
+    }
+    lazyLoadCheckDone();
+}
+
+/* Load all the keys still on disk. */
+void lazyLoadFinish(void) {
+    long long start = ustime();
+
+    if (!server.lazy_loading) return;
+    while (lazy.cursor < lazy.numkeys) {
+        lazyKey *lk = lazy.keys+lazy.cursor++;
+
+        if (lk->pending) lazyLoadEntry(lk);
+    }
+    latencyAddSampleIfNeeded("lazy-load-finish",(ustime()-start)/1000);
+    lazyLoadCheckDone();
+}
+
+/* Called by call() before executing a command while keys are pending:
+ * load the keys the command accesses, or all of them if the command needs
+ * the whole keyspace. */
+void lazyLoadForCommand(client *c) {
+    struct redisCommand *cmd = c->cmd;
+    int *keys, numkeys, j;
+
+    if (cmd->proc == keysCommand || cmd->proc == scanCommand ||
+        cmd->proc == randomkeyCommand || cmd->proc == dbsizeCommand ||
+        cmd->proc == swapdbCommand || cmd->proc == debugCommand ||
+        cmd->proc == memoryCommand)
+    {
+        lazyLoadFinish();
+        return;
+    }
+    keys = getKeysFromCommand(cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys; j++)
+        lazyLoadKey(c->db,c->argv[keys[j]]->ptr);
+    getKeysFreeResult(keys);
+}
+
+/* The "lazy_loading" fields of INFO persistence. */
+sds genLazyLoadInfoString(sds info) {
+    uint64_t total = lazy.numkeys, pending = lazy.pending_keys;
+
+    return sdscatprintf(info,
+        "lazy_loading:%d\r\n"
+        "lazy_loading_total_keys:%llu\r\n"
+        "lazy_loading_pending_keys:%llu\r\n"
+        "lazy_loading_on_demand_keys:%llu\r\n"
+        "lazy_loading_loaded_perc:%.2f%%\r\n",
+        server.lazy_loading,
+        (unsigned long long) total,
+        (unsigned long long) pending,
+        (unsigned long long) lazy.on_demand_keys,
+        total ? (double)(total-pending)/total*100 : 100.0);
+}
@@ -0,0 +1,378 @@
+/* Incremental keyspace memory report.
+ *
+ * When "memory-report-period" is greater than zero, serverCron() walks the
+ * whole keyspace incrementally, using at most MEMREPORT_CPU_PERC percent of
+ * the CPU time, and estimates the memory used by every key with
+ * objectComputeSize(). The estimates are aggregated:
+ *
+ * 1) Per key prefix: the part of the key name before the first occurrence
+ *    of "memory-report-delimiter", so that "user:1000:sessions" is accounted
+ *    to "user". Keys without the delimiter are accounted to "(none)". At most
+ *    MEMREPORT_MAX_PREFIXES prefixes are tracked, the others are accounted
+ *    to "(other)".
+ * 2) Per type.
+ * 3) The "memory-report-top-keys" biggest keys are remembered.
+ *
+ * When a full scan completes the new report replaces the previous one, and
+ * a new scan is started "memory-report-period" seconds later. The last
+ * completed report is returned by MEMORY REPORT, so that no client needs to
+ * SCAN the dataset and call MEMORY USAGE for every key.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+#define MEMREPORT_CPU_PERC 1            /* Scan CPU budget, in percentage. */
+#define MEMREPORT_MAX_PREFIXES 1024
+#define MEMREPORT_TYPES (OBJ_MODULE+1)
+
+typedef struct memReportStat {
+    unsigned long long keys;
+    unsigned long long bytes;
+} memReportStat;
+
+typedef struct memReportKey {
+    sds key;
+    int dbid;
+    int type;
+    size_t bytes;
+} memReportKey;
+
+typedef struct memReport {
+    dict *prefixes;                     /* prefix -> memReportStat. */
+    memReportStat other;                /* Prefixes over the limit. */
+    memReportStat types[MEMREPORT_TYPES];
+    memReportStat total;
+    memReportKey *top;                  /* Biggest keys, unsorted. */
+    int toplen, topsize;
+    long long start;                    /* Scan start/end, unix time in ms. */
+    long long end;
+} memReport;
+
+static void memReportStatDestructor(void *privdata, void *val) {
+    DICT_NOTUSED(privdata);
+    zfree(val);
+}
+
+dictType memReportPrefixesDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    memReportStatDestructor     /* val destructor */
+};
+
+static memReport *report = NULL;        /* Last completed report. */
+static memReport *building = NULL;      /* Report of the scan in progress. */
+static int scan_dbid;
+static unsigned long scan_cursor;
+
+static memReport *memReportCreate(void) {
+    memReport *mr = zcalloc(sizeof(*mr));
+    mr->prefixes = dictCreate(&memReportPrefixesDictType,NULL);
+    mr->topsize = server.memory_report_top_keys;
+    mr->top = zmalloc(sizeof(memReportKey)*mr->topsize);
+    mr->start = mstime();
+    return mr;
+}
+
+static void memReportFree(memReport *mr) {
+    int j;
+
+    if (mr == NULL) return;
+    for (j = 0; j < mr->toplen; j++) sdsfree(mr->top[j].key);
+    dictRelease(mr->prefixes);
+    zfree(mr->top);
+    zfree(mr);
+}
+
+static void memReportStatAdd(memReportStat *st, size_t bytes) {
+    st->keys++;
+    st->bytes += bytes;
+}
+
+/* Return the length of the prefix of 'key' (the part before the configured
+ * delimiter), or -1 if the key does not contain the delimiter. */
+static ssize_t memReportPrefixLen(sds key) {
+    const char *delim = server.memory_report_delimiter;
+    size_t dlen = strlen(delim), klen = sdslen(key), j;
+
+    if (dlen == 0 || dlen > klen) return -1;
+    for (j = 0; j <= klen-dlen; j++)
+        if (key[j] == delim[0] && !memcmp(key+j,delim,dlen)) return j;
+    return -1;
+}
+
+static void memReportAddPrefix(memReport *mr, sds key, size_t bytes) {
+    static sds prefix = NULL;   /* Reused to avoid an allocation per key. */
+    ssize_t plen = memReportPrefixLen(key);
+    dictEntry *de;
+
+    if (prefix == NULL) prefix = sdsempty();
+    prefix = plen == -1 ? sdscpy(prefix,"(none)") : sdscpylen(prefix,key,plen);
+    de = dictFind(mr->prefixes,prefix);
+    if (de) {
+        memReportStatAdd(dictGetVal(de),bytes);
+    } else if (dictSize(mr->prefixes) < MEMREPORT_MAX_PREFIXES) {
+        memReportStat *st = zcalloc(sizeof(*st));
+        memReportStatAdd(st,bytes);
+        dictAdd(mr->prefixes,sdsdup(prefix),st);
+    } else {
+        memReportStatAdd(&mr->other,bytes);
+    }
+}
+
+static void memReportAddTopKey(memReport *mr, int dbid, sds key, int type,
+                               size_t bytes)
+{
+    memReportKey *slot;
+    int j, min = 0;
+
+    if (mr->topsize == 0) return;
+    if (mr->toplen < mr->topsize) {
+        slot = mr->top + mr->toplen++;
+    } else {
+        for (j = 1; j < mr->toplen; j++)
+            if (mr->top[j].bytes < mr->top[min].bytes) min = j;
+        if (mr->top[min].bytes >= bytes) return;
+        slot = mr->top + min;
+        sdsfree(slot->key);
+    }
+    slot->key = sdsdup(key);
+    slot->dbid = dbid;
+    slot->type = type;
+    slot->bytes = bytes;
+}
+
+/* dictScan() callback: account a single key. */
+static void memReportScanCallback(void *privdata, const dictEntry *de) {
+    memReport *mr = privdata;
+    sds key = dictGetKey(de);
+    robj *val = dictGetVal(de);
+    size_t bytes;
+
+    bytes = objectComputeSize(val,OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+    bytes += sdsAllocSize(key);
+    bytes += sizeof(dictEntry);
+
+    memReportStatAdd(&mr->total,bytes);
+    if (val->type < MEMREPORT_TYPES)
+        memReportStatAdd(&mr->types[val->type],bytes);
+    memReportAddPrefix(mr,key,bytes);
+    memReportAddTopKey(mr,scan_dbid,key,val->type,bytes);
+}
+
+/* Called by serverCron() at every iteration: start a new scan if the
+ * previous report is older than "memory-report-period" seconds, then
+ * continue the scan in progress within the MEMREPORT_CPU_PERC budget. */
+void memoryReportCron(void) {
+    long long start, timelimit = MEMREPORT_CPU_PERC*1000000/server.hz/100;
+    int iterations = 0;
+
+    if (server.memory_report_period <= 0) {
+        /* Disabled: just release the partial report, if any. The last
+         * completed one is still available via MEMORY REPORT. */
+        memReportFree(building);
+        building = NULL;
+        return;
+    }
+
+    if (building == NULL) {
+        if (report &&
+            mstime()-report->end < server.memory_report_period*1000LL)
+            return;
+        building = memReportCreate();
+        scan_dbid = 0;
+        scan_cursor = 0;
+    }
+
+    start = ustime();
+    while (1) {
+        scan_cursor = dictScan(server.db[scan_dbid].dict,scan_cursor,
+                               memReportScanCallback,NULL,building);
+        if (scan_cursor == 0 && ++scan_dbid == server.dbnum) {
+            building->end = mstime();
+            memReportFree(report);
+            report = building;
+            building = NULL;
+            break;
+        }
+        /* Check the time every 16 buckets: calling ustime() is not free. */
+        if ((++iterations & 15) == 0 && ustime()-start > timelimit)
+            break;
+    }
+}
+
+/* ----------------------------- MEMORY REPORT ----------------------------- */
+
+static char *memReportTypeName(int type) {
+    switch(type) {
+    case OBJ_STRING: return "string";
+    case OBJ_LIST: return "list";
+    case OBJ_SET: return "set";
+    case OBJ_ZSET: return "zset";
+    case OBJ_HASH: return "hash";
+    case OBJ_MODULE: return "module";
+    default: return "unknown";
+    }
+}
+
+typedef struct memReportPrefix {
+    sds prefix;
+    memReportStat *st;
+} memReportPrefix;
+
+static int memReportComparePrefixes(const void *a, const void *b) {
+    const memReportPrefix *pa = a, *pb = b;
+    if (pa->st->bytes == pb->st->bytes) return 0;
+    return pa->st->bytes > pb->st->bytes ? -1 : 1;
+}
+
+static int memReportCompareKeys(const void *a, const void *b) {
+    const memReportKey *ka = a, *kb = b;
+    if (ka->bytes == kb->bytes) return 0;
+    return ka->bytes > kb->bytes ? -1 : 1;
+}
+
+static void addReplyMemReportStat(client *c, const char *name, size_t len,
+                                  memReportStat *st)
+{
+    addReplyMultiBulkLen(c,3);
+    addReplyBulkCBuffer(c,name,len);
+    addReplyLongLong(c,st->keys);
+    addReplyLongLong(c,st->bytes);
+}
+
+/* MEMORY REPORT [<count>]
+ *
+ * Reply with the last completed report. Prefixes are sorted by memory usage
+ * and at most 'count' (default 50) are returned. */
+void memoryReportCommand(client *c) {
+    memReport *mr = report;
+    long count = 50;
+    void *replylen;
+    int fields = 0, j;
+
+    if (c->argc > 3) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (c->argc == 3) {
+        if (getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != C_OK)
+            return;
+        if (count < 0) {
+            addReplyError(c,"count can't be negative");
+            return;
+        }
+    }
+
+    replylen = addDeferredMultiBulkLength(c);
+    addReplyBulkCString(c,"status");
+    addReplyBulkCString(c,building ? "scanning" :
+        (server.memory_report_period > 0 ? "idle" : "disabled"));
+    fields++;
+    addReplyBulkCString(c,"scan-keys");
+    addReplyLongLong(c,building ? building->total.keys : 0);
+    fields++;
+    if (mr == NULL) {
+        setDeferredMultiBulkLength(c,replylen,fields*2);
+        return;
+    }
+
+    addReplyBulkCString(c,"last-scan-end");
+    addReplyLongLong(c,mr->end/1000);
+    addReplyBulkCString(c,"last-scan-duration-ms");
+    addReplyLongLong(c,mr->end-mr->start);
+    addReplyBulkCString(c,"keys");
+    addReplyLongLong(c,mr->total.keys);
+    addReplyBulkCString(c,"bytes");
+    addReplyLongLong(c,mr->total.bytes);
+    fields += 4;
+
+    /* Per type stats. */
+    int types = 0;
+    for (j = 0; j < MEMREPORT_TYPES; j++) if (mr->types[j].keys) types++;
+    addReplyBulkCString(c,"types");
+    addReplyMultiBulkLen(c,types);
+    for (j = 0; j < MEMREPORT_TYPES; j++) {
+        if (mr->types[j].keys == 0) continue;
+        char *name = memReportTypeName(j);
+        addReplyMemReportStat(c,name,strlen(name),&mr->types[j]);
+    }
+    fields++;
+
+    /* Per prefix stats, sorted by memory usage. */
+    unsigned long numprefixes = dictSize(mr->prefixes), i = 0;
+    memReportPrefix *prefixes = zmalloc(sizeof(*prefixes)*(numprefixes+1));
+    dictIterator *di = dictGetIterator(mr->prefixes);
+    dictEntry *de;
+    while((de = dictNext(di)) != NULL) {
+        prefixes[i].prefix = dictGetKey(de);
+        prefixes[i].st = dictGetVal(de);
+        i++;
+    }
+    dictReleaseIterator(di);
+    if (mr->other.keys) {
+        prefixes[i].prefix = NULL;
+        prefixes[i].st = &mr->other;
+        i++;
+    }
+    qsort(prefixes,i,sizeof(*prefixes),memReportComparePrefixes);
+    if ((unsigned long)count > i) count = i;
+    addReplyBulkCString(c,"prefixes");
+    addReplyMultiBulkLen(c,count);
+    for (j = 0; j < count; j++) {
+        if (prefixes[j].prefix) {
+            addReplyMemReportStat(c,prefixes[j].prefix,
+                sdslen(prefixes[j].prefix),prefixes[j].st);
+        } else {
+            addReplyMemReportStat(c,"(other)",7,prefixes[j].st);
+        }
+    }
+    zfree(prefixes);
+    fields++;
+
+    /* Biggest keys. */
+    qsort(mr->top,mr->toplen,sizeof(memReportKey),memReportCompareKeys);
+    addReplyBulkCString(c,"biggest-keys");
+    addReplyMultiBulkLen(c,mr->toplen);
+    for (j = 0; j < mr->toplen; j++) {
+        addReplyMultiBulkLen(c,4);
+        addReplyBulkCBuffer(c,mr->top[j].key,sdslen(mr->top[j].key));
+        addReplyLongLong(c,mr->top[j].dbid);
+        addReplyBulkCString(c,memReportTypeName(mr->top[j].type));
+        addReplyLongLong(c,mr->top[j].bytes);
+    }
+    fields++;
+
+    setDeferredMultiBulkLength(c,replylen,fields*2);
+}
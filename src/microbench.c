@@ -0,0 +1,728 @@
+/* Microbenchmarks of the Redis core data structures.
+ *
+ * Measures insert, lookup, iteration and deletion, plus the memory used per
+ * element, of sds, dict, ziplist, quicklist, intset and rax at several
+ * sizes, linking the very same objects used to build the server. Every
+ * measure is the median of a number of rounds, and inputs are generated
+ * with fixed seeds, so that the output of two builds can be compared:
+ *
+ *   $ make bench                  # Build and run with the defaults.
+ *   $ ./microbench --csv > a.csv  # Later, on another commit:
+ *   $ ./microbench --csv > b.csv
+ *   $ ./microbench --compare a.csv b.csv
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sds.h"
+#include "dict.h"
+#include "ziplist.h"
+#include "quicklist.h"
+#include "intset.h"
+#include "rax.h"
+#include "adlist.h"
+#include "zmalloc.h"
+#include "util.h"
+
+#define MAX_SIZES 4
+#define MAX_OPS 8
+#define MAX_ROUNDS 101
+#define MIN_ELEMENTS 20000 /* Elements processed by every round at least. */
+
+/* The result of one round of a structure at a given size: the time of
+ * every operation, in nanoseconds per operation, and the memory used per
+ * element. */
+typedef struct benchRound {
+    int numops;
+    const char *op[MAX_OPS];
+    double nsop[MAX_OPS];
+    double bytes_per_elem;
+} benchRound;
+
+typedef struct benchStructure {
+    const char *name;
+    const char *memory;         /* What bytes/elem accounts for. */
+    int elements;               /* True if sizes are element counts. */
+    long sizes[MAX_SIZES];
+    void (*run)(long size, benchRound *r);
+} benchStructure;
+
+static struct config {
+    int rounds;
+    int csv;
+    char *only;                 /* Comma separated structures, or NULL. */
+} config;
+
+/* These are referenced by redisassert.h, included by some of the
+ * structures. */
+void _serverAssert(char *estr, char *file, int line) {
+    fprintf(stderr,"=== ASSERTION FAILED ===\n==> %s:%d '%s' is not true\n",
+        file, line, estr);
+    _exit(1);
+}
+
+void _serverPanic(const char *file, int line, const char *msg, ...) {
+    va_list ap;
+
+    va_start(ap,msg);
+    fprintf(stderr,"!!! Software Failure at %s:%d: ", file, line);
+    vfprintf(stderr,msg,ap);
+    fprintf(stderr,"\n");
+    va_end(ap);
+    _exit(1);
+}
+
+/* ------------------------------- Utilities ------------------------------- */
+
+static long long nstime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/* Deterministic xorshift64* generator: every round, and every build, sees
+ * exactly the same inputs. */
+static uint64_t rand_state;
+
+static void benchSeed(void) {
+    rand_state = 0x9E3779B97F4A7C15ULL;
+}
+
+static uint64_t benchRandom(void) {
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545F4914F6CDD1DULL;
+}
+
+#define benchStart() long long _start = nstime()
+#define benchEnd(r,name,ops) roundAdd(r,name,nstime()-_start,ops)
+
+static void roundAdd(benchRound *r, const char *op, long long ns, long ops) {
+    r->op[r->numops] = op;
+    r->nsop[r->numops] = ops ? (double)ns/ops : 0;
+    r->numops++;
+}
+
+/* Return 'count' keys "key:<n>" in random order, and as many missing keys
+ * if 'missing' is not NULL. */
+static sds *benchKeys(long count, sds **missing) {
+    sds *keys = zmalloc(sizeof(sds)*count);
+    long j;
+
+    for (j = 0; j < count; j++) keys[j] = sdscatfmt(sdsempty(),"key:%I",
+                                                    (long long)j);
+    for (j = count-1; j > 0; j--) {
+        long k = benchRandom() % (j+1);
+        sds tmp = keys[j];
+        keys[j] = keys[k];
+        keys[k] = tmp;
+    }
+    if (missing) {
+        *missing = zmalloc(sizeof(sds)*count);
+        for (j = 0; j < count; j++)
+            (*missing)[j] = sdscatfmt(sdsempty(),"missing:%I",(long long)j);
+    }
+    return keys;
+}
+
+static void freeKeys(sds *keys, long count) {
+    long j;
+
+    for (j = 0; j < count; j++) sdsfree(keys[j]);
+    zfree(keys);
+}
+
+/* Number of random lookups performed against structures with linear
+ * lookups, so that big sizes don't take forever. */
+static long linearOps(long size) {
+    return size < 1000 ? size : 1000;
+}
+
+/* ---------------------------------- sds ---------------------------------- */
+
+/* For sds the size is the length of the strings, and every round works on
+ * the same amount of bytes. */
+static void benchSds(long size, benchRound *r) {
+    long count = 16*1024*1024/size, j;
+    sds *strings = zmalloc(sizeof(sds)*count);
+    char *buf = zmalloc(size);
+    size_t used;
+
+    if (count > 100000) count = 100000;
+    memset(buf,'x',size);
+
+    used = zmalloc_used_memory();
+    {
+        benchStart();
+        for (j = 0; j < count; j++) strings[j] = sdsnewlen(buf,size);
+        benchEnd(r,"create",count);
+    }
+    r->bytes_per_elem = (double)(zmalloc_used_memory()-used)/count;
+
+    {
+        long matches = 0;
+        benchStart();
+        for (j = 1; j < count; j++)
+            matches += sdscmp(strings[j-1],strings[j]) == 0;
+        benchEnd(r,"compare",count-1);
+        if (matches != count-1) exit(1);
+    }
+
+    {
+        benchStart();
+        for (j = 0; j < count; j++) sdsfree(strings[j]);
+        benchEnd(r,"free",count);
+    }
+
+    /* Build the strings appending 16 bytes at a time. */
+    {
+        benchStart();
+        for (j = 0; j < count; j++) {
+            sds s = sdsempty();
+            long len;
+            for (len = 0; len < size; len += 16)
+                s = sdscatlen(s,buf,size-len < 16 ? size-len : 16);
+            strings[j] = s;
+        }
+        benchEnd(r,"append",count);
+    }
+    for (j = 0; j < count; j++) sdsfree(strings[j]);
+    zfree(strings);
+    zfree(buf);
+}
+
+/* ---------------------------------- dict --------------------------------- */
+
+static uint64_t benchHashCallback(const void *key) {
+    return dictGenHashFunction((unsigned char*)key,sdslen((char*)key));
+}
+
+static int benchCompareCallback(void *privdata, const void *key1,
+                                const void *key2)
+{
+    int l1, l2;
+    DICT_NOTUSED(privdata);
+
+    l1 = sdslen((sds)key1);
+    l2 = sdslen((sds)key2);
+    if (l1 != l2) return 0;
+    return memcmp(key1,key2,l1) == 0;
+}
+
+/* Keys are owned by the benchmark, so bytes/elem is the overhead of the
+ * hash table itself: entries and buckets. */
+static dictType benchDictType = {
+    benchHashCallback,
+    NULL,
+    NULL,
+    benchCompareCallback,
+    NULL,
+    NULL
+};
+
+static void benchDict(long size, benchRound *r) {
+    sds *missing, *keys = benchKeys(size,&missing);
+    dict *d;
+    long j, found = 0;
+    size_t used = zmalloc_used_memory();
+
+    d = dictCreate(&benchDictType,NULL);
+    {
+        benchStart();
+        for (j = 0; j < size; j++) dictAdd(d,keys[j],NULL);
+        benchEnd(r,"insert",size);
+    }
+    while (dictIsRehashing(d)) dictRehash(d,100);
+    r->bytes_per_elem = (double)(zmalloc_used_memory()-used)/size;
+
+    {
+        benchStart();
+        for (j = 0; j < size; j++) found += dictFind(d,keys[j]) != NULL;
+        benchEnd(r,"lookup",size);
+    }
+    {
+        benchStart();
+        for (j = 0; j < size; j++) found += dictFind(d,missing[j]) != NULL;
+        benchEnd(r,"lookup-miss",size);
+    }
+    if (found != size) exit(1);
+
+    {
+        dictIterator *di = dictGetIterator(d);
+        long seen = 0;
+        benchStart();
+        while (dictNext(di) != NULL) seen++;
+        benchEnd(r,"iterate",seen);
+        dictReleaseIterator(di);
+    }
+
+    {
+        benchStart();
+        for (j = 0; j < size; j++) dictDelete(d,keys[j]);
+        benchEnd(r,"delete",size);
+    }
+    dictRelease(d);
+    freeKeys(keys,size);
+    freeKeys(missing,size);
+}
+
+/* -------------------------------- ziplist -------------------------------- */
+
+/* The elements are short strings, as in small hashes, sets and lists. */
+static void benchZiplist(long size, benchRound *r) {
+    sds *keys = benchKeys(size,NULL);
+    unsigned char *zl = ziplistNew(), *p, *vstr;
+    unsigned int vlen;
+    long long vll;
+    long j, ops = linearOps(size), found = 0;
+
+    {
+        benchStart();
+        for (j = 0; j < size; j++)
+            zl = ziplistPush(zl,(unsigned char*)keys[j],sdslen(keys[j]),
+                             ZIPLIST_TAIL);
+        benchEnd(r,"insert",size);
+    }
+    r->bytes_per_elem = (double)ziplistBlobLen(zl)/size;
+
+    {
+        benchStart();
+        for (j = 0; j < ops; j++) {
+            sds key = keys[benchRandom() % size];
+            p = ziplistIndex(zl,ZIPLIST_HEAD);
+            found += ziplistFind(p,(unsigned char*)key,sdslen(key),0) != NULL;
+        }
+        benchEnd(r,"lookup",ops);
+    }
+    if (found != ops) exit(1);
+
+    {
+        long seen = 0;
+        benchStart();
+        p = ziplistIndex(zl,ZIPLIST_HEAD);
+        while (p && ziplistGet(p,&vstr,&vlen,&vll)) {
+            seen++;
+            p = ziplistNext(zl,p);
+        }
+        benchEnd(r,"iterate",seen);
+    }
+
+    {
+        benchStart();
+        for (j = 0; j < size; j++) {
+            p = ziplistIndex(zl,ZIPLIST_HEAD);
+            zl = ziplistDelete(zl,&p);
+        }
+        benchEnd(r,"delete",size);
+    }
+    zfree(zl);
+    freeKeys(keys,size);
+}
+
+/* ------------------------------- quicklist ------------------------------- */
+
+/* Same settings of a list with the default list-max-ziplist-size and
+ * list-compress-depth. */
+static void benchQuicklist(long size, benchRound *r) {
+    sds *keys = benchKeys(size,NULL);
+    quicklist *ql;
+    quicklistEntry entry;
+    long j, ops = linearOps(size);
+    size_t used = zmalloc_used_memory();
+
+    ql = quicklistNew(-2,0);
+    {
+        benchStart();
+        for (j = 0; j < size; j++)
+            quicklistPushTail(ql,keys[j],sdslen(keys[j]));
+        benchEnd(r,"insert",size);
+    }
+    r->bytes_per_elem = (double)(zmalloc_used_memory()-used)/size;
+
+    {
+        benchStart();
+        for (j = 0; j < ops; j++)
+            if (!quicklistIndex(ql,benchRandom() % size,&entry)) exit(1);
+        benchEnd(r,"lookup",ops);
+    }
+
+    {
+        quicklistIter *iter = quicklistGetIterator(ql,AL_START_HEAD);
+        long seen = 0;
+        benchStart();
+        while (quicklistNext(iter,&entry)) seen++;
+        benchEnd(r,"iterate",seen);
+        quicklistReleaseIterator(iter);
+    }
+
+    {
+        unsigned char *data;
+        unsigned int sz;
+        long long sval;
+        benchStart();
+        for (j = 0; j < size; j++) {
+            data = NULL;
+            quicklistPop(ql,QUICKLIST_HEAD,&data,&sz,&sval);
+            zfree(data);
+        }
+        benchEnd(r,"delete",size);
+    }
+    quicklistRelease(ql);
+    freeKeys(keys,size);
+}
+
+/* -------------------------------- intset --------------------------------- */
+
+static void benchIntset(long size, benchRound *r) {
+    int64_t *values = zmalloc(sizeof(int64_t)*size), v;
+    intset *is = intsetNew();
+    uint8_t success;
+    long j, found = 0;
+
+    /* Distinct 32 bit values, inserted in random order. */
+    for (j = 0; j < size; j++) values[j] = j*104729;
+    for (j = size-1; j > 0; j--) {
+        long k = benchRandom() % (j+1);
+        v = values[j];
+        values[j] = values[k];
+        values[k] = v;
+    }
+
+    {
+        benchStart();
+        for (j = 0; j < size; j++) is = intsetAdd(is,values[j],&success);
+        benchEnd(r,"insert",size);
+    }
+    r->bytes_per_elem = (double)intsetBlobLen(is)/size;
+
+    {
+        benchStart();
+        for (j = 0; j < size; j++) found += intsetFind(is,values[j]);
+        benchEnd(r,"lookup",size);
+    }
+    {
+        benchStart();
+        for (j = 0; j < size; j++) found += intsetFind(is,values[j]+1);
+        benchEnd(r,"lookup-miss",size);
+    }
+    if (found != size) exit(1);
+
+    {
+        long seen = 0;
+        benchStart();
+        while (intsetGet(is,seen,&v)) seen++;
+        benchEnd(r,"iterate",seen);
+    }
+
+    {
+        int removed;
+        benchStart();
+        for (j = 0; j < size; j++) is = intsetRemove(is,values[j],&removed);
+        benchEnd(r,"delete",size);
+    }
+    zfree(is);
+    zfree(values);
+}
+
+/* ---------------------------------- rax ---------------------------------- */
+
+/* Keys are copied into the tree, so bytes/elem includes them. */
+static void benchRax(long size, benchRound *r) {
+    sds *missing, *keys = benchKeys(size,&missing);
+    rax *rt;
+    long j, found = 0;
+    size_t used = zmalloc_used_memory();
+
+    rt = raxNew();
+    {
+        benchStart();
+        for (j = 0; j < size; j++)
+            raxInsert(rt,(unsigned char*)keys[j],sdslen(keys[j]),NULL,NULL);
+        benchEnd(r,"insert",size);
+    }
+    r->bytes_per_elem = (double)(zmalloc_used_memory()-used)/size;
+
+    {
+        benchStart();
+        for (j = 0; j < size; j++)
+            found += raxFind(rt,(unsigned char*)keys[j],sdslen(keys[j])) !=
+                     raxNotFound;
+        benchEnd(r,"lookup",size);
+    }
+    {
+        benchStart();
+        for (j = 0; j < size; j++)
+            found += raxFind(rt,(unsigned char*)missing[j],
+                             sdslen(missing[j])) != raxNotFound;
+        benchEnd(r,"lookup-miss",size);
+    }
+    if (found != size) exit(1);
+
+    {
+        raxIterator ri;
+        long seen = 0;
+        benchStart();
+        raxStart(&ri,rt);
+        raxSeek(&ri,"^",NULL,0);
+        while (raxNext(&ri)) seen++;
+        raxStop(&ri);
+        benchEnd(r,"iterate",seen);
+    }
+
+    {
+        benchStart();
+        for (j = 0; j < size; j++)
+            raxRemove(rt,(unsigned char*)keys[j],sdslen(keys[j]),NULL);
+        benchEnd(r,"delete",size);
+    }
+    raxFree(rt);
+    freeKeys(keys,size);
+    freeKeys(missing,size);
+}
+
+/* --------------------------------- Driver -------------------------------- */
+
+static benchStructure structures[] = {
+    {"sds","bytes per string",0,{16,128,1024,16384},benchSds},
+    {"dict","table and entries, keys excluded",1,{100,1000,10000,100000},benchDict},
+    {"ziplist","ziplist blob",1,{16,128,512,4096},benchZiplist},
+    {"quicklist","nodes and ziplists",1,{100,1000,10000,100000},benchQuicklist},
+    {"intset","intset blob",1,{16,128,1024,8192},benchIntset},
+    {"rax","nodes, keys included",1,{100,1000,10000,100000},benchRax},
+    {NULL,NULL,0,{0},NULL}
+};
+
+static int compareDouble(const void *a, const void *b) {
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+static int isSelected(const char *name) {
+    char buf[64];
+
+    if (config.only == NULL) return 1;
+    snprintf(buf,sizeof(buf),",%s,",name);
+    return strstr(config.only,buf) != NULL;
+}
+
+static void printResult(const char *structure, long size, const char *op,
+                        double value, const char *unit)
+{
+    if (config.csv)
+        printf("%s,%ld,%s,%.2f\n", structure, size, op, value);
+    else
+        printf("%-10s %8ld  %-12s %12.2f %s\n", structure, size, op, value,
+            unit);
+}
+
+/* Run 'config.rounds' rounds of every selected structure and size, and
+ * report the median of every operation. Every round starts from the same
+ * seed, so it processes the same inputs. */
+static void runBenchmarks(void) {
+    static benchRound rounds[MAX_ROUNDS];
+    double values[MAX_ROUNDS];
+    benchStructure *bs;
+    int j, k, op;
+
+    if (config.csv) printf("structure,size,operation,value\n");
+    for (bs = structures; bs->name; bs++) {
+        if (!isSelected(bs->name)) continue;
+        if (!config.csv)
+            printf("# %s (bytes/elem: %s)\n", bs->name, bs->memory);
+        for (j = 0; j < MAX_SIZES; j++) {
+            long size = bs->sizes[j];
+
+            /* Small sizes are repeated within every round, averaging the
+             * results, or timer resolution and noise would dominate. */
+            long iterations = 1, i;
+
+            if (bs->elements && size < MIN_ELEMENTS)
+                iterations = MIN_ELEMENTS/size;
+
+            for (k = 0; k < config.rounds; k++) {
+                memset(&rounds[k],0,sizeof(benchRound));
+                for (i = 0; i < iterations; i++) {
+                    benchRound r;
+
+                    memset(&r,0,sizeof(r));
+                    benchSeed();
+                    bs->run(size,&r);
+                    for (op = 0; op < r.numops; op++) {
+                        rounds[k].op[op] = r.op[op];
+                        rounds[k].nsop[op] += r.nsop[op]/iterations;
+                    }
+                    rounds[k].numops = r.numops;
+                    rounds[k].bytes_per_elem = r.bytes_per_elem;
+                }
+            }
+            for (op = 0; op < rounds[0].numops; op++) {
+                for (k = 0; k < config.rounds; k++)
+                    values[k] = rounds[k].nsop[op];
+                qsort(values,config.rounds,sizeof(double),compareDouble);
+                printResult(bs->name,size,rounds[0].op[op],
+                    values[config.rounds/2],"ns/op");
+            }
+            printResult(bs->name,size,"bytes/elem",rounds[0].bytes_per_elem,
+                "bytes");
+        }
+        if (!config.csv) printf("\n");
+    }
+}
+
+/* Load a CSV file produced with --csv into a dict mapping
+ * "structure,size,operation" to the value. */
+static dict *loadResults(const char *filename) {
+    static dictType resultsDictType = {
+        benchHashCallback,
+        NULL,
+        NULL,
+        benchCompareCallback,
+        NULL,
+        NULL
+    };
+    dict *results = dictCreate(&resultsDictType,NULL);
+    FILE *fp = fopen(filename,"r");
+    char buf[1024];
+
+    if (fp == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    while (fgets(buf,sizeof(buf),fp) != NULL) {
+        char *comma = strrchr(buf,',');
+        double *value;
+
+        if (comma == NULL || !strncmp(buf,"structure,",10)) continue;
+        value = zmalloc(sizeof(double));
+        *value = strtod(comma+1,NULL);
+        dictAdd(results,sdsnewlen(buf,comma-buf),value);
+    }
+    fclose(fp);
+    return results;
+}
+
+/* Compare two CSV files, in the order of the second one. Changes below
+ * 'noise' percent are considered noise and are not flagged. */
+static void compareResults(const char *oldfile, const char *newfile,
+                           double noise)
+{
+    dict *old = loadResults(oldfile);
+    FILE *fp = fopen(newfile,"r");
+    char buf[1024];
+
+    if (fp == NULL) {
+        perror(newfile);
+        exit(1);
+    }
+    printf("%-36s %12s %12s %9s\n", "benchmark", "old", "new", "change");
+    while (fgets(buf,sizeof(buf),fp) != NULL) {
+        char *comma = strrchr(buf,',');
+        sds key;
+        dictEntry *de;
+        double oldval, newval, change;
+
+        if (comma == NULL || !strncmp(buf,"structure,",10)) continue;
+        key = sdsnewlen(buf,comma-buf);
+        newval = strtod(comma+1,NULL);
+        de = dictFind(old,key);
+        if (de == NULL) {
+            printf("%-36s %12s %12.2f %9s\n", key, "-", newval, "new");
+        } else {
+            oldval = *(double*)dictGetVal(de);
+            change = oldval ? (newval-oldval)*100/oldval : 0;
+            printf("%-36s %12.2f %12.2f %+8.1f%%%s\n", key, oldval, newval,
+                change, (change > noise || change < -noise) ? " *" : "");
+        }
+        sdsfree(key);
+    }
+    fclose(fp);
+}
+
+static void usage(void) {
+    fprintf(stderr,
+"Usage: microbench [--rounds <n>] [--only <structures>] [--csv]\n"
+"       microbench --compare <old.csv> <new.csv> [--noise <percent>]\n\n"
+" --rounds <n>        Rounds of every benchmark, the median is reported\n"
+"                     (default 5).\n"
+" --only <list>       Comma separated list of structures among sds, dict,\n"
+"                     ziplist, quicklist, intset and rax.\n"
+" --csv               Output in CSV format, as expected by --compare.\n"
+" --compare <a> <b>   Compare two CSV outputs, flagging with '*' the\n"
+"                     changes above the noise threshold.\n"
+" --noise <percent>   Noise threshold of --compare (default 5).\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *oldfile = NULL, *newfile = NULL;
+    double noise = 5;
+    uint8_t seed[16] = {0};
+    int j;
+
+    config.rounds = 5;
+    config.csv = 0;
+    config.only = NULL;
+    for (j = 1; j < argc; j++) {
+        int lastarg = j == argc-1;
+
+        if (!strcmp(argv[j],"--rounds") && !lastarg) {
+            config.rounds = atoi(argv[++j]);
+            if (config.rounds < 1) config.rounds = 1;
+            if (config.rounds > MAX_ROUNDS) config.rounds = MAX_ROUNDS;
+        } else if (!strcmp(argv[j],"--only") && !lastarg) {
+            config.only = sdscatfmt(sdsempty(),",%s,",argv[++j]);
+        } else if (!strcmp(argv[j],"--csv")) {
+            config.csv = 1;
+        } else if (!strcmp(argv[j],"--compare") && j+2 < argc) {
+            oldfile = argv[++j];
+            newfile = argv[++j];
+        } else if (!strcmp(argv[j],"--noise") && !lastarg) {
+            noise = atof(argv[++j]);
+        } else {
+            usage();
+        }
+    }
+
+    /* A fixed seed makes the hash tables layout the same in every run. */
+    dictSetHashFunctionSeed(seed);
+    if (oldfile) compareResults(oldfile,newfile,noise);
+    else runBenchmarks();
+    return 0;
+}
@@ -29,6 +29,7 @@
 
 #include "server.h"
 #include "cluster.h"
+#include "bio.h"
 #include <dlfcn.h>
 
 #define REDISMODULE_CORE 1
@@ -51,6 +52,7 @@ struct RedisModule {
 typedef struct RedisModule RedisModule;
 
 static dict *modules; /* Hash table of modules. SDS -> RedisModule ptr.*/
+static int module_unlink_types = 0; /* Types with an 'unlink' method. */
 
 /* Entries in the context->amqueue array, representing objects to free
  * when the callback returns. */
@@ -127,6 +129,7 @@ typedef struct RedisModuleCtx RedisModuleCtx;
 #define REDISMODULE_CTX_BLOCKED_REPLY (1<<3)
 #define REDISMODULE_CTX_BLOCKED_TIMEOUT (1<<4)
 #define REDISMODULE_CTX_THREAD_SAFE (1<<5)
+#define REDISMODULE_CTX_THREAD_SAFE_READ (1<<6)
 
 /* This represents a Redis key opened with RM_OpenKey(). */
 struct RedisModuleKey {
@@ -134,6 +137,8 @@ struct RedisModuleKey {
     redisDb *db;
     robj *key;      /* Key name object. */
     robj *value;    /* Value object, or NULL if the key was not found. */
+    robj *decoded;  /* Private uncompressed copy of a compressed value,
+                       referenced by 'value'. See RM_OpenKey(). */
     void *iter;     /* Iterator. */
     int mode;       /* Opening mode. */
 
@@ -212,9 +217,31 @@ typedef struct RedisModuleBlockedClient {
 static pthread_mutex_t moduleUnblockedClientsMutex = PTHREAD_MUTEX_INITIALIZER;
 static list *moduleUnblockedClients;
 
-/* We need a mutex that is unlocked / relocked in beforeSleep() in order to
- * allow thread safe contexts to execute commands at a safe moment. */
-static pthread_mutex_t moduleGIL = PTHREAD_MUTEX_INITIALIZER;
+/* We need a lock that is unlocked / relocked in beforeSleep() in order to
+ * allow thread safe contexts to execute commands at a safe moment. It is a
+ * read-write lock: the main thread and RM_ThreadSafeContextLock() take it
+ * exclusively, while RM_ThreadSafeContextReadLock() takes it in shared mode,
+ * so that multiple module threads can read the dataset at the same time. */
+static pthread_rwlock_t moduleGIL;
+
+/* A module thread pool. Jobs are executed in FIFO order by 'numthreads'
+ * threads, see RM_CreateThreadPool(). */
+typedef struct RedisModuleThreadPool {
+    RedisModule *module;        /* Module that created the pool. */
+    pthread_t *threads;         /* Worker threads. */
+    int numthreads;             /* Number of worker threads. */
+    list *jobs;                 /* Pending RedisModuleThreadPoolJob entries. */
+    pthread_mutex_t mutex;      /* Protects 'jobs' and 'shutdown'. */
+    pthread_cond_t newjob_cond; /* Signaled when a job is queued. */
+    int shutdown;               /* Set by RM_FreeThreadPool(). */
+} RedisModuleThreadPool;
+
+typedef void (*RedisModuleThreadPoolJobFunc)(void *privdata);
+
+typedef struct RedisModuleThreadPoolJob {
+    RedisModuleThreadPoolJobFunc func;
+    void *privdata;
+} RedisModuleThreadPoolJob;
 
 
 /* Function pointer type for keyspace event notification subscriptions from modules. */
@@ -241,6 +268,24 @@ static list *moduleKeyspaceSubscribers;
  * per round. */
 static client *moduleKeyspaceSubscribersClient;
 
+/* Function pointer type of module timers callbacks. */
+typedef void (*RedisModuleTimerProc)(RedisModuleCtx *ctx, void *data);
+
+/* Module timer information, used as client data of the ae time event.
+ * See RM_CreateTimer() for more information. */
+typedef struct RedisModuleTimer {
+    RedisModule *module;            /* Module owning the timer. */
+    RedisModuleTimerProc callback;  /* Callback called when the timer fires. */
+    void *data;                     /* Private data passed to the callback. */
+    int dbid;                       /* Database selected in the callback. */
+} RedisModuleTimer;
+
+/* Pending module timers, indexed by the id of their time event. */
+static rax *moduleTimers;
+
+/* Static client recycled for all the timer callbacks. */
+static client *moduleTimersClient;
+
 /* --------------------------------------------------------------------------
  * Prototypes
  * -------------------------------------------------------------------------- */
@@ -664,6 +709,7 @@ int RM_CreateCommand(RedisModuleCtx *ctx, const char *name, RedisModuleCmdFunc c
     cp->rediscmd->keystep = keystep;
     cp->rediscmd->microseconds = 0;
     cp->rediscmd->calls = 0;
+    cp->rediscmd->latency_histogram = NULL;
     dictAdd(server.commands,sdsdup(cmdname),cp->rediscmd);
     dictAdd(server.orig_commands,sdsdup(cmdname),cp->rediscmd);
     return REDISMODULE_OK;
@@ -1251,7 +1297,7 @@ int RM_Replicate(RedisModuleCtx *ctx, const char *cmdname, const char *fmt, ...)
     /* Release the argv. */
     for (j = 0; j < argc; j++) decrRefCount(argv[j]);
     zfree(argv);
-    server.dirty++;
+    incrDirty(1);
     return REDISMODULE_OK;
 }
 
@@ -1270,7 +1316,7 @@ int RM_ReplicateVerbatim(RedisModuleCtx *ctx) {
     alsoPropagate(ctx->client->cmd,ctx->client->db->id,
         ctx->client->argv,ctx->client->argc,
         PROPAGATE_AOF|PROPAGATE_REPL);
-    server.dirty++;
+    incrDirty(1);
     return REDISMODULE_OK;
 }
 
@@ -1398,9 +1444,19 @@ int RM_SelectDb(RedisModuleCtx *ctx, int newid) {
  * value. */
 void *RM_OpenKey(RedisModuleCtx *ctx, robj *keyname, int mode) {
     RedisModuleKey *kp;
-    robj *value;
-
-    if (mode & REDISMODULE_WRITE) {
+    robj *value, *decoded = NULL;
+
+    if (ctx->flags & REDISMODULE_CTX_THREAD_SAFE_READ) {
+        /* Other threads may be reading the dataset right now: only
+         * read only keys can be opened, and the lookup must not have
+         * any side effect, so compressed values are not decompressed
+         * in place: the key gets a private uncompressed copy. */
+        if (mode & REDISMODULE_WRITE) return NULL;
+        value = lookupKeyReadNoSideEffects(ctx->client->db,keyname);
+        if (value == NULL) return NULL;
+        if (value->encoding == OBJ_ENCODING_COMPRESSED)
+            value = decoded = compressionDecodeObject(value);
+    } else if (mode & REDISMODULE_WRITE) {
         value = lookupKeyWrite(ctx->client->db,keyname);
     } else {
         value = lookupKeyRead(ctx->client->db,keyname);
@@ -1416,6 +1472,7 @@ void *RM_OpenKey(RedisModuleCtx *ctx, robj *keyname, int mode) {
     kp->key = keyname;
     incrRefCount(keyname);
     kp->value = value;
+    kp->decoded = decoded;
     kp->iter = NULL;
     kp->mode = mode;
     zsetKeyReset(kp);
@@ -1429,6 +1486,7 @@ void RM_CloseKey(RedisModuleKey *key) {
     if (key->mode & REDISMODULE_WRITE) signalModifiedKey(key->db,key->key);
     /* TODO: if (key->iter) RM_KeyIteratorStop(kp); */
     RM_ZsetRangeStop(key);
+    if (key->decoded) decrRefCount(key->decoded);
     decrRefCount(key->key);
     autoMemoryFreed(key->ctx,REDISMODULE_AM_KEY,key);
     zfree(key);
@@ -2622,6 +2680,13 @@ RedisModuleCallReply *RM_Call(RedisModuleCtx *ctx, const char *cmdname, const ch
     RedisModuleCallReply *reply = NULL;
     int replicate = 0; /* Replicate this command? */
 
+    /* Commands may have side effects on the dataset (expires, stats,
+     * propagation), so they can't run while the GIL is shared. */
+    if (ctx->flags & REDISMODULE_CTX_THREAD_SAFE_READ) {
+        errno = EPERM;
+        return NULL;
+    }
+
     cmd = lookupCommandByCString((char*)cmdname);
     if (!cmd) {
         errno = EINVAL;
@@ -2884,6 +2949,9 @@ void moduleTypeNameByID(char *name, uint64_t moduleid) {
  *          // Optional fields
  *          .digest = myType_DigestCallBack,
  *          .mem_usage = myType_MemUsageCallBack,
+ *          .free_effort = myType_FreeEffortCallBack,
+ *          .unlink = myType_UnlinkCallBack,
+ *          .defrag = myType_DefragCallBack,
  *      }
  *
  * * **rdb_load**: A callback function pointer that loads data from RDB files.
@@ -2891,6 +2959,22 @@ void moduleTypeNameByID(char *name, uint64_t moduleid) {
  * * **aof_rewrite**: A callback function pointer that rewrites data as commands.
  * * **digest**: A callback function pointer that is used for `DEBUG DIGEST`.
  * * **free**: A callback function pointer that can free a type value.
+ * * **free_effort**: A callback function pointer used to decide if the value
+ *   should be freed in a background thread by UNLINK and the other lazy free
+ *   paths. It returns the number of allocations the value is composed of:
+ *   above a small threshold the value is freed asynchronously, and 0 means
+ *   to always free it asynchronously. Types implementing this method must
+ *   have a **free** callback that is safe to call from another thread.
+ * * **unlink**: A callback function pointer called in the main thread when
+ *   a key holding the value is removed from the keyspace, before the value
+ *   is freed, possibly asynchronously. It is also called for every value of
+ *   the type when the database is emptied (FLUSHDB, FLUSHALL, full resync
+ *   of a replica, DEBUG RELOAD).
+ * * **defrag**: A callback function pointer called by active defragmentation
+ *   for every value of the type, see RedisModule_DefragAlloc().
+ *
+ * The **free_effort**, **unlink** and **defrag** fields require the methods
+ * structure version to be at least 2.
  *
  * The **digest* and **mem_usage** methods should currently be omitted since
  * they are not yet implemented inside the Redis modules core.
@@ -2929,6 +3013,11 @@ moduleType *RM_CreateDataType(RedisModuleCtx *ctx, const char *name, int encver,
         moduleTypeMemUsageFunc mem_usage;
         moduleTypeDigestFunc digest;
         moduleTypeFreeFunc free;
+        struct {
+            moduleTypeFreeEffortFunc free_effort;
+            moduleTypeUnlinkFunc unlink;
+            moduleTypeDefragFunc defrag;
+        } v2;
     } *tms = (struct typemethods*) typemethods_ptr;
 
     moduleType *mt = zcalloc(sizeof(*mt));
@@ -2940,6 +3029,12 @@ moduleType *RM_CreateDataType(RedisModuleCtx *ctx, const char *name, int encver,
     mt->mem_usage = tms->mem_usage;
     mt->digest = tms->digest;
     mt->free = tms->free;
+    if (typemethods_version >= 2) {
+        mt->free_effort = tms->v2.free_effort;
+        mt->unlink = tms->v2.unlink;
+        mt->defrag = tms->v2.defrag;
+        if (mt->unlink) module_unlink_types++;
+    }
     memcpy(mt->name,name,sizeof(mt->name));
     listAddNodeTail(ctx->module->types,mt);
     return mt;
@@ -2986,6 +3081,158 @@ void *RM_ModuleTypeGetValue(RedisModuleKey *key) {
     return mv->value;
 }
 
+/* --------------------------------------------------------------------------
+ * Lazy free and active defragmentation of module values
+ * -------------------------------------------------------------------------- */
+
+/* Context passed to the module type 'defrag' callback. */
+struct RedisModuleDefragCtx {
+    long long endtime;      /* Unix time in microseconds at which to stop. */
+    unsigned long *cursor;  /* Resume cursor, see RM_DefragCursorSet(). */
+    int resumed;            /* True if the defrag of the value is resumed. */
+    long long defragged;    /* Number of allocations moved. */
+};
+typedef struct RedisModuleDefragCtx RedisModuleDefragCtx;
+
+/* Return the free effort of a module value, as reported by the type
+ * 'free_effort' method. Without the method the value is considered a single
+ * allocation, and is freed synchronously. A module returning 0 asks for the
+ * value to always be freed asynchronously. */
+size_t moduleGetFreeEffort(robj *key, robj *val) {
+    moduleValue *mv = val->ptr;
+    moduleType *mt = mv->type;
+    size_t effort;
+
+    if (mt->free_effort == NULL) return 1;
+    effort = mt->free_effort(key,mv->value);
+    return effort == 0 ? ULONG_MAX : effort;
+}
+
+/* Called when the key 'key' holding 'val' is removed from the keyspace,
+ * before the value is released: if this is a module value with an 'unlink'
+ * method, let the module know. */
+void moduleNotifyKeyUnlink(robj *key, robj *val) {
+    if (val->type == OBJ_MODULE) {
+        moduleValue *mv = val->ptr;
+        moduleType *mt = mv->type;
+        if (mt->unlink != NULL) mt->unlink(key,mv->value);
+    }
+}
+
+/* Called by emptyDb() before the keys of 'db' are released: call the
+ * 'unlink' method of every module value in the database. The keyspace is
+ * only scanned if some module type has an 'unlink' method. */
+void moduleNotifyDbUnlink(redisDb *db) {
+    dictIterator *di;
+    dictEntry *de;
+
+    if (module_unlink_types == 0 || dictSize(db->dict) == 0) return;
+    di = dictGetSafeIterator(db->dict);
+    while((de = dictNext(di)) != NULL) {
+        robj keyobj;
+
+        initStaticStringObject(keyobj,dictGetKey(de));
+        moduleNotifyKeyUnlink(&keyobj,dictGetVal(de));
+    }
+    dictReleaseIterator(di);
+}
+
+/* Defrag the module value 'value' stored at 'key', calling the type
+ * 'defrag' method. The moduleValue allocation itself is always handled
+ * here. 'resumed' is 0 when starting to defrag the value, and 1 when the
+ * work previously interrupted is resumed: '*cursor' is then the cursor set
+ * by the module at that time, and is updated again if the work is
+ * interrupted once more.
+ *
+ * Returns 1 if the module needs more time to defrag the value (so the
+ * function should be called again later with the same cursor), otherwise 0.
+ * The number of moved allocations is added to '*defragged'. */
+int moduleDefragValue(robj *key, robj *value, unsigned long *cursor, int resumed, long long endtime, long long *defragged) {
+    moduleValue *mv = value->ptr, *newmv;
+    moduleType *mt = mv->type;
+    RedisModuleDefragCtx ctx = {endtime, cursor, resumed, 0};
+    int retval;
+
+    if (!resumed && (newmv = activeDefragAlloc(mv))) {
+        (*defragged)++;
+        value->ptr = mv = newmv;
+    }
+    if (mt->defrag == NULL) return 0;
+
+    retval = mt->defrag(&ctx,key,&mv->value);
+    *defragged += ctx.defragged;
+    if (retval == 0) *cursor = 0;
+    return retval != 0;
+}
+
+/* Defrag an allocation done with RedisModule_Alloc() or the other module
+ * allocation functions. This is meant to be called from the type 'defrag'
+ * callback, which must update its references to the returned pointer.
+ *
+ * If NULL is returned the allocation was not moved and 'ptr' is still valid.
+ * Otherwise the old pointer was released and must not be accessed anymore.
+ *
+ * The 'defrag' callback of a type receives a pointer to the value, so it can
+ * also replace the top level allocation of the value itself. For instance:
+ *
+ *     int myType_DefragCallBack(RedisModuleDefragCtx *ctx,
+ *                               RedisModuleString *key, void **value)
+ *     {
+ *         struct myType *newval, *v = *value;
+ *         if ((newval = RedisModule_DefragAlloc(ctx,v))) *value = v = newval;
+ *         ... defrag the allocations referenced by 'v' ...
+ *         return 0;
+ *     }
+ *
+ * The callback returns 0 when the value was completely processed. Large
+ * values should check RedisModule_DefragShouldStop() from time to time and,
+ * when it returns true, save where they stopped with
+ * RedisModule_DefragCursorSet() and return 1: the callback will be called
+ * again in a later defrag cycle, and RedisModule_DefragCursorGet() will
+ * return the saved cursor. Note that the key may be modified between calls,
+ * so the cursor should be something the module can validate. */
+void *RM_DefragAlloc(RedisModuleDefragCtx *ctx, void *ptr) {
+    void *newptr = activeDefragAlloc(ptr);
+    if (newptr) ctx->defragged++;
+    return newptr;
+}
+
+/* Like RedisModule_DefragAlloc() but for a string retained by the module
+ * value. Returns the new string pointer, or NULL if it was not moved. */
+RedisModuleString *RM_DefragRedisModuleString(RedisModuleDefragCtx *ctx, RedisModuleString *str) {
+    int defragged = 0;
+    robj *newstr = activeDefragStringOb(str,&defragged);
+    ctx->defragged += defragged;
+    return newstr;
+}
+
+/* Return non-zero if the defrag callback used all the time of the current
+ * defrag cycle, and should save its cursor and return 1. */
+int RM_DefragShouldStop(RedisModuleDefragCtx *ctx) {
+    return ustime() > ctx->endtime;
+}
+
+/* Save the position reached by the defrag callback, in order to resume
+ * from it the next time the callback is called for the same key. */
+int RM_DefragCursorSet(RedisModuleDefragCtx *ctx, unsigned long cursor) {
+    *ctx->cursor = cursor;
+    return REDISMODULE_OK;
+}
+
+/* Store in '*cursor' the value saved with RedisModule_DefragCursorSet() the
+ * last time the defrag callback was interrupted for the current key, and
+ * return REDISMODULE_OK. Returns REDISMODULE_ERR (and sets the cursor to 0)
+ * if this is the first call for the key, that is, the defrag of the value
+ * starts from scratch. Note that 0 is a valid saved cursor. */
+int RM_DefragCursorGet(RedisModuleDefragCtx *ctx, unsigned long *cursor) {
+    if (!ctx->resumed) {
+        *cursor = 0;
+        return REDISMODULE_ERR;
+    }
+    *cursor = *ctx->cursor;
+    return REDISMODULE_OK;
+}
+
 /* --------------------------------------------------------------------------
  * RDB loading and saving functions
  * -------------------------------------------------------------------------- */
@@ -3680,18 +3927,182 @@ void RM_ThreadSafeContextLock(RedisModuleCtx *ctx) {
     moduleAcquireGIL();
 }
 
-/* Release the server lock after a thread safe API call was executed. */
+/* Acquire the server lock in shared mode. Multiple threads can hold the
+ * lock in shared mode at the same time, and only while the main thread is
+ * not touching the dataset, so this is the right lock to take when the
+ * thread only needs to read keys, for instance in order to run a CPU heavy
+ * aggregation without blocking the server nor serializing with other module
+ * threads.
+ *
+ * While the lock is held in shared mode only a subset of the API can be used:
+ * keys can be opened only with REDISMODULE_READ (opening a key for writing
+ * returns NULL), and they are looked up without side effects, so logically
+ * expired keys are reported as missing but are not deleted, and their access
+ * time is not updated. RedisModule_Call() is not allowed and returns NULL
+ * with errno set to EPERM.
+ *
+ * The lock is not recursive: a thread already holding it in any mode must
+ * not try to acquire it again. Release it with
+ * RedisModule_ThreadSafeContextUnlock(). */
+void RM_ThreadSafeContextReadLock(RedisModuleCtx *ctx) {
+    pthread_rwlock_rdlock(&moduleGIL);
+    ctx->flags |= REDISMODULE_CTX_THREAD_SAFE_READ;
+}
+
+/* Release the server lock after a thread safe API call was executed.
+ * This works for both the exclusive and the shared mode. */
 void RM_ThreadSafeContextUnlock(RedisModuleCtx *ctx) {
-    DICT_NOTUSED(ctx);
+    ctx->flags &= ~REDISMODULE_CTX_THREAD_SAFE_READ;
     moduleReleaseGIL();
 }
 
 void moduleAcquireGIL(void) {
-    pthread_mutex_lock(&moduleGIL);
+    pthread_rwlock_wrlock(&moduleGIL);
 }
 
 void moduleReleaseGIL(void) {
-    pthread_mutex_unlock(&moduleGIL);
+    pthread_rwlock_unlock(&moduleGIL);
+}
+
+/* --------------------------------------------------------------------------
+ * Module Thread Pools
+ * -------------------------------------------------------------------------- */
+
+void RM_FreeThreadPool(RedisModuleThreadPool *pool);
+
+/* Worker thread main loop: wait for jobs and run them until the pool
+ * is released and the queue drained. */
+static void *moduleThreadPoolMain(void *arg) {
+    RedisModuleThreadPool *pool = arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    while(1) {
+        listNode *ln;
+        RedisModuleThreadPoolJob *job;
+
+        if (listLength(pool->jobs) == 0) {
+            if (pool->shutdown) break;
+            pthread_cond_wait(&pool->newjob_cond,&pool->mutex);
+            continue;
+        }
+        ln = listFirst(pool->jobs);
+        job = ln->value;
+        listDelNode(pool->jobs,ln);
+
+        /* Run the job without holding the queue lock. */
+        pthread_mutex_unlock(&pool->mutex);
+        job->func(job->privdata);
+        zfree(job);
+        pthread_mutex_lock(&pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+/* Create a pool of 'numthreads' threads that will execute the jobs submitted
+ * with RedisModule_ThreadPoolSubmit(). This is the building block to move
+ * CPU heavy work out of the event loop: a command usually blocks the client
+ * with RedisModule_BlockClient(), submits a job, and the job uses a thread
+ * safe context, taking the lock with RedisModule_ThreadSafeContextReadLock()
+ * when it only needs to read the dataset.
+ *
+ * Returns NULL if 'numthreads' is out of range or the threads can't be
+ * created. */
+RedisModuleThreadPool *RM_CreateThreadPool(RedisModuleCtx *ctx, int numthreads) {
+    RedisModuleThreadPool *pool;
+    pthread_attr_t attr;
+    size_t stacksize;
+    int j;
+
+    if (numthreads <= 0 || numthreads > REDISMODULE_THREADPOOL_MAX_THREADS)
+        return NULL;
+
+    pool = zmalloc(sizeof(*pool));
+    pool->module = ctx->module;
+    pool->threads = zmalloc(sizeof(pthread_t)*numthreads);
+    pool->numthreads = 0;
+    pool->jobs = listCreate();
+    pool->shutdown = 0;
+    pthread_mutex_init(&pool->mutex,NULL);
+    pthread_cond_init(&pool->newjob_cond,NULL);
+
+    /* Use the same stack size policy of the bio.c threads. */
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr,&stacksize);
+    if (!stacksize) stacksize = 1; /* The world is full of Solaris Fixes */
+    while (stacksize < REDIS_THREAD_STACK_SIZE) stacksize *= 2;
+    pthread_attr_setstacksize(&attr, stacksize);
+
+    for (j = 0; j < numthreads; j++) {
+        if (pthread_create(&pool->threads[j],&attr,moduleThreadPoolMain,pool)
+            != 0)
+        {
+            serverLog(LL_WARNING,
+                "Module %s: can't create thread pool worker: %s",
+                ctx->module ? ctx->module->name : "<unknown>",
+                strerror(errno));
+            pthread_attr_destroy(&attr);
+            RM_FreeThreadPool(pool);
+            return NULL;
+        }
+        pool->numthreads++;
+    }
+    pthread_attr_destroy(&attr);
+    return pool;
+}
+
+/* Queue a job for execution: 'func' will be called with 'privdata' as
+ * argument by one of the pool threads. Returns REDISMODULE_OK, or
+ * REDISMODULE_ERR if the pool is being released. */
+int RM_ThreadPoolSubmit(RedisModuleThreadPool *pool, RedisModuleThreadPoolJobFunc func, void *privdata) {
+    RedisModuleThreadPoolJob *job = zmalloc(sizeof(*job));
+
+    job->func = func;
+    job->privdata = privdata;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->shutdown) {
+        pthread_mutex_unlock(&pool->mutex);
+        zfree(job);
+        return REDISMODULE_ERR;
+    }
+    listAddNodeTail(pool->jobs,job);
+    pthread_cond_signal(&pool->newjob_cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return REDISMODULE_OK;
+}
+
+/* Return the number of jobs queued and not yet picked by a thread. */
+size_t RM_ThreadPoolPendingJobs(RedisModuleThreadPool *pool) {
+    size_t pending;
+
+    pthread_mutex_lock(&pool->mutex);
+    pending = listLength(pool->jobs);
+    pthread_mutex_unlock(&pool->mutex);
+    return pending;
+}
+
+/* Release the thread pool. Jobs already queued are executed before the
+ * threads exit, and the function waits for all of them to terminate.
+ *
+ * Must not be called from a pool thread, nor while holding the server lock
+ * if queued jobs may need to acquire it: from the main thread this means
+ * that jobs taking the lock must be completed before releasing the pool. */
+void RM_FreeThreadPool(RedisModuleThreadPool *pool) {
+    int j;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->newjob_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (j = 0; j < pool->numthreads; j++)
+        pthread_join(pool->threads[j],NULL);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->newjob_cond);
+    listRelease(pool->jobs);
+    zfree(pool->threads);
+    zfree(pool);
 }
 
 
@@ -3808,6 +4219,141 @@ void moduleUnsubscribeNotifications(RedisModule *module) {
     }
 }
 
+/* --------------------------------------------------------------------------
+ * Module Timers API
+ *
+ * Module timers are one-shot timers served by the Redis event loop, so they
+ * fire in the main thread with the GIL held, like commands. Pending timers
+ * are stored in a heap, so creating and stopping them is O(log(N)) even when
+ * there are many.
+ * -------------------------------------------------------------------------- */
+
+/* The time proc of module timers: call the module callback and release the
+ * timer, which is never rescheduled. */
+static int moduleTimerHandler(aeEventLoop *eventLoop, long long id,
+                              void *clientData)
+{
+    RedisModuleTimer *timer = clientData;
+    RedisModuleCtx ctx = REDISMODULE_CTX_INIT;
+    UNUSED(eventLoop);
+
+    /* Remove the timer first, so that stopping it from the callback fails
+     * as expected. */
+    raxRemove(moduleTimers,(unsigned char*)&id,sizeof(id),NULL);
+    if (server.read_threads) readThreadsWait();
+    ctx.module = timer->module;
+    ctx.client = moduleTimersClient;
+    selectDb(ctx.client,timer->dbid);
+    timer->callback(&ctx,timer->data);
+    moduleFreeContext(&ctx);
+    zfree(timer);
+    return AE_NOMORE;
+}
+
+static uint64_t moduleCreateTimer(RedisModuleCtx *ctx, long long period_us,
+                                  RedisModuleTimerProc callback, void *data)
+{
+    RedisModuleTimer *timer = zmalloc(sizeof(*timer));
+    long long id;
+
+    timer->module = ctx->module;
+    timer->callback = callback;
+    timer->data = data;
+    timer->dbid = ctx->client ? ctx->client->db->id : 0;
+    if (period_us < 0) period_us = 0;
+    id = aeCreateTimeEventUs(server.el,period_us,moduleTimerHandler,timer,
+                             NULL);
+    raxInsert(moduleTimers,(unsigned char*)&id,sizeof(id),timer,NULL);
+    return id;
+}
+
+/* Create a new timer that will fire after `period` milliseconds, and will
+ * call the specified function using `data` as argument. The returned timer
+ * ID can be used to get information from the timer or to stop it before it
+ * fires.
+ *
+ * The callback signature is:
+ *
+ *   void (*RedisModuleTimerProc)(RedisModuleCtx *ctx, void *data);
+ *
+ * The context has the database selected when the timer was created as its
+ * selected db, and can't be used to reply to any client. Timers fire only
+ * once: to have a periodic timer, create a new one from the callback. */
+uint64_t RM_CreateTimer(RedisModuleCtx *ctx, mstime_t period,
+                        RedisModuleTimerProc callback, void *data)
+{
+    return moduleCreateTimer(ctx,period*1000,callback,data);
+}
+
+/* Like RedisModule_CreateTimer(), but the period is in microseconds. How
+ * close to the deadline the timer fires depends on the multiplexing API
+ * used by the event loop: with epoll, timers may fire up to a millisecond
+ * late. */
+uint64_t RM_CreateTimerUs(RedisModuleCtx *ctx, long long period,
+                          RedisModuleTimerProc callback, void *data)
+{
+    return moduleCreateTimer(ctx,period,callback,data);
+}
+
+/* Stop a timer, returning REDISMODULE_OK if the timer was found, belonged
+ * to the calling module, and was stopped, otherwise REDISMODULE_ERR is
+ * returned. If not NULL, the data pointer is set to the value of the data
+ * argument when the timer was created. */
+int RM_StopTimer(RedisModuleCtx *ctx, uint64_t id, void **data) {
+    long long llid = id;
+    RedisModuleTimer *timer = raxFind(moduleTimers,(unsigned char*)&llid,
+                                      sizeof(llid));
+
+    if (timer == raxNotFound || timer->module != ctx->module)
+        return REDISMODULE_ERR;
+    if (data) *data = timer->data;
+    raxRemove(moduleTimers,(unsigned char*)&llid,sizeof(llid),NULL);
+    aeDeleteTimeEvent(server.el,llid);
+    zfree(timer);
+    return REDISMODULE_OK;
+}
+
+/* Obtain information about a timer: its remaining time before firing, in
+ * milliseconds, and the private data pointer associated with the timer.
+ * If the timer specified does not exist or belongs to a different module
+ * no information is returned and the function returns REDISMODULE_ERR,
+ * otherwise REDISMODULE_OK is returned. The arguments remaining or data
+ * can be NULL if the caller does not need certain information. */
+int RM_GetTimerInfo(RedisModuleCtx *ctx, uint64_t id, uint64_t *remaining,
+                    void **data)
+{
+    long long llid = id;
+    RedisModuleTimer *timer = raxFind(moduleTimers,(unsigned char*)&llid,
+                                      sizeof(llid));
+
+    if (timer == raxNotFound || timer->module != ctx->module)
+        return REDISMODULE_ERR;
+    if (remaining)
+        *remaining = aeTimeEventRemainingUs(server.el,llid)/1000;
+    if (data) *data = timer->data;
+    return REDISMODULE_OK;
+}
+
+/* Stop all the timers of a module being unloaded. */
+void moduleStopTimers(RedisModule *module) {
+    raxIterator ri;
+
+    raxStart(&ri,moduleTimers);
+    raxSeek(&ri,"^",NULL,0);
+    while (raxNext(&ri)) {
+        RedisModuleTimer *timer = ri.data;
+        long long id;
+
+        if (timer->module != module) continue;
+        memcpy(&id,ri.key,sizeof(id));
+        aeDeleteTimeEvent(server.el,id);
+        raxRemove(moduleTimers,ri.key,ri.key_len,NULL);
+        zfree(timer);
+        raxSeek(&ri,">",ri.key,ri.key_len);
+    }
+    raxStop(&ri);
+}
+
 /* --------------------------------------------------------------------------
  * Modules API internals
  * -------------------------------------------------------------------------- */
@@ -3853,6 +4399,10 @@ void moduleInitModulesSystem(void) {
     moduleKeyspaceSubscribersClient = createClient(-1);
     moduleKeyspaceSubscribersClient->flags |= CLIENT_MODULE;
 
+    moduleTimers = raxNew();
+    moduleTimersClient = createClient(-1);
+    moduleTimersClient->flags |= CLIENT_MODULE;
+
     moduleRegisterCoreAPI();
     if (pipe(server.module_blocked_pipe) == -1) {
         serverLog(LL_WARNING,
@@ -3864,10 +4414,27 @@ void moduleInitModulesSystem(void) {
      * and we do not want to block not in the read nor in the write half. */
     anetNonBlock(NULL,server.module_blocked_pipe[0]);
     anetNonBlock(NULL,server.module_blocked_pipe[1]);
+}
 
-    /* Our thread-safe contexts GIL must start with already locked:
-     * it is just unlocked when it's safe. */
-    pthread_mutex_lock(&moduleGIL);
+/* Initialize the thread-safe contexts GIL. This is called by initServer(),
+ * after daemonize(): a read-write lock can only be released by the thread
+ * that locked it, so it must be locked by the main thread of the final
+ * process.
+ *
+ * The lock must start already locked: it is just unlocked when it's safe.
+ * When available, writers are preferred: otherwise module threads
+ * continuously taking the lock in shared mode could starve the main thread
+ * in afterSleep(). */
+void moduleInitGIL(void) {
+    pthread_rwlockattr_t gilattr;
+    pthread_rwlockattr_init(&gilattr);
+#if defined(__linux__) && defined(__GLIBC__)
+    pthread_rwlockattr_setkind_np(&gilattr,
+        PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&moduleGIL,&gilattr);
+    pthread_rwlockattr_destroy(&gilattr);
+    pthread_rwlock_wrlock(&moduleGIL);
 }
 
 /* Load all the modules in the server.loadmodule_queue list, which is
@@ -3988,6 +4555,9 @@ int moduleUnload(sds name) {
     /* Remvoe any noification subscribers this module might have */
     moduleUnsubscribeNotifications(module);
 
+    /* Stop the timers the module didn't fire yet. */
+    moduleStopTimers(module);
+
     /* Unregister all the hooks. TODO: Yet no hooks support here. */
 
     /* Unload the dynamic library. */
@@ -4182,8 +4752,22 @@ void moduleRegisterCoreAPI(void) {
     REGISTER_API(FreeThreadSafeContext);
     REGISTER_API(ThreadSafeContextLock);
     REGISTER_API(ThreadSafeContextUnlock);
+    REGISTER_API(ThreadSafeContextReadLock);
+    REGISTER_API(CreateThreadPool);
+    REGISTER_API(ThreadPoolSubmit);
+    REGISTER_API(ThreadPoolPendingJobs);
+    REGISTER_API(FreeThreadPool);
+    REGISTER_API(DefragAlloc);
+    REGISTER_API(DefragRedisModuleString);
+    REGISTER_API(DefragShouldStop);
+    REGISTER_API(DefragCursorSet);
+    REGISTER_API(DefragCursorGet);
     REGISTER_API(DigestAddStringBuffer);
     REGISTER_API(DigestAddLongLong);
     REGISTER_API(DigestEndSequence);
     REGISTER_API(SubscribeToKeyspaceEvents);
+    REGISTER_API(CreateTimer);
+    REGISTER_API(CreateTimerUs);
+    REGISTER_API(StopTimer);
+    REGISTER_API(GetTimerInfo);
 }
@@ -176,6 +176,75 @@ int HelloKeys_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int ar
     return REDISMODULE_OK;
 }
 
+/* Thread pool used by HELLO.ZSUM, created when the module is loaded. */
+static RedisModuleThreadPool *HelloPool;
+
+/* The job executed by the thread pool for HELLO.ZSUM: sum all the scores of
+ * the sorted set. The GIL is only taken in shared mode, so multiple HELLO.ZSUM
+ * calls can scan their sorted sets at the same time. */
+void HelloZsum_Job(void *arg) {
+    void **targ = arg;
+    RedisModuleBlockedClient *bc = targ[0];
+    RedisModuleString *keyname = targ[1];
+    RedisModule_Free(targ);
+
+    RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(bc);
+    double sum = 0;
+    int wrongtype = 0;
+
+    RedisModule_ThreadSafeContextReadLock(ctx);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx,keyname,REDISMODULE_READ);
+    if (key && RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_ZSET) {
+        wrongtype = 1;
+    } else if (key) {
+        RedisModule_ZsetFirstInScoreRange(key,REDISMODULE_NEGATIVE_INFINITE,
+            REDISMODULE_POSITIVE_INFINITE,0,0);
+        while(!RedisModule_ZsetRangeEndReached(key)) {
+            double score;
+            RedisModuleString *ele =
+                RedisModule_ZsetRangeCurrentElement(key,&score);
+            RedisModule_FreeString(ctx,ele);
+            sum += score;
+            RedisModule_ZsetRangeNext(key);
+        }
+        RedisModule_ZsetRangeStop(key);
+    }
+    RedisModule_CloseKey(key);
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    if (wrongtype)
+        RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    else
+        RedisModule_ReplyWithDouble(ctx,sum);
+    RedisModule_FreeString(ctx,keyname);
+    RedisModule_FreeThreadSafeContext(ctx);
+    RedisModule_UnblockClient(bc,NULL);
+}
+
+/* HELLO.ZSUM <key> -- Return the sum of the scores of the sorted set at
+ * <key>, computing it in the module thread pool. */
+int HelloZsum_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+
+    RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx,NULL,NULL,NULL,0);
+
+    /* The key name must survive the command callback: pass a private copy
+     * to the job, that will release it. */
+    void **targ = RedisModule_Alloc(sizeof(void*)*2);
+    targ[0] = bc;
+    targ[1] = RedisModule_CreateStringFromString(ctx,argv[1]);
+
+    if (RedisModule_ThreadPoolSubmit(HelloPool,HelloZsum_Job,targ) !=
+        REDISMODULE_OK)
+    {
+        RedisModule_FreeString(ctx,targ[1]);
+        RedisModule_Free(targ);
+        RedisModule_AbortBlock(bc);
+        return RedisModule_ReplyWithError(ctx,"-ERR Can't submit job");
+    }
+    return REDISMODULE_OK;
+}
+
 /* This function must be present on each Redis module. It is used in order to
  * register the commands into the Redis server. */
 int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -191,6 +260,12 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
     if (RedisModule_CreateCommand(ctx,"hello.keys",
         HelloKeys_RedisCommand,"",0,0,0) == REDISMODULE_ERR)
         return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx,"hello.zsum",
+        HelloZsum_RedisCommand,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    HelloPool = RedisModule_CreateThreadPool(ctx,4);
+    if (HelloPool == NULL) return REDISMODULE_ERR;
 
     return REDISMODULE_OK;
 }
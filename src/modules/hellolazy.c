@@ -0,0 +1,313 @@
+/* Lazy free and active defragmentation example -- a module data type
+ * implementing the free_effort, unlink and defrag type methods.
+ *
+ * A "hellolazy" value is a vector of separately allocated 64 bit integers,
+ * every element holding its own position: something large enough to be
+ * worth freeing in the background, and made of many allocations that active
+ * defragmentation may move.
+ *
+ * HELLOLAZY.STATS reports how many times the type methods were called, and
+ * how many values were freed outside the main thread. When the module is
+ * loaded with the "defrag-step <count>" arguments, the defrag method yields
+ * after 'count' elements even if it still has time, in order to show how the
+ * work is resumed with the defrag cursor.
+ *
+ * -----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../redismodule.h"
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+
+static RedisModuleType *HelloLazyType;
+static pthread_t main_thread;
+static long long defrag_step = 0;   /* Elements per defrag call, 0 = no limit. */
+
+/* Calls of the type methods. The free method may be called by the lazy free
+ * thread, so the counters are updated atomically. */
+static long long stat_unlinked, stat_freed, stat_freed_async;
+static long long stat_defrag_calls, stat_defrag_resumed, stat_defrag_moved;
+
+#define statIncr(var,n) __atomic_add_fetch(&(var),(n),__ATOMIC_RELAXED)
+#define statGet(var) __atomic_load_n(&(var),__ATOMIC_RELAXED)
+
+/* ========================== Internal data structure ======================= */
+
+typedef struct HelloLazyObject {
+    size_t len;
+    size_t size;
+    int64_t **items;
+} HelloLazyObject;
+
+HelloLazyObject *createHelloLazyObject(void) {
+    HelloLazyObject *o = RedisModule_Alloc(sizeof(*o));
+    o->len = 0;
+    o->size = 0;
+    o->items = NULL;
+    return o;
+}
+
+/* Append 'count' elements to the vector. */
+void HelloLazyPush(HelloLazyObject *o, size_t count) {
+    if (o->len+count > o->size) {
+        o->size = (o->len+count)*2;
+        o->items = RedisModule_Realloc(o->items,sizeof(int64_t*)*o->size);
+    }
+    while(count--) {
+        int64_t *ele = RedisModule_Alloc(sizeof(*ele));
+        *ele = o->len;
+        o->items[o->len++] = ele;
+    }
+}
+
+void HelloLazyReleaseObject(HelloLazyObject *o) {
+    size_t j;
+
+    for (j = 0; j < o->len; j++) RedisModule_Free(o->items[j]);
+    RedisModule_Free(o->items);
+    RedisModule_Free(o);
+}
+
+/* ========================= "hellolazy" type commands ====================== */
+
+/* HELLOLAZY.PUSH key count -- Append 'count' elements, returning the new
+ * length of the vector. */
+int HelloLazyPush_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+    if (argc != 3) return RedisModule_WrongArity(ctx);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx,argv[1],
+        REDISMODULE_READ|REDISMODULE_WRITE);
+    int type = RedisModule_KeyType(key);
+    if (type != REDISMODULE_KEYTYPE_EMPTY &&
+        RedisModule_ModuleTypeGetType(key) != HelloLazyType)
+    {
+        return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+
+    long long count;
+    if (RedisModule_StringToLongLong(argv[2],&count) != REDISMODULE_OK ||
+        count < 0)
+    {
+        return RedisModule_ReplyWithError(ctx,"ERR invalid count");
+    }
+
+    HelloLazyObject *hlo;
+    if (type == REDISMODULE_KEYTYPE_EMPTY) {
+        hlo = createHelloLazyObject();
+        RedisModule_ModuleTypeSetValue(key,HelloLazyType,hlo);
+    } else {
+        hlo = RedisModule_ModuleTypeGetValue(key);
+    }
+    HelloLazyPush(hlo,count);
+
+    RedisModule_ReplyWithLongLong(ctx,hlo->len);
+    RedisModule_ReplicateVerbatim(ctx);
+    return REDISMODULE_OK;
+}
+
+/* HELLOLAZY.LEN key -- Return the length of the vector. */
+int HelloLazyLen_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    RedisModule_AutoMemory(ctx); /* Use automatic memory management. */
+
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    RedisModuleKey *key = RedisModule_OpenKey(ctx,argv[1],REDISMODULE_READ);
+    int type = RedisModule_KeyType(key);
+    if (type != REDISMODULE_KEYTYPE_EMPTY &&
+        RedisModule_ModuleTypeGetType(key) != HelloLazyType)
+    {
+        return RedisModule_ReplyWithError(ctx,REDISMODULE_ERRORMSG_WRONGTYPE);
+    }
+
+    HelloLazyObject *hlo = RedisModule_ModuleTypeGetValue(key);
+    return RedisModule_ReplyWithLongLong(ctx,hlo ? (long long)hlo->len : 0);
+}
+
+/* HELLOLAZY.STATS -- Return the calls of the type methods as a list of
+ * name / value pairs. */
+int HelloLazyStats_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+
+    if (argc != 1) return RedisModule_WrongArity(ctx);
+    RedisModule_ReplyWithArray(ctx,12);
+    RedisModule_ReplyWithSimpleString(ctx,"unlinked");
+    RedisModule_ReplyWithLongLong(ctx,stat_unlinked);
+    RedisModule_ReplyWithSimpleString(ctx,"freed");
+    RedisModule_ReplyWithLongLong(ctx,statGet(stat_freed));
+    RedisModule_ReplyWithSimpleString(ctx,"freed-async");
+    RedisModule_ReplyWithLongLong(ctx,statGet(stat_freed_async));
+    RedisModule_ReplyWithSimpleString(ctx,"defrag-calls");
+    RedisModule_ReplyWithLongLong(ctx,stat_defrag_calls);
+    RedisModule_ReplyWithSimpleString(ctx,"defrag-resumed");
+    RedisModule_ReplyWithLongLong(ctx,stat_defrag_resumed);
+    RedisModule_ReplyWithSimpleString(ctx,"defrag-moved");
+    RedisModule_ReplyWithLongLong(ctx,stat_defrag_moved);
+    return REDISMODULE_OK;
+}
+
+/* ========================== "hellolazy" type methods ====================== */
+
+void *HelloLazyRdbLoad(RedisModuleIO *rdb, int encver) {
+    if (encver != 0) return NULL;
+    HelloLazyObject *hlo = createHelloLazyObject();
+    HelloLazyPush(hlo,RedisModule_LoadUnsigned(rdb));
+    return hlo;
+}
+
+/* The elements hold their position, so the length describes the value. */
+void HelloLazyRdbSave(RedisModuleIO *rdb, void *value) {
+    HelloLazyObject *hlo = value;
+    RedisModule_SaveUnsigned(rdb,hlo->len);
+}
+
+void HelloLazyAofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *value) {
+    HelloLazyObject *hlo = value;
+    RedisModule_EmitAOF(aof,"HELLOLAZY.PUSH","sl",key,(long long)hlo->len);
+}
+
+size_t HelloLazyMemUsage(const void *value) {
+    const HelloLazyObject *hlo = value;
+    return sizeof(*hlo) + (sizeof(int64_t*)+sizeof(int64_t))*hlo->size;
+}
+
+/* Called in the main thread, or in the lazy free thread when the value was
+ * large enough according to HelloLazyFreeEffort(): the function must not
+ * access anything but the value itself. */
+void HelloLazyFree(void *value) {
+    HelloLazyReleaseObject(value);
+    statIncr(stat_freed,1);
+    if (!pthread_equal(pthread_self(),main_thread))
+        statIncr(stat_freed_async,1);
+}
+
+/* Every element is an allocation: UNLINK frees the vectors larger than a
+ * few dozens of elements in the background. */
+size_t HelloLazyFreeEffort(RedisModuleString *key, const void *value) {
+    const HelloLazyObject *hlo = value;
+    REDISMODULE_NOT_USED(key);
+    return hlo->len;
+}
+
+/* Called in the main thread when the key is deleted, overwritten or the
+ * database flushed, before the value is freed. A module keeping references
+ * to its values, for instance in an index, would remove them here. */
+void HelloLazyUnlink(RedisModuleString *key, const void *value) {
+    REDISMODULE_NOT_USED(key);
+    REDISMODULE_NOT_USED(value);
+    stat_unlinked++;
+}
+
+/* Move the value, the items array and the elements. Large vectors are
+ * processed in multiple calls, saving the position reached in the defrag
+ * cursor. The vector may have changed in the meantime: it can only grow or
+ * be replaced by a new value, so a cursor past its end just means the
+ * value is done. */
+int HelloLazyDefrag(RedisModuleDefragCtx *ctx, RedisModuleString *key, void **value) {
+    HelloLazyObject *newhlo, *hlo = *value;
+    unsigned long j = 0;
+    long long steps = 0;
+    void *newptr;
+    REDISMODULE_NOT_USED(key);
+
+    stat_defrag_calls++;
+    if (RedisModule_DefragCursorGet(ctx,&j) == REDISMODULE_OK) {
+        stat_defrag_resumed++;
+    } else {
+        if ((newhlo = RedisModule_DefragAlloc(ctx,hlo))) {
+            *value = hlo = newhlo;
+            stat_defrag_moved++;
+        }
+        if (hlo->items && (newptr = RedisModule_DefragAlloc(ctx,hlo->items))) {
+            hlo->items = newptr;
+            stat_defrag_moved++;
+        }
+    }
+
+    for (; j < hlo->len; j++, steps++) {
+        if ((defrag_step && steps == defrag_step) ||
+            ((steps & 63) == 0 && RedisModule_DefragShouldStop(ctx)))
+        {
+            RedisModule_DefragCursorSet(ctx,j);
+            return 1;
+        }
+        if ((newptr = RedisModule_DefragAlloc(ctx,hlo->items[j]))) {
+            hlo->items[j] = newptr;
+            stat_defrag_moved++;
+        }
+    }
+    return 0;
+}
+
+/* This function must be present on each Redis module. It is used in order to
+ * register the commands into the Redis server. */
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    if (RedisModule_Init(ctx,"hellolazy",1,REDISMODULE_APIVER_1)
+        == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (argc == 2 && !strcasecmp(RedisModule_StringPtrLen(argv[0],NULL),
+                                 "defrag-step"))
+    {
+        if (RedisModule_StringToLongLong(argv[1],&defrag_step) ==
+            REDISMODULE_ERR || defrag_step < 0) return REDISMODULE_ERR;
+    } else if (argc != 0) {
+        return REDISMODULE_ERR;
+    }
+    main_thread = pthread_self();
+
+    RedisModuleTypeMethods tm = {
+        .version = REDISMODULE_TYPE_METHOD_VERSION,
+        .rdb_load = HelloLazyRdbLoad,
+        .rdb_save = HelloLazyRdbSave,
+        .aof_rewrite = HelloLazyAofRewrite,
+        .mem_usage = HelloLazyMemUsage,
+        .free = HelloLazyFree,
+        .free_effort = HelloLazyFreeEffort,
+        .unlink = HelloLazyUnlink,
+        .defrag = HelloLazyDefrag
+    };
+
+    HelloLazyType = RedisModule_CreateDataType(ctx,"hellolazy",0,&tm);
+    if (HelloLazyType == NULL) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"hellolazy.push",
+        HelloLazyPush_RedisCommand,"write deny-oom",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"hellolazy.len",
+        HelloLazyLen_RedisCommand,"readonly",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"hellolazy.stats",
+        HelloLazyStats_RedisCommand,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    return REDISMODULE_OK;
+}
@@ -0,0 +1,129 @@
+/* Timer API example -- Setup timers, stop them, and get their remaining time.
+ *
+ * -----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define REDISMODULE_EXPERIMENTAL_API
+#include "../redismodule.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Key and value to set when a timer fires. */
+typedef struct HelloTimerData {
+    RedisModuleString *key;
+    RedisModuleString *value;
+} HelloTimerData;
+
+void HelloTimer_FreeData(RedisModuleCtx *ctx, HelloTimerData *td) {
+    RedisModule_FreeString(ctx,td->key);
+    RedisModule_FreeString(ctx,td->value);
+    RedisModule_Free(td);
+}
+
+/* Timer callback: set the key, in the db selected when the timer was
+ * created. */
+void HelloTimer_Handler(RedisModuleCtx *ctx, void *data) {
+    HelloTimerData *td = data;
+    RedisModuleCallReply *reply;
+
+    reply = RedisModule_Call(ctx,"SET","ss",td->key,td->value);
+    if (reply) RedisModule_FreeCallReply(reply);
+    HelloTimer_FreeData(ctx,td);
+}
+
+/* HELLOTIMER.SETAFTER <key> <value> <microseconds> -- Set the key after the
+ * specified number of microseconds, returning the ID of the timer. */
+int HelloTimerSetAfter_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    long long us;
+
+    if (argc != 4) return RedisModule_WrongArity(ctx);
+    if (RedisModule_StringToLongLong(argv[3],&us) != REDISMODULE_OK || us < 0)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid delay");
+
+    HelloTimerData *td = RedisModule_Alloc(sizeof(*td));
+    td->key = argv[1];
+    td->value = argv[2];
+    RedisModule_RetainString(ctx,td->key);
+    RedisModule_RetainString(ctx,td->value);
+    RedisModuleTimerID id = RedisModule_CreateTimerUs(ctx,us,
+                                                      HelloTimer_Handler,td);
+    return RedisModule_ReplyWithLongLong(ctx,id);
+}
+
+/* HELLOTIMER.STOP <id> -- Stop a timer, returning 1 if it was pending,
+ * otherwise 0. */
+int HelloTimerStop_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    long long id;
+    void *data;
+
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    if (RedisModule_StringToLongLong(argv[1],&id) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid timer ID");
+    if (RedisModule_StopTimer(ctx,id,&data) == REDISMODULE_ERR)
+        return RedisModule_ReplyWithLongLong(ctx,0);
+    HelloTimer_FreeData(ctx,data);
+    return RedisModule_ReplyWithLongLong(ctx,1);
+}
+
+/* HELLOTIMER.TTL <id> -- Return the milliseconds remaining before the timer
+ * fires, or -1 if no such timer is pending. */
+int HelloTimerTTL_RedisCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    long long id;
+    uint64_t remaining;
+
+    if (argc != 2) return RedisModule_WrongArity(ctx);
+    if (RedisModule_StringToLongLong(argv[1],&id) != REDISMODULE_OK)
+        return RedisModule_ReplyWithError(ctx,"ERR invalid timer ID");
+    if (RedisModule_GetTimerInfo(ctx,id,&remaining,NULL) == REDISMODULE_ERR)
+        return RedisModule_ReplyWithLongLong(ctx,-1);
+    return RedisModule_ReplyWithLongLong(ctx,remaining);
+}
+
+/* This function must be present on each Redis module. It is used in order to
+ * register the commands into the Redis server. */
+int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+    REDISMODULE_NOT_USED(argv);
+    REDISMODULE_NOT_USED(argc);
+
+    if (RedisModule_Init(ctx,"hellotimer",1,REDISMODULE_APIVER_1)
+        == REDISMODULE_ERR) return REDISMODULE_ERR;
+
+    if (RedisModule_CreateCommand(ctx,"hellotimer.setafter",
+        HelloTimerSetAfter_RedisCommand,"write",1,1,1) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx,"hellotimer.stop",
+        HelloTimerStop_RedisCommand,"",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+    if (RedisModule_CreateCommand(ctx,"hellotimer.ttl",
+        HelloTimerTTL_RedisCommand,"readonly",0,0,0) == REDISMODULE_ERR)
+        return REDISMODULE_ERR;
+
+    return REDISMODULE_OK;
+}
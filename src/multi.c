@@ -174,7 +174,7 @@ void execCommand(client *c) {
      * was already propagated. */
     if (must_propagate) {
         int is_master = server.masterhost == NULL;
-        server.dirty++;
+        incrDirty(1);
         /* If inside the MULTI/EXEC block this instance was suddenly
          * switched from master to slave (using the SLAVEOF command), the
          * initial MULTI was propagated into the replication backlog, but the
@@ -28,6 +28,7 @@
  */
 
 #include "server.h"
+#include "trace.h"
 #include "atomicvar.h"
 #include <sys/uio.h>
 #include <math.h>
@@ -128,14 +129,25 @@ client *createClient(int fd) {
     c->bpop.target = NULL;
     c->bpop.numreplicas = 0;
     c->bpop.reploffset = 0;
+    c->bpop.thread_usec = 0;
+    memset(&c->bpop.thread_stats,0,sizeof(c->bpop.thread_stats));
+    c->bpop.thread_close = 0;
     c->woff = 0;
     c->watched_keys = listCreate();
     c->pubsub_channels = dictCreate(&objectKeyPointerValueDictType,NULL);
     c->pubsub_patterns = listCreate();
     c->peerid = NULL;
+    c->tracking_redirection = 0;
+    c->tracking_prefixes = NULL;
+    c->shm = NULL;
     listSetFreeMethod(c->pubsub_patterns,decrRefCountVoid);
     listSetMatchMethod(c->pubsub_patterns,listMatchObjects);
-    if (fd != -1) listAddNodeTail(server.clients,c);
+    if (fd != -1) {
+        uint64_t id = htonu64(c->id);
+
+        listAddNodeTail(server.clients,c);
+        raxInsert(server.clients_index,(unsigned char*)&id,sizeof(id),c,NULL);
+    }
     initClientMultiState(c);
     return c;
 }
@@ -177,6 +189,10 @@ int prepareClientToWrite(client *c) {
 
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
+    /* Shard and read threads only fill the output buffers: the main thread
+     * schedules the write once the client is handed back. */
+    if (inCommandThread()) return C_OK;
+
     /* Schedule the client to write the output buffers to the socket only
      * if not already done (there were no pending writes already and the client
      * was yet not flagged), and, for slaves, if the slave can actually
@@ -751,16 +767,27 @@ void unlinkClient(client *c) {
      * If the client was already unlinked or if it's a "fake client" the
      * fd is already set to -1. */
     if (c->fd != -1) {
+        uint64_t id = htonu64(c->id);
+
         /* Remove from the list of active clients. */
         ln = listSearchKey(server.clients,c);
         serverAssert(ln != NULL);
         listDelNode(server.clients,ln);
+        raxRemove(server.clients_index,(unsigned char*)&id,sizeof(id),NULL);
 
         /* Unregister async I/O handlers and close the socket. */
         aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
         aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
         close(c->fd);
         c->fd = -1;
+
+        /* Release the shared memory rings, if any. */
+        if (c->shm) {
+            aeDeleteFileEvent(server.el,c->shm->wait_fd,AE_READABLE);
+            shmConnFree(c->shm);
+            c->shm = NULL;
+            server.shm_clients--;
+        }
     }
 
     /* Remove from the list of pending writes if needed. */
@@ -781,9 +808,27 @@ void unlinkClient(client *c) {
     }
 }
 
+/* Return the active client with the specified ID, or NULL. */
+client *lookupClientByID(uint64_t id) {
+    client *c;
+
+    id = htonu64(id);
+    c = raxFind(server.clients_index,(unsigned char*)&id,sizeof(id));
+    return (c == raxNotFound) ? NULL : c;
+}
+
 void freeClient(client *c) {
     listNode *ln;
 
+    /* Another thread is executing a command of this client: it will be
+     * released when handed back to the main thread. */
+    if (c->flags & CLIENT_BLOCKED && c->btype == BLOCKED_THREAD) {
+        c->bpop.thread_close = 1;
+        aeDeleteFileEvent(server.el,c->fd,AE_READABLE|AE_WRITABLE);
+        if (c->shm) aeDeleteFileEvent(server.el,c->shm->wait_fd,AE_READABLE);
+        return;
+    }
+
     /* If it is our master that's beging disconnected we should make sure
      * to cache the state to try a partial resynchronization later.
      *
@@ -823,6 +868,7 @@ void freeClient(client *c) {
     /* Unsubscribe from all the pubsub channels */
     pubsubUnsubscribeAllChannels(c,0);
     pubsubUnsubscribeAllPatterns(c,0);
+    disableTracking(c);
     dictRelease(c->pubsub_channels);
     listRelease(c->pubsub_patterns);
 
@@ -881,6 +927,10 @@ void freeClient(client *c) {
  * should be valid for the continuation of the flow of the program. */
 void freeClientAsync(client *c) {
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;
+    if (c->flags & CLIENT_BLOCKED && c->btype == BLOCKED_THREAD) {
+        c->bpop.thread_close = 1;
+        return;
+    }
     c->flags |= CLIENT_CLOSE_ASAP;
     listAddNodeTail(server.clients_to_close,c);
 }
@@ -896,6 +946,20 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
+/* Write to the client socket, or to its shared memory ring after
+ * CLIENT SHM. A full ring is reported like a full socket buffer. */
+static ssize_t clientWrite(client *c, int fd, const void *buf, size_t len) {
+    ssize_t nwritten;
+
+    if (c->shm == NULL) return write(fd,buf,len);
+    nwritten = shmConnWrite(c->shm,buf,len);
+    if (nwritten == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return nwritten;
+}
+
 /* Write data in output buffers to client. Return C_OK if the client
  * is still valid after the call, C_ERR if it was freed. */
 int writeToClient(int fd, client *c, int handler_installed) {
@@ -905,7 +969,8 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
     while(clientHasPendingReplies(c)) {
         if (c->bufpos > 0) {
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
+            nwritten = clientWrite(c,fd,c->buf+c->sentlen,
+                                   c->bufpos-c->sentlen);
             if (nwritten <= 0) break;
             c->sentlen += nwritten;
             totwritten += nwritten;
@@ -925,7 +990,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
                 continue;
             }
 
-            nwritten = write(fd, o + c->sentlen, objlen - c->sentlen);
+            nwritten = clientWrite(c, fd, o + c->sentlen, objlen - c->sentlen);
             if (nwritten <= 0) break;
             c->sentlen += nwritten;
             totwritten += nwritten;
@@ -996,6 +1061,12 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     writeToClient(fd,privdata,1);
 }
 
+/* The replies of a shared memory client don't fit its ring: ask the client
+ * to wake us up once it makes room, since there is no socket to poll. */
+static void shmWaitWritable(client *c) {
+    if (shmConnWaitWritable(c->shm)) shmConnWakeup(c->shm);
+}
+
 /* This function is called just before entering the event loop, in the hope
  * we can just write the replies to the client output buffer without any
  * need to use a syscall in order to install the writable event handler,
@@ -1008,6 +1079,10 @@ int handleClientsWithPendingWrites(void) {
     listRewind(server.clients_pending_write,&li);
     while((ln = listNext(&li))) {
         client *c = listNodeValue(ln);
+
+        /* Another thread may be appending to the buffers of this client:
+         * keep it in the list until it is handed back. */
+        if (c->flags & CLIENT_BLOCKED && c->btype == BLOCKED_THREAD) continue;
         c->flags &= ~CLIENT_PENDING_WRITE;
         listDelNode(server.clients_pending_write,ln);
 
@@ -1016,7 +1091,9 @@ int handleClientsWithPendingWrites(void) {
 
         /* If after the synchronous writes above we still have data to
          * output to the client, we need to install the writable handler. */
-        if (clientHasPendingReplies(c)) {
+        if (clientHasPendingReplies(c) && c->shm) {
+            shmWaitWritable(c);
+        } else if (clientHasPendingReplies(c)) {
             int ae_flags = AE_WRITABLE;
             /* For the fsync=always policy, we want that a given FD is never
              * served for reading and writing in the same event loop iteration,
@@ -1353,8 +1430,17 @@ void processInputBuffer(client *c) {
         if (c->argc == 0) {
             resetClient(c);
         } else {
+            int retval;
+
+            /* Trace a sample of the commands, see trace.c. */
+            if (server.trace_sample_rate) traceCommandStart(c);
+            retval = processCommand(c);
+            /* The client may have been freed: see the check below. */
+            if (server.trace_active)
+                traceCommandEnd(server.current_client ? c : NULL);
+
             /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK) {
+            if (retval == C_OK) {
                 if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
                     /* Update the applied replication offset of our master. */
                     c->reploff = c->read_reploff - sdslen(c->querybuf);
@@ -1363,8 +1449,13 @@ void processInputBuffer(client *c) {
                 /* Don't reset the client structure for clients blocked in a
                  * module blocking command, so that the reply callback will
                  * still be able to access the client argv and argc field.
-                 * The client will be reset in unblockClientFromModule(). */
-                if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
+                 * The client will be reset in unblockClientFromModule().
+                 * The same applies to commands executed by another thread,
+                 * reset once handed back, and to commands waiting for keys
+                 * locked by offloaded commands, processed again later. */
+                if (!(c->flags & CLIENT_BLOCKED) ||
+                    (c->btype != BLOCKED_MODULE && c->btype != BLOCKED_THREAD &&
+                     c->btype != BLOCKED_KEYLOCK))
                     resetClient(c);
             }
             /* freeMemoryIfNeeded may flush slave output buffers. This may
@@ -1457,6 +1548,144 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Event handler of the shared memory clients, called when the client
+ * wrote requests in the ring while we were waiting for them, or made room
+ * in the ring of the replies while we were waiting to write them. */
+void readQueryFromShm(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client *c = (client*) privdata;
+    ssize_t nread;
+    size_t qblen, totread = 0;
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(mask);
+
+    shmConnClearEvent(c->shm);
+
+    /* Another thread may be appending to the buffers of this client: the
+     * replies are written once it is handed back. */
+    if (clientHasPendingReplies(c) &&
+        !(c->flags & CLIENT_BLOCKED && c->btype == BLOCKED_THREAD))
+    {
+        if (writeToClient(c->fd,c,0) == C_ERR) return;
+        if (clientHasPendingReplies(c)) shmWaitWritable(c);
+    }
+
+    /* Read and process the requests in chunks, like readQueryFromClient()
+     * does, serving up to NET_MAX_WRITES_PER_EVENT bytes before giving the
+     * other clients a chance. */
+    while(totread < NET_MAX_WRITES_PER_EVENT) {
+        size_t readlen = PROTO_IOBUF_LEN;
+
+        /* Read big arguments exactly, see readQueryFromClient(). */
+        if (c->reqtype == PROTO_REQ_MULTIBULK && c->multibulklen &&
+            c->bulklen != -1 && c->bulklen >= PROTO_MBULK_BIG_ARG)
+        {
+            size_t remaining = (size_t)(c->bulklen+2)-sdslen(c->querybuf);
+
+            if (remaining > 0 && remaining < readlen) readlen = remaining;
+        }
+
+        qblen = sdslen(c->querybuf);
+        if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
+        c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
+        nread = shmConnRead(c->shm, c->querybuf+qblen, readlen);
+        if (nread == -1) {
+            serverLog(LL_VERBOSE,
+                "Reading from client: invalid shared memory ring state");
+            freeClient(c);
+            return;
+        } else if (nread == 0) {
+            /* Sleep until the client writes more requests. */
+            if (!shmConnWaitReadable(c->shm)) return;
+            continue;
+        }
+
+        sdsIncrLen(c->querybuf,nread);
+        totread += nread;
+        c->lastinteraction = server.unixtime;
+        server.stat_net_input_bytes += nread;
+        if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
+            sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
+
+            bytes = sdscatrepr(bytes,c->querybuf,64);
+            serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
+            sdsfree(ci);
+            sdsfree(bytes);
+            freeClient(c);
+            return;
+        }
+        processInputBuffer(c);
+    }
+
+    /* More requests may be waiting: make sure we are called again. */
+    shmConnWakeup(c->shm);
+}
+
+/* CLIENT SHM: switch the replies, and optionally the requests, of a client
+ * connected via the Unix socket to a pair of shared memory rings. The OK
+ * reply carries the file descriptors of the shared memory and of the two
+ * eventfds, see shmring.c for the protocol. */
+static void clientShmCommand(client *c) {
+    shmConn *conn;
+    int memfd, fds[SHMRING_NUM_FDS];
+
+    if (server.unixsocket_shm_size == 0) {
+        addReplyError(c,"The shared memory transport is disabled, "
+                        "see unixsocket-shm-size");
+        return;
+    }
+    if (!(c->flags & CLIENT_UNIX_SOCKET)) {
+        addReplyError(c,"CLIENT SHM is only available via the Unix socket");
+        return;
+    }
+    if (c->shm) {
+        addReplyError(c,"The client is already using shared memory");
+        return;
+    }
+    if (c->flags & (CLIENT_MULTI|CLIENT_SLAVE|CLIENT_MONITOR) ||
+        server.shard_threads)
+    {
+        addReplyError(c,"CLIENT SHM is not allowed in this context");
+        return;
+    }
+    /* The OK reply is sent directly on the socket, so it must not overtake
+     * other replies, and the next requests must come from the rings. */
+    if (clientHasPendingReplies(c) || sdslen(c->querybuf)) {
+        addReplyError(c,"CLIENT SHM can't be pipelined with other commands");
+        return;
+    }
+
+    if ((conn = shmConnCreate(server.unixsocket_shm_size,&memfd)) == NULL) {
+        addReplyErrorFormat(c,"Can't create the shared memory rings: %s",
+            strerror(errno));
+        return;
+    }
+    fds[0] = memfd;
+    fds[1] = conn->notify_fd;
+    fds[2] = conn->wait_fd;
+    if (aeCreateFileEvent(server.el,conn->wait_fd,AE_READABLE,
+            readQueryFromShm,c) == AE_ERR)
+    {
+        close(memfd);
+        shmConnFree(conn);
+        addReplyError(c,"Can't register the shared memory rings events");
+        return;
+    }
+    if (shmSendFds(c->fd,"+OK\r\n",5,fds,SHMRING_NUM_FDS) == -1) {
+        serverLog(LL_VERBOSE,"Error sending the shared memory rings: %s",
+            strerror(errno));
+        aeDeleteFileEvent(server.el,conn->wait_fd,AE_READABLE);
+        close(memfd);
+        shmConnFree(conn);
+        freeClientAsync(c);
+        return;
+    }
+    close(memfd);
+    c->shm = conn;
+    server.shm_clients++;
+    server.stat_net_output_bytes += 5;
+}
+
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer) {
     client *c;
@@ -1533,6 +1762,7 @@ sds catClientInfoString(sds s, client *client) {
     if (client->flags & CLIENT_CLOSE_ASAP) *p++ = 'A';
     if (client->flags & CLIENT_UNIX_SOCKET) *p++ = 'U';
     if (client->flags & CLIENT_READONLY) *p++ = 'r';
+    if (client->flags & CLIENT_TRACKING) *p++ = 't';
     if (p == flags) *p++ = 'N';
     *p++ = '\0';
 
@@ -1588,6 +1818,12 @@ void clientCommand(client *c) {
         sds o = getAllClientsInfoString();
         addReplyBulkCBuffer(c,o,sdslen(o));
         sdsfree(o);
+    } else if (!strcasecmp(c->argv[1]->ptr,"shm") && c->argc == 2) {
+        /* CLIENT SHM */
+        clientShmCommand(c);
+    } else if (!strcasecmp(c->argv[1]->ptr,"id") && c->argc == 2) {
+        /* CLIENT ID */
+        addReplyLongLong(c,c->id);
     } else if (!strcasecmp(c->argv[1]->ptr,"reply") && c->argc == 3) {
         /* CLIENT REPLY ON|OFF|SKIP */
         if (!strcasecmp(c->argv[2]->ptr,"on")) {
@@ -1728,8 +1964,69 @@ void clientCommand(client *c) {
                                         != C_OK) return;
         pauseClients(duration);
         addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"tracking") && c->argc >= 3) {
+        /* CLIENT TRACKING (on|off) [REDIRECT <id>] [BCAST]
+         *                          [PREFIX <prefix> ...] */
+        long long redir = 0;
+        int bcast = 0, j;
+        robj **prefixes = NULL;
+        size_t numprefixes = 0;
+
+        for (j = 3; j < c->argc; j++) {
+            int moreargs = (c->argc-1) - j;
+
+            if (!strcasecmp(c->argv[j]->ptr,"redirect") && moreargs) {
+                j++;
+                if (getLongLongFromObjectOrReply(c,c->argv[j],&redir,NULL) !=
+                    C_OK) goto tracking_err;
+                if (redir == (long long)c->id) redir = 0;
+                else if (lookupClientByID(redir) == NULL) {
+                    addReplyError(c,"The client ID you want redirect to "
+                                    "does not exist");
+                    goto tracking_err;
+                }
+            } else if (!strcasecmp(c->argv[j]->ptr,"bcast")) {
+                bcast = 1;
+            } else if (!strcasecmp(c->argv[j]->ptr,"prefix") && moreargs) {
+                j++;
+                prefixes = zrealloc(prefixes,sizeof(robj*)*(numprefixes+1));
+                prefixes[numprefixes++] = c->argv[j];
+            } else {
+                addReply(c,shared.syntaxerr);
+                goto tracking_err;
+            }
+        }
+
+        if (!strcasecmp(c->argv[2]->ptr,"on")) {
+            if (server.shard_threads) {
+                addReplyError(c,"Tracking is not supported in sharded mode");
+                goto tracking_err;
+            }
+            if (!bcast && numprefixes) {
+                addReplyError(c,"PREFIX option requires BCAST mode");
+                goto tracking_err;
+            }
+            enableTracking(c,redir,bcast,prefixes,numprefixes);
+        } else if (!strcasecmp(c->argv[2]->ptr,"off")) {
+            disableTracking(c);
+        } else {
+            addReply(c,shared.syntaxerr);
+            goto tracking_err;
+        }
+        zfree(prefixes);
+        addReply(c,shared.ok);
+        return;
+
+tracking_err:
+        zfree(prefixes);
+    } else if (!strcasecmp(c->argv[1]->ptr,"getredir") && c->argc == 2) {
+        /* CLIENT GETREDIR */
+        if (c->flags & CLIENT_TRACKING)
+            addReplyLongLong(c,c->tracking_redirection);
+        else
+            addReplyLongLong(c,-1);
     } else {
-        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL | GETNAME | SETNAME | PAUSE | REPLY)");
+        addReplyError(c, "Syntax error, try CLIENT (LIST | KILL | ID | GETNAME | SETNAME | PAUSE | REPLY | TRACKING | GETREDIR | SHM)");
     }
 }
 
@@ -1934,6 +2231,8 @@ int checkClientOutputBufferLimits(client *c) {
 void asyncCloseClientOnOutputBufferLimitReached(client *c) {
     serverAssert(c->reply_bytes < SIZE_MAX-(1024*64));
     if (c->reply_bytes == 0 || c->flags & CLIENT_CLOSE_ASAP) return;
+    /* Checked by the main thread once the command is handed back. */
+    if (inCommandThread()) return;
     if (checkClientOutputBufferLimits(c)) {
         sds client = catClientInfoString(sdsempty(),c);
 
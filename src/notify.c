@@ -98,6 +98,13 @@ void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid) {
     int len = -1;
     char buf[24];
 
+    /* Offloaded commands emit their events once committed by the main
+     * thread, see offload.c. */
+    if (server.offload_threads && offloadIsOffloadThread()) {
+        offloadDeferKeyspaceEvent(type,event,key,dbid);
+        return;
+    }
+
     /* If any modules are interested in events, notify the module system now. 
      * This bypasses the notifications configuration, but the module engine
      * will only call event subscribers if the event type matches the types
@@ -210,6 +210,8 @@ robj *dupStringObject(const robj *o) {
         	d->encoding = OBJ_ENCODING_INT;
         	d->ptr = o->ptr;
         	return d;
+    	case OBJ_ENCODING_COMPRESSED:
+        	return dupCompressedObject(o);
     	default:
         	serverPanic("Wrong encoding.");
         	break;
@@ -324,6 +326,8 @@ void freeStringObject(robj *o) {
     if (o->encoding == OBJ_ENCODING_RAW) {
 		//释放对应的数据部分的空间
         sdsfree(o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_COMPRESSED) {
+        freeCompressedObject(o);
     }
 }
 
@@ -388,6 +392,9 @@ void freeHashObject(robj *o) {
 			//释放对应的数据部分空间
         	zfree(o->ptr);
        	 	break;
+    	case OBJ_ENCODING_COMPRESSED:
+        	freeCompressedObject(o);
+        	break;
     	default:
         	serverPanic("Unknown hash encoding type");
         	break;
@@ -638,6 +645,9 @@ robj *getDecodedObject(robj *o) {
         dec = createStringObject(buf,strlen(buf));
 		//返回新创建的字符串类型对象
         return dec;
+    } else if (o->type == OBJ_STRING &&
+               o->encoding == OBJ_ENCODING_COMPRESSED) {
+        return createObject(OBJ_STRING,compressionDecode(o));
     } else {
         serverPanic("Unknown encoding type");
     }
@@ -741,6 +751,8 @@ size_t stringObjectLen(robj *o) {
 	//如果是字符串编码的两种类型
     if (sdsEncodedObject(o)) {
         return sdslen(o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_COMPRESSED) {
+        return compressionValueLength(o);
     } else {
         //计算出整数值的位数返回
         return sdigits10((long)o->ptr);
@@ -950,6 +962,8 @@ char *strEncoding(int encoding) {
 			return "skiplist";
     	case OBJ_ENCODING_EMBSTR: 
 			return "embstr";
+    	case OBJ_ENCODING_COMPRESSED:
+			return "compressed";
     	default: return "unknown";
     }
 }
@@ -961,7 +975,6 @@ char *strEncoding(int encoding) {
  * case of aggregated data types where only "sample_size" elements
  * are checked and averaged to estimate the total size. 
  */
-#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
 size_t objectComputeSize(robj *o, size_t sample_size) {
     sds ele, ele2;
     dict *d;
@@ -969,7 +982,9 @@ size_t objectComputeSize(robj *o, size_t sample_size) {
     struct dictEntry *de;
     size_t asize = 0, elesize = 0, samples = 0;
 
-    if (o->type == OBJ_STRING) {
+    if (o->encoding == OBJ_ENCODING_COMPRESSED) {
+        asize = zmalloc_size(o->ptr)+sizeof(*o);
+    } else if (o->type == OBJ_STRING) {
         if(o->encoding == OBJ_ENCODING_INT) {
             asize = sizeof(*o);
         } else if(o->encoding == OBJ_ENCODING_RAW) {
@@ -1134,6 +1149,19 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
     mh->aof_buffer = mem;
     mem_total+=mem;
 
+    mem = replyCacheMemory();
+    mh->reply_cache = mem;
+    mem_total+=mem;
+
+    mem = compressionDictsMemory();
+    mh->compression_dicts = mem;
+    mem_total+=mem;
+
+    /* Compressed values are part of the dataset. */
+    mh->compression_values = compressionValuesCount();
+    mh->compression_saved = compressionSavedMemory();
+    mh->compression_cache = compressionCacheMemory();
+
     for (j = 0; j < server.dbnum; j++) {
         redisDb *db = server.db+j;
         long long keyscount = dictSize(db->dict);
@@ -1360,7 +1388,7 @@ void memoryCommand(client *c) {
     } else if (!strcasecmp(c->argv[1]->ptr,"stats") && c->argc == 2) {
         struct redisMemOverhead *mh = getMemoryOverheadData();
 
-        addReplyMultiBulkLen(c,(14+mh->num_dbs)*2);
+        addReplyMultiBulkLen(c,(21+mh->num_dbs)*2);
 
         addReplyBulkCString(c,"peak.allocated");
         addReplyLongLong(c,mh->peak_allocated);
@@ -1383,6 +1411,9 @@ void memoryCommand(client *c) {
         addReplyBulkCString(c,"aof.buffer");
         addReplyLongLong(c,mh->aof_buffer);
 
+        addReplyBulkCString(c,"reply.cache");
+        addReplyLongLong(c,mh->reply_cache);
+
         for (size_t j = 0; j < mh->num_dbs; j++) {
             char dbname[32];
             snprintf(dbname,sizeof(dbname),"db.%zd",mh->db[j].dbid);
@@ -1417,6 +1448,24 @@ void memoryCommand(client *c) {
         addReplyBulkCString(c,"fragmentation");
         addReplyDouble(c,mh->fragmentation);
 
+        addReplyBulkCString(c,"compression.values");
+        addReplyLongLong(c,mh->compression_values);
+
+        addReplyBulkCString(c,"compression.saved");
+        addReplyLongLong(c,mh->compression_saved);
+
+        addReplyBulkCString(c,"compression.cache");
+        addReplyLongLong(c,mh->compression_cache);
+
+        addReplyBulkCString(c,"compression.dicts");
+        addReplyLongLong(c,mh->compression_dicts);
+
+        addReplyBulkCString(c,"compression.cpu-usec");
+        addReplyLongLong(c,server.stat_compression_usec);
+
+        addReplyBulkCString(c,"decompression.cpu-usec");
+        addReplyLongLong(c,server.stat_decompression_usec);
+
         freeMemoryOverheadData(mh);
     } else if (!strcasecmp(c->argv[1]->ptr,"malloc-stats") && c->argc == 2) {
 #if defined(USE_JEMALLOC)
@@ -1446,8 +1495,10 @@ void memoryCommand(client *c) {
         addReply(c, shared.ok);
         /* Nothing to do for other allocators. */
 #endif
+    } else if (!strcasecmp(c->argv[1]->ptr,"report")) {
+        memoryReportCommand(c);
     } else if (!strcasecmp(c->argv[1]->ptr,"help") && c->argc == 2) {
-        addReplyMultiBulkLen(c,5);
+        addReplyMultiBulkLen(c,6);
         addReplyBulkCString(c,
 "MEMORY DOCTOR                        - Outputs memory problems report");
         addReplyBulkCString(c,
@@ -1458,6 +1509,8 @@ void memoryCommand(client *c) {
 "MEMORY PURGE                         - Ask the allocator to release memory");
         addReplyBulkCString(c,
 "MEMORY MALLOC-STATS                  - Show allocator internal stats");
+        addReplyBulkCString(c,
+"MEMORY REPORT [<count>]              - Show memory usage by key prefix and type");
     } else {
         addReplyError(c,"Syntax error. Try MEMORY HELP");
     }
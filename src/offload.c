@@ -0,0 +1,494 @@
+/* Offloading of CPU heavy multi key commands to background threads.
+ *
+ * Set operations and sorts on big collections (SUNIONSTORE, SINTERSTORE,
+ * SDIFFSTORE, ZUNIONSTORE, ZINTERSTORE, SORT ... STORE and their non STORE
+ * variants) can block the event loop for seconds. When "offload-threads" is
+ * set to N > 0, such a command whose input collections have at least
+ * "offload-threshold" elements in total is executed by one of N background
+ * threads while the main thread keeps serving the other clients.
+ *
+ * All the keys of the command are locked while it executes: the commands
+ * of other clients touching a locked key are not executed, their client is
+ * blocked (BLOCKED_KEYLOCK) and the command is processed again when the
+ * offloaded command completes. The same happens for the commands that may
+ * touch any key (keyless writes like FLUSHALL, admin commands, EXEC, EVAL,
+ * module commands), that wait for all the offloaded commands to complete.
+ * Waiting clients are served in FIFO order: the keys of a waiting command
+ * are reserved, so that the commands received later touching them wait as
+ * well, and while a command waiting for all the offloaded commands is
+ * pending, every other command waits.
+ * Locked keys are not expired nor evicted, and active defrag is suspended.
+ *
+ * The command implementation runs unmodified, against a private database
+ * holding only the locked keys, whose values are shared with the real
+ * database. Keyspace notifications are deferred. Once the thread is done,
+ * the main thread commits the keys the command modified into the real
+ * database, emits the notifications, propagates the command to AOF and
+ * slaves exactly as call() would, and releases the locks. The command is
+ * deterministic and its keys did not change in the meantime, so AOF and
+ * slaves reach the same state executing it again.
+ *
+ * Commands are only offloaded by masters, and never inside MULTI/EXEC or
+ * scripts. SORT is only offloaded without BY and GET, since the patterns
+ * access keys that are not known in advance.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "workers.h"
+
+/* A keyspace notification emitted by an offloaded command. */
+typedef struct offloadEvent {
+    int type;
+    char *event;        /* Always a string literal. */
+    robj *key;
+    int dbid;
+} offloadEvent;
+
+typedef struct offloadJob {
+    client *c;
+    redisDb *db;        /* The database of the client. */
+    redisDb tmp;        /* Private database the command is executed on. */
+    robj **keys;        /* Locked keys. */
+    robj **vals;        /* Values of the keys when locked, or NULL. */
+    int numkeys;
+    list *events;       /* Deferred keyspace notifications. */
+} offloadJob;
+
+static workerPool *offload_pool = NULL;
+static pthread_key_t offload_key;
+
+/* Clients blocked because of locked keys, main thread only. The keys of
+ * their commands are reserved in 'reserved_keys' (sds key -> number of
+ * waiting commands, one dictionary per DB), 'global_waiters' is the number
+ * of waiting commands that may touch any key. */
+static list *offload_waiting;
+static list *offload_retrying;
+static dict **reserved_keys;
+static int global_waiters = 0;
+
+/* Locked keys (sds key -> job) and reserved keys (sds key -> number of
+ * waiting commands). */
+static dictType offloadKeysDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/* -----------------------------------------------------------------------------
+ * Offload threads
+ * -------------------------------------------------------------------------- */
+
+static offloadJob *offloadCurrentJob(void) {
+    return offload_pool ? pthread_getspecific(offload_key) : NULL;
+}
+
+/* Return true if the caller is an offload thread. */
+int offloadIsOffloadThread(void) {
+    return offloadCurrentJob() != NULL;
+}
+
+/* Called by notifyKeyspaceEvent() in an offload thread: the notification
+ * is emitted by the main thread when the command is committed. */
+void offloadDeferKeyspaceEvent(int type, char *event, robj *key, int dbid) {
+    offloadJob *job = offloadCurrentJob();
+    offloadEvent *e = zmalloc(sizeof(*e));
+
+    e->type = type;
+    e->event = event;
+    e->key = key;
+    e->dbid = dbid;
+    incrRefCount(key);
+    listAddNodeTail(job->events,e);
+}
+
+/* Executed by an offload thread. */
+static void offloadExecute(void *arg) {
+    offloadJob *job = arg;
+    client *c = job->c;
+    long long start = ustime();
+
+    /* The counters updated by the command, server.dirty included, are
+     * merged into the global ones by unblockClientFromThread(). */
+    pthread_setspecific(offload_key,job);
+    thread_stats = &c->bpop.thread_stats;
+    c->db = &job->tmp;
+    c->cmd->proc(c);
+    c->db = job->db;
+    thread_stats = NULL;
+    pthread_setspecific(offload_key,NULL);
+    c->bpop.thread_usec = ustime()-start;
+}
+
+/* -----------------------------------------------------------------------------
+ * Key locking
+ * -------------------------------------------------------------------------- */
+
+/* Return true if 'key' of 'db' is locked by an offloaded command. */
+int offloadKeyIsLocked(redisDb *db, sds key) {
+    return db->locked_keys && dictFind(db->locked_keys,key) != NULL;
+}
+
+/* Return true if the command may touch any key: it can only be executed
+ * when no command is offloaded. */
+static int offloadIsGlobalCommand(struct redisCommand *cmd) {
+    if (cmd->proc == execCommand || cmd->proc == evalCommand ||
+        cmd->proc == evalShaCommand || cmd->flags & CMD_MODULE) return 1;
+    return cmd->getkeys_proc == NULL && cmd->firstkey == 0 &&
+           (cmd->flags & (CMD_WRITE|CMD_ADMIN));
+}
+
+/* Return true if the command of the client can't be executed now because
+ * it may access keys locked by offloaded commands, or reserved by the
+ * commands waiting for them. Called only while commands are offloaded. */
+int offloadMustWait(client *c) {
+    struct redisCommand *cmd = c->cmd;
+    int *keys, numkeys, j, wait = 0;
+
+    if (global_waiters || offloadIsGlobalCommand(cmd)) return 1;
+
+    keys = getKeysFromCommand(cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys && !wait; j++) {
+        sds key = c->argv[keys[j]]->ptr;
+
+        wait = offloadKeyIsLocked(c->db,key) ||
+               dictFind(reserved_keys[c->db->id],key) != NULL;
+    }
+    getKeysFreeResult(keys);
+    return wait;
+}
+
+/* Reserve (incr = 1) or release (incr = -1) the keys of the command of a
+ * waiting client. */
+static void offloadReserveKeys(client *c, int incr) {
+    dict *d = reserved_keys[c->db->id];
+    int *keys, numkeys, j;
+
+    if (offloadIsGlobalCommand(c->cmd)) {
+        global_waiters += incr;
+        return;
+    }
+    keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys; j++) {
+        sds key = c->argv[keys[j]]->ptr;
+        dictEntry *de = dictFind(d,key);
+
+        if (de == NULL) {
+            de = dictAddRaw(d,sdsdup(key),NULL);
+            dictSetUnsignedIntegerVal(de,0);
+        }
+        dictSetUnsignedIntegerVal(de,dictGetUnsignedIntegerVal(de)+incr);
+        if (dictGetUnsignedIntegerVal(de) == 0) dictDelete(d,key);
+    }
+    getKeysFreeResult(keys);
+}
+
+/* Block the client until the offloaded commands complete. The client is
+ * not reset, so that the command can be processed again. */
+void offloadBlockClient(client *c) {
+    c->bpop.timeout = 0;
+    blockClient(c,BLOCKED_KEYLOCK);
+    listAddNodeTail(offload_waiting,c);
+    offloadReserveKeys(c,1);
+    server.stat_offload_lock_waits++;
+}
+
+/* Called by unblockClient() for clients blocked with BLOCKED_KEYLOCK. The
+ * client may be freed while the waiting clients are processed again. */
+void unblockClientWaitingKeyLock(client *c) {
+    listNode *ln = listSearchKey(offload_waiting,c);
+
+    if (ln) {
+        listDelNode(offload_waiting,ln);
+        offloadReserveKeys(c,-1);
+    } else {
+        ln = offload_retrying ? listSearchKey(offload_retrying,c) : NULL;
+        serverAssert(ln != NULL);
+        listDelNode(offload_retrying,ln);
+    }
+}
+
+/* Process again, in FIFO order, the commands of the clients waiting for
+ * locked keys. They may be blocked again, or offloaded, while iterating. */
+static void offloadRetryWaitingClients(void) {
+    listNode *ln;
+    listIter li;
+
+    offload_retrying = offload_waiting;
+    offload_waiting = listCreate();
+    listRewind(offload_retrying,&li);
+    while ((ln = listNext(&li)) != NULL)
+        offloadReserveKeys(ln->value,-1);
+
+    while ((ln = listFirst(offload_retrying)) != NULL) {
+        client *c = ln->value;
+
+        listDelNode(offload_retrying,ln);
+        c->flags &= ~CLIENT_BLOCKED;
+        c->btype = BLOCKED_NONE;
+        server.bpop_blocked_clients--;
+
+        server.current_client = c;
+        if (processCommand(c) == C_ERR) {
+            /* The client was freed. */
+            server.current_client = NULL;
+            continue;
+        }
+        if (!(c->flags & CLIENT_BLOCKED) ||
+            (c->btype != BLOCKED_MODULE && c->btype != BLOCKED_THREAD &&
+             c->btype != BLOCKED_KEYLOCK))
+        {
+            resetClient(c);
+        }
+        server.current_client = NULL;
+
+        /* Pipelined commands are processed ASAP, like for the other kind of
+         * blocked clients. */
+        if (!(c->flags & (CLIENT_BLOCKED|CLIENT_UNBLOCKED)) &&
+            sdslen(c->querybuf))
+        {
+            c->flags |= CLIENT_UNBLOCKED;
+            listAddNodeTail(server.unblocked_clients,c);
+        }
+    }
+    listRelease(offload_retrying);
+    offload_retrying = NULL;
+}
+
+/* -----------------------------------------------------------------------------
+ * Main thread side
+ * -------------------------------------------------------------------------- */
+
+/* Return the number of elements of the collections of the command, -1 if
+ * the command can't be offloaded. */
+static long long offloadCommandWork(client *c, int *keys, int numkeys) {
+    long long work = 0;
+    int j;
+
+    if (c->cmd->proc == sortCommand) {
+        for (j = 2; j < c->argc; j++) {
+            if (!strcasecmp(c->argv[j]->ptr,"by") ||
+                !strcasecmp(c->argv[j]->ptr,"get")) return -1;
+        }
+    }
+
+    for (j = 0; j < numkeys; j++) {
+        robj *o = lookupKeyReadNoSideEffects(c->db,c->argv[keys[j]]);
+
+        if (o == NULL) continue;
+        if (o->type == OBJ_SET) work += setTypeSize(o);
+        else if (o->type == OBJ_ZSET) work += zsetLength(o);
+        else if (o->type == OBJ_LIST) work += listTypeLength(o);
+    }
+    return work;
+}
+
+static void offloadInitTmpDb(redisDb *tmp, redisDb *db) {
+    tmp->dict = dictCreate(&dbDictType,NULL);
+    tmp->expires = dictCreate(&keyptrDictType,NULL);
+    tmp->blocking_keys = dictCreate(&keylistDictType,NULL);
+    tmp->ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
+    tmp->watched_keys = dictCreate(&keylistDictType,NULL);
+    tmp->locked_keys = NULL;
+    tmp->id = db->id;
+    tmp->avg_ttl = 0;
+}
+
+static void offloadFreeTmpDb(redisDb *tmp) {
+    dictRelease(tmp->dict);
+    dictRelease(tmp->expires);
+    dictRelease(tmp->blocking_keys);
+    dictRelease(tmp->ready_keys);
+    dictRelease(tmp->watched_keys);
+}
+
+/* Try to offload the command of the client, already checked by
+ * processCommand(). Returns 1 if the command was offloaded, 0 if it
+ * should be executed by the caller. */
+int offloadCommand(client *c) {
+    struct redisCommand *cmd = c->cmd;
+    int *keys, numkeys, j;
+    offloadJob *job;
+
+    if (!offload_pool || server.masterhost || server.lazy_loading ||
+        c->flags & (CLIENT_MULTI|CLIENT_MASTER|CLIENT_LUA)) return 0;
+    if (cmd->proc != sunionCommand && cmd->proc != sunionstoreCommand &&
+        cmd->proc != sinterCommand && cmd->proc != sinterstoreCommand &&
+        cmd->proc != sdiffCommand && cmd->proc != sdiffstoreCommand &&
+        cmd->proc != zunionstoreCommand && cmd->proc != zinterstoreCommand &&
+        cmd->proc != sortCommand) return 0;
+
+    keys = getKeysFromCommand(cmd,c->argv,c->argc,&numkeys);
+    if (numkeys == 0 ||
+        offloadCommandWork(c,keys,numkeys) < server.offload_threshold)
+    {
+        getKeysFreeResult(keys);
+        return 0;
+    }
+
+    /* Lock the keys and build the private database. The same key may be
+     * repeated in the command. */
+    job = zmalloc(sizeof(*job));
+    job->c = c;
+    job->db = c->db;
+    job->keys = zmalloc(sizeof(robj*)*numkeys);
+    job->vals = zmalloc(sizeof(robj*)*numkeys);
+    job->numkeys = 0;
+    job->events = listCreate();
+    offloadInitTmpDb(&job->tmp,c->db);
+    for (j = 0; j < numkeys; j++) {
+        robj *key = c->argv[keys[j]];
+        dictEntry *de;
+
+        if (offloadKeyIsLocked(c->db,key->ptr)) continue;
+        /* Keys don't expire in the private database: expire them now. */
+        expireIfNeeded(c->db,key);
+        dictAdd(c->db->locked_keys,sdsdup(key->ptr),job);
+        incrRefCount(key);
+        job->keys[job->numkeys] = key;
+        de = dictFind(c->db->dict,key->ptr);
+        job->vals[job->numkeys] = de ? dictGetVal(de) : NULL;
+        if (de) {
+            incrRefCount(dictGetVal(de));
+            dbAdd(&job->tmp,key,dictGetVal(de));
+        }
+        job->numkeys++;
+    }
+    getKeysFreeResult(keys);
+
+    /* The offloaded command may look up values concurrently with the main
+     * thread: stop the incremental rehashing like for the read threads. */
+    if (server.offload_jobs++ == 0) dictPauseRehashSteps();
+    server.stat_offloaded_commands++;
+
+    if (listLength(server.monitors) && !server.loading &&
+        !(cmd->flags & (CMD_SKIP_MONITOR|CMD_ADMIN)))
+    {
+        replicationFeedMonitors(c,server.monitors,c->db->id,c->argv,c->argc);
+    }
+    blockClientForThread(c);
+
+    workerPoolSubmit(offload_pool,job);
+    return 1;
+}
+
+/* Apply the effects of an executed command to the real database. */
+static void offloadCommit(offloadJob *job) {
+    client *c = job->c;
+    redisDb *db = job->db;
+    int j, changed = 0;
+    listNode *ln;
+
+    if (server.read_threads) readThreadsWait();
+
+    for (j = 0; j < job->numkeys; j++) {
+        robj *key = job->keys[j];
+        dictEntry *de = dictFind(job->tmp.dict,key->ptr);
+        robj *val = de ? dictGetVal(de) : NULL;
+
+        dictDelete(db->locked_keys,key->ptr);
+        if (val == job->vals[j]) continue;
+        dbDelete(db,key);
+        if (val) {
+            incrRefCount(val);
+            dbAdd(db,key,val);
+        }
+        signalModifiedKey(db,key);
+        changed = 1;
+    }
+
+    while ((ln = listFirst(job->events)) != NULL) {
+        offloadEvent *e = ln->value;
+
+        notifyKeyspaceEvent(e->type,e->event,e->key,e->dbid);
+        decrRefCount(e->key);
+        zfree(e);
+        listDelNode(job->events,ln);
+    }
+
+    if (changed) {
+        propagate(c->cmd,db->id,c->argv,c->argc,
+                  PROPAGATE_AOF|PROPAGATE_REPL);
+    }
+}
+
+static void offloadFreeJob(offloadJob *job) {
+    int j;
+
+    for (j = 0; j < job->numkeys; j++) decrRefCount(job->keys[j]);
+    offloadFreeTmpDb(&job->tmp);
+    listRelease(job->events);
+    zfree(job->keys);
+    zfree(job->vals);
+    zfree(job);
+}
+
+/* Called in the main thread for every executed command: commit it. */
+static void offloadDone(void *arg) {
+    offloadJob *job = arg;
+    client *c = job->c;
+
+    offloadCommit(job);
+    offloadFreeJob(job);
+    if (--server.offload_jobs == 0) dictResumeRehashSteps();
+    unblockClientFromThread(c);
+}
+
+void offloadInit(void) {
+    char *incompatible = NULL;
+    int j;
+
+    if (server.sentinel_mode) {
+        server.offload_threads = 0;
+        return;
+    }
+    if (server.cluster_enabled) incompatible = "cluster-enabled";
+    else if (server.shard_threads) incompatible = "shard-threads";
+    if (incompatible) {
+        serverLog(LL_WARNING,
+            "offload-threads can't be used together with %s. Exiting.",
+            incompatible);
+        exit(1);
+    }
+
+    offload_waiting = listCreate();
+    reserved_keys = zmalloc(sizeof(dict*)*server.dbnum);
+    for (j = 0; j < server.dbnum; j++) {
+        server.db[j].locked_keys = dictCreate(&offloadKeysDictType,NULL);
+        reserved_keys[j] = dictCreate(&offloadKeysDictType,NULL);
+    }
+    pthread_key_create(&offload_key,NULL);
+    offload_pool = workerPoolCreate("offload",server.offload_threads,
+        offloadExecute,offloadDone,offloadRetryWaitingClients);
+}
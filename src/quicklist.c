@@ -1131,7 +1131,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
         __quicklistInsertNode(quicklist, node, new_node, after);
     } else if (full) {
 		//本节点已经没有对应的空间 且没有对应的前置和后置节点的处理情况----->需要进行拆分操作处理
-        /* else, node is full we need to split it. */ covers both after and !after cases */
+        /* else, node is full we need to split it. */ /* covers both after and !after cases */
         D("\tsplitting node...");
         quicklistDecompressNodeForUse(node);
 		//进行拆分操作处理
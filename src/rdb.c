@@ -451,6 +451,18 @@ void *rdbLoadLzfStringObject(rio *rdb, int flags, size_t *lenptr) {
         if (rdbCheckMode) rdbCheckSetError("Invalid LZF compressed string");
         goto err;
     }
+
+    /* The value compression stores strings with the same LZF format: now
+     * that the data is known to be valid, keep it compressed. */
+    if ((flags & RDB_LOAD_COMPRESSED) && !plain && !sds &&
+        compressionIsWorthwhile(len,clen))
+    {
+        robj *o = createCompressedStringObject(c,clen,len);
+
+        zfree(c);
+        sdsfree(val);
+        return o;
+    }
     zfree(c);
 
     if (plain || sds) {
@@ -568,6 +580,22 @@ ssize_t rdbSaveLongLongAsStringObject(rio *rdb, long long value) {
     return nwritten;
 }
 
+/* Save a string object compressed by the value compression: the LZF data
+ * is saved as it is, unless the RDB compression is disabled. Values
+ * compressed with a dictionary are saved uncompressed. */
+static ssize_t rdbSaveCompressedStringObject(rio *rdb, robj *obj) {
+    compressedString *cs = obj->ptr;
+    ssize_t nwritten;
+    sds s;
+
+    if (server.rdb_compression && cs->method == COMPRESSION_LZF)
+        return rdbSaveLzfBlob(rdb,cs->data,cs->clen,cs->len);
+    s = compressionDecode(obj);
+    nwritten = rdbSaveRawString(rdb,(unsigned char*)s,sdslen(s));
+    sdsfree(s);
+    return nwritten;
+}
+
 /* 将字符串对象obj写到rio中
  * Like rdbSaveRawString() gets a Redis object instead. 
  */
@@ -577,6 +605,8 @@ ssize_t rdbSaveStringObject(rio *rdb, robj *obj) {
     if (obj->encoding == OBJ_ENCODING_INT) {
 		//将对象值进行编码后发送给rio
         return rdbSaveLongLongAsStringObject(rdb,(long)obj->ptr);
+    } else if (obj->encoding == OBJ_ENCODING_COMPRESSED) {
+        return rdbSaveCompressedStringObject(rdb,obj);
     } else {
         serverAssertWithInfo(NULL,obj,sdsEncodedObject(obj));
 		//RAW或EMBSTR编码类型的字符串对象,将字符串类型的对象写到rio
@@ -785,7 +815,8 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
             	serverPanic("Unknown sorted set encoding");
 		//哈希类型
     	case OBJ_HASH:
-        	if (o->encoding == OBJ_ENCODING_ZIPLIST)
+        	if (o->encoding == OBJ_ENCODING_ZIPLIST ||
+        	    o->encoding == OBJ_ENCODING_COMPRESSED)
             	return rdbSaveType(rdb,RDB_TYPE_HASH_ZIPLIST);
         	else if (o->encoding == OBJ_ENCODING_HT)
             	return rdbSaveType(rdb,RDB_TYPE_HASH);
@@ -818,6 +849,15 @@ int rdbLoadObjectType(rio *rdb) {
  */
 ssize_t rdbSaveObject(rio *rdb, robj *o) {
     ssize_t n = 0, nwritten = 0;
+
+    /* Compressed hashes are saved as the ziplist they decompress to. */
+    if (o->type != OBJ_STRING && o->encoding == OBJ_ENCODING_COMPRESSED) {
+        robj *d = compressionDecodeObject(o);
+
+        nwritten = rdbSaveObject(rdb,d);
+        decrRefCount(d);
+        return nwritten;
+    }
 	//根据对象类型和编码方式不同进行不同方式的存储处理
     if (o->type == OBJ_STRING) {
         //保存字符串对象
@@ -1130,6 +1170,34 @@ int rdbSaveInfoAuxFields(rio *rdb, int flags, rdbSaveInfo *rsi) {
     }
     if (rdbSaveAuxFieldStrInt(rdb,"aof-preamble",aof_preamble) == -1) 
 		return -1;
+    if (compressionSaveDict(rdb) == -1)
+        return -1;
+    return 1;
+}
+
+/* Append to the key index 'idx' the entry of a key saved at 'offset'. */
+static int rdbSaveKeyIndexEntry(rio *idx, int dbid, sds key, uint64_t offset) {
+    if (rdbSaveLen(idx,dbid) == -1) return -1;
+    if (rdbSaveLen(idx,sdslen(key)) == -1) return -1;
+    if (sdslen(key) && rdbWriteRaw(idx,key,sdslen(key)) == -1) return -1;
+    if (rdbSaveLen(idx,offset) == -1) return -1;
+    return 1;
+}
+
+/* Write the key index and its trailer, see RDB_SAVE_KEY_INDEX. */
+static int rdbSaveKeyIndex(rio *rdb, rio *idx, uint64_t tail, uint64_t keys) {
+    sds buf = idx->io.buffer.ptr;
+    uint64_t trailer[3];
+
+    trailer[0] = rdb->processed_bytes;
+    trailer[1] = tail;
+    trailer[2] = keys;
+    memrev64ifbe(&trailer[0]);
+    memrev64ifbe(&trailer[1]);
+    memrev64ifbe(&trailer[2]);
+    if (sdslen(buf) && rdbWriteRaw(rdb,buf,sdslen(buf)) == -1) return -1;
+    if (rdbWriteRaw(rdb,trailer,sizeof(trailer)) == -1) return -1;
+    if (rdbWriteRaw(rdb,RDB_KEY_INDEX_MAGIC,8) == -1) return -1;
     return 1;
 }
 
@@ -1150,7 +1218,10 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     int j;
     uint64_t cksum;
     size_t processed = 0;
+    rio idx;
+    uint64_t idx_keys = 0, idx_tail;
 
+    if (flags & RDB_SAVE_KEY_INDEX) rioInitWithBuffer(&idx,sdsempty());
     //检测是否开启了校验和选项
     if (server.rdb_checksum)
 		//设置校验和的函数
@@ -1165,18 +1236,20 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
 		goto werr;
 	//遍历redis中所有库中的数据,进行数据备份操作处理
     for (j = 0; j < server.dbnum; j++) {
-		//获取当前索引对应的库
-        redisDb *db = server.db+j;
-		//获取当前库对应的数据集
-        dict *d = db->dict;
+        /* In sharded mode the keys of every DB are spread among the shards:
+         * they are saved one shard after the other after a single SELECT. */
+        int k, parts = server.shard_threads ? server.shard_threads : 1;
+        unsigned long long keys = 0, expires = 0;
+
+        for (k = 0; k < parts; k++) {
+            redisDb *db = server.shard_threads ? shardGetDb(k,j) : server.db+j;
+
+            keys += dictSize(db->dict);
+            expires += dictSize(db->expires);
+        }
 	    //检测当前库中是否有数据需要存储处理
-        if (dictSize(d) == 0) 
+        if (keys == 0) 
 			continue;
-		//获取对应的迭代器对象
-        di = dictGetSafeIterator(d);
-		//检测获取对应的迭代器是否成功
-        if (!di) 
-			return C_ERR;
 
         /* Write the SELECT DB opcode */
 		//写入数据库的选择标识码 RDB_OPCODE_SELECTDB为254
@@ -1194,9 +1267,9 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
          */
         uint32_t db_size, expires_size;
 		//如果字典的大小大于UINT32_MAX，则设置db_size为最大的UINT32_MAX
-        db_size = (dictSize(db->dict) <= UINT32_MAX) ? dictSize(db->dict) : UINT32_MAX;
+        db_size = (keys <= UINT32_MAX) ? keys : UINT32_MAX;
 		//设置有过期时间键的大小超过UINT32_MAX，则设置expires_size为最大的UINT32_MAX
-        expires_size = (dictSize(db->expires) <= UINT32_MAX) ? dictSize(db->expires) : UINT32_MAX;
+        expires_size = (expires <= UINT32_MAX) ? expires : UINT32_MAX;
 		//写入调整哈希表大小的操作码，RDB_OPCODE_RESIZEDB = 251
         if (rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) 
 			goto werr;
@@ -1207,36 +1280,56 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
         if (rdbSaveLen(rdb,expires_size) == -1) 
 			goto werr;
 
-        /* Iterate this DB writing every entry */
-		//遍历数据库所有的键值对
-        while((de = dictNext(di)) != NULL) {
-			//当前键字符串
-            sds keystr = dictGetKey(de);
-			//当前键对应的值对象
-            robj key, *o = dictGetVal(de);
-            long long expire;
-			//在栈中创建一个键对象并初始化
-            initStaticStringObject(key,keystr);
-			//获取当前键的过期时间
-            expire = getExpire(db,&key);
-			//将键的键对象，值对象，过期时间写到rio中
-            if (rdbSaveKeyValuePair(rdb,&key,o,expire) == -1) 
-				goto werr;
-
-            /* 
-             * When this RDB is produced as part of an AOF rewrite, move
-             * accumulated diff from parent to child while rewriting in
-             * order to have a smaller final write. 
-             */
-            if (flags & RDB_SAVE_AOF_PREAMBLE && rdb->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES) {
-                processed = rdb->processed_bytes;
-                aofReadDiffFromParent();
+        for (k = 0; k < parts; k++) {
+            //获取当前索引对应的库
+            redisDb *db = server.shard_threads ? shardGetDb(k,j) : server.db+j;
+
+            if (dictSize(db->dict) == 0) continue;
+            //获取对应的迭代器对象
+            di = dictGetSafeIterator(db->dict);
+            //检测获取对应的迭代器是否成功
+            if (!di) 
+                return C_ERR;
+
+            /* Iterate this DB writing every entry */
+            //遍历数据库所有的键值对
+            while((de = dictNext(di)) != NULL) {
+                //当前键字符串
+                sds keystr = dictGetKey(de);
+                //当前键对应的值对象
+                robj key, *o = dictGetVal(de);
+                long long expire;
+                //在栈中创建一个键对象并初始化
+                initStaticStringObject(key,keystr);
+                //获取当前键的过期时间
+                expire = getExpire(db,&key);
+                if (flags & RDB_SAVE_KEY_INDEX) {
+                    if (rdbSaveKeyIndexEntry(&idx,j,keystr,
+                                             rdb->processed_bytes) == -1)
+                        goto werr;
+                    idx_keys++;
+                }
+                //将键的键对象，值对象，过期时间写到rio中
+                if (rdbSaveKeyValuePair(rdb,&key,o,expire) == -1) 
+                    goto werr;
+
+                /* 
+                 * When this RDB is produced as part of an AOF rewrite, move
+                 * accumulated diff from parent to child while rewriting in
+                 * order to have a smaller final write. 
+                 */
+                if (flags & RDB_SAVE_AOF_PREAMBLE && rdb->processed_bytes > processed+AOF_READ_DIFF_INTERVAL_BYTES) {
+                    processed = rdb->processed_bytes;
+                    aofReadDiffFromParent();
+                }
             }
+            //释放迭代器
+            dictReleaseIterator(di);
+            di = NULL;
         }
-		//释放迭代器
-        dictReleaseIterator(di);
     }
     di = NULL; /* So that we don't release it again on error. */
+    idx_tail = rdb->processed_bytes;
 
     /* If we are storing the replication information on disk, persist
      * the script cache as well: on successful PSYNC after a restart, we need
@@ -1271,12 +1364,17 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
 	//将8位校验码写入到文件的最后
     if (rioWrite(rdb,&cksum,8) == 0) 
 		goto werr;
+    if (flags & RDB_SAVE_KEY_INDEX) {
+        if (rdbSaveKeyIndex(rdb,&idx,idx_tail,idx_keys) == -1) goto werr;
+        sdsfree(idx.io.buffer.ptr);
+    }
     return C_OK;
 
 werr:
     if (error) 
 		//设置存储失败原因
 		*error = errno;
+    if (flags & RDB_SAVE_KEY_INDEX) sdsfree(idx.io.buffer.ptr);
 	//检测对应的迭代器是否存在
     if (di) 
 		//释放对应的空间
@@ -1324,6 +1422,9 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
     rio rdb;
     int error = 0;
 
+    /* Keys not yet loaded from the previous RDB must be saved as well. */
+    lazyLoadFinish();
+
     //拼接获取对应的备份临时文件的名称
     snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());
 	//以写方式打开临时文件
@@ -1342,10 +1443,16 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
 	//初始化一个rio对象，该对象是一个文件对象IO
     rioInitWithFile(&rdb,fp);
 	//将库中的内容写到rio中
-    if (rdbSaveRio(&rdb,&error,RDB_SAVE_NONE,rsi) == C_ERR) {
+    shardsPause();
+    if (rdbSaveRio(&rdb,&error,
+                   server.rdb_lazy_load ? RDB_SAVE_KEY_INDEX : RDB_SAVE_NONE,
+                   rsi) == C_ERR)
+    {
+        shardsResume();
         errno = error;
         goto werr;
     }
+    shardsResume();
 
     /* Make sure data will not remain on the OS's output buffers */
 	//冲洗缓冲区，确保所有的数据都写入磁盘
@@ -1400,6 +1507,7 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
 	//当前没有正在进行AOF和RDB操作，否则返回C_ERR
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) 
 		return C_ERR;
+    lazyLoadFinish();
 
     //备份当前数据库的脏键值
     server.dirty_before_bgsave = server.dirty;
@@ -1410,6 +1518,9 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
 
     //fork函数开始时间，记录fork函数的耗时
     start = ustime();
+    /* The shard threads must be stopped while forking, so that the child
+     * gets a consistent snapshot of their databases. */
+    shardsPause();
 	//创建子进程
     if ((childpid = fork()) == 0) {
         int retval;
@@ -1439,6 +1550,7 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
         exitFromChild((retval == C_OK) ? 0 : 1);
     } else {
         /* Parent 父进程执行的代码 */
+        shardsResume();
         server.stat_fork_time = ustime()-start;
         server.stat_fork_rate = (double) zmalloc_used_memory() * 1000000 / server.stat_fork_time / (1024*1024*1024); /* GB per second. */
         latencyAddSampleIfNeeded("fork",server.stat_fork_time/1000);
@@ -1507,7 +1619,9 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
 
     if (rdbtype == RDB_TYPE_STRING) {
         /* Read string value */
-        if ((o = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
+        o = rdbGenericLoadStringObject(rdb,RDB_LOAD_ENC|RDB_LOAD_COMPRESSED,
+                                       NULL);
+        if (o == NULL) return NULL;
         o = tryObjectEncoding(o);
     } else if (rdbtype == RDB_TYPE_LIST) {
         /* Read list value */
@@ -1789,6 +1903,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
     } else {
         rdbExitReportCorruptRDB("Unknown RDB encoding type %d",rdbtype);
     }
+    if (server.value_compression) compressionCompressLoadedValue(o);
     return o;
 }
 
@@ -1848,6 +1963,63 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     }
 }
 
+/* Load an AUX field, the opcode being already consumed, updating 'rsi' with
+ * the replication info and the server with the Lua scripts it carries.
+ * Returns -1 on short read. */
+int rdbLoadAuxField(rio *rdb, rdbSaveInfo *rsi) {
+    /* AUX: generic string-string fields. Use to add state to RDB
+     * which is backward compatible. Implementations of RDB loading
+     * are requierd to skip AUX fields they don't understand.
+     *
+     * An AUX field is composed of two strings: key and value. */
+    //读出的是一个辅助字段
+    robj *auxkey, *auxval;
+    //读出辅助字段的键对象和值对象
+    if ((auxkey = rdbLoadStringObject(rdb)) == NULL)
+        return -1;
+    if ((auxval = rdbLoadStringObject(rdb)) == NULL)
+        return -1;
+
+    //根据对应的键对象的值来区分对应的操作
+    if (((char*)auxkey->ptr)[0] == '%') {
+        /* All the fields with a name staring with '%' are considered
+         * information fields and are logged at startup with a log level of NOTICE. */
+        //键对象的第一个字符是%
+        //写日志信息
+        serverLog(LL_NOTICE,"RDB '%s': %s",(char*)auxkey->ptr,(char*)auxval->ptr);
+    } else if (!strcasecmp(auxkey->ptr,"repl-stream-db")) {
+        if (rsi)
+            rsi->repl_stream_db = atoi(auxval->ptr);
+    } else if (!strcasecmp(auxkey->ptr,"repl-id")) {
+        if (rsi && sdslen(auxval->ptr) == CONFIG_RUN_ID_SIZE) {
+            memcpy(rsi->repl_id,auxval->ptr,CONFIG_RUN_ID_SIZE+1);
+            rsi->repl_id_is_set = 1;
+        }
+    } else if (!strcasecmp(auxkey->ptr,"repl-offset")) {
+        if (rsi)
+            rsi->repl_offset = strtoll(auxval->ptr,NULL,10);
+    } else if (!strcasecmp(auxkey->ptr,"vc-dict")) {
+        if (compressionLoadDict(auxval->ptr) == C_ERR)
+            serverLog(LL_WARNING,"Ignoring invalid value compression "
+                                 "dictionary in RDB file");
+    } else if (!strcasecmp(auxkey->ptr,"lua")) {
+        /* Load the script back in memory. */
+        //加载对应的lua脚本到内存中
+        //创建对应的lua处理函数
+        if (luaCreateFunction(NULL,server.lua,auxval) == NULL) {
+            rdbExitReportCorruptRDB("Can't load Lua script from RDB file! " "BODY: %s", auxval->ptr);
+        }
+    } else {
+        /* We ignore fields we don't understand, as by AUX field contract. */
+        serverLog(LL_DEBUG,"Unrecognized RDB AUX field: '%s'",(char*)auxkey->ptr);
+    }
+
+    //释放对应的键值对对象
+    decrRefCount(auxkey);
+    decrRefCount(auxval);
+    return 0;
+}
+
 /* 通过rdb文件进行数据载入处理
  * Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
  * otherwise C_ERR is returned and 'errno' is set accordingly. 
@@ -1961,52 +2133,8 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
             dictExpand(db->expires,expires_size);
             continue; /* Read type again. */
         } else if (type == RDB_OPCODE_AUX) {
-            /* AUX: generic string-string fields. Use to add state to RDB
-             * which is backward compatible. Implementations of RDB loading
-             * are requierd to skip AUX fields they don't understand.
-             *
-             * An AUX field is composed of two strings: key and value. */
-            //读出的是一个辅助字段
-            robj *auxkey, *auxval;
-			//读出辅助字段的键对象和值对象
-            if ((auxkey = rdbLoadStringObject(rdb)) == NULL) 
-				goto eoferr;
-            if ((auxval = rdbLoadStringObject(rdb)) == NULL) 
-				goto eoferr;
-			
-            //根据对应的键对象的值来区分对应的操作 
-            if (((char*)auxkey->ptr)[0] == '%') {
-                /* All the fields with a name staring with '%' are considered
-                 * information fields and are logged at startup with a log level of NOTICE. */
-                //键对象的第一个字符是%
-                //写日志信息
-                serverLog(LL_NOTICE,"RDB '%s': %s",(char*)auxkey->ptr,(char*)auxval->ptr);
-            } else if (!strcasecmp(auxkey->ptr,"repl-stream-db")) {
-                if (rsi) 
-					rsi->repl_stream_db = atoi(auxval->ptr);
-            } else if (!strcasecmp(auxkey->ptr,"repl-id")) {
-                if (rsi && sdslen(auxval->ptr) == CONFIG_RUN_ID_SIZE) {
-                    memcpy(rsi->repl_id,auxval->ptr,CONFIG_RUN_ID_SIZE+1);
-                    rsi->repl_id_is_set = 1;
-                }
-            } else if (!strcasecmp(auxkey->ptr,"repl-offset")) {
-                if (rsi) 
-					rsi->repl_offset = strtoll(auxval->ptr,NULL,10);
-            } else if (!strcasecmp(auxkey->ptr,"lua")) {
-                /* Load the script back in memory. */
-			    //加载对应的lua脚本到内存中
-			    //创建对应的lua处理函数
-                if (luaCreateFunction(NULL,server.lua,auxval) == NULL) {
-                    rdbExitReportCorruptRDB("Can't load Lua script from RDB file! " "BODY: %s", auxval->ptr);
-                }
-            } else {
-                /* We ignore fields we don't understand, as by AUX field contract. */
-                serverLog(LL_DEBUG,"Unrecognized RDB AUX field: '%s'",(char*)auxkey->ptr);
-            }
-
-			//释放对应的键值对对象
-            decrRefCount(auxkey);
-            decrRefCount(auxval);
+            if (rdbLoadAuxField(rdb,rsi) == -1)
+                goto eoferr;
             continue; /* Read type again. */
         }
 
@@ -2032,12 +2160,18 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
         }
         /* Add the new object in the hash table */
 		//将没有过期的键值对添加到数据库键值对字典中
-        dbAdd(db,key,val);
+        {
+            /* In sharded mode the key goes to the shard owning its slot. */
+            redisDb *kdb = server.shard_threads ?
+                           shardGetDbForKey(db->id,key) : db;
+
+            dbAdd(kdb,key,val);
 
-        /* Set the expire time if needed */
-		//如果需要，设置过期时间
-        if (expiretime != -1) 
-			setExpire(NULL,db,key,expiretime);
+            /* Set the expire time if needed */
+            //如果需要，设置过期时间
+            if (expiretime != -1) 
+                setExpire(NULL,kdb,key,expiretime);
+        }
 		//释放临时对象
         decrRefCount(key);
     }
@@ -2271,6 +2405,7 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
     //首先检测当前是否处于备份中
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) 
 		return C_ERR;
+    lazyLoadFinish();
 
     /* 
      * Before to fork, create a pipe that will be used in order to
@@ -116,9 +116,23 @@
 #define RDB_LOAD_ENC    (1<<0)
 #define RDB_LOAD_PLAIN  (1<<1)
 #define RDB_LOAD_SDS    (1<<2)
+#define RDB_LOAD_COMPRESSED (1<<3) /* Keep LZF strings compressed when the
+                                      value compression would do it. */
 
 #define RDB_SAVE_NONE 0
 #define RDB_SAVE_AOF_PREAMBLE (1<<0)
+#define RDB_SAVE_KEY_INDEX (1<<1)
+
+/* With RDB_SAVE_KEY_INDEX an index of the keys is appended after the
+ * checksum, where the loaders not using it stop reading. Every entry is
+ * the DB id (length encoded), the key (length + bytes), and the offset
+ * of the key in the file (length encoded), in file order. The trailer, at
+ * the very end of the file, is made of the offset of the index, the offset
+ * where the data following the keys starts (Lua scripts, EOF opcode), and
+ * the number of keys, as 64 bit little endian integers, then the magic.
+ * See lazyload.c. */
+#define RDB_KEY_INDEX_MAGIC "RDBKEYIX"
+#define RDB_KEY_INDEX_TRAILER_LEN 32
 
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
@@ -142,12 +156,15 @@ int rdbSaveKeyValuePair(rio *rdb, robj *key, robj *val, long long expiretime);
 robj *rdbLoadStringObject(rio *rdb);
 ssize_t rdbSaveStringObject(rio *rdb, robj *obj);
 ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len);
+ssize_t rdbSaveAuxField(rio *rdb, void *key, size_t keylen, void *val, size_t vallen);
 void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr);
 int rdbSaveBinaryDoubleValue(rio *rdb, double val);
 int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
 int rdbSaveBinaryFloatValue(rio *rdb, float val);
 int rdbLoadBinaryFloatValue(rio *rdb, float *val);
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof);
+int rdbLoadAuxField(rio *rdb, rdbSaveInfo *rsi);
+long long rdbLoadMillisecondTime(rio *rdb);
 rdbSaveInfo *rdbPopulateSaveInfo(rdbSaveInfo *rsi);
 
 #endif
@@ -0,0 +1,187 @@
+/* Concurrent execution of read only commands.
+ *
+ * When "read-threads" is set to N > 0, a pool of N threads executes the
+ * read only commands (CMD_READONLY) having keys, concurrently with each
+ * other. The main thread keeps doing the network I/O, the protocol parsing
+ * and all the checks of processCommand(), then queues the client: it is
+ * flagged as blocked (BLOCKED_THREAD) until a read thread hands it back, so
+ * the main thread never touches a client while a reader is executing a
+ * command on its behalf.
+ *
+ * Everything else, that is, all the commands that may modify the dataset
+ * and the main thread activities doing the same (serverCron(), the fast
+ * expire cycle, eviction, module timers and blocked clients, ...) still
+ * runs in the main thread, but only when no reader is running. This is a
+ * simple epoch scheme with a single writer:
+ *
+ * 1) The first command dispatched to the readers opens a read epoch. From
+ *    now on the main thread does not mutate the dataset, and the dict
+ *    incremental rehashing steps are paused, so that lookups performed by
+ *    the readers never modify the hash tables.
+ *
+ * 2) Before mutating the dataset the main thread calls readThreadsWait(),
+ *    that waits for all the dispatched commands to be executed and closes
+ *    the epoch. Since every write happens outside a read epoch, memory
+ *    unlinked from the keyspace (including the objects released by the
+ *    lazy free thread and the allocations moved by active defrag) can't
+ *    be referenced by a reader.
+ *
+ * The epoch is always closed before the main thread sleeps in the event
+ * loop, so a burst of reads received in the same event loop iteration is
+ * executed in parallel, while a write only waits for the reads that were
+ * received before it.
+ *
+ * Readers lookup keys with the usual API: logically expired keys are
+ * reported as missing without deleting them (the main thread will expire
+ * them later), and the keyspace hits / misses stats are approximate.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "workers.h"
+
+static workerPool *read_pool = NULL;
+
+/* Main thread only: true while a read epoch is open. */
+static int read_epoch_open = 0;
+
+/* Return true if the caller is a read thread. */
+int readThreadsIsReader(void) {
+    return workerPoolIsWorker(read_pool);
+}
+
+/* Executed by a read thread. */
+static void readThreadExecute(void *job) {
+    client *c = job;
+    long long start = ustime();
+
+    c->cmd->proc(c);
+    c->bpop.thread_usec = ustime()-start;
+}
+
+/* Called in the main thread to hand an executed command back. */
+static void readThreadDone(void *job) {
+    unblockClientFromThread(job);
+}
+
+/* Return true if the command of the client, already checked by
+ * processCommand(), can be executed by a read thread. */
+int readThreadsCanExecute(client *c) {
+    struct redisCommand *cmd = c->cmd;
+
+    if (!read_pool) return 0;
+    /* Loading lazily the keys still on disk mutates the dataset. */
+    if (server.lazy_loading) return 0;
+    if (!(cmd->flags & CMD_READONLY)) return 0;
+    /* The hot keys tracking and the command tracing state are not thread
+     * safe: while they are active, run in the main thread. */
+    if (server.hotkeys_tracking || server.trace_active) return 0;
+    /* Commands without keys (KEYS, SCAN, RANDOMKEY, ...) run in the main
+     * thread: KEYS for instance uses a safe iterator, that registers
+     * itself into the dict. */
+    if (cmd->firstkey == 0 && cmd->getkeys_proc == NULL) return 0;
+    if (c->flags & (CLIENT_MULTI|CLIENT_MASTER|CLIENT_SLAVE|CLIENT_LUA))
+        return 0;
+    /* Modules are not required to be thread safe. PFCOUNT caches the
+     * cardinality into the HyperLogLog, and reading a compressed quicklist
+     * node decompresses it in place. */
+    if (cmd->flags & CMD_MODULE || cmd->proc == pfcountCommand) return 0;
+    if (server.list_compress_depth &&
+        (cmd->proc == lrangeCommand || cmd->proc == lindexCommand))
+        return 0;
+    /* Same for the values compressed by the value compression. */
+    if (compressionCommandKeysCompressed(c)) return 0;
+    return 1;
+}
+
+/* Queue the command of the client, that must be accepted by
+ * readThreadsCanExecute(), for execution in a read thread. */
+void readThreadsExecute(client *c) {
+    if (listLength(server.monitors) && !server.loading &&
+        !(c->cmd->flags & (CMD_SKIP_MONITOR|CMD_ADMIN)))
+    {
+        replicationFeedMonitors(c,server.monitors,c->db->id,c->argv,c->argc);
+    }
+
+    if (!read_epoch_open) {
+        read_epoch_open = 1;
+        dictPauseRehashSteps();
+    }
+    blockClientForThread(c);
+    server.stat_threaded_reads++;
+    workerPoolSubmit(read_pool,c);
+}
+
+/* Wait for the readers to execute all the dispatched commands and close
+ * the read epoch: after this call the main thread can modify the dataset.
+ * The executed commands are handed back later by readThreadDone(). */
+void readThreadsWait(void) {
+    if (!read_epoch_open) return;
+
+    if (workerPoolWaitIdle(read_pool)) server.stat_read_threads_waits++;
+    read_epoch_open = 0;
+    dictResumeRehashSteps();
+}
+
+/* Called before executing a command in the main thread. Commands without
+ * keys flagged as fast and not writing (PING, ECHO, SELECT, AUTH, TIME,
+ * DBSIZE, ...) don't modify the dataset and can run concurrently with the
+ * readers. */
+void readThreadsWaitIfNeeded(client *c) {
+    struct redisCommand *cmd = c->cmd;
+
+    if (!read_epoch_open) return;
+    if ((cmd->flags & CMD_FAST) && !(cmd->flags & CMD_WRITE) &&
+        cmd->firstkey == 0 && cmd->getkeys_proc == NULL) return;
+    readThreadsWait();
+}
+
+void readThreadsInit(void) {
+    char *incompatible = NULL;
+
+    if (server.sentinel_mode) {
+        server.read_threads = 0;
+        return;
+    }
+    if (server.cluster_enabled) incompatible = "cluster-enabled";
+    else if (server.shard_threads) incompatible = "shard-threads";
+    if (incompatible) {
+        serverLog(LL_WARNING,
+            "read-threads can't be used together with %s. Exiting.",
+            incompatible);
+        exit(1);
+    }
+
+    read_pool = workerPoolCreate("read",server.read_threads,
+        readThreadExecute,readThreadDone,NULL);
+    serverLog(LL_NOTICE,"Read only commands executed by %d read threads.",
+        server.read_threads);
+}
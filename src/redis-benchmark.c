@@ -39,26 +39,138 @@
 #include <sys/time.h>
 #include <signal.h>
 #include <assert.h>
+#include <pthread.h>
+#include <math.h>
+#include <stdint.h>
 
 #include <sds.h> /* Use hiredis sds. */
 #include "ae.h"
+#include "anet.h"
 #include "hiredis.h"
 #include "adlist.h"
 #include "zmalloc.h"
+#include "atomicvar.h"
+#include "shmring.h"
 
 #define UNUSED(V) ((void) V)
 #define RANDPTR_INITIAL_SIZE 8
 
-static struct config {
+#define CLUSTER_SLOTS 16384
+#define CLUSTER_MAX_NODES 1024
+#define CLUSTER_MAX_REDIRECTS 5     /* Redirections followed per request. */
+#define CLUSTER_MAX_KEY_TRIES 64    /* See clusterPrepareRequest(). */
+
+unsigned short crc16(const char *buf, int len); /* From crc16.c */
+
+/* Latencies are recorded in microseconds into a fixed size histogram in the
+ * spirit of HdrHistogram: values below HIST_SUB_BUCKETS are stored exactly,
+ * then every power of two is split into HIST_SUB_BUCKETS linear buckets, so
+ * that every recorded value has a relative error below 1%, whatever the
+ * number of requests. */
+#define HIST_SUB_BITS 7
+#define HIST_SUB_BUCKETS (1<<HIST_SUB_BITS)
+#define HIST_MAX_BITS 36 /* Up to 2^36 microseconds, that's ~19 hours. */
+#define HIST_BUCKETS ((HIST_MAX_BITS-HIST_SUB_BITS+1)*HIST_SUB_BUCKETS)
+
+typedef struct latencyHistogram {
+    long long count;            /* Number of recorded values. */
+    long long min;              /* Exact minimum value recorded. */
+    long long max;              /* Exact maximum value recorded. */
+    long long sum;              /* Sum of the values, for the average. */
+    long long buckets[HIST_BUCKETS];
+} latencyHistogram;
+
+/* Every benchmark thread runs its own event loop serving a subset of the
+ * clients, and records latencies into its own histogram, so that the only
+ * state shared among threads are the request counters. The histograms are
+ * merged once the threads are joined. Without --threads a single one of
+ * those is used, and its event loop runs in the main thread. */
+typedef struct benchmarkThread {
+    int index;
+    pthread_t thread;
     aeEventLoop *el;
+    list *clients;              /* Clients served by this thread. */
+    int numclients;             /* Number of clients this thread should run. */
+    int liveclients;            /* Number of clients currently connected. */
+    latencyHistogram *histogram;
+    latencyHistogram **cmd_histograms; /* Per workload command latencies. */
+    uint64_t rand_state;        /* Per thread PRNG state, see threadRandom(). */
+    sds scratch;                /* Buffer used to expand workload arguments. */
+    sds cmdbuf;                 /* Buffer used to build workload commands. */
+    /* Cluster mode: per node statistics, indexed like config.cluster_nodes,
+     * and blocking connections used to follow redirections. */
+    latencyHistogram **node_histograms;
+    long long *node_moved;
+    long long *node_ask;
+    redisContext **redirect_contexts;
+} benchmarkThread;
+
+/* Master node of the benchmarked cluster. Nodes are only ever added, so
+ * that an index in config.cluster_nodes stays valid for the whole run. */
+typedef struct clusterNode {
+    sds ip;
+    int port;
+} clusterNode;
+
+/* A workload file describes one or more phases, executed in order, each one
+ * sending a weighted mix of commands. Command arguments are templates where
+ * the following placeholders are expanded for every request:
+ *
+ * __key__       Key number, picked accordingly to the key distribution.
+ * __value__     Value of a size picked by the value size distribution.
+ * __rand_int__  Uniformly distributed integer in the keyspace range.
+ *
+ * See the usage text for the file syntax. */
+#define WORKLOAD_MAX_COMMANDS 64
+
+#define KEYDIST_UNIFORM 0
+#define KEYDIST_SEQUENTIAL 1
+#define KEYDIST_ZIPF 2
+#define KEYDIST_HOTSPOT 3
+
+#define VALUESIZE_FIXED 0
+#define VALUESIZE_UNIFORM 1
+#define VALUESIZE_NORMAL 2
+
+typedef struct workloadCommand {
+    sds name;                   /* Template joined by spaces, for reports. */
+    int weight;
+    int argc;
+    sds *argv;                  /* Argument templates. */
+    int *dynamic;               /* True if argv[j] contains placeholders. */
+} workloadCommand;
+
+typedef struct workloadPhase {
+    sds name;
+    int requests;
+    long long rate;             /* Target requests per second, 0 = closed loop. */
+    long long keyspace;
+    int keydist;                /* KEYDIST_* */
+    double zipf_theta;          /* Zipf skew, 0 < theta < 1. */
+    double zipf_zetan, zipf_eta, zipf_alpha; /* Precomputed zipf constants. */
+    double hot_keys;            /* Fraction of the keyspace that is hot. */
+    double hot_ops;             /* Fraction of the requests hitting it. */
+    int valuedist;              /* VALUESIZE_* */
+    long long value_a, value_b; /* Fixed size, min/max, or mean/stddev. */
+    long long value_max;        /* Upper bound of the generated sizes. */
+    long long sequence;         /* Next key of the sequential distribution. */
+    pthread_mutex_t sequence_mutex;
+    workloadCommand commands[WORKLOAD_MAX_COMMANDS];
+    int numcommands;
+    int totweight;
+} workloadPhase;
+
+static struct config {
     const char *hostip;
     int hostport;
     const char *hostsocket;
+    int shm;                    /* --shm: use the shared memory rings. */
     int numclients;
     int liveclients;
     int requests;
     int requests_issued;
     int requests_finished;
+    long long end;              /* Time the last request was completed. */
     int keysize;
     int datasize;
     int randomkeys;
@@ -67,18 +179,43 @@ static struct config {
     int pipeline;
     int showerrors;
     long long start;
+    long long start_us;         /* Same as 'start' in microseconds. */
     long long totlatency;
-    long long *latency;
+    latencyHistogram *histogram; /* Merged latencies of all the threads. */
     const char *title;
-    list *clients;
+    int num_threads;
+    benchmarkThread **threads;
     int quiet;
     int csv;
+    int csv_latency;
+    int json;
     int loop;
     int idlemode;
     int dbnum;
     sds dbnumstr;
     char *tests;
     char *auth;
+    const char *workload;       /* --workload file name. */
+    workloadPhase **phases;     /* Phases of the --workload file, if any. */
+    int numphases;
+    workloadPhase *phase;       /* Phase being executed. */
+    latencyHistogram **cmd_histograms; /* Merged per command latencies. */
+    char *valuebuf;             /* Source of the __value__ placeholders. */
+    int cluster_mode;
+    clusterNode *cluster_nodes[CLUSTER_MAX_NODES];
+    int cluster_numnodes;
+    /* Owner of every slot, as an index in cluster_nodes. MOVED redirections
+     * update it from any thread: entries are plain ints, a stale read only
+     * costs one more redirection. */
+    int cluster_slots[CLUSTER_SLOTS];
+    pthread_mutex_t cluster_mutex; /* Protects the addition of nodes. */
+    latencyHistogram **node_histograms; /* Merged per node statistics. */
+    long long *node_moved;
+    long long *node_ask;
+    /* Used by the atomicvar.h macros when no atomic builtin is available. */
+    pthread_mutex_t liveclients_mutex;
+    pthread_mutex_t requests_issued_mutex;
+    pthread_mutex_t requests_finished_mutex;
 } config;
 
 typedef struct _client {
@@ -95,10 +232,25 @@ typedef struct _client {
                                such as auth and select are prefixed to the pipeline of
                                benchmark commands and discarded after the first send. */
     int prefixlen;          /* Size in bytes of the pending prefix commands */
+    benchmarkThread *thread; /* Thread whose event loop serves the client */
+    int *cmdidx;            /* Workload command of every pipelined request */
+    int scheduled;          /* Request ready, waiting for its send time */
+    long long timer_id;     /* Timer of a scheduled request, or -1 */
+    /* Cluster mode only. */
+    redisContext **contexts; /* Connection to every node, NULL if missing */
+    int node;               /* Node of the current connection 'context' */
+    int batch_node;         /* Node owning the keys of the pipeline, or -1 */
+    size_t *cmdoff;         /* Offset of every pipelined command in obuf */
+    size_t *keyoff;         /* Offset and length of the key of every */
+    size_t *keylen;         /* pipelined command, keylen is 0 if missing */
+    /* Shared memory transport only (--shm). */
+    shmConn *shm;           /* Rings used instead of the socket, or NULL */
+    int shm_full;           /* Waiting for room in the requests ring */
 } *client;
 
 /* Prototypes */
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+static void shmWrite(client c);
 static void createMissingClients(client c);
 
 /* Implementation */
@@ -122,34 +274,658 @@ static long long mstime(void) {
     return mst;
 }
 
+/* ----------------------------- Latency histogram ------------------------- */
+
+static void histogramReset(latencyHistogram *h) {
+    memset(h,0,sizeof(*h));
+}
+
+/* Return the index of the bucket where 'value' is accounted. */
+static int histogramBucketIndex(long long value) {
+    int msb, group;
+
+    if (value < HIST_SUB_BUCKETS) return value;
+    msb = 63-__builtin_clzll(value);
+    if (msb >= HIST_MAX_BITS) return HIST_BUCKETS-1;
+    group = msb-HIST_SUB_BITS+1;
+    return group*HIST_SUB_BUCKETS+
+           (int)((value>>(group-1))-HIST_SUB_BUCKETS);
+}
+
+/* Return the lowest and highest values accounted in the bucket 'idx'. */
+static long long histogramBucketLowest(int idx) {
+    int group = idx/HIST_SUB_BUCKETS, sub = idx%HIST_SUB_BUCKETS;
+
+    if (group == 0) return sub;
+    return (long long)(sub+HIST_SUB_BUCKETS) << (group-1);
+}
+
+static long long histogramBucketHighest(int idx) {
+    int group = idx/HIST_SUB_BUCKETS, sub = idx%HIST_SUB_BUCKETS;
+
+    if (group == 0) return sub;
+    return ((long long)(sub+HIST_SUB_BUCKETS+1) << (group-1))-1;
+}
+
+static void histogramRecord(latencyHistogram *h, long long value) {
+    if (value < 0) value = 0;
+    if (h->count == 0 || value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+    h->count++;
+    h->sum += value;
+    h->buckets[histogramBucketIndex(value)]++;
+}
+
+/* Add all the values recorded into 'src' to 'dst'. */
+static void histogramMerge(latencyHistogram *dst, latencyHistogram *src) {
+    int j;
+
+    if (src->count == 0) return;
+    if (dst->count == 0 || src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (j = 0; j < HIST_BUCKETS; j++) dst->buckets[j] += src->buckets[j];
+}
+
+/* Return the value below which 'perc' percent of the recorded values fall,
+ * that is, the highest value equivalent to the bucket reaching the
+ * percentile, capped to the maximum value actually recorded. */
+static long long histogramPercentile(latencyHistogram *h, double perc) {
+    long long target, seen = 0;
+    int j;
+
+    if (h->count == 0) return 0;
+    target = (long long)((perc/100)*h->count+0.5);
+    if (target < 1) target = 1;
+    for (j = 0; j < HIST_BUCKETS; j++) {
+        seen += h->buckets[j];
+        if (seen >= target) {
+            long long value = histogramBucketHighest(j);
+            return value > h->max ? h->max : value;
+        }
+    }
+    return h->max;
+}
+
+/* ------------------------------ Cluster mode ----------------------------- */
+
+/* Same as keyHashSlot() in cluster.c. */
+static int clusterKeyHashSlot(const char *key, int keylen) {
+    int s, e; /* start-end indexes of { and } */
+
+    for (s = 0; s < keylen; s++)
+        if (key[s] == '{') break;
+    if (s == keylen) return crc16(key,keylen) & 0x3FFF;
+    for (e = s+1; e < keylen; e++)
+        if (key[e] == '}') break;
+    if (e == keylen || e == s+1) return crc16(key,keylen) & 0x3FFF;
+    return crc16(key+s+1,e-s-1) & 0x3FFF;
+}
+
+/* Return the index of the node ip:port, adding it if unknown. */
+static int clusterGetNode(const char *ip, int port) {
+    int j;
+
+    pthread_mutex_lock(&config.cluster_mutex);
+    for (j = 0; j < config.cluster_numnodes; j++) {
+        clusterNode *node = config.cluster_nodes[j];
+        if (node->port == port && !strcmp(node->ip,ip)) break;
+    }
+    if (j == config.cluster_numnodes) {
+        clusterNode *node;
+
+        if (j == CLUSTER_MAX_NODES) {
+            fprintf(stderr,"Too many cluster nodes\n");
+            exit(1);
+        }
+        node = zmalloc(sizeof(*node));
+        node->ip = sdsnew(ip);
+        node->port = port;
+        config.cluster_nodes[j] = node;
+        config.cluster_numnodes++;
+    }
+    pthread_mutex_unlock(&config.cluster_mutex);
+    return j;
+}
+
+/* Connect to the node with the specified index, authenticating if needed.
+ * Connections are established synchronously, then switched to non blocking
+ * mode unless 'blocking' is true. */
+static redisContext *clusterConnectNode(int idx, int blocking) {
+    clusterNode *node = config.cluster_nodes[idx];
+    redisContext *ctx = redisConnect(node->ip,node->port);
+
+    if (ctx->err) {
+        fprintf(stderr,"Could not connect to Redis at %s:%d: %s\n",
+            node->ip, node->port, ctx->errstr);
+        exit(1);
+    }
+    if (config.auth) {
+        redisReply *reply = redisCommand(ctx,"AUTH %s",config.auth);
+        if (reply == NULL || reply->type == REDIS_REPLY_ERROR) {
+            fprintf(stderr,"AUTH failed on %s:%d: %s\n", node->ip,
+                node->port, reply ? reply->str : ctx->errstr);
+            exit(1);
+        }
+        freeReplyObject(reply);
+    }
+    if (!blocking) {
+        /* What the (not exported) redisSetBlocking() of hiredis does. */
+        anetNonBlock(NULL,ctx->fd);
+        ctx->flags &= ~REDIS_BLOCK;
+        ctx->reader->maxbuf = 0;
+    }
+    return ctx;
+}
+
+/* Fetch the slots configuration with CLUSTER SLOTS from the node specified
+ * with -h and -p. */
+static void clusterFetchSlots(void) {
+    redisContext *ctx;
+    redisReply *reply;
+    size_t j;
+    int slot;
+
+    for (slot = 0; slot < CLUSTER_SLOTS; slot++) config.cluster_slots[slot] = -1;
+    ctx = clusterConnectNode(clusterGetNode(config.hostip,config.hostport),1);
+    reply = redisCommand(ctx,"CLUSTER SLOTS");
+    if (reply == NULL || reply->type != REDIS_REPLY_ARRAY) {
+        fprintf(stderr,"Can't fetch the cluster slots from %s:%d: %s\n",
+            config.hostip, config.hostport,
+            reply ? reply->str : ctx->errstr);
+        exit(1);
+    }
+    for (j = 0; j < reply->elements; j++) {
+        redisReply *range = reply->element[j], *master;
+        const char *ip;
+        int node;
+
+        if (range->elements < 3) continue;
+        master = range->element[2];
+        /* A node not knowing its own address reports an empty IP. */
+        ip = master->element[0]->len ? master->element[0]->str : config.hostip;
+        node = clusterGetNode(ip,master->element[1]->integer);
+        for (slot = range->element[0]->integer;
+             slot <= range->element[1]->integer; slot++)
+            config.cluster_slots[slot] = node;
+    }
+    freeReplyObject(reply);
+    redisFree(ctx);
+
+    for (slot = 0; slot < CLUSTER_SLOTS; slot++) {
+        if (config.cluster_slots[slot] == -1) {
+            fprintf(stderr,"WARNING: slot %d is not served by any node, "
+                           "its keys will be sent to %s:%d\n",
+                slot, config.hostip, config.hostport);
+            break;
+        }
+    }
+    for (; slot < CLUSTER_SLOTS; slot++)
+        if (config.cluster_slots[slot] == -1) config.cluster_slots[slot] = 0;
+}
+
+/* Return the node owning the key of 'keylen' bytes at 'key'. */
+static int clusterKeyNode(const char *key, size_t keylen) {
+    return config.cluster_slots[clusterKeyHashSlot(key,keylen)];
+}
+
+/* Find the offsets of the pipelined commands in the output buffer, and of
+ * their first argument, that is the key of all the commands benchmarked in
+ * cluster mode. */
+static void clusterParseCommands(client c) {
+    char *p = c->obuf;
+    int j, k;
+
+    for (j = 0; j < config.pipeline; j++) {
+        c->cmdoff[j] = p-c->obuf;
+        c->keylen[j] = 0;
+        if (*p != '*') {
+            /* Inline command, such as the PING_INLINE test. */
+            p = strstr(p,"\r\n")+2;
+            continue;
+        }
+        int argc = strtol(p+1,&p,10);
+        p += 2;
+        for (k = 0; k < argc; k++) {
+            long len = strtol(p+1,&p,10);
+            p += 2;
+            if (k == 1) {
+                c->keyoff[j] = p-c->obuf;
+                c->keylen[j] = len;
+            }
+            p += len+2;
+        }
+    }
+    c->cmdoff[j] = p-c->obuf;
+}
+
+/* Move the client to the connection with 'node', so that the next pipeline
+ * is sent where its keys are served. */
+static void clusterSwitchNode(client c, int node) {
+    aeEventLoop *el = c->thread->el;
+
+    if (node == -1 || node == c->node) return;
+    aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+    aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
+    if (c->contexts[node] == NULL)
+        c->contexts[node] = clusterConnectNode(node,0);
+    c->context = c->contexts[node];
+    c->node = node;
+    aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
+}
+
+static void writeRandInt(char *p, size_t r) {
+    size_t j;
+
+    p += 11;
+    for (j = 0; j < 12; j++) {
+        *p = '0'+r%10;
+        r/=10;
+        p--;
+    }
+}
+
+/* Randomize the keys of the pipeline, then route it to the node owning
+ * them. All the __rand_int__ occurrences of a command get the same value,
+ * so that multi key commands don't span slots. Since a pipeline is sent to
+ * a single node, the keys of the commands after the first one are drawn
+ * again, up to CLUSTER_MAX_KEY_TRIES times, until they belong to the same
+ * node: the node receiving a pipeline is still picked accordingly to the
+ * key distribution. */
+static void clusterPrepareRequest(client c) {
+    size_t i = 0;
+    int j;
+
+    c->batch_node = -1;
+    for (j = 0; j < config.pipeline; j++) {
+        char *end = c->obuf+c->cmdoff[j+1];
+        size_t first = i, k;
+        int node, tries = 0;
+
+        while(i < c->randlen && c->randptr[i] < end) i++;
+        while(1) {
+            if (config.randomkeys && first != i) {
+                size_t r = random() % config.randomkeys_keyspacelen;
+                for (k = first; k < i; k++) writeRandInt(c->randptr[k],r);
+            }
+            if (c->keylen[j] == 0) break;
+            node = clusterKeyNode(c->obuf+c->keyoff[j],c->keylen[j]);
+            if (c->batch_node == -1) c->batch_node = node;
+            if (node == c->batch_node || !config.randomkeys || first == i ||
+                ++tries == CLUSTER_MAX_KEY_TRIES) break;
+        }
+    }
+    clusterSwitchNode(c,c->batch_node);
+}
+
+static void clusterRecordLatency(benchmarkThread *thread, int node,
+                                 long long latency)
+{
+    if (thread->node_histograms[node] == NULL)
+        thread->node_histograms[node] = zcalloc(sizeof(latencyHistogram));
+    histogramRecord(thread->node_histograms[node],latency);
+}
+
+/* Return true if 'reply' is a MOVED or ASK redirection. On success the
+ * slot and the target node index are returned by reference. */
+static int clusterParseRedirect(redisReply *reply, int *ask, int *slot,
+                                int *node)
+{
+    char *p, *addr, *colon;
+    sds ip;
+
+    if (reply->type != REDIS_REPLY_ERROR) return 0;
+    if (!strncmp(reply->str,"MOVED ",6)) *ask = 0;
+    else if (!strncmp(reply->str,"ASK ",4)) *ask = 1;
+    else return 0;
+
+    p = strchr(reply->str,' ')+1;
+    *slot = strtol(p,&addr,10);
+    addr++;
+    colon = strrchr(addr,':');
+    if (*slot < 0 || *slot >= CLUSTER_SLOTS || colon == NULL) return 0;
+    ip = sdsnewlen(addr,colon-addr);
+    *node = clusterGetNode(ip,atoi(colon+1));
+    sdsfree(ip);
+    return 1;
+}
+
+/* Follow the MOVED or ASK redirection got as reply to the pipelined command
+ * number 'idx', sending it again to the target node. MOVED also updates
+ * the slots table so that the next requests are routed correctly.
+ *
+ * Redirections only happen while slots are migrating, so the command is
+ * sent using a blocking connection owned by the thread: stalling the event
+ * loop for a round trip is simpler than rescheduling a part of the
+ * pipeline, and the time is accounted in the request latency anyway.
+ *
+ * The final reply replaces '*reply', and the index of the node that served
+ * the command is returned. */
+static int clusterFollowRedirects(client c, int idx, redisReply **reply) {
+    benchmarkThread *thread = c->thread;
+    char *cmd = c->obuf+c->cmdoff[idx];
+    size_t cmdlen = c->cmdoff[idx+1]-c->cmdoff[idx];
+    int node = c->node, ask, slot, target, j;
+
+    for (j = 0; j < CLUSTER_MAX_REDIRECTS; j++) {
+        redisContext *ctx;
+        void *r;
+
+        if (!clusterParseRedirect(*reply,&ask,&slot,&target)) break;
+        if (ask) {
+            thread->node_ask[node]++;
+        } else {
+            thread->node_moved[node]++;
+            config.cluster_slots[slot] = target;
+        }
+        if (thread->redirect_contexts[target] == NULL)
+            thread->redirect_contexts[target] = clusterConnectNode(target,1);
+        ctx = thread->redirect_contexts[target];
+        if (ask) redisAppendCommand(ctx,"ASKING");
+        redisAppendFormattedCommand(ctx,cmd,cmdlen);
+        if (ask) {
+            if (redisGetReply(ctx,&r) != REDIS_OK) goto ioerr;
+            freeReplyObject(r);
+        }
+        if (redisGetReply(ctx,&r) != REDIS_OK) goto ioerr;
+        freeReplyObject(*reply);
+        *reply = r;
+        node = target;
+    }
+    return node;
+
+ioerr:
+    fprintf(stderr,"Error following a redirection: %s\n",
+        thread->redirect_contexts[target]->errstr);
+    exit(1);
+}
+
+/* -------------------------------- Workloads ------------------------------ */
+
+/* xorshift64* generator: random() takes a lock in most libc implementations,
+ * which is not what we want in the hot path of several threads. */
+static uint64_t threadRandom(benchmarkThread *thread) {
+    uint64_t x = thread->rand_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    thread->rand_state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Return a random double in the [0,1) interval. */
+static double threadRandomDouble(benchmarkThread *thread) {
+    return (threadRandom(thread) >> 11) * (1.0/9007199254740992.0);
+}
+
+/* Precompute the constants used by workloadPickKey() for the zipfian
+ * distribution, see "Quickly Generating Billion-Record Synthetic Databases"
+ * by Gray et al., the same algorithm used by YCSB. */
+static void workloadInitZipf(workloadPhase *phase) {
+    double theta = phase->zipf_theta, zeta2 = 1+pow(0.5,theta);
+    long long j;
+
+    phase->zipf_zetan = 0;
+    for (j = 1; j <= phase->keyspace; j++)
+        phase->zipf_zetan += 1/pow((double)j,theta);
+    phase->zipf_alpha = 1/(1-theta);
+    phase->zipf_eta = (1-pow(2.0/phase->keyspace,1-theta)) /
+                      (1-zeta2/phase->zipf_zetan);
+}
+
+static long long workloadPickKey(workloadPhase *phase, benchmarkThread *thread) {
+    long long key, hot;
+    double u;
+
+    switch(phase->keydist) {
+    case KEYDIST_SEQUENTIAL:
+        atomicGetIncr(phase->sequence,key,1);
+        return key % phase->keyspace;
+    case KEYDIST_ZIPF:
+        u = threadRandomDouble(thread);
+        if (u*phase->zipf_zetan < 1) return 0;
+        if (u*phase->zipf_zetan < 1+pow(0.5,phase->zipf_theta)) return 1;
+        key = phase->keyspace *
+              pow(phase->zipf_eta*u-phase->zipf_eta+1,phase->zipf_alpha);
+        return key >= phase->keyspace ? phase->keyspace-1 : key;
+    case KEYDIST_HOTSPOT:
+        hot = phase->keyspace*phase->hot_keys;
+        if (hot < 1) hot = 1;
+        if (hot >= phase->keyspace ||
+            threadRandomDouble(thread) < phase->hot_ops)
+            return threadRandom(thread) % hot;
+        return hot + threadRandom(thread) % (phase->keyspace-hot);
+    default:
+        return threadRandom(thread) % phase->keyspace;
+    }
+}
+
+static long long workloadPickValueSize(workloadPhase *phase,
+                                       benchmarkThread *thread)
+{
+    long long size;
+
+    switch(phase->valuedist) {
+    case VALUESIZE_UNIFORM:
+        size = phase->value_a +
+               threadRandom(thread) % (phase->value_b-phase->value_a+1);
+        break;
+    case VALUESIZE_NORMAL: {
+        /* Box-Muller transform. */
+        double u1 = threadRandomDouble(thread), u2 = threadRandomDouble(thread);
+        double z = sqrt(-2*log(1-u1))*cos(2*M_PI*u2);
+        size = llround(phase->value_a+z*phase->value_b);
+        break;
+    }
+    default:
+        size = phase->value_a;
+        break;
+    }
+    if (size < 0) size = 0;
+    if (size > phase->value_max) size = phase->value_max;
+    return size;
+}
+
+/* Append to 'dst' the argument template 'arg' with the placeholders
+ * expanded. */
+static sds workloadExpandArg(sds dst, sds arg, long long key,
+                             workloadPhase *phase, benchmarkThread *thread)
+{
+    char *p = arg, *end = arg+sdslen(arg);
+
+    while(p < end) {
+        char *ph = strstr(p,"__");
+
+        if (ph == NULL) break;
+        dst = sdscatlen(dst,p,ph-p);
+        if (!strncmp(ph,"__key__",7)) {
+            dst = sdscatfmt(dst,"%I",key);
+            p = ph+7;
+        } else if (!strncmp(ph,"__value__",9)) {
+            dst = sdscatlen(dst,config.valuebuf,
+                            workloadPickValueSize(phase,thread));
+            p = ph+9;
+        } else if (!strncmp(ph,"__rand_int__",12)) {
+            dst = sdscatfmt(dst,"%I",
+                (long long)(threadRandom(thread) % phase->keyspace));
+            p = ph+12;
+        } else {
+            dst = sdscatlen(dst,"__",2);
+            p = ph+2;
+        }
+    }
+    return sdscatlen(dst,p,end-p);
+}
+
+/* Build into thread->cmdbuf the command 'wc' for the specified key.
+ * In cluster mode the node serving the key is returned, otherwise or if the
+ * command has no arguments -1 is returned. */
+static int workloadBuildCommand(benchmarkThread *thread, workloadCommand *wc,
+                                long long key, workloadPhase *phase)
+{
+    int k, node = -1;
+
+    sdsclear(thread->cmdbuf);
+    thread->cmdbuf = sdscatfmt(thread->cmdbuf,"*%i\r\n",wc->argc);
+    for (k = 0; k < wc->argc; k++) {
+        sds arg = wc->argv[k];
+
+        if (wc->dynamic[k]) {
+            sdsclear(thread->scratch);
+            thread->scratch = workloadExpandArg(thread->scratch,arg,key,
+                                                phase,thread);
+            arg = thread->scratch;
+        }
+        if (k == 1 && config.cluster_mode)
+            node = clusterKeyNode(arg,sdslen(arg));
+        thread->cmdbuf = sdscatfmt(thread->cmdbuf,"$%U\r\n",
+                                   (unsigned long long)sdslen(arg));
+        thread->cmdbuf = sdscatlen(thread->cmdbuf,arg,sdslen(arg));
+        thread->cmdbuf = sdscatlen(thread->cmdbuf,"\r\n",2);
+    }
+    return node;
+}
+
+/* Fill the output buffer of the client with a new pipeline of requests
+ * picked from the command mix of the current phase. Pending prefix commands
+ * (AUTH, SELECT) are preserved.
+ *
+ * In cluster mode the pipeline is routed to the node serving the key of its
+ * first command: the following ones are drawn again, up to
+ * CLUSTER_MAX_KEY_TRIES times, until they are served by the same node. */
+static void workloadPrepareRequest(client c) {
+    workloadPhase *phase = config.phase;
+    benchmarkThread *thread = c->thread;
+    int j;
+
+    if (c->prefixlen) sdsrange(c->obuf,0,c->prefixlen-1);
+    else sdsclear(c->obuf);
+    c->batch_node = -1;
+    for (j = 0; j < config.pipeline; j++) {
+        workloadCommand *wc;
+        int tries = 0;
+
+        while(1) {
+            int pick = threadRandom(thread) % phase->totweight, node;
+
+            wc = phase->commands;
+            while(pick >= wc->weight) pick -= (wc++)->weight;
+            node = workloadBuildCommand(thread,wc,
+                                        workloadPickKey(phase,thread),phase);
+            if (node == -1) break;
+            if (c->batch_node == -1) c->batch_node = node;
+            if (node == c->batch_node || ++tries == CLUSTER_MAX_KEY_TRIES)
+                break;
+        }
+        c->cmdidx[j] = wc-phase->commands;
+        if (c->cmdoff) c->cmdoff[j] = sdslen(c->obuf);
+        c->obuf = sdscatsds(c->obuf,thread->cmdbuf);
+    }
+    if (c->cmdoff) c->cmdoff[j] = sdslen(c->obuf);
+    if (config.cluster_mode) clusterSwitchNode(c,c->batch_node);
+}
+
+static int workloadScheduledSend(struct aeEventLoop *el, long long id,
+                                 void *clientData)
+{
+    client c = clientData;
+    UNUSED(id);
+
+    c->timer_id = -1;
+    aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    return AE_NOMORE;
+}
+
+/* In open loop mode (phase with a target rate) every request has an
+ * intended send time, derived from its sequence number alone. Latency is
+ * measured starting from that time rather than from the time the request
+ * is actually sent: when the server stalls, the requests that could not be
+ * sent in time are still accounted for the delay, avoiding the coordinated
+ * omission problem of closed loop benchmarks.
+ *
+ * Returns 1 if the request is not due yet and was scheduled with a timer,
+ * otherwise 0 is returned and the request should be sent right away. */
+static int workloadScheduleRequest(client c, long long seq) {
+    long long now = ustime(), intended, delay;
+
+    if (config.phase->rate == 0) {
+        c->start = now;
+        return 0;
+    }
+    intended = config.start_us + seq*1000000/config.phase->rate;
+    delay = (intended-now)/1000;
+    if (delay <= 0) {
+        /* Due or less than a millisecond early: send it now. */
+        c->start = intended < now ? intended : now;
+        return 0;
+    }
+    c->start = intended;
+
+    aeDeleteFileEvent(c->thread->el,c->context->fd,AE_WRITABLE);
+    c->timer_id = aeCreateTimeEvent(c->thread->el,delay,
+                                    workloadScheduledSend,c,NULL);
+    c->scheduled = 1;
+    return 1;
+}
+
+/* ------------------------------- Clients --------------------------------- */
+
 static void freeClient(client c) {
     listNode *ln;
-    aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-    aeDeleteFileEvent(config.el,c->context->fd,AE_READABLE);
-    redisFree(c->context);
+    benchmarkThread *thread = c->thread;
+
+    aeDeleteFileEvent(thread->el,c->context->fd,AE_WRITABLE);
+    aeDeleteFileEvent(thread->el,c->context->fd,AE_READABLE);
+    if (c->timer_id != -1) aeDeleteTimeEvent(thread->el,c->timer_id);
+    if (c->shm) {
+        aeDeleteFileEvent(thread->el,c->shm->wait_fd,AE_READABLE);
+        shmConnFree(c->shm);
+    }
+    if (c->contexts) {
+        int j;
+        for (j = 0; j < CLUSTER_MAX_NODES; j++)
+            if (c->contexts[j]) redisFree(c->contexts[j]);
+        zfree(c->contexts);
+        zfree(c->cmdoff);
+        zfree(c->keyoff);
+        zfree(c->keylen);
+    } else {
+        redisFree(c->context);
+    }
     sdsfree(c->obuf);
     zfree(c->randptr);
+    zfree(c->cmdidx);
     zfree(c);
-    config.liveclients--;
-    ln = listSearchKey(config.clients,c);
+    thread->liveclients--;
+    atomicDecr(config.liveclients,1);
+    ln = listSearchKey(thread->clients,c);
     assert(ln != NULL);
-    listDelNode(config.clients,ln);
+    listDelNode(thread->clients,ln);
 }
 
 static void freeAllClients(void) {
-    listNode *ln = config.clients->head, *next;
+    int j;
+
+    for (j = 0; j < config.num_threads; j++) {
+        list *clients = config.threads[j]->clients;
+        listNode *ln = clients->head, *next;
 
-    while(ln) {
-        next = ln->next;
-        freeClient(ln->value);
-        ln = next;
+        while(ln) {
+            next = ln->next;
+            freeClient(ln->value);
+            ln = next;
+        }
     }
 }
 
 static void resetClient(client c) {
-    aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-    aeDeleteFileEvent(config.el,c->context->fd,AE_READABLE);
-    aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    aeEventLoop *el = c->thread->el;
+
+    aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+    aeDeleteFileEvent(el,c->context->fd,AE_READABLE);
+    aeCreateFileEvent(el,c->context->fd,AE_WRITABLE,writeHandler,c);
     c->written = 0;
     c->pending = config.pipeline;
 }
@@ -157,31 +933,27 @@ static void resetClient(client c) {
 static void randomizeClientKey(client c) {
     size_t i;
 
-    for (i = 0; i < c->randlen; i++) {
-        char *p = c->randptr[i]+11;
-        size_t r = random() % config.randomkeys_keyspacelen;
-        size_t j;
-
-        for (j = 0; j < 12; j++) {
-            *p = '0'+r%10;
-            r/=10;
-            p--;
-        }
-    }
+    for (i = 0; i < c->randlen; i++)
+        writeRandInt(c->randptr[i],random() % config.randomkeys_keyspacelen);
 }
 
 static void clientDone(client c) {
-    if (config.requests_finished == config.requests) {
+    int requests_finished;
+
+    atomicGet(config.requests_finished,requests_finished);
+    if (requests_finished >= config.requests) {
+        aeEventLoop *el = c->thread->el;
+
         freeClient(c);
-        aeStop(config.el);
+        aeStop(el);
         return;
     }
     if (config.keepalive) {
         resetClient(c);
     } else {
-        config.liveclients--;
+        c->thread->liveclients--;
         createMissingClients(c);
-        config.liveclients++;
+        c->thread->liveclients++;
         freeClient(c);
     }
 }
@@ -198,7 +970,23 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
      * is not part of the latency, so calculate it only once, here. */
     if (c->latency < 0) c->latency = ustime()-(c->start);
 
-    if (redisBufferRead(c->context) != REDIS_OK) {
+    if (c->shm) {
+        /* Feed the parser with the whole content of the replies ring, and
+         * ask the server to wake us up on the next replies. */
+        char buf[1024*16];
+        ssize_t nread;
+
+        do {
+            while((nread = shmConnRead(c->shm,buf,sizeof(buf))) > 0)
+                redisReaderFeed(c->context->reader,buf,nread);
+            if (nread == -1) {
+                fprintf(stderr,"Error: invalid shared memory ring state\n");
+                exit(1);
+            }
+        } while(shmConnWaitReadable(c->shm));
+    }
+
+    if (!c->shm && redisBufferRead(c->context) != REDIS_OK) {
         fprintf(stderr,"Error: %s\n",c->context->errstr);
         exit(1);
     } else {
@@ -213,6 +1001,18 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                     exit(1);
                 }
 
+                /* In cluster mode follow redirections, as long as the
+                 * reply is for a benchmarked command. */
+                int node = c->node;
+                long long latency = c->latency;
+                if (config.cluster_mode && c->prefix_pending == 0 &&
+                    ((redisReply*)reply)->type == REDIS_REPLY_ERROR)
+                {
+                    node = clusterFollowRedirects(c,config.pipeline-c->pending,
+                                                  (redisReply**)&reply);
+                    if (node != c->node) latency = ustime()-c->start;
+                }
+
                 if (config.showerrors) {
                     static time_t lasterr_time = 0;
                     time_t now = time(NULL);
@@ -241,8 +1041,20 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
                     continue;
                 }
 
-                if (config.requests_finished < config.requests)
-                    config.latency[config.requests_finished++] = c->latency;
+                int requests_finished;
+                atomicGetIncr(config.requests_finished,requests_finished,1);
+                if (requests_finished < config.requests) {
+                    histogramRecord(c->thread->histogram,latency);
+                    if (config.phase) {
+                        int idx = c->cmdidx[config.pipeline-c->pending];
+                        histogramRecord(c->thread->cmd_histograms[idx],
+                                        latency);
+                    }
+                    if (config.cluster_mode)
+                        clusterRecordLatency(c->thread,node,latency);
+                    if (requests_finished == config.requests-1)
+                        config.end = mstime();
+                }
                 c->pending--;
                 if (c->pending == 0) {
                     clientDone(c);
@@ -257,22 +1069,45 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     client c = privdata;
-    UNUSED(el);
     UNUSED(fd);
     UNUSED(mask);
 
-    /* Initialize request when nothing was written. */
-    if (c->written == 0) {
-        /* Enforce upper bound to number of requests. */
-        if (config.requests_issued++ >= config.requests) {
+    /* Initialize request when nothing was written, unless the request was
+     * already prepared and just waited for its scheduled send time. */
+    if (c->written == 0 && c->scheduled) {
+        /* Timers have millisecond resolution and may fire a bit before
+         * the intended send time: never count less than the actual
+         * round trip. */
+        long long now = ustime();
+        if (c->start > now) c->start = now;
+        c->scheduled = 0;
+    } else if (c->written == 0) {
+        /* Enforce upper bound to number of requests. Workloads account
+         * every request of the pipeline, since in open loop mode the
+         * sequence number determines the send time. */
+        int requests_issued;
+        atomicGetIncr(config.requests_issued,requests_issued,
+                      config.phase ? config.pipeline : 1);
+        if (requests_issued >= config.requests) {
             freeClient(c);
             return;
         }
 
         /* Really initialize: randomize keys and set start time. */
-        if (config.randomkeys) randomizeClientKey(c);
-        c->start = ustime();
         c->latency = -1;
+        if (config.phase) {
+            workloadPrepareRequest(c);
+            if (workloadScheduleRequest(c,requests_issued)) return;
+        } else {
+            if (config.cluster_mode) clusterPrepareRequest(c);
+            else if (config.randomkeys) randomizeClientKey(c);
+            c->start = ustime();
+        }
+    }
+
+    if (c->shm) {
+        shmWrite(c);
+        return;
     }
 
     if (sdslen(c->obuf) > c->written) {
@@ -286,12 +1121,87 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
         }
         c->written += nwritten;
         if (sdslen(c->obuf) == c->written) {
-            aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-            aeCreateFileEvent(config.el,c->context->fd,AE_READABLE,readHandler,c);
+            aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+            aeCreateFileEvent(el,c->context->fd,AE_READABLE,readHandler,c);
         }
     }
 }
 
+/* Write the request of a --shm client in the requests ring. The writable
+ * event of the socket is only used to start sending a request, the rest of
+ * the communication is signaled by the eventfd of the rings. */
+static void shmWrite(client c) {
+    aeEventLoop *el = c->thread->el;
+
+    while(sdslen(c->obuf) > c->written) {
+        void *ptr = c->obuf+c->written;
+        ssize_t nwritten = shmConnWrite(c->shm,ptr,sdslen(c->obuf)-c->written);
+
+        if (nwritten == -1) {
+            fprintf(stderr,"Error: invalid shared memory ring state\n");
+            exit(1);
+        } else if (nwritten == 0) {
+            /* Ring full: wait for the server to make room. */
+            aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+            c->shm_full = 1;
+            if (shmConnWaitWritable(c->shm)) shmConnWakeup(c->shm);
+            return;
+        }
+        c->written += nwritten;
+    }
+    /* Request sent: wait for the replies. */
+    aeDeleteFileEvent(el,c->context->fd,AE_WRITABLE);
+    if (shmConnWaitReadable(c->shm)) shmConnWakeup(c->shm);
+}
+
+/* Eventfd handler of the --shm clients: replies arrived, or the server made
+ * room in the requests ring. */
+static void shmEventHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    client c = privdata;
+
+    shmConnClearEvent(c->shm);
+    if (c->shm_full) {
+        c->shm_full = 0;
+        shmWrite(c);
+        if (c->shm_full) return;
+    }
+    /* Once the prefix commands are discarded 'obuf' is shorter than the
+     * bytes written. */
+    if (c->written >= sdslen(c->obuf)) readHandler(el,fd,c,mask);
+}
+
+/* Switch the connection of the client to the shared memory rings of the
+ * server with CLIENT SHM. */
+static void shmNegotiate(client c) {
+    static const char *cmd = "*2\r\n$6\r\nCLIENT\r\n$3\r\nSHM\r\n";
+    char buf[256];
+    int fds[SHMRING_NUM_FDS];
+    int fd = c->context->fd;
+    ssize_t nread;
+
+    if (write(fd,cmd,strlen(cmd)) != (ssize_t)strlen(cmd) ||
+        (nread = shmRecvFds(fd,buf,sizeof(buf)-1,fds,SHMRING_NUM_FDS)) <= 0)
+    {
+        fprintf(stderr,"Error switching to shared memory: %s\n",
+            strerror(errno));
+        exit(1);
+    }
+    buf[nread] = '\0';
+    if (fds[0] == -1) {
+        fprintf(stderr,"Error switching to shared memory: %s",buf);
+        exit(1);
+    }
+    c->shm = shmConnAttach(fds[0],fds[1],fds[2]);
+    close(fds[0]);
+    if (c->shm == NULL) {
+        fprintf(stderr,"Error mapping the shared memory rings: %s\n",
+            strerror(errno));
+        exit(1);
+    }
+    anetNonBlock(NULL,fd);
+    c->context->flags &= ~REDIS_BLOCK;
+}
+
 /* Create a benchmark client, configured to send the command passed as 'cmd' of
  * 'len' bytes.
  *
@@ -312,13 +1222,27 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
  * 2) The offsets of the __rand_int__ elements inside the command line, used
  *    for arguments randomization.
  *
- * Even when cloning another client, prefix commands are applied if needed.*/
-static client createClient(char *cmd, size_t len, client from) {
+ * Even when cloning another client, prefix commands are applied if needed.
+ *
+ * The client is served by the event loop of 'thread'. */
+static client createClient(char *cmd, size_t len, client from,
+                           benchmarkThread *thread)
+{
     int j;
     client c = zmalloc(sizeof(struct _client));
 
-    if (config.hostsocket == NULL) {
+    c->contexts = NULL;
+    if (config.cluster_mode) {
+        /* Start from a different node for every client, the connection
+         * will be switched accordingly to the keys anyway. */
+        c->contexts = zcalloc(sizeof(redisContext*)*CLUSTER_MAX_NODES);
+        c->node = thread->liveclients % config.cluster_numnodes;
+        c->context = c->contexts[c->node] = clusterConnectNode(c->node,0);
+    } else if (config.hostsocket == NULL) {
         c->context = redisConnectNonBlock(config.hostip,config.hostport);
+    } else if (config.shm) {
+        /* The rings are negotiated in blocking mode. */
+        c->context = redisConnectUnix(config.hostsocket);
     } else {
         c->context = redisConnectUnixNonBlock(config.hostsocket);
     }
@@ -332,6 +1256,9 @@ static client createClient(char *cmd, size_t len, client from) {
     }
     /* Suppress hiredis cleanup of unused buffers for max speed. */
     c->context->reader->maxbuf = 0;
+    c->shm = NULL;
+    c->shm_full = 0;
+    if (config.shm) shmNegotiate(c);
 
     /* Build the request buffer:
      * Queue N requests accordingly to the pipeline size, or simply clone
@@ -341,7 +1268,8 @@ static client createClient(char *cmd, size_t len, client from) {
      * These commands are discarded after the first response, so if the client is
      * reused the commands will not be used again. */
     c->prefix_pending = 0;
-    if (config.auth) {
+    if (config.auth && !config.cluster_mode) {
+        /* In cluster mode connections are authenticated on creation. */
         char *buf = NULL;
         int len = redisFormatCommand(&buf, "AUTH %s", config.auth);
         c->obuf = sdscatlen(c->obuf, buf, len);
@@ -403,18 +1331,34 @@ static client createClient(char *cmd, size_t len, client from) {
             }
         }
     }
+    c->thread = thread;
+    c->cmdidx = config.phase ? zmalloc(sizeof(int)*config.pipeline) : NULL;
+    c->batch_node = -1;
+    c->cmdoff = c->keyoff = c->keylen = NULL;
+    if (config.cluster_mode) {
+        c->cmdoff = zmalloc(sizeof(size_t)*(config.pipeline+1));
+        c->keyoff = zmalloc(sizeof(size_t)*config.pipeline);
+        c->keylen = zmalloc(sizeof(size_t)*config.pipeline);
+        if (!config.phase && !config.idlemode) clusterParseCommands(c);
+    }
+    c->scheduled = 0;
+    c->timer_id = -1;
     if (config.idlemode == 0)
-        aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
-    listAddNodeTail(config.clients,c);
-    config.liveclients++;
+        aeCreateFileEvent(thread->el,c->context->fd,AE_WRITABLE,writeHandler,c);
+    if (c->shm)
+        aeCreateFileEvent(thread->el,c->shm->wait_fd,AE_READABLE,
+                          shmEventHandler,c);
+    listAddNodeTail(thread->clients,c);
+    thread->liveclients++;
+    atomicIncr(config.liveclients,1);
     return c;
 }
 
 static void createMissingClients(client c) {
     int n = 0;
 
-    while(config.liveclients < config.numclients) {
-        createClient(NULL,0,c);
+    while(c->thread->liveclients < c->thread->numclients) {
+        createClient(NULL,0,c,c->thread);
 
         /* Listen backlog is quite limited on most systems */
         if (++n > 64) {
@@ -424,58 +1368,541 @@ static void createMissingClients(client c) {
     }
 }
 
-static int compareLatency(const void *a, const void *b) {
-    return (*(long long*)a)-(*(long long*)b);
+/* Output 'str' as a JSON string, quoted and escaped. */
+static void printJSONString(const char *str) {
+    putchar('"');
+    for (; *str; str++) {
+        unsigned char ch = *str;
+
+        if (ch == '"' || ch == '\\') printf("\\%c", ch);
+        else if (ch == '\n') printf("\\n");
+        else if (ch == '\r') printf("\\r");
+        else if (ch == '\t') printf("\\t");
+        else if (ch < 0x20) printf("\\u%04x", ch);
+        else putchar(ch);
+    }
+    putchar('"');
+}
+
+/* Print the latency summary of 'h' in the format selected by the user:
+ * space separated fields for the human readable report, a JSON object, or
+ * the end of the CSV row following the title and rps columns (the latency
+ * columns are only added with --csv-latency). */
+static void printLatencySummary(latencyHistogram *h) {
+    double avg = h->count ? (double)h->sum/h->count : 0;
+    long long p50 = histogramPercentile(h,50),
+              p99 = histogramPercentile(h,99),
+              p999 = histogramPercentile(h,99.9),
+              p9999 = histogramPercentile(h,99.99);
+
+    if (config.csv) {
+        if (config.csv_latency)
+            printf(",\"%.2f\",\"%lld\",\"%lld\",\"%lld\",\"%lld\",\"%lld\","
+                   "\"%lld\"", avg, h->min, p50, p99, p999, p9999, h->max);
+        printf("\n");
+    } else if (config.json) {
+        printf("{\"min\":%lld,\"avg\":%.2f,\"p50\":%lld,\"p99\":%lld,"
+               "\"p99.9\":%lld,\"p99.99\":%lld,\"max\":%lld}",
+               h->min, avg, p50, p99, p999, p9999, h->max);
+    } else {
+        printf("min=%lld avg=%.2f p50=%lld p99=%lld p99.9=%lld "
+               "p99.99=%lld max=%lld", h->min, avg, p50, p99, p999, p9999,
+               h->max);
+    }
+}
+
+/* Report the latency of every command of the workload mix. */
+static void showWorkloadReport(float reqpersec) {
+    workloadPhase *phase = config.phase;
+    long long total = config.histogram->count;
+    int j;
+
+    for (j = 0; j < phase->numcommands; j++) {
+        workloadCommand *wc = phase->commands+j;
+        latencyHistogram *h = config.cmd_histograms[j];
+        float rps = total ? reqpersec*h->count/total : 0;
+
+        if (config.csv) {
+            printf("\"%s: %s\",\"%.2f\"", phase->name, wc->name, rps);
+            printLatencySummary(h);
+        } else if (config.json) {
+            printf("%s{\"command\":", j ? "," : "");
+            printJSONString(wc->name);
+            printf(",\"weight\":%d,\"requests\":%lld,\"rps\":%.2f,"
+                   "\"latency_usec\":", wc->weight, h->count, rps);
+            printLatencySummary(h);
+            printf("}");
+        } else {
+            printf("  %s: %lld requests, %.2f requests per second\n",
+                wc->name, h->count, rps);
+            printf("    latency (usec): ");
+            printLatencySummary(h);
+            printf("\n");
+        }
+    }
+}
+
+/* Report throughput, latency and redirections of every cluster node. */
+static void showClusterReport(float reqpersec) {
+    long long total = config.histogram->count;
+    int j, printed = 0;
+
+    for (j = 0; j < config.cluster_numnodes; j++) {
+        clusterNode *node = config.cluster_nodes[j];
+        latencyHistogram *h = config.node_histograms[j];
+        float rps = total ? reqpersec*h->count/total : 0;
+
+        if (h->count == 0 && config.node_moved[j] == 0 &&
+            config.node_ask[j] == 0) continue;
+        if (config.csv) {
+            printf("\"%s: %s:%d\",\"%.2f\"", config.title, node->ip,
+                node->port, rps);
+            printLatencySummary(h);
+        } else if (config.json) {
+            printf("%s{\"node\":\"%s:%d\",\"requests\":%lld,\"rps\":%.2f,"
+                   "\"moved\":%lld,\"ask\":%lld,\"latency_usec\":",
+                printed ? "," : "", node->ip, node->port, h->count, rps,
+                config.node_moved[j], config.node_ask[j]);
+            printLatencySummary(h);
+            printf("}");
+        } else {
+            printf("  %s:%d: %lld requests, %.2f requests per second, "
+                   "%lld moved, %lld ask\n", node->ip, node->port, h->count,
+                   rps, config.node_moved[j], config.node_ask[j]);
+            printf("    latency (usec): ");
+            printLatencySummary(h);
+            printf("\n");
+        }
+        printed++;
+    }
 }
 
 static void showLatencyReport(void) {
-    int i, curlat = 0;
-    float perc, reqpersec;
+    latencyHistogram *h = config.histogram;
+    int j, curlat = -1;
+    long long seen = 0;
+    float reqpersec;
 
-    reqpersec = (float)config.requests_finished/((float)config.totlatency/1000);
-    if (!config.quiet && !config.csv) {
+    reqpersec = (float)h->count/((float)config.totlatency/1000);
+    if (!config.quiet && !config.csv && !config.json) {
         printf("====== %s ======\n", config.title);
-        printf("  %d requests completed in %.2f seconds\n", config.requests_finished,
+        printf("  %lld requests completed in %.2f seconds\n", h->count,
             (float)config.totlatency/1000);
         printf("  %d parallel clients\n", config.numclients);
-        printf("  %d bytes payload\n", config.datasize);
+        if (config.num_threads > 1)
+            printf("  %d threads\n", config.num_threads);
+        if (config.phase && config.phase->rate)
+            printf("  target rate: %lld requests per second\n",
+                config.phase->rate);
+        if (!config.phase)
+            printf("  %d bytes payload\n", config.datasize);
         printf("  keep alive: %d\n", config.keepalive);
         printf("\n");
 
-        qsort(config.latency,config.requests,sizeof(long long),compareLatency);
-        for (i = 0; i < config.requests; i++) {
-            if (config.latency[i]/1000 != curlat || i == (config.requests-1)) {
-                curlat = config.latency[i]/1000;
-                perc = ((float)(i+1)*100)/config.requests;
-                printf("%.2f%% <= %d milliseconds\n", perc, curlat);
-            }
+        /* Show the cumulative distribution with millisecond resolution,
+         * one line every time the latency crosses a millisecond. */
+        for (j = 0; j < HIST_BUCKETS; j++) {
+            int lat;
+
+            if (h->buckets[j] == 0) continue;
+            lat = histogramBucketLowest(j)/1000;
+            if (curlat != -1 && lat != curlat)
+                printf("%.2f%% <= %d milliseconds\n",
+                    (float)seen*100/h->count, curlat);
+            curlat = lat;
+            seen += h->buckets[j];
         }
-        printf("%.2f requests per second\n\n", reqpersec);
+        if (curlat != -1)
+            printf("%.2f%% <= %d milliseconds\n",
+                (float)seen*100/h->count, curlat);
+        printf("%.2f requests per second\n", reqpersec);
+        printf("latency (usec): ");
+        printLatencySummary(h);
+        printf("\n");
+        if (config.phase) {
+            printf("\n");
+            showWorkloadReport(reqpersec);
+        }
+        if (config.cluster_mode) {
+            printf("\n");
+            showClusterReport(reqpersec);
+        }
+        printf("\n");
     } else if (config.csv) {
-        printf("\"%s\",\"%.2f\"\n", config.title, reqpersec);
+        printf("\"%s\",\"%.2f\"", config.title, reqpersec);
+        printLatencySummary(h);
+        if (config.phase) showWorkloadReport(reqpersec);
+        if (config.cluster_mode) showClusterReport(reqpersec);
+    } else if (config.json) {
+        printf("{\"test\":");
+        printJSONString(config.title);
+        printf(",\"requests\":%lld,\"clients\":%d,\"threads\":%d,"
+               "\"pipeline\":%d,",
+            h->count, config.numclients, config.num_threads,
+            config.pipeline);
+        if (config.phase)
+            printf("\"target_rps\":%lld,", config.phase->rate);
+        else
+            printf("\"payload\":%d,", config.datasize);
+        printf("\"rps\":%.2f,\"latency_usec\":", reqpersec);
+        printLatencySummary(h);
+        if (config.phase) {
+            printf(",\"commands\":[");
+            showWorkloadReport(reqpersec);
+            printf("]");
+        }
+        if (config.cluster_mode) {
+            printf(",\"nodes\":[");
+            showClusterReport(reqpersec);
+            printf("]");
+        }
+        printf("}\n");
     } else {
         printf("%s: %.2f requests per second\n", config.title, reqpersec);
     }
 }
 
+static void *execBenchmarkThread(void *ptr) {
+    benchmarkThread *thread = ptr;
+    aeMain(thread->el);
+    return NULL;
+}
+
 static void benchmark(char *title, char *cmd, int len) {
-    client c;
+    client c = NULL;
+    int j;
 
     config.title = title;
-    config.requests_issued = 0;
-    config.requests_finished = 0;
-
-    c = createClient(cmd,len,NULL);
-    createMissingClients(c);
-
-    config.start = mstime();
-    aeMain(config.el);
-    config.totlatency = mstime()-config.start;
+    atomicSet(config.requests_issued,0);
+    atomicSet(config.requests_finished,0);
+
+    /* Only the first client formats the command, all the others, in every
+     * thread, are cloned from it. */
+    for (j = 0; j < config.num_threads; j++) {
+        benchmarkThread *thread = config.threads[j];
+
+        histogramReset(thread->histogram);
+        if (config.phase) {
+            int k;
+            for (k = 0; k < config.phase->numcommands; k++)
+                histogramReset(thread->cmd_histograms[k]);
+        }
+        if (config.cluster_mode) {
+            int k;
+            for (k = 0; k < CLUSTER_MAX_NODES; k++) {
+                if (thread->node_histograms[k])
+                    histogramReset(thread->node_histograms[k]);
+                thread->node_moved[k] = thread->node_ask[k] = 0;
+            }
+        }
+        c = createClient(c ? NULL : cmd, c ? 0 : len, c, thread);
+        createMissingClients(c);
+    }
 
+    config.start_us = ustime();
+    config.start = config.start_us/1000;
+    if (config.num_threads == 1) {
+        aeMain(config.threads[0]->el);
+    } else {
+        for (j = 0; j < config.num_threads; j++) {
+            benchmarkThread *thread = config.threads[j];
+            if (pthread_create(&thread->thread,NULL,
+                               execBenchmarkThread,thread) != 0)
+            {
+                fprintf(stderr,"Can't create benchmark thread: %s\n",
+                    strerror(errno));
+                exit(1);
+            }
+        }
+        for (j = 0; j < config.num_threads; j++)
+            pthread_join(config.threads[j]->thread,NULL);
+    }
+    /* Threads other than the one completing the last request may take a
+     * few milliseconds to notice the benchmark is over, so use the time the
+     * last reply was received instead of the time the loops returned. */
+    config.totlatency = config.end-config.start;
+
+    histogramReset(config.histogram);
+    for (j = 0; j < config.num_threads; j++)
+        histogramMerge(config.histogram,config.threads[j]->histogram);
+    if (config.cluster_mode) {
+        int k;
+        for (k = 0; k < config.cluster_numnodes; k++) {
+            if (config.node_histograms[k] == NULL)
+                config.node_histograms[k] = zmalloc(sizeof(latencyHistogram));
+            histogramReset(config.node_histograms[k]);
+            config.node_moved[k] = config.node_ask[k] = 0;
+            for (j = 0; j < config.num_threads; j++) {
+                benchmarkThread *thread = config.threads[j];
+                if (thread->node_histograms[k])
+                    histogramMerge(config.node_histograms[k],
+                                   thread->node_histograms[k]);
+                config.node_moved[k] += thread->node_moved[k];
+                config.node_ask[k] += thread->node_ask[k];
+            }
+        }
+    }
+    if (config.phase) {
+        int k;
+        for (k = 0; k < config.phase->numcommands; k++) {
+            histogramReset(config.cmd_histograms[k]);
+            for (j = 0; j < config.num_threads; j++)
+                histogramMerge(config.cmd_histograms[k],
+                               config.threads[j]->cmd_histograms[k]);
+        }
+    }
     showLatencyReport();
     freeAllClients();
 }
 
+/* Parse the arguments of a key-distribution or value-size directive,
+ * returning NULL on success or the error message. */
+static const char *workloadParseKeyDist(workloadPhase *phase, int argc,
+                                        sds *argv)
+{
+    if (!strcasecmp(argv[1],"uniform") && argc == 2) {
+        phase->keydist = KEYDIST_UNIFORM;
+    } else if (!strcasecmp(argv[1],"sequential") && argc == 2) {
+        phase->keydist = KEYDIST_SEQUENTIAL;
+    } else if (!strcasecmp(argv[1],"zipf") && argc == 3) {
+        phase->keydist = KEYDIST_ZIPF;
+        phase->zipf_theta = atof(argv[2]);
+        if (phase->zipf_theta <= 0 || phase->zipf_theta >= 1)
+            return "The zipf skew must be greater than 0 and less than 1";
+    } else if (!strcasecmp(argv[1],"hotspot") && argc == 4) {
+        phase->keydist = KEYDIST_HOTSPOT;
+        phase->hot_keys = atof(argv[2]);
+        phase->hot_ops = atof(argv[3]);
+        if (phase->hot_keys <= 0 || phase->hot_keys > 1 ||
+            phase->hot_ops < 0 || phase->hot_ops > 1)
+            return "The hotspot fractions must be between 0 and 1";
+    } else {
+        return "Invalid key distribution, use uniform, sequential, "
+               "zipf <skew> or hotspot <hot-keys-fraction> <hot-ops-fraction>";
+    }
+    return NULL;
+}
+
+static const char *workloadParseValueSize(workloadPhase *phase, int argc,
+                                          sds *argv)
+{
+    if (argc == 2) {
+        phase->valuedist = VALUESIZE_FIXED;
+        phase->value_a = atoll(argv[1]);
+        phase->value_max = phase->value_a;
+    } else if (!strcasecmp(argv[1],"uniform") && argc == 4) {
+        phase->valuedist = VALUESIZE_UNIFORM;
+        phase->value_a = atoll(argv[2]);
+        phase->value_b = atoll(argv[3]);
+        phase->value_max = phase->value_b;
+        if (phase->value_b < phase->value_a)
+            return "The maximum value size is less than the minimum";
+    } else if (!strcasecmp(argv[1],"normal") && argc == 4) {
+        phase->valuedist = VALUESIZE_NORMAL;
+        phase->value_a = atoll(argv[2]);
+        phase->value_b = atoll(argv[3]);
+        /* Values beyond six standard deviations are practically never
+         * generated, cap them there. */
+        phase->value_max = phase->value_a+phase->value_b*6;
+    } else {
+        return "Invalid value size, use <size>, uniform <min> <max> or "
+               "normal <mean> <stddev>";
+    }
+    if (phase->value_a < 0 || phase->value_b < 0)
+        return "Value sizes can't be negative";
+    if (phase->value_max > 512*1024*1024)
+        return "Value sizes are limited to 512MB";
+    return NULL;
+}
+
+static workloadPhase *workloadCreatePhase(const char *name,
+                                          workloadPhase *defaults)
+{
+    workloadPhase *phase = zcalloc(sizeof(*phase));
+
+    if (defaults) {
+        memcpy(phase,defaults,sizeof(*phase));
+        phase->numcommands = 0;
+        phase->totweight = 0;
+    } else {
+        phase->requests = config.requests;
+        phase->keyspace = config.randomkeys_keyspacelen > 0 ?
+                          config.randomkeys_keyspacelen : 100000;
+        phase->keydist = KEYDIST_UNIFORM;
+        phase->valuedist = VALUESIZE_FIXED;
+        phase->value_a = phase->value_max = config.datasize;
+    }
+    phase->name = sdsnew(name);
+    pthread_mutex_init(&phase->sequence_mutex,NULL);
+    return phase;
+}
+
+/* Load the workload file 'filename'. Every line is a directive, with the
+ * arguments parsed like redis.conf ones. Directives appearing before the
+ * first "phase" one are the defaults of all the phases. */
+static void loadWorkload(const char *filename) {
+    FILE *fp = fopen(filename,"r");
+    char buf[1024*16];
+    const char *err = NULL;
+    int linenum = 0, argc = 0, j;
+    sds line = NULL, *argv = NULL;
+    workloadPhase *defaults, *phase;
+
+    if (fp == NULL) {
+        fprintf(stderr,"Can't open the workload file '%s': %s\n",
+            filename, strerror(errno));
+        exit(1);
+    }
+    defaults = phase = workloadCreatePhase("workload",NULL);
+    while(fgets(buf,sizeof(buf),fp) != NULL) {
+        linenum++;
+        line = sdstrim(sdsnew(buf)," \t\r\n");
+
+        /* Skip comments and blank lines. */
+        if (line[0] == '#' || line[0] == '\0') {
+            sdsfree(line);
+            continue;
+        }
+        argv = sdssplitargs(line,&argc);
+        if (argv == NULL) {
+            err = "Unbalanced quotes in workload line";
+            goto loaderr;
+        }
+        if (argc == 0) {
+            sdsfreesplitres(argv,argc);
+            sdsfree(line);
+            continue;
+        }
+
+        if (!strcasecmp(argv[0],"phase") && argc == 2) {
+            if (defaults->numcommands) {
+                err = "Commands can't appear before the first phase";
+                goto loaderr;
+            }
+            phase = workloadCreatePhase(argv[1],defaults);
+            config.phases = zrealloc(config.phases,
+                sizeof(workloadPhase*)*(config.numphases+1));
+            config.phases[config.numphases++] = phase;
+        } else if (!strcasecmp(argv[0],"requests") && argc == 2) {
+            phase->requests = atoi(argv[1]);
+            if (phase->requests <= 0) {
+                err = "Invalid number of requests"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"rate") && argc == 2) {
+            phase->rate = atoll(argv[1]);
+            if (phase->rate < 0) {
+                err = "Invalid target rate"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"keyspace") && argc == 2) {
+            phase->keyspace = atoll(argv[1]);
+            if (phase->keyspace <= 0) {
+                err = "Invalid keyspace size"; goto loaderr;
+            }
+        } else if (!strcasecmp(argv[0],"key-distribution") && argc >= 2) {
+            if ((err = workloadParseKeyDist(phase,argc,argv)) != NULL)
+                goto loaderr;
+        } else if (!strcasecmp(argv[0],"value-size") && argc >= 2) {
+            if ((err = workloadParseValueSize(phase,argc,argv)) != NULL)
+                goto loaderr;
+        } else if (!strcasecmp(argv[0],"command") && argc >= 3) {
+            workloadCommand *wc;
+
+            if (phase->numcommands == WORKLOAD_MAX_COMMANDS) {
+                err = "Too many commands in the phase"; goto loaderr;
+            }
+            wc = phase->commands+phase->numcommands;
+            wc->weight = atoi(argv[1]);
+            if (wc->weight <= 0) {
+                err = "The command weight must be a positive integer";
+                goto loaderr;
+            }
+            wc->argc = argc-2;
+            wc->argv = zmalloc(sizeof(sds)*wc->argc);
+            wc->dynamic = zmalloc(sizeof(int)*wc->argc);
+            wc->name = sdsempty();
+            for (j = 0; j < wc->argc; j++) {
+                wc->argv[j] = sdsdup(argv[j+2]);
+                wc->dynamic[j] = strstr(wc->argv[j],"__") != NULL;
+                if (j) wc->name = sdscatlen(wc->name," ",1);
+                wc->name = sdscatsds(wc->name,wc->argv[j]);
+            }
+            phase->numcommands++;
+            phase->totweight += wc->weight;
+        } else {
+            err = "Bad directive or wrong number of arguments"; goto loaderr;
+        }
+        sdsfreesplitres(argv,argc);
+        sdsfree(line);
+    }
+    fclose(fp);
+
+    /* A file without phases describes a single one. */
+    if (config.numphases == 0) {
+        config.phases = zmalloc(sizeof(workloadPhase*));
+        config.phases[config.numphases++] = defaults;
+    }
+    for (j = 0; j < config.numphases; j++) {
+        phase = config.phases[j];
+        if (phase->numcommands == 0) {
+            fprintf(stderr,"Workload phase '%s' has no commands\n",
+                phase->name);
+            exit(1);
+        }
+        if (phase->keydist == KEYDIST_ZIPF) workloadInitZipf(phase);
+    }
+    return;
+
+loaderr:
+    fprintf(stderr, "\n*** FATAL WORKLOAD FILE ERROR ***\n");
+    fprintf(stderr, "Reading the workload file, at line %d\n", linenum);
+    fprintf(stderr, ">>> '%s'\n", line);
+    fprintf(stderr, "%s\n", err);
+    exit(1);
+}
+
+/* Prepare the buffers used to run the loaded workload, sized after the
+ * phase with the most commands and the biggest values. */
+static void initWorkload(void) {
+    long long value_max = 0;
+    int maxcommands = 0, j, k;
+
+    for (j = 0; j < config.numphases; j++) {
+        workloadPhase *phase = config.phases[j];
+        if (phase->numcommands > maxcommands)
+            maxcommands = phase->numcommands;
+        if (phase->value_max > value_max) value_max = phase->value_max;
+    }
+    config.valuebuf = zmalloc(value_max+1);
+    memset(config.valuebuf,'x',value_max);
+    config.valuebuf[value_max] = '\0';
+
+    config.cmd_histograms = zmalloc(sizeof(latencyHistogram*)*maxcommands);
+    for (k = 0; k < maxcommands; k++)
+        config.cmd_histograms[k] = zmalloc(sizeof(latencyHistogram));
+    for (j = 0; j < config.num_threads; j++) {
+        benchmarkThread *thread = config.threads[j];
+
+        thread->cmd_histograms =
+            zmalloc(sizeof(latencyHistogram*)*maxcommands);
+        for (k = 0; k < maxcommands; k++)
+            thread->cmd_histograms[k] = zmalloc(sizeof(latencyHistogram));
+    }
+}
+
+/* Run every phase of the loaded workload, in order. */
+static void runWorkload(void) {
+    int j, requests = config.requests;
+
+    for (j = 0; j < config.numphases; j++) {
+        config.phase = config.phases[j];
+        config.phase->sequence = 0;
+        config.requests = config.phase->requests;
+        benchmark(config.phase->name,"",0);
+    }
+    config.phase = NULL;
+    config.requests = requests;
+}
+
 /* Returns number of consumed options. */
 int parseOptions(int argc, const char **argv) {
     int i;
@@ -525,6 +1952,11 @@ int parseOptions(int argc, const char **argv) {
             config.quiet = 1;
         } else if (!strcmp(argv[i],"--csv")) {
             config.csv = 1;
+        } else if (!strcmp(argv[i],"--csv-latency")) {
+            config.csv = 1;
+            config.csv_latency = 1;
+        } else if (!strcmp(argv[i],"--json")) {
+            config.json = 1;
         } else if (!strcmp(argv[i],"-l")) {
             config.loop = 1;
         } else if (!strcmp(argv[i],"-I")) {
@@ -546,6 +1978,18 @@ int parseOptions(int argc, const char **argv) {
             if (lastarg) goto invalid;
             config.dbnum = atoi(argv[++i]);
             config.dbnumstr = sdsfromlonglong(config.dbnum);
+        } else if (!strcmp(argv[i],"--cluster")) {
+            config.cluster_mode = 1;
+        } else if (!strcmp(argv[i],"--shm")) {
+            config.shm = 1;
+        } else if (!strcmp(argv[i],"--workload")) {
+            if (lastarg) goto invalid;
+            config.workload = argv[++i];
+        } else if (!strcmp(argv[i],"--threads")) {
+            if (lastarg) goto invalid;
+            config.num_threads = atoi(argv[++i]);
+            if (config.num_threads < 1) config.num_threads = 1;
+            if (config.num_threads > 256) config.num_threads = 256;
         } else if (!strcmp(argv[i],"--help")) {
             exit_status = 0;
             goto usage;
@@ -569,11 +2013,20 @@ usage:
 " -h <hostname>      Server hostname (default 127.0.0.1)\n"
 " -p <port>          Server port (default 6379)\n"
 " -s <socket>        Server socket (overrides host and port)\n"
+" --shm              Exchange requests and replies with the server through\n"
+"                    shared memory rings (CLIENT SHM), requires -s\n"
 " -a <password>      Password for Redis Auth\n"
 " -c <clients>       Number of parallel connections (default 50)\n"
 " -n <requests>      Total number of requests (default 100000)\n"
 " -d <size>          Data size of SET/GET value in bytes (default 3)\n"
 " --dbnum <db>       SELECT the specified db number (default 0)\n"
+" --cluster          Cluster mode: fetch the slots map from the specified node,\n"
+"                    send every request to the master serving its key, and\n"
+"                    follow MOVED/ASK redirections. The first argument of\n"
+"                    every command is considered its key. Per node\n"
+"                    statistics are reported.\n"
+" --threads <num>    Spread the clients across <num> threads, each one running\n"
+"                    its own event loop (default 1)\n"
 " -k <boolean>       1=keep alive 0=reconnect (default 1)\n"
 " -r <keyspacelen>   Use random keys for SET/GET/INCR, random values for SADD\n"
 "  Using this option the benchmark will expand the string __rand_int__\n"
@@ -585,11 +2038,32 @@ usage:
 " -e                 If server replies with errors, show them on stdout.\n"
 "                    (no more than 1 error per second is displayed)\n"
 " -q                 Quiet. Just show query/sec values\n"
-" --csv              Output in CSV format\n"
+" --csv              Output in CSV format: test name and requests per second\n"
+" --csv-latency      Output in CSV format, with a header row and the latency\n"
+"                    percentiles after the requests per second\n"
+" --json             Output in JSON format, one object per line and test\n"
 " -l                 Loop. Run the tests forever\n"
 " -t <tests>         Only run the comma separated list of tests. The test\n"
 "                    names are the same as the ones produced as output.\n"
-" -I                 Idle mode. Just open N idle connections and wait.\n\n"
+" -I                 Idle mode. Just open N idle connections and wait.\n"
+" --workload <file>  Run the phases described in the workload file instead\n"
+"                    of the tests. Each line of the file is a directive:\n"
+"                      phase <name>        Start a new phase. Directives before\n"
+"                                          the first phase are the defaults.\n"
+"                      requests <num>      Requests of the phase (default -n).\n"
+"                      rate <rps>          Open loop: send at the target rate,\n"
+"                                          measuring latency from the intended\n"
+"                                          send time (default 0, closed loop).\n"
+"                      keyspace <num>      Number of keys (default -r or 100000).\n"
+"                      key-distribution uniform|sequential|zipf <skew>|\n"
+"                                       hotspot <hot-keys> <hot-ops>\n"
+"                      value-size <size>|uniform <min> <max>|\n"
+"                                 normal <mean> <stddev>\n"
+"                      command <weight> <arg> ... Add a command to the mix,\n"
+"                                          where __key__, __value__ and\n"
+"                                          __rand_int__ are expanded.\n\n"
+    );
+    printf(
 "Examples:\n\n"
 " Run the benchmark with the default configuration against 127.0.0.1:6379:\n"
 "   $ redis-benchmark\n\n"
@@ -599,6 +2073,22 @@ usage:
 "   $ redis-benchmark -t set -n 1000000 -r 100000000\n\n"
 " Benchmark 127.0.0.1:6379 for a few commands producing CSV output:\n"
 "   $ redis-benchmark -t ping,set,get -n 100000 --csv\n\n"
+" Use 4 threads and 200 clients, reporting latency percentiles as JSON:\n"
+"   $ redis-benchmark --threads 4 -c 200 -t set,get --json\n\n"
+" Populate 1 million keys, then run a 90/10 GET/SET mix on a zipfian keyspace\n"
+" at 50000 requests per second, as described in workload.txt:\n"
+"   keyspace 1000000\n"
+"   value-size uniform 32 512\n"
+"   phase populate\n"
+"   requests 1000000\n"
+"   key-distribution sequential\n"
+"   command 1 SET key:__key__ __value__\n"
+"   phase mix\n"
+"   rate 50000\n"
+"   key-distribution zipf 0.99\n"
+"   command 90 GET key:__key__\n"
+"   command 10 SET key:__key__ __value__\n"
+"   $ redis-benchmark --workload workload.txt\n\n"
 " Benchmark a specific command line:\n"
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
 " Fill a list with 10000 random elements:\n"
@@ -610,27 +2100,89 @@ usage:
 }
 
 int showThroughput(struct aeEventLoop *eventLoop, long long id, void *clientData) {
-    UNUSED(eventLoop);
+    benchmarkThread *thread = clientData;
+    int liveclients, requests_finished;
     UNUSED(id);
-    UNUSED(clientData);
 
-    if (config.liveclients == 0 && config.requests_finished != config.requests) {
+    atomicGet(config.liveclients,liveclients);
+    atomicGet(config.requests_finished,requests_finished);
+    if (liveclients == 0 && requests_finished < config.requests) {
         fprintf(stderr,"All clients disconnected... aborting.\n");
         exit(1);
     }
-    if (config.csv) return 250;
+    /* A thread may have no client left while the others are still
+     * completing the last requests: stop its loop once they are done. */
+    if (config.num_threads > 1 && requests_finished >= config.requests) {
+        aeStop(eventLoop);
+        return 250;
+    }
+    /* Only the first thread reports the throughput. */
+    if (thread->index != 0) return 250;
+    if (config.csv || config.json) return 250;
     if (config.idlemode == 1) {
-        printf("clients: %d\r", config.liveclients);
+        printf("clients: %d\r", liveclients);
         fflush(stdout);
 	return 250;
     }
+    if (requests_finished > config.requests)
+        requests_finished = config.requests;
     float dt = (float)(mstime()-config.start)/1000.0;
-    float rps = (float)config.requests_finished/dt;
+    if (dt <= 0) return 250;
+    float rps = (float)requests_finished/dt;
     printf("%s: %.2f\r", config.title, rps);
     fflush(stdout);
     return 250; /* every 250ms */
 }
 
+/* Create the benchmark threads, with their event loops and histograms, and
+ * spread the clients evenly among them. In idle mode, or when a single
+ * thread is requested, everything runs in the main thread. */
+static void initBenchmarkThreads(void) {
+    int j;
+
+    if (config.idlemode) config.num_threads = 1;
+    if (config.num_threads > config.numclients)
+        config.num_threads = config.numclients > 0 ? config.numclients : 1;
+    config.histogram = zmalloc(sizeof(latencyHistogram));
+    if (config.cluster_mode) {
+        config.node_histograms =
+            zcalloc(sizeof(latencyHistogram*)*CLUSTER_MAX_NODES);
+        config.node_moved = zcalloc(sizeof(long long)*CLUSTER_MAX_NODES);
+        config.node_ask = zcalloc(sizeof(long long)*CLUSTER_MAX_NODES);
+    }
+    config.threads = zmalloc(sizeof(benchmarkThread*)*config.num_threads);
+    for (j = 0; j < config.num_threads; j++) {
+        benchmarkThread *thread = zmalloc(sizeof(*thread));
+
+        thread->index = j;
+        thread->el = aeCreateEventLoop(1024*10);
+        aeCreateTimeEvent(thread->el,1,showThroughput,thread,NULL);
+        thread->clients = listCreate();
+        thread->numclients = config.numclients/config.num_threads +
+                             (j < config.numclients%config.num_threads);
+        thread->liveclients = 0;
+        thread->histogram = zmalloc(sizeof(latencyHistogram));
+        histogramReset(thread->histogram);
+        thread->cmd_histograms = NULL;
+        thread->node_histograms = NULL;
+        thread->node_moved = thread->node_ask = NULL;
+        thread->redirect_contexts = NULL;
+        if (config.cluster_mode) {
+            thread->node_histograms =
+                zcalloc(sizeof(latencyHistogram*)*CLUSTER_MAX_NODES);
+            thread->node_moved = zcalloc(sizeof(long long)*CLUSTER_MAX_NODES);
+            thread->node_ask = zcalloc(sizeof(long long)*CLUSTER_MAX_NODES);
+            thread->redirect_contexts =
+                zcalloc(sizeof(redisContext*)*CLUSTER_MAX_NODES);
+        }
+        /* The xorshift state must never be zero. */
+        thread->rand_state = ((uint64_t)ustime() << 16) ^ (j+1);
+        thread->scratch = sdsempty();
+        thread->cmdbuf = sdsempty();
+        config.threads[j] = thread;
+    }
+}
+
 /* Return true if the named test was selected using the -t command line
  * switch, or if all the tests are selected (no -t passed by user). */
 int test_is_selected(char *name) {
@@ -659,8 +2211,6 @@ int main(int argc, const char **argv) {
     config.numclients = 50;
     config.requests = 100000;
     config.liveclients = 0;
-    config.el = aeCreateEventLoop(1024*10);
-    aeCreateTimeEvent(config.el,1,showThroughput,NULL,NULL);
     config.keepalive = 1;
     config.datasize = 3;
     config.pipeline = 1;
@@ -669,22 +2219,53 @@ int main(int argc, const char **argv) {
     config.randomkeys_keyspacelen = 0;
     config.quiet = 0;
     config.csv = 0;
+    config.csv_latency = 0;
+    config.json = 0;
     config.loop = 0;
     config.idlemode = 0;
-    config.latency = NULL;
-    config.clients = listCreate();
+    config.num_threads = 1;
     config.hostip = "127.0.0.1";
     config.hostport = 6379;
     config.hostsocket = NULL;
+    config.shm = 0;
     config.tests = NULL;
     config.dbnum = 0;
     config.auth = NULL;
+    config.workload = NULL;
+    config.cluster_mode = 0;
+    config.cluster_numnodes = 0;
+    pthread_mutex_init(&config.cluster_mutex,NULL);
+    config.phases = NULL;
+    config.numphases = 0;
+    config.phase = NULL;
+    pthread_mutex_init(&config.liveclients_mutex,NULL);
+    pthread_mutex_init(&config.requests_issued_mutex,NULL);
+    pthread_mutex_init(&config.requests_finished_mutex,NULL);
 
     i = parseOptions(argc,argv);
     argc -= i;
     argv += i;
 
-    config.latency = zmalloc(sizeof(long long)*config.requests);
+    if (config.shm && (config.hostsocket == NULL || config.cluster_mode)) {
+        fprintf(stderr,"--shm requires -s and can't be used in cluster mode\n");
+        exit(1);
+    }
+    if (config.cluster_mode) {
+        if (config.hostsocket) {
+            fprintf(stderr,"Cluster mode can't be used with -s\n");
+            exit(1);
+        }
+        if (config.dbnum != 0) {
+            fprintf(stderr,"Cluster mode only supports database 0\n");
+            exit(1);
+        }
+        clusterFetchSlots();
+    }
+    initBenchmarkThreads();
+    if (config.workload) {
+        loadWorkload(config.workload);
+        initWorkload();
+    }
 
     if (config.keepalive == 0) {
         printf("WARNING: keepalive disabled, you probably need 'echo 1 > /proc/sys/net/ipv4/tcp_tw_reuse' for Linux and 'sudo sysctl -w net.inet.tcp.msl=1000' for Mac OS X in order to use a lot of clients/requests\n");
@@ -692,12 +2273,26 @@ int main(int argc, const char **argv) {
 
     if (config.idlemode) {
         printf("Creating %d idle connections and waiting forever (Ctrl+C when done)\n", config.numclients);
-        c = createClient("",0,NULL); /* will never receive a reply */
+        c = createClient("",0,NULL,config.threads[0]); /* will never receive a reply */
         createMissingClients(c);
-        aeMain(config.el);
+        aeMain(config.threads[0]->el);
         /* and will wait for every */
     }
 
+    if (config.csv_latency)
+        printf("\"test\",\"rps\",\"avg_latency_usec\",\"min_latency_usec\","
+               "\"p50_latency_usec\",\"p99_latency_usec\","
+               "\"p99.9_latency_usec\",\"p99.99_latency_usec\","
+               "\"max_latency_usec\"\n");
+
+    /* Run the phases of the workload file. */
+    if (config.workload) {
+        do {
+            runWorkload();
+        } while(config.loop);
+        return 0;
+    }
+
     /* Run benchmark with command in the remainder of the arguments. */
     if (argc) {
         sds title = sdsnew(argv[0]);
@@ -829,17 +2424,24 @@ int main(int argc, const char **argv) {
 
         if (test_is_selected("mset")) {
             const char *argv[21];
+            sds keys[10];
             argv[0] = "MSET";
             for (i = 1; i < 21; i += 2) {
-                argv[i] = "key:__rand_int__";
+                /* In cluster mode the keys share a hash tag, so that they
+                 * are in the same slot. */
+                keys[i/2] = config.cluster_mode ?
+                    sdscatfmt(sdsempty(),"key:{__rand_int__}:%i",i/2) :
+                    sdsnew("key:__rand_int__");
+                argv[i] = keys[i/2];
                 argv[i+1] = data;
             }
             len = redisFormatCommandArgv(&cmd,21,argv,NULL);
+            for (i = 0; i < 10; i++) sdsfree(keys[i]);
             benchmark("MSET (10 keys)",cmd,len);
             free(cmd);
         }
 
-        if (!config.csv) printf("\n");
+        if (!config.csv && !config.json) printf("\n");
     } while(config.loop);
 
     return 0;
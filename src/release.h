@@ -0,0 +1,3 @@
+#define REDIS_GIT_SHA1 "c0ddf827"
+#define REDIS_GIT_DIRTY "13"
+#define REDIS_BUILD_ID "vm-1792288455"
@@ -0,0 +1,194 @@
+/* Reply cache for large string values.
+ *
+ * Replying with a big string value means emitting the bulk length header,
+ * copying the payload into the client output buffers and appending the
+ * final CRLF, every time the value is read. When "reply-cache-max-memory"
+ * is set, GET & co. keep the fully encoded bulk reply of the values of at
+ * least "reply-cache-min-size" bytes they reply with, so that the next
+ * reads of the same value just append the encoded reply as it is, as a
+ * single chunk of the output buffers.
+ *
+ * Entries are indexed by "<dbid>:<key>" and remember the value object the
+ * reply was encoded from, without holding a reference to it. An entry is
+ * used only if the key still points to the same value object, and it is
+ * removed by signalModifiedKey() when the key is modified, including in
+ * place modifications like APPEND or SETRANGE. Keys removed without being
+ * signaled (expired or evicted keys) are recreated only by commands that
+ * signal them, and whole databases are dropped from the cache when they
+ * are emptied or swapped, so a reply is never served for a different
+ * value allocated at the same address.
+ *
+ * The cache is bounded by "reply-cache-max-memory": when full, random
+ * entries are evicted. Like the AOF buffers, its memory is not counted
+ * for the maxmemory limit, since it is bounded by its own limit.
+ *
+ * The cache is only used by the main thread: replies produced by the
+ * shard and read threads are built as usual.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+typedef struct replyCacheEntry {
+    robj *val;          /* Value the reply was encoded from, not owned. */
+    robj *reply;        /* Encoded bulk reply. */
+} replyCacheEntry;
+
+static void replyCacheEntryDestructor(void *privdata, void *val);
+
+/* "<dbid>:<key>" -> replyCacheEntry. */
+static dictType replyCacheDictType = {
+    dictSdsHash,                /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    dictSdsKeyCompare,          /* key compare */
+    dictSdsDestructor,          /* key destructor */
+    replyCacheEntryDestructor   /* val destructor */
+};
+
+static dict *reply_cache = NULL;
+static size_t reply_cache_memory = 0;
+
+/* Memory accounted for an entry: the name and the encoded reply. */
+static size_t replyCacheEntrySize(sds name, replyCacheEntry *e) {
+    return sdsZmallocSize(name)+sdsZmallocSize(e->reply->ptr)+
+           sizeof(*e)+sizeof(robj);
+}
+
+static void replyCacheEntryDestructor(void *privdata, void *val) {
+    replyCacheEntry *e = val;
+    UNUSED(privdata);
+
+    decrRefCount(e->reply);
+    zfree(e);
+}
+
+static void replyCacheDelete(dictEntry *de) {
+    reply_cache_memory -= replyCacheEntrySize(dictGetKey(de),dictGetVal(de));
+    dictDelete(reply_cache,dictGetKey(de));
+}
+
+/* Evict random entries until 'needed' more bytes fit in the cache. */
+static void replyCacheMakeRoom(size_t needed) {
+    while (dictSize(reply_cache) &&
+           reply_cache_memory+needed > (size_t)server.reply_cache_max_memory)
+    {
+        replyCacheDelete(dictGetRandomKey(reply_cache));
+    }
+}
+
+/* Reply to the client with the string value 'val' of 'key', like
+ * addReplyBulk() does, using and populating the cache when possible. */
+void replyCacheAddReplyBulk(client *c, robj *key, robj *val) {
+    dictEntry *de;
+    replyCacheEntry *e;
+    sds name, reply;
+    size_t len, size;
+
+    if (server.reply_cache_max_memory == 0 ||
+        !sdsEncodedObject(val) ||
+        sdslen(val->ptr) < (size_t)server.reply_cache_min_size ||
+        inCommandThread())
+    {
+        addReplyBulk(c,val);
+        return;
+    }
+    if (reply_cache == NULL) reply_cache = dictCreate(&replyCacheDictType,NULL);
+
+    name = sideTableName(c->db->id,key->ptr);
+    de = dictFind(reply_cache,name);
+    if (de) {
+        e = dictGetVal(de);
+        if (e->val == val) {
+            server.stat_reply_cache_hits++;
+            addReply(c,e->reply);
+            sdsfree(name);
+            return;
+        }
+        /* Stale entry. */
+        replyCacheDelete(de);
+    }
+    server.stat_reply_cache_misses++;
+
+    len = sdslen(val->ptr);
+    reply = sdsMakeRoomFor(sdsempty(),len+32);
+    reply = sdscatfmt(reply,"$%U\r\n",(unsigned long long)len);
+    reply = sdscatlen(reply,val->ptr,len);
+    reply = sdscatlen(reply,"\r\n",2);
+
+    e = zmalloc(sizeof(*e));
+    e->val = val;
+    e->reply = createObject(OBJ_STRING,reply);
+    size = replyCacheEntrySize(name,e);
+    addReply(c,e->reply);
+
+    if (size > (size_t)server.reply_cache_max_memory) {
+        replyCacheEntryDestructor(NULL,e);
+        sdsfree(name);
+        return;
+    }
+    replyCacheMakeRoom(size);
+    dictAdd(reply_cache,name,e);
+    reply_cache_memory += size;
+}
+
+/* Called by signalModifiedKey(): drop the reply of the modified key. */
+void replyCacheInvalidateKey(redisDb *db, robj *key) {
+    dictEntry *de;
+    sds name;
+
+    if (reply_cache == NULL || dictSize(reply_cache) == 0 ||
+        inCommandThread()) return;
+    name = sideTableName(db->id,key->ptr);
+    if ((de = dictFind(reply_cache,name)) != NULL) replyCacheDelete(de);
+    sdsfree(name);
+}
+
+/* Drop the replies of the keys of the database 'dbid', or of all the
+ * databases if 'dbid' is -1. */
+void replyCacheFlush(int dbid) {
+    sideTableFlush(reply_cache,dbid,replyCacheDelete);
+}
+
+/* Enforce a new "reply-cache-max-memory" value. */
+void replyCacheResize(void) {
+    if (reply_cache == NULL) return;
+    if (server.reply_cache_max_memory == 0) replyCacheFlush(-1);
+    else replyCacheMakeRoom(0);
+}
+
+size_t replyCacheMemory(void) {
+    return reply_cache_memory;
+}
+
+size_t replyCacheSize(void) {
+    return reply_cache ? dictSize(reply_cache) : 0;
+}
@@ -30,6 +30,7 @@
 #include "server.h"
 #include "cluster.h"
 #include "slowlog.h"
+#include "trace.h"
 #include "bio.h"
 #include "latency.h"
 #include "atomicvar.h"
@@ -70,6 +71,7 @@ double R_Zero, R_PosInf, R_NegInf, R_Nan;
 
 /* Global vars */
 struct redisServer server; /* Server global state */
+__thread threadStats *thread_stats; /* Private counters, see server.h. */
 volatile unsigned long lru_clock; /* Server global current LRU time. */
 
 /* Our command table.
@@ -92,7 +94,8 @@ volatile unsigned long lru_clock; /* Server global current LRU time. */
  * calls: total number of calls of this command.
  *
  * The flags, microseconds and calls fields are computed by Redis and should
- * always be set to zero.
+ * always be set to zero. The latency histogram of the command, reported
+ * by INFO latencystats, is not listed and is allocated on the first call.
  *
  * Command flags are expressed using strings where every character represents
  * a flag. Later the populateCommandTable() function will take care of
@@ -301,10 +304,12 @@ struct redisCommand redisCommandTable[] = {
     {"pfadd",pfaddCommand,-2,"wmF",0,NULL,1,1,1,0,0},
     {"pfcount",pfcountCommand,-2,"r",0,NULL,1,-1,1,0,0},
     {"pfmerge",pfmergeCommand,-2,"wm",0,NULL,1,-1,1,0,0},
-    {"pfdebug",pfdebugCommand,-3,"w",0,NULL,0,0,0,0,0},
+    {"pfdebug",pfdebugCommand,-3,"w",0,NULL,2,2,1,0,0},
     {"post",securityWarningCommand,-1,"lt",0,NULL,0,0,0,0,0},
     {"host:",securityWarningCommand,-1,"lt",0,NULL,0,0,0,0,0},
-    {"latency",latencyCommand,-2,"aslt",0,NULL,0,0,0,0,0}
+    {"latency",latencyCommand,-2,"aslt",0,NULL,0,0,0,0,0},
+    {"hotkeys",hotkeysCommand,-2,"aslt",0,NULL,0,0,0,0,0},
+    {"trace",traceCommand,-2,"aslt",0,NULL,0,0,0,0,0}
 };
 
 /*============================ Utility functions ============================ */
@@ -789,15 +794,9 @@ int clientsCronHandleTimeout(client *c, mstime_t now_ms) {
         freeClient(c);
         return 1;
     } else if (c->flags & CLIENT_BLOCKED) {
-        /* Blocked OPS timeout is handled with milliseconds resolution.
-         * However note that the actual resolution is limited by
-         * server.hz. */
-
-        if (c->bpop.timeout != 0 && c->bpop.timeout < now_ms) {
-            /* Handle blocking operation specific timeout. */
-            replyToBlockedClientTimedOut(c);
-            unblockClient(c);
-        } else if (server.cluster_enabled) {
+        /* Blocked OPS timeouts are handled by handleBlockedClientsTimeout()
+         * in beforeSleep(), with milliseconds resolution. */
+        if (server.cluster_enabled) {
             /* Cluster: handle unblock & redirect of clients blocked
              * into keys no longer served by this server. */
             if (clusterRedirectBlockedClientIfNeeded(c))
@@ -953,6 +952,7 @@ void updateCachedTime(void) {
  */
 
 int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    long long cron_start = ustime(), cron_usec;
     int j;
     UNUSED(eventLoop);
     UNUSED(id);
@@ -965,6 +965,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Update the time cache. */
     updateCachedTime();
 
+    /* The cron may modify the dataset, see readthreads.c. */
+    if (server.read_threads) readThreadsWait();
+
     run_with_period(100) {
         trackInstantaneousMetric(STATS_METRIC_COMMAND,server.stat_numcommands);
         trackInstantaneousMetric(STATS_METRIC_NET_INPUT,
@@ -1034,6 +1037,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Handle background operations on Redis databases. */
     databasesCron();
 
+    /* Compress the big string values that are not hot. */
+    if (server.value_compression) compressionCron();
+
     /* Start a scheduled AOF rewrite if this was requested by the user while
      * a BGSAVE was in progress. */
     if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
@@ -1139,6 +1145,16 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Clear the paused clients flag if needed. */
     clientsArePaused(); /* Don't check return value, just use the side effect.*/
 
+    /* Decay the hot keys counters, so that the top-K reflects the recent
+     * access pattern. */
+    run_with_period(HOTKEYS_DECAY_PERIOD) hotkeysDecay();
+
+    /* Keep the client side caching tracking table within its limit. */
+    trackingLimitUsedKeys();
+
+    /* Continue the incremental keyspace memory report scan. */
+    memoryReportCron();
+
     /* Replication cron function -- used to reconnect to master,
      * detect transfer failures, start background RDB transfers and so forth. */
     run_with_period(1000) replicationCron();
@@ -1176,7 +1192,15 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
             server.rdb_bgsave_scheduled = 0;
     }
 
+    /* Halve the event loop profiler histograms, so that the percentiles
+     * reported by INFO eventloop reflect the recent behavior. */
+    run_with_period(EL_PROFILER_DECAY_PERIOD) eventLoopProfilerDecay();
+
     server.cronloops++;
+    cron_usec = ustime()-cron_start;
+    eventLoopPhaseAdd(EL_PHASE_CRON,cron_usec);
+    server.el_cron_usec += cron_usec;
+    latencyAddSampleIfNeeded("server-cron",cron_usec/1000);
     return 1000/server.hz;
 }
 
@@ -1184,18 +1208,37 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
  * main loop of the event driven library, that is, before to sleep
  * for ready file descriptors. */
 void beforeSleep(struct aeEventLoop *eventLoop) {
+    long long start = ustime(), now = start;
     UNUSED(eventLoop);
 
+    /* Event loop profiler: account the file events processed since the
+     * event loop woke up. The time spent in serverCron() is accounted
+     * separately. */
+    if (server.el_events_start) {
+        eventLoopPhaseAdd(EL_PHASE_FILE_EVENTS,
+            start-server.el_events_start-server.el_cron_usec);
+    }
+    server.el_cron_usec = 0;
+
+    /* Everything below may modify the dataset: wait for the commands
+     * executed by the read threads, if any. */
+    if (server.read_threads) readThreadsWait();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
      * later in this function. */
-    if (server.cluster_enabled) clusterBeforeSleep();
+    if (server.cluster_enabled) {
+        clusterBeforeSleep();
+        now = eventLoopPhaseEnd(EL_PHASE_CLUSTER,now);
+    }
 
     /* Run a fast expire cycle (the called function will return
      * ASAP if a fast cycle is not needed). */
-    if (server.active_expire_enabled && server.masterhost == NULL)
+    if (server.active_expire_enabled && server.masterhost == NULL) {
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
+        now = eventLoopPhaseEnd(EL_PHASE_FAST_EXPIRE,now);
+    }
 
     /* Send all the slaves an ACK request if at least one client blocked
      * during the previous event loop iteration. */
@@ -1221,28 +1264,69 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
      * blocking commands. */
     moduleHandleBlockedClients();
 
+    /* Reply to the blocked clients that reached their timeout. */
+    handleBlockedClientsTimeout();
+
     /* Try to process pending commands for clients that were just unblocked. */
     if (listLength(server.unblocked_clients))
         processUnblockedClients();
+    now = eventLoopPhaseEnd(EL_PHASE_UNBLOCKED,now);
+
+    /* Compress the values that are no longer hot, now that the commands of
+     * this cycle no longer reference them. */
+    compressionBeforeSleep();
+
+    /* Send the invalidation messages of the client side caching clients
+     * in broadcasting mode, accumulated during this cycle. */
+    trackingBroadcastInvalidationMessages();
 
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
+    now = eventLoopPhaseEnd(EL_PHASE_AOF_FLUSH,now);
 
     /* Handle writes with pending output buffers. */
     handleClientsWithPendingWrites();
+    now = eventLoopPhaseEnd(EL_PHASE_PENDING_WRITES,now);
+
+    /* Event loop profiler: close the current iteration. The commands time
+     * includes the commands executed by clients unblocked above. */
+    eventLoopPhaseAdd(EL_PHASE_BEFORE_SLEEP,now-start);
+    latencyAddSampleIfNeeded("before-sleep",(now-start)/1000);
+    eventLoopPhaseAdd(EL_PHASE_COMMANDS,server.el_cmd_usec);
+    server.el_cmd_usec = 0;
+    if (server.el_wake_time) {
+        eventLoopPhaseAdd(EL_PHASE_CYCLE,now-server.el_wake_time);
+        latencyAddSampleIfNeeded("eventloop-cycle",
+                                 (now-server.el_wake_time)/1000);
+    }
+    server.el_sleep_start = now;
 
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
-     * time. */
-    if (moduleCount()) moduleReleaseGIL();
+     * time. Module threads may hold the GIL in shared mode and perform
+     * concurrent lookups, so incremental rehashing must be paused. */
+    if (moduleCount()) {
+        dictPauseRehashSteps();
+        moduleReleaseGIL();
+    }
 }
 
 /* This function is called immadiately after the event loop multiplexing
  * API returned, and the control is going to soon return to Redis by invoking
  * the different events callbacks. */
 void afterSleep(struct aeEventLoop *eventLoop) {
+    long long now = ustime();
     UNUSED(eventLoop);
-    if (moduleCount()) moduleAcquireGIL();
+
+    if (server.el_sleep_start)
+        eventLoopPhaseAdd(EL_PHASE_POLL,now-server.el_sleep_start);
+    server.el_wake_time = now;
+    if (moduleCount()) {
+        moduleAcquireGIL();
+        dictResumeRehashSteps();
+        now = eventLoopPhaseEnd(EL_PHASE_MODULE_GIL,now);
+    }
+    server.el_events_start = now;
 }
 
 /* =========================== Server initialization ======================== */
@@ -1359,6 +1443,8 @@ void initServerConfig(void) {
     server.bindaddr_count = 0;
     server.unixsocket = NULL;
     server.unixsocketperm = CONFIG_DEFAULT_UNIX_SOCKET_PERM;
+    server.unixsocket_shm_size = CONFIG_DEFAULT_UNIXSOCKET_SHM_SIZE;
+    server.shm_clients = 0;
     server.ipfd_count = 0;
     server.sofd = -1;
     server.protected_mode = CONFIG_DEFAULT_PROTECTED_MODE;
@@ -1377,6 +1463,7 @@ void initServerConfig(void) {
     server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
     server.saveparams = NULL;
     server.loading = 0;
+    server.lazy_loading = 0;
     server.logfile = zstrdup(CONFIG_DEFAULT_LOGFILE);
     server.syslog_enabled = CONFIG_DEFAULT_SYSLOG_ENABLED;
     server.syslog_ident = zstrdup(CONFIG_DEFAULT_SYSLOG_IDENT);
@@ -1408,6 +1495,8 @@ void initServerConfig(void) {
     server.requirepass = NULL;
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    server.rdb_lazy_load = CONFIG_DEFAULT_RDB_LAZY_LOAD;
+    server.rdb_lazy_load_cycle_us = CONFIG_DEFAULT_RDB_LAZY_LOAD_CYCLE_US;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     server.active_defrag_running = 0;
@@ -1419,6 +1508,30 @@ void initServerConfig(void) {
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
+    server.hotkeys_tracking = CONFIG_DEFAULT_HOTKEYS_TRACKING;
+    server.hotkeys_sample_rate = CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE;
+    server.hotkeys_max_keys = CONFIG_DEFAULT_HOTKEYS_MAX_KEYS;
+    server.memory_report_period = CONFIG_DEFAULT_MEMORY_REPORT_PERIOD;
+    server.memory_report_delimiter = zstrdup(CONFIG_DEFAULT_MEMORY_REPORT_DELIMITER);
+    server.memory_report_top_keys = CONFIG_DEFAULT_MEMORY_REPORT_TOP_KEYS;
+    server.trace_sample_rate = CONFIG_DEFAULT_TRACE_SAMPLE_RATE;
+    server.trace_max_len = CONFIG_DEFAULT_TRACE_MAX_LEN;
+    server.shard_threads = CONFIG_DEFAULT_SHARD_THREADS;
+    server.read_threads = CONFIG_DEFAULT_READ_THREADS;
+    server.offload_threads = CONFIG_DEFAULT_OFFLOAD_THREADS;
+    server.offload_threshold = CONFIG_DEFAULT_OFFLOAD_THRESHOLD;
+    server.offload_jobs = 0;
+    server.reply_cache_max_memory = CONFIG_DEFAULT_REPLY_CACHE_MAX_MEMORY;
+    server.reply_cache_min_size = CONFIG_DEFAULT_REPLY_CACHE_MIN_SIZE;
+    server.value_compression = CONFIG_DEFAULT_VALUE_COMPRESSION;
+    server.value_compression_min_size = CONFIG_DEFAULT_VALUE_COMPRESSION_MIN_SIZE;
+    server.value_compression_min_savings = CONFIG_DEFAULT_VALUE_COMPRESSION_MIN_SAVINGS;
+    server.value_compression_cache_memory = CONFIG_DEFAULT_VALUE_COMPRESSION_CACHE_MEMORY;
+    server.value_compression_dict_size = CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_SIZE;
+    server.value_compression_dict_min_size = CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_MIN_SIZE;
+    server.value_compression_dict_train_period = CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_TRAIN_PERIOD;
+    server.tracking_clients = 0;
+    server.tracking_table_max_keys = CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS;
     server.hash_max_ziplist_entries = OBJ_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = OBJ_HASH_MAX_ZIPLIST_VALUE;
     server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
@@ -1544,11 +1657,13 @@ extern char **environ;
  * RESTART_SERVER_NONE              No flags.
  * RESTART_SERVER_GRACEFULLY        Do a proper shutdown before restarting.
  * RESTART_SERVER_CONFIG_REWRITE    Rewrite the config file before restarting.
+ * RESTART_SERVER_HANDOVER          Hand the dataset over to the new process
+ *                                  (see handover.c) before the shutdown.
  *
  * On success the function does not return, because the process turns into
  * a different process. On error C_ERR is returned. */
 int restartServer(int flags, mstime_t delay) {
-    int j;
+    int j, handover_fd = -1;
 
     /* Check if we still have accesses to the executable that started this
      * server instance. */
@@ -1568,11 +1683,22 @@ int restartServer(int flags, mstime_t delay) {
         return C_ERR;
     }
 
-    /* Perform a proper shutdown. */
+    /* Serialize the dataset for the new process. */
+    if (flags & RESTART_SERVER_HANDOVER &&
+        (handover_fd = handoverSave()) == -1)
+    {
+        serverLog(LL_WARNING,"Can't restart: error handing over the dataset");
+        return C_ERR;
+    }
+
+    /* Perform a proper shutdown. With a handover the RDB is saved as well
+     * if save points are configured: the new process falls back to it if
+     * it does not accept the image. */
     if (flags & RESTART_SERVER_GRACEFULLY &&
         prepareForShutdown(SHUTDOWN_NOFLAGS) != C_OK)
     {
         serverLog(LL_WARNING,"Can't restart: error preparing for shutdown");
+        if (handover_fd != -1) handoverDiscard(handover_fd);
         return C_ERR;
     }
 
@@ -1581,7 +1707,7 @@ int restartServer(int flags, mstime_t delay) {
     for (j = 3; j < (int)server.maxclients + 1024; j++) {
         /* Test the descriptor validity before closing it, otherwise
          * Valgrind issues a warning on close(). */
-        if (fcntl(j,F_GETFD) != -1) close(j);
+        if (j != handover_fd && fcntl(j,F_GETFD) != -1) close(j);
     }
 
     /* Execute the server with the original command line. */
@@ -1773,6 +1899,16 @@ int listenToPort(int port, int *fds, int *count) {
     return C_OK;
 }
 
+/* Add the counters accounted by a shard or offload thread to the global
+ * ones, and reset them. */
+void mergeThreadStats(threadStats *ts) {
+    server.dirty += ts->dirty;
+    server.stat_keyspace_hits += ts->stat_keyspace_hits;
+    server.stat_keyspace_misses += ts->stat_keyspace_misses;
+    server.stat_expiredkeys += ts->stat_expiredkeys;
+    memset(ts,0,sizeof(*ts));
+}
+
 /* Resets the stats that we expose via INFO or other means that we want
  * to reset via CONFIG RESETSTAT. The function is also used in order to
  * initialize these fields in initServer() at server startup. */
@@ -1797,6 +1933,18 @@ void resetServerStats(void) {
     server.stat_sync_full = 0;
     server.stat_sync_partial_ok = 0;
     server.stat_sync_partial_err = 0;
+    server.stat_threaded_reads = 0;
+    server.stat_read_threads_waits = 0;
+    server.stat_offloaded_commands = 0;
+    server.stat_offload_lock_waits = 0;
+    server.stat_reply_cache_hits = 0;
+    server.stat_reply_cache_misses = 0;
+    server.stat_compressions = 0;
+    server.stat_decompressions = 0;
+    server.stat_compression_usec = 0;
+    server.stat_decompression_usec = 0;
+    server.stat_compression_dict_trainings = 0;
+    eventLoopProfilerReset();
     for (j = 0; j < STATS_METRIC_COUNT; j++) {
         server.inst_metric[j].idx = 0;
         server.inst_metric[j].last_sample_time = mstime();
@@ -1822,14 +1970,19 @@ void initServer(void) {
     }
 
     server.pid = getpid();
+    moduleInitGIL();
     server.current_client = NULL;
     server.clients = listCreate();
+    server.clients_index = raxNew();
     server.clients_to_close = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
+    server.clients_timeout_table = raxNew();
+    server.clients_timeout_timer = -1;
+    server.clients_timeout_timer_when = 0;
     server.ready_keys = listCreate();
     server.clients_waiting_acks = listCreate();
     server.get_ack_from_slaves = 0;
@@ -1877,6 +2030,7 @@ void initServer(void) {
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
+        server.db[j].locked_keys = NULL;
         server.db[j].id = j;
         server.db[j].avg_ttl = 0;
     }
@@ -1971,6 +2125,9 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    if (server.shard_threads) shardsInit();
+    if (server.read_threads) readThreadsInit();
+    if (server.offload_threads) offloadInit();
     server.initial_memory_usage = zmalloc_used_memory();
 }
 
@@ -2023,6 +2180,8 @@ void resetCommandTableStats(void) {
         c = (struct redisCommand *) dictGetVal(de);
         c->microseconds = 0;
         c->calls = 0;
+        zfree(c->latency_histogram);
+        c->latency_histogram = NULL;
     }
     dictReleaseIterator(di);
 
@@ -2118,10 +2277,12 @@ struct redisCommand *lookupCommandOrOriginal(sds name) {
  * alsoPropagate(), preventCommandPropagation(), forceCommandPropagation().
  */
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags) {
+    if (server.trace_active) traceMark(TRACE_MARK_PROP_START);
     if (server.aof_state != AOF_OFF && flags & PROPAGATE_AOF)
         feedAppendOnlyFile(cmd,dbid,argv,argc);
     if (flags & PROPAGATE_REPL)
         replicationFeedSlaves(server.slaves,dbid,argv,argc);
+    if (server.trace_active) traceMark(TRACE_MARK_PROP_END);
 }
 
 /* Used inside commands to schedule the propagation of additional commands
@@ -2213,6 +2374,7 @@ void preventCommandReplication(client *c) {
  *
  */
 void call(client *c, int flags) {
+    static int depth = 0; /* Nesting level, for MULTI/EXEC, Lua, modules. */
     long long dirty, start, duration;
     int client_old_flags = c->flags;
 
@@ -2231,11 +2393,20 @@ void call(client *c, int flags) {
     redisOpArray prev_also_propagate = server.also_propagate;
     redisOpArrayInit(&server.also_propagate);
 
+    /* Load the keys of the command still on disk after a lazy RDB load. */
+    if (server.lazy_loading) lazyLoadForCommand(c);
+
     /* Call the command. */
     dirty = server.dirty;
+    if (server.trace_active && depth == 0) traceMark(TRACE_MARK_EXEC_START);
     start = ustime();
+    depth++;
     c->cmd->proc(c);
+    depth--;
     duration = ustime()-start;
+    if (server.trace_active && depth == 0) traceMark(TRACE_MARK_EXEC_END);
+    /* Nested calls are already accounted in the time of the outer one. */
+    if (depth == 0) server.el_cmd_usec += duration;
     dirty = server.dirty-dirty;
     if (dirty < 0) dirty = 0;
 
@@ -2265,6 +2436,15 @@ void call(client *c, int flags) {
     if (flags & CMD_CALL_STATS) {
         c->lastcmd->microseconds += duration;
         c->lastcmd->calls++;
+        latencyHistogramAdd(&c->lastcmd->latency_histogram,duration);
+    }
+
+    /* Remember the keys read by clients doing client side caching, in
+     * order to send them the invalidation messages later. */
+    if (c->flags & CLIENT_TRACKING && !(c->flags & CLIENT_TRACKING_BCAST) &&
+        c->cmd->flags & CMD_READONLY)
+    {
+        trackingRememberKeys(c);
     }
 
     /* Propagate the command into the AOF and replication link */
@@ -2351,6 +2531,7 @@ int processCommand(client *c) {
     /* Now lookup the command and check ASAP about trivial error conditions
      * such as wrong arity, bad command name and so forth. */
     c->cmd = c->lastcmd = lookupCommand(c->argv[0]->ptr);
+    if (server.trace_active) traceMark(TRACE_MARK_LOOKUP);
     if (!c->cmd) {
         flagTransaction(c);
         sds args = sdsempty();
@@ -2409,7 +2590,9 @@ int processCommand(client *c) {
      * keys in the dataset). If there are not the only thing we can do
      * is returning an error. */
     if (server.maxmemory) {
+        if (server.trace_active) traceMark(TRACE_MARK_EVICT_START);
         int retval = freeMemoryIfNeeded();
+        if (server.trace_active) traceMark(TRACE_MARK_EVICT_END);
         /* freeMemoryIfNeeded may flush slave output buffers. This may result
          * into a slave, that may be the active client, to be freed. */
         if (server.current_client == NULL) return C_ERR;
@@ -2519,7 +2702,22 @@ int processCommand(client *c) {
     {
         queueMultiCommand(c);
         addReply(c,shared.queued);
+    } else if (server.shard_threads) {
+        /* Keyspace commands are executed by the thread owning the slots
+         * of their keys, see shard.c. */
+        shardCall(c);
+    } else if (server.offload_jobs && offloadMustWait(c)) {
+        /* The command may access keys locked by offloaded commands: it is
+         * processed again once they complete, see offload.c. */
+        offloadBlockClient(c);
+    } else if (server.read_threads && readThreadsCanExecute(c)) {
+        /* Read only commands are executed concurrently by the read
+         * threads, see readthreads.c. */
+        readThreadsExecute(c);
+    } else if (server.offload_threads && offloadCommand(c)) {
+        /* Heavy multi key command executed by an offload thread. */
     } else {
+        if (server.read_threads) readThreadsWaitIfNeeded(c);
         call(c,CMD_CALL_FULL);
         c->woff = server.master_repl_offset;
         if (listLength(server.ready_keys))
@@ -2962,10 +3160,14 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_longest_output_list:%lu\r\n"
             "client_biggest_input_buf:%lu\r\n"
-            "blocked_clients:%d\r\n",
+            "blocked_clients:%d\r\n"
+            "tracking_clients:%d\r\n"
+            "shm_clients:%u\r\n",
             listLength(server.clients)-listLength(server.slaves),
             lol, bib,
-            server.bpop_blocked_clients);
+            server.bpop_blocked_clients,
+            server.tracking_clients,
+            server.shm_clients);
     }
 
     /* Memory */
@@ -3020,7 +3222,15 @@ sds genRedisInfoString(char *section) {
             "mem_fragmentation_ratio:%.2f\r\n"
             "mem_allocator:%s\r\n"
             "active_defrag_running:%d\r\n"
-            "lazyfree_pending_objects:%zu\r\n",
+            "lazyfree_pending_objects:%zu\r\n"
+            "reply_cache_memory:%zu\r\n"
+            "reply_cache_entries:%zu\r\n"
+            "compressed_values:%zu\r\n"
+            "compression_saved_bytes:%zu\r\n"
+            "compression_cache_memory:%zu\r\n"
+            "compression_dict_version:%u\r\n"
+            "compression_dicts:%zu\r\n"
+            "compression_dicts_memory:%zu\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size,
@@ -3042,7 +3252,15 @@ sds genRedisInfoString(char *section) {
             mh->fragmentation,
             ZMALLOC_LIB,
             server.active_defrag_running,
-            lazyfreeGetPendingObjectsCount()
+            lazyfreeGetPendingObjectsCount(),
+            replyCacheMemory(),
+            replyCacheSize(),
+            mh->compression_values,
+            mh->compression_saved,
+            mh->compression_cache,
+            compressionDictVersion(),
+            compressionDictsCount(),
+            mh->compression_dicts
         );
         freeMemoryOverheadData(mh);
     }
@@ -3135,6 +3353,7 @@ sds genRedisInfoString(char *section) {
                 (intmax_t)eta
             );
         }
+        info = genLazyLoadInfoString(info);
     }
 
     /* Stats */
@@ -3167,7 +3386,20 @@ sds genRedisInfoString(char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "threaded_reads_processed:%lld\r\n"
+            "read_threads_waits:%lld\r\n"
+            "offloaded_commands:%lld\r\n"
+            "offload_lock_waits:%lld\r\n"
+            "reply_cache_hits:%lld\r\n"
+            "reply_cache_misses:%lld\r\n"
+            "compressions:%lld\r\n"
+            "decompressions:%lld\r\n"
+            "compression_cpu_usec:%lld\r\n"
+            "decompression_cpu_usec:%lld\r\n"
+            "compression_dict_trainings:%lld\r\n"
+            "tracking_total_keys:%llu\r\n"
+            "tracking_total_prefixes:%llu\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3193,7 +3425,20 @@ sds genRedisInfoString(char *section) {
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            server.stat_threaded_reads,
+            server.stat_read_threads_waits,
+            server.stat_offloaded_commands,
+            server.stat_offload_lock_waits,
+            server.stat_reply_cache_hits,
+            server.stat_reply_cache_misses,
+            server.stat_compressions,
+            server.stat_decompressions,
+            server.stat_compression_usec,
+            server.stat_decompression_usec,
+            server.stat_compression_dict_trainings,
+            (unsigned long long) trackingGetTotalKeys(),
+            (unsigned long long) trackingGetTotalPrefixes());
     }
 
     /* Replication */
@@ -3359,6 +3604,38 @@ sds genRedisInfoString(char *section) {
         dictReleaseIterator(di);
     }
 
+    /* Event loop profiler */
+    if (allsections || !strcasecmp(section,"eventloop")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Eventloop\r\n");
+        info = genEventLoopInfoString(info);
+    }
+
+    /* Latency percentiles, from the per command latency histograms. */
+    if (allsections || !strcasecmp(section,"latencystats")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info, "# Latencystats\r\n");
+
+        struct redisCommand *c;
+        dictEntry *de;
+        dictIterator *di;
+        di = dictGetSafeIterator(server.commands);
+        while((de = dictNext(di)) != NULL) {
+            c = (struct redisCommand *) dictGetVal(de);
+            if (!c->latency_histogram) continue;
+            info = sdscatprintf(info,
+                "latency_percentiles_usec_%s:p50=%llu,p99=%llu,p99.9=%llu\r\n",
+                c->name,
+                (unsigned long long)
+                    latencyHistogramPercentile(c->latency_histogram,50),
+                (unsigned long long)
+                    latencyHistogramPercentile(c->latency_histogram,99),
+                (unsigned long long)
+                    latencyHistogramPercentile(c->latency_histogram,99.9));
+        }
+        dictReleaseIterator(di);
+    }
+
     /* Cluster */
     if (allsections || defsections || !strcasecmp(section,"cluster")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -3368,19 +3645,31 @@ sds genRedisInfoString(char *section) {
         server.cluster_enabled);
     }
 
+    /* Shards */
+    if (allsections || defsections || !strcasecmp(section,"shards")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscat(info,"# Shards\r\n");
+        info = genShardsInfoString(info);
+    }
+
     /* Key space */
     if (allsections || defsections || !strcasecmp(section,"keyspace")) {
         if (sections++) info = sdscat(info,"\r\n");
         info = sdscatprintf(info, "# Keyspace\r\n");
         for (j = 0; j < server.dbnum; j++) {
-            long long keys, vkeys;
+            long long keys, vkeys, avg_ttl;
 
-            keys = dictSize(server.db[j].dict);
-            vkeys = dictSize(server.db[j].expires);
+            if (server.shard_threads) {
+                shardsGetDbStats(j,&keys,&vkeys,&avg_ttl);
+            } else {
+                keys = dictSize(server.db[j].dict);
+                vkeys = dictSize(server.db[j].expires);
+                avg_ttl = server.db[j].avg_ttl;
+            }
             if (keys || vkeys) {
                 info = sdscatprintf(info,
                     "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
-                    j, keys, vkeys, server.db[j].avg_ttl);
+                    j, keys, vkeys, avg_ttl);
             }
         }
     }
@@ -3593,35 +3882,55 @@ int checkForSentinelMode(int argc, char **argv) {
     return 0;
 }
 
+/* Restore the replication ID / offset saved in the RDB payload. */
+static void restoreReplicationInfo(rdbSaveInfo *rsi) {
+    if (server.masterhost &&
+        rsi->repl_id_is_set &&
+        rsi->repl_offset != -1 &&
+        /* Note that older implementations may save a repl_stream_db
+         * of -1 inside the RDB file in a wrong way, see more information
+         * in function rdbPopulateSaveInfo. */
+        rsi->repl_stream_db != -1)
+    {
+        memcpy(server.replid,rsi->repl_id,sizeof(server.replid));
+        server.master_repl_offset = rsi->repl_offset;
+        /* If we are a slave, create a cached master from this
+         * information, in order to allow partial resynchronizations
+         * with masters. */
+        replicationCacheMasterUsingMyself();
+        selectDb(server.cached_master,rsi->repl_stream_db);
+    }
+}
+
 /* Function called at startup to load RDB or AOF file in memory. */
 void loadDataFromDisk(void) {
     long long start = ustime();
+    rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
+
+    /* After SHUTDOWN HANDOVER the dataset comes from the previous process. */
+    if (handoverLoad(&rsi) == C_OK) {
+        serverLog(LL_NOTICE,"DB loaded from the handover image: %.3f seconds",
+            (float)(ustime()-start)/1000000);
+        restoreReplicationInfo(&rsi);
+        return;
+    }
+
     if (server.aof_state == AOF_ON) {
         if (loadAppendOnlyFile(server.aof_filename) == C_OK)
             serverLog(LL_NOTICE,"DB loaded from append only file: %.3f seconds",(float)(ustime()-start)/1000000);
     } else {
-        rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
-        if (rdbLoad(server.rdb_filename,&rsi) == C_OK) {
+        if (server.rdb_lazy_load &&
+            lazyLoadStart(server.rdb_filename,&rsi) == C_OK)
+        {
+            serverLog(LL_NOTICE,"DB lazy loading started: %.3f seconds",
+                (float)(ustime()-start)/1000000);
+            restoreReplicationInfo(&rsi);
+        } else if (rdbLoad(server.rdb_filename,&rsi) == C_OK) {
             serverLog(LL_NOTICE,"DB loaded from disk: %.3f seconds",
                 (float)(ustime()-start)/1000000);
 
             /* Restore the replication ID / offset from the RDB file. */
-            if (server.masterhost &&
-                rsi.repl_id_is_set &&
-                rsi.repl_offset != -1 &&
-                /* Note that older implementations may save a repl_stream_db
-                 * of -1 inside the RDB file in a wrong way, see more information
-                 * in function rdbPopulateSaveInfo. */
-                rsi.repl_stream_db != -1)
-            {
-                memcpy(server.replid,rsi.repl_id,sizeof(server.replid));
-                server.master_repl_offset = rsi.repl_offset;
-                /* If we are a slave, create a cached master from this
-                 * information, in order to allow partial resynchronizations
-                 * with masters. */
-                replicationCacheMasterUsingMyself();
-                selectDb(server.cached_master,rsi.repl_stream_db);
-            }
+            restoreReplicationInfo(&rsi);
         } else if (errno != ENOENT) {
             serverLog(LL_WARNING,"Fatal error loading the DB: %s. Exiting.",strerror(errno));
             exit(1);
@@ -3914,6 +4223,7 @@ int main(int argc, char **argv) {
     #endif
         moduleLoadFromQueue();
         loadDataFromDisk();
+        if (server.shard_threads) shardsStart();
         if (server.cluster_enabled) {
             if (verifyClusterConfigWithData() == C_ERR) {
                 serverLog(LL_WARNING,
@@ -66,6 +66,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "quicklist.h"  /* Lists are encoded as linked lists of
                            N-elements flat arrays */
 #include "rax.h"     /* Radix tree */
+#include "shmring.h" /* Shared memory ring transport */
 
 /* Following includes allow test functions to be called from Redis main() */
 #include "zipmap.h"
@@ -124,6 +125,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_RDB_LAZY_LOAD 0
+#define CONFIG_DEFAULT_RDB_LAZY_LOAD_CYCLE_US 1000
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
@@ -154,6 +157,33 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
+#define CONFIG_DEFAULT_HOTKEYS_TRACKING 0
+#define CONFIG_DEFAULT_HOTKEYS_SAMPLE_RATE 10
+#define CONFIG_DEFAULT_HOTKEYS_MAX_KEYS 32
+#define HOTKEYS_DECAY_PERIOD 60000 /* Halve hot keys counters every minute. */
+#define CONFIG_DEFAULT_MEMORY_REPORT_PERIOD 0
+#define CONFIG_DEFAULT_MEMORY_REPORT_DELIMITER ":"
+#define CONFIG_DEFAULT_MEMORY_REPORT_TOP_KEYS 10
+#define CONFIG_DEFAULT_TRACE_SAMPLE_RATE 0
+#define CONFIG_DEFAULT_TRACE_MAX_LEN 1024
+#define CONFIG_DEFAULT_SHARD_THREADS 0
+#define CONFIG_MAX_SHARD_THREADS 128
+#define CONFIG_DEFAULT_READ_THREADS 0
+#define CONFIG_MAX_READ_THREADS 128
+#define CONFIG_DEFAULT_OFFLOAD_THREADS 0
+#define CONFIG_MAX_OFFLOAD_THREADS 128
+#define CONFIG_DEFAULT_OFFLOAD_THRESHOLD 100000
+#define CONFIG_DEFAULT_REPLY_CACHE_MAX_MEMORY 0
+#define CONFIG_DEFAULT_REPLY_CACHE_MIN_SIZE (16*1024)
+#define CONFIG_DEFAULT_VALUE_COMPRESSION 0
+#define CONFIG_DEFAULT_VALUE_COMPRESSION_MIN_SIZE 2048
+#define CONFIG_DEFAULT_VALUE_COMPRESSION_MIN_SAVINGS 20
+#define CONFIG_DEFAULT_VALUE_COMPRESSION_CACHE_MEMORY (8*1024*1024)
+#define CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_SIZE (4*1024)
+#define CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_MIN_SIZE 64
+#define CONFIG_DEFAULT_VALUE_COMPRESSION_DICT_TRAIN_PERIOD 3600
+#define CONFIG_DEFAULT_TRACKING_TABLE_MAX_KEYS 1000000
+#define CONFIG_DEFAULT_UNIXSOCKET_SHM_SIZE 0
 #define CONFIG_DEFAULT_ACTIVE_DEFRAG 0
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER 10 /* don't defrag when fragmentation is below 10% */
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_UPPER 100 /* maximum defrag force at 100% fragmentation */
@@ -249,6 +279,9 @@ typedef long long mstime_t; /* millisecond time type. */
 #define CLIENT_LUA_DEBUG (1<<25)  /* Run EVAL in debug mode. */
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
+#define CLIENT_TRACKING (1<<28) /* Client enabled keys tracking in order to
+                                   perform client side caching. */
+#define CLIENT_TRACKING_BCAST (1<<29) /* Tracking in broadcasting mode. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -256,6 +289,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define BLOCKED_LIST 1    /* BLPOP & co. */
 #define BLOCKED_WAIT 2    /* WAIT for synchronous replication. */
 #define BLOCKED_MODULE 3  /* Blocked by a loadable module. */
+#define BLOCKED_THREAD 4  /* Command executed by a shard or read thread. */
+#define BLOCKED_KEYLOCK 5 /* Key locked by an offloaded command. */
 
 /* Client request types */
 #define PROTO_REQ_INLINE 1
@@ -478,6 +513,7 @@ struct RedisModule;
 struct RedisModuleIO;
 struct RedisModuleDigest;
 struct RedisModuleCtx;
+struct RedisModuleDefragCtx;
 struct redisObject;
 
 /* Each module type implementation should export a set of methods in order
@@ -490,6 +526,9 @@ typedef void (*moduleTypeRewriteFunc)(struct RedisModuleIO *io, struct redisObje
 typedef void (*moduleTypeDigestFunc)(struct RedisModuleDigest *digest, void *value);
 typedef size_t (*moduleTypeMemUsageFunc)(const void *value);
 typedef void (*moduleTypeFreeFunc)(void *value);
+typedef size_t (*moduleTypeFreeEffortFunc)(struct redisObject *key, const void *value);
+typedef void (*moduleTypeUnlinkFunc)(struct redisObject *key, const void *value);
+typedef int (*moduleTypeDefragFunc)(struct RedisModuleDefragCtx *ctx, struct redisObject *key, void **value);
 
 /* The module type, which is referenced in each value of a given type, defines
  * the methods and links to the module exporting the type. */
@@ -502,6 +541,9 @@ typedef struct RedisModuleType {
     moduleTypeMemUsageFunc mem_usage;
     moduleTypeDigestFunc digest;
     moduleTypeFreeFunc free;
+    moduleTypeFreeEffortFunc free_effort;
+    moduleTypeUnlinkFunc unlink;
+    moduleTypeDefragFunc defrag;
     char name[10]; /* 9 bytes name + null term. Charset: A-Z a-z 0-9 _- */
 } moduleType;
 
@@ -578,6 +620,7 @@ typedef struct RedisModuleDigest {
 #define OBJ_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
 #define OBJ_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
 #define OBJ_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define OBJ_ENCODING_COMPRESSED 10 /* Compressed, see compression.c */
 
 #define LRU_BITS 24
 #define LRU_CLOCK_MAX ((1<<LRU_BITS)-1) /* Max value of obj->lru */
@@ -594,6 +637,19 @@ typedef struct redisObject {
     void *ptr;
 } robj;
 
+/* The 'ptr' of OBJ_ENCODING_COMPRESSED objects: the compressed content of
+ * a string, or the compressed ziplist of a small hash. */
+#define COMPRESSION_LZF 0
+#define COMPRESSION_DICT 1
+#define COMPRESSION_DICT_MAX_SIZE (6*1024) /* Max dictionary size. */
+typedef struct compressedString {
+    uint32_t len;               /* Length of the uncompressed data. */
+    uint32_t clen;              /* Length of the compressed data. */
+    struct compressionDict *dict; /* Dictionary of COMPRESSION_DICT data. */
+    unsigned char method;       /* COMPRESSION_LZF or COMPRESSION_DICT. */
+    unsigned char data[];
+} compressedString;
+
 /* Macro used to initialize a Redis object allocated on the stack.
  * Note that this macro is taken near the structure definition to make sure
  * we'll update it when the structure is changed, to avoid bugs like
@@ -616,6 +672,7 @@ typedef struct redisDb {
     dict *blocking_keys;        /* Keys with clients waiting for data (BLPOP)*/
     dict *ready_keys;           /* Blocked keys that received a PUSH */
     dict *watched_keys;         /* WATCHED keys for MULTI/EXEC CAS */
+    dict *locked_keys;          /* Keys locked by offloaded commands */
     int id;                     /* Database ID */
     long long avg_ttl;          /* Average TTL, just for stats */
 } redisDb;
@@ -634,6 +691,17 @@ typedef struct multiState {
     time_t minreplicas_timeout; /* MINREPLICAS timeout as unixtime. */
 } multiState;
 
+/* Counters updated by commands that may also be executed outside of the
+ * main thread, by the shard threads and the offload threads. Those threads
+ * account them into a private copy, see thread_stats, that the main thread
+ * adds to the global counters with mergeThreadStats(). */
+typedef struct threadStats {
+    long long dirty;
+    long long stat_keyspace_hits;
+    long long stat_keyspace_misses;
+    long long stat_expiredkeys;
+} threadStats;
+
 /* This structure holds the blocking operation state for a client.
  * The fields used depend on client->btype. */
 typedef struct blockingState {
@@ -655,6 +723,11 @@ typedef struct blockingState {
     void *module_blocked_handle; /* RedisModuleBlockedClient structure.
                                     which is opaque for the Redis core, only
                                     handled in module.c. */
+
+    /* BLOCKED_THREAD */
+    long long thread_usec;  /* Execution time measured by the thread. */
+    threadStats thread_stats; /* Counters updated by the thread. */
+    int thread_close;       /* Free the client once handed back. */
 } blockingState;
 
 /* The following structure represents a node in the server.ready_keys list,
@@ -725,6 +798,10 @@ typedef struct client {
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
     sds peerid;             /* Cached peer ID. */
+    uint64_t tracking_redirection; /* Client ID receiving the invalidation
+                                      messages if CLIENT_TRACKING, or 0. */
+    rax *tracking_prefixes; /* Prefixes of CLIENT_TRACKING_BCAST. */
+    shmConn *shm;           /* Shared memory rings after CLIENT SHM, or NULL. */
 
     /* Response buffer */
     int bufpos;
@@ -822,6 +899,11 @@ struct redisMemOverhead {
     size_t clients_slaves;
     size_t clients_normal;
     size_t aof_buffer;
+    size_t reply_cache;
+    size_t compression_values;
+    size_t compression_saved;
+    size_t compression_cache;
+    size_t compression_dicts;
     size_t overhead_total;
     size_t dataset;
     size_t total_keys;
@@ -910,12 +992,15 @@ struct redisServer {
     int bindaddr_count;         /* Number of addresses in server.bindaddr[] */
     char *unixsocket;           /* UNIX socket path */
     mode_t unixsocketperm;      /* UNIX socket permission */
+    long long unixsocket_shm_size; /* Rings size of CLIENT SHM, 0 = off. */
+    unsigned int shm_clients;   /* Clients using the shared memory rings. */
     int ipfd[CONFIG_BINDADDR_MAX]; /* TCP socket file descriptors */
     int ipfd_count;             /* Used slots in ipfd[] */
     int sofd;                   /* Unix socket file descriptor */
     int cfd[CONFIG_BINDADDR_MAX];/* Cluster bus listening socket */
     int cfd_count;              /* Used slots in cfd[] */
     list *clients;              /* List of active clients */
+    rax *clients_index;         /* Active clients dictionary by client ID. */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
@@ -928,6 +1013,7 @@ struct redisServer {
     int protected_mode;         /* Don't accept external connections. */
     /* RDB / AOF loading information */
     int loading;                /* We are loading data from disk if true */
+    int lazy_loading;           /* Keys of the RDB file still on disk. */
     off_t loading_total_bytes;
     off_t loading_loaded_bytes;
     time_t loading_start_time;
@@ -959,6 +1045,17 @@ struct redisServer {
     long long stat_sync_full;       /* Number of full resyncs with slaves. */
     long long stat_sync_partial_ok; /* Number of accepted PSYNC requests. */
     long long stat_sync_partial_err;/* Number of unaccepted PSYNC requests. */
+    long long stat_threaded_reads;  /* Commands executed by read threads. */
+    long long stat_read_threads_waits; /* Main thread waits for readers. */
+    long long stat_offloaded_commands; /* Commands executed by offload threads. */
+    long long stat_offload_lock_waits; /* Commands delayed by locked keys. */
+    long long stat_reply_cache_hits;   /* Replies served by the reply cache. */
+    long long stat_reply_cache_misses; /* Replies encoded for the cache. */
+    long long stat_compressions;    /* Values compressed. */
+    long long stat_decompressions;  /* Values decompressed on access. */
+    long long stat_compression_usec;   /* Time spent compressing values. */
+    long long stat_decompression_usec; /* Time spent decompressing values. */
+    long long stat_compression_dict_trainings; /* Dictionaries trained. */
     list *slowlog;                  /* SLOWLOG list of commands */
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
@@ -1038,6 +1135,8 @@ struct redisServer {
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_lazy_load;              /* Save a key index, load lazily? */
+    long long rdb_lazy_load_cycle_us; /* Background lazy loading budget. */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1132,13 +1231,11 @@ struct redisServer {
     /* Blocked clients */
     unsigned int bpop_blocked_clients; /* Number of clients blocked by lists */
     list *unblocked_clients; /* list of clients to unblock before next loop */
+    rax *clients_timeout_table; /* Blocked clients by timeout, see blocked.c */
+    long long clients_timeout_timer; /* Time event waking up the event loop
+                                        for the nearest timeout, or -1. */
+    mstime_t clients_timeout_timer_when; /* When the above timer fires. */
     list *ready_keys;        /* List of readyList structures for BLPOP & co */
-    /* Sort parameters - qsort_r() is only available under BSD so we
-     * have to take this state global, in order to pass it to sortCompare() */
-    int sort_desc;
-    int sort_alpha;
-    int sort_bypattern;
-    int sort_store;
     /* Zip structure config, see redis.conf for more information  */
     size_t hash_max_ziplist_entries;
     size_t hash_max_ziplist_value;
@@ -1193,6 +1290,51 @@ struct redisServer {
     int lazyfree_lazy_eviction;
     int lazyfree_lazy_expire;
     int lazyfree_lazy_server_del;
+    /* Hot keys tracking */
+    int hotkeys_tracking;           /* Track hot keys in lookupKey() if true. */
+    int hotkeys_sample_rate;        /* Account one lookup every N on average. */
+    int hotkeys_max_keys;           /* Size of the reads/writes top-K. */
+    /* Keyspace memory report */
+    int memory_report_period;       /* Seconds between scans, 0 = disabled. */
+    char *memory_report_delimiter;  /* Key prefix delimiter. */
+    int memory_report_top_keys;     /* Number of biggest keys to report. */
+    /* Command tracing */
+    long long trace_sample_rate;    /* Trace one command every N, 0 = off. */
+    unsigned long trace_max_len;    /* Max number of traced commands kept. */
+    int trace_active;               /* Tracing the current command if true. */
+    /* Sharded mode */
+    int shard_threads;              /* Number of shard threads, 0 = off. */
+    /* Read threads */
+    int read_threads;               /* Number of read threads, 0 = off. */
+    /* Offload threads */
+    int offload_threads;            /* Number of offload threads, 0 = off. */
+    long long offload_threshold;    /* Min elements to offload a command. */
+    int offload_jobs;               /* Offloaded commands in progress. */
+    /* Reply cache */
+    long long reply_cache_max_memory; /* Max memory of the cache, 0 = off. */
+    long long reply_cache_min_size; /* Min size of the cached values. */
+    /* Value compression */
+    int value_compression;          /* Compress big string values. */
+    long long value_compression_min_size; /* Min size of compressed values. */
+    int value_compression_min_savings; /* Min % of memory saved. */
+    long long value_compression_cache_memory; /* Max memory of the values
+                                                 kept uncompressed. */
+    long long value_compression_dict_size; /* Size of the dictionary trained
+                                              for small values, 0 = off. */
+    long long value_compression_dict_min_size; /* Min size of the values
+                                                  compressed with it. */
+    int value_compression_dict_train_period; /* Seconds between trainings,
+                                                0 = train once. */
+    /* Client side caching */
+    unsigned int tracking_clients;  /* Number of clients with tracking on. */
+    long long tracking_table_max_keys; /* Max keys in the tracking table. */
+    /* Event loop profiler */
+    struct eventLoopPhase el_phases[EL_PHASE_NUM];
+    long long el_sleep_start;   /* ustime() when the last poll started. */
+    long long el_wake_time;     /* ustime() when the last poll returned. */
+    long long el_events_start;  /* ustime() when afterSleep() returned. */
+    long long el_cron_usec;     /* serverCron() time in the current cycle. */
+    long long el_cmd_usec;      /* Commands time in the current cycle. */
     /* Latency monitor */
     long long latency_monitor_threshold;
     dict *latency_events;
@@ -1233,6 +1375,7 @@ struct redisCommand {
     int lastkey;  /* The last argument that's a key */
     int keystep;  /* The step between first and last key */
     long long microseconds, calls;
+    struct latencyHistogram *latency_histogram; /* Allocated on first call. */
 };
 
 struct redisFunctionSym {
@@ -1320,6 +1463,7 @@ typedef struct {
  *----------------------------------------------------------------------------*/
 
 extern struct redisServer server;
+extern __thread threadStats *thread_stats;
 extern struct sharedObjectsStruct shared;
 extern dictType objectKeyPointerValueDictType;
 extern dictType setDictType;
@@ -1332,8 +1476,17 @@ extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
 extern dictType keyptrDictType;
+extern dictType keylistDictType;
 extern dictType modulesDictType;
 
+/* Increment a counter of threadStats: the global one in the main thread,
+ * the private copy of the shard and offload threads. */
+#define serverStatIncr(_field,_n) do { \
+    if (thread_stats) thread_stats->_field += (_n); \
+    else server._field += (_n); \
+} while(0)
+#define incrDirty(_n) serverStatIncr(dirty,_n)
+
 /*-----------------------------------------------------------------------------
  * Functions prototypes
  *----------------------------------------------------------------------------*/
@@ -1351,9 +1504,14 @@ void moduleHandleBlockedClients(void);
 void moduleBlockedClientTimedOut(client *c);
 void moduleBlockedClientPipeReadable(aeEventLoop *el, int fd, void *privdata, int mask);
 size_t moduleCount(void);
+void moduleInitGIL(void);
 void moduleAcquireGIL(void);
 void moduleReleaseGIL(void);
 void moduleNotifyKeyspaceEvent(int type, const char *event, robj *key, int dbid);
+size_t moduleGetFreeEffort(robj *key, robj *val);
+void moduleNotifyKeyUnlink(robj *key, robj *val);
+void moduleNotifyDbUnlink(redisDb *db);
+int moduleDefragValue(robj *key, robj *value, unsigned long *cursor, int resumed, long long endtime, long long *defragged);
 
 
 /* Utils */
@@ -1379,6 +1537,7 @@ void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
+void readQueryFromShm(aeEventLoop *el, int fd, void *privdata, int mask);
 void addReplyString(client *c, const char *s, size_t len);
 void addReplyBulk(client *c, robj *obj);
 void addReplyBulkCString(client *c, const char *s);
@@ -1420,6 +1579,7 @@ int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
 int clientHasPendingReplies(client *c);
 void unlinkClient(client *c);
+client *lookupClientByID(uint64_t id);
 int writeToClient(int fd, client *c, int handler_installed);
 
 #ifdef __GNUC__
@@ -1482,6 +1642,8 @@ int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
 robj *tryObjectEncoding(robj *o);
 robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5 /* Default sample size. */
+size_t objectComputeSize(robj *o, size_t sample_size);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
 robj *createQuicklistObject(void);
@@ -1665,7 +1827,10 @@ void adjustOpenFilesLimit(void);
 void closeListeningSockets(int unlink_unix_socket);
 void updateCachedTime(void);
 void resetServerStats(void);
+void mergeThreadStats(threadStats *ts);
 void activeDefragCycle(void);
+void *activeDefragAlloc(void *ptr);
+robj *activeDefragStringOb(robj* ob, int *defragged);
 unsigned int getLRUClock(void);
 unsigned int LRU_CLOCK(void);
 const char *evictPolicyToString(void);
@@ -1675,6 +1840,7 @@ void freeMemoryOverheadData(struct redisMemOverhead *mh);
 #define RESTART_SERVER_NONE 0
 #define RESTART_SERVER_GRACEFULLY (1<<0)     /* Do proper shutdown. */
 #define RESTART_SERVER_CONFIG_REWRITE (1<<1) /* CONFIG REWRITE before restart.*/
+#define RESTART_SERVER_HANDOVER (1<<2)       /* Hand the dataset over. */
 int restartServer(int flags, mstime_t delay);
 
 /* Set data type */
@@ -1748,10 +1914,12 @@ robj *lookupKeyWrite(redisDb *db, robj *key);
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags);
+robj *lookupKeyReadNoSideEffects(redisDb *db, robj *key);
 robj *objectCommandLookup(client *c, robj *key);
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
 #define LOOKUP_NONE 0
 #define LOOKUP_NOTOUCH (1<<0)
+#define LOOKUP_WRITE (1<<1) /* Lookup on behalf of a write (hot keys tracking). */
 void dbAdd(redisDb *db, robj *key, robj *val);
 void dbOverwrite(redisDb *db, robj *key, robj *val);
 void setKey(redisDb *db, robj *key, robj *val);
@@ -1768,6 +1936,9 @@ long long emptyDb(int dbnum, int flags, void(callback)(void*));
 int selectDb(client *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
 void signalFlushedDb(int dbid);
+sds sideTableName(int dbid, sds key);
+void sideTableFlush(dict *d, int dbid, void (*del)(dictEntry *de));
+void flushSideTables(int dbid);
 unsigned int getKeysInSlot(unsigned int hashslot, robj **keys, unsigned int count);
 unsigned int countKeysInSlot(unsigned int hashslot);
 unsigned int delKeysInSlot(unsigned int hashslot);
@@ -1782,6 +1953,106 @@ void emptyDbAsync(redisDb *db);
 void slotToKeyFlushAsync(void);
 size_t lazyfreeGetPendingObjectsCount(void);
 
+/* Hot keys tracking */
+void hotkeysTrackLookup(redisDb *db, robj *key, int write);
+void hotkeysDecay(void);
+void hotkeysReset(void);
+
+/* Keyspace memory report */
+void memoryReportCron(void);
+void memoryReportCommand(client *c);
+
+/* Sharded mode */
+void shardsInit(void);
+void shardsStart(void);
+void shardsPause(void);
+void shardsResume(void);
+void shardCall(client *c);
+int shardIsShardThread(void);
+redisDb *shardSelectDb(int id);
+redisDb *shardGetDb(int shard, int dbid);
+redisDb *shardGetDbForKey(int dbid, robj *key);
+long long shardsEmptyDb(int dbnum, int async, void(callback)(void*));
+void shardsGetDbStats(int dbid, long long *keys, long long *vkeys,
+                      long long *avg_ttl);
+sds genShardsInfoString(sds info);
+
+/* Read threads */
+void readThreadsInit(void);
+int readThreadsIsReader(void);
+int readThreadsCanExecute(client *c);
+void readThreadsExecute(client *c);
+void readThreadsWaitIfNeeded(client *c);
+void readThreadsWait(void);
+
+/* Offload threads */
+void offloadInit(void);
+int offloadIsOffloadThread(void);
+int offloadCommand(client *c);
+int offloadMustWait(client *c);
+void offloadBlockClient(client *c);
+void unblockClientWaitingKeyLock(client *c);
+int offloadKeyIsLocked(redisDb *db, sds key);
+void offloadDeferKeyspaceEvent(int type, char *event, robj *key, int dbid);
+
+/* Client side caching (tracking) */
+void enableTracking(client *c, uint64_t redirect_to, int bcast,
+                    robj **prefixes, size_t numprefixes);
+void disableTracking(client *c);
+void trackingRememberKeys(client *c);
+void trackingInvalidateKey(robj *keyobj);
+void trackingInvalidateKeysOnFlush(int dbid);
+void trackingBroadcastInvalidationMessages(void);
+void trackingLimitUsedKeys(void);
+uint64_t trackingGetTotalKeys(void);
+uint64_t trackingGetTotalPrefixes(void);
+
+/* Lazy loading */
+int lazyLoadStart(char *filename, rdbSaveInfo *rsi);
+int lazyLoadKey(redisDb *db, sds key);
+void lazyLoadDiscardKey(redisDb *db, sds key);
+void lazyLoadEmptyDb(int dbnum);
+void lazyLoadFinish(void);
+void lazyLoadForCommand(client *c);
+sds genLazyLoadInfoString(sds info);
+
+/* Warm restart handover */
+int handoverSave(void);
+void handoverDiscard(int fd);
+int handoverLoad(rdbSaveInfo *rsi);
+
+/* Reply cache */
+void replyCacheAddReplyBulk(client *c, robj *key, robj *val);
+void replyCacheInvalidateKey(redisDb *db, robj *key);
+void replyCacheFlush(int dbid);
+void replyCacheResize(void);
+size_t replyCacheMemory(void);
+size_t replyCacheSize(void);
+
+/* Value compression */
+robj *createCompressedStringObject(const void *data, size_t clen, size_t len);
+robj *dupCompressedObject(const robj *o);
+int compressionIsWorthwhile(size_t len, size_t clen);
+void freeCompressedObject(robj *o);
+sds compressionDecode(robj *o);
+size_t compressionValueLength(robj *o);
+void compressionDecompressValue(redisDb *db, robj *key, robj *val);
+void compressionTrackKey(redisDb *db, robj *key);
+int compressionCommandKeysCompressed(client *c);
+void compressionBeforeSleep(void);
+void compressionCron(void);
+void compressionCacheFlush(int dbid);
+size_t compressionCacheMemory(void);
+size_t compressionValuesCount(void);
+size_t compressionSavedMemory(void);
+robj *compressionDecodeObject(robj *o);
+void compressionCompressLoadedValue(robj *o);
+int compressionSaveDict(rio *rdb);
+int compressionLoadDict(sds data);
+unsigned int compressionDictVersion(void);
+size_t compressionDictsCount(void);
+size_t compressionDictsMemory(void);
+
 /* API to get key arguments from commands */
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
 void getKeysFreeResult(int *result);
@@ -1826,9 +2097,14 @@ void unblockClient(client *c);
 void replyToBlockedClientTimedOut(client *c);
 int getTimeoutFromObjectOrReply(client *c, robj *object, mstime_t *timeout, int unit);
 void disconnectAllBlockedClients(void);
+void handleBlockedClientsTimeout(void);
+void blockClientForThread(client *c);
+void unblockClientFromThread(client *c);
+int inCommandThread(void);
 
 /* expire.c -- Handling of expired keys */
 void activeExpireCycle(int type);
+int activeExpireCycleTryExpire(redisDb *db, dictEntry *de, long long now);
 void expireSlaveKeys(void);
 void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
@@ -2026,6 +2302,7 @@ void pfcountCommand(client *c);
 void pfmergeCommand(client *c);
 void pfdebugCommand(client *c);
 void latencyCommand(client *c);
+void hotkeysCommand(client *c);
 void moduleCommand(client *c);
 void securityWarningCommand(client *c);
 
@@ -0,0 +1,645 @@
+/* Shared nothing sharded mode.
+ *
+ * When "shard-threads" is set to N > 0, the keyspace is split among N shard
+ * threads using the 16384 hash slots of Redis Cluster: keyHashSlot() maps
+ * every key to a slot, and every slot is owned by exactly one shard. Each
+ * shard thread runs its own event loop and owns a private set of
+ * server.dbnum databases holding only the keys of its slots, so the data
+ * structures code runs unmodified and without locks: a given key is only
+ * ever touched by the thread owning it.
+ *
+ * The main thread keeps doing the network I/O, the protocol parsing and all
+ * the checks of processCommand(). A command having all its keys in the
+ * slots of a single shard is forwarded to the owner through a lock free
+ * single producer / single consumer queue. The client is flagged as
+ * blocked (BLOCKED_THREAD) until the shard hands it back on a second queue,
+ * so the main thread never touches a client while a shard is executing a
+ * command on its behalf. Keys hashing to slots owned by different shards
+ * are rejected with a -CROSSSLOT error, and hash tags can be used exactly
+ * like in Redis Cluster to keep related keys together. The global counters
+ * updated by the commands (changes since the last save, keyspace hits and
+ * misses, expired keys) are accounted per thread, see threadStats, and
+ * merged by the main thread.
+ *
+ * Commands without keys run in the main thread. The ones operating on the
+ * whole keyspace (DBSIZE, KEYS, FLUSHALL, INFO, SAVE, CONFIG, ...) run while
+ * all the shards are stopped at a command boundary, see shardsPause(): this
+ * is also what makes fork() safe when persisting on disk.
+ *
+ * Features requiring a global order of the writes, or running commands
+ * from the main thread against keys owned by the shards, are not available
+ * in this mode: replication, AOF, MULTI/EXEC, scripting, blocking commands,
+ * keyspace notifications and modules. Eviction is not available either,
+ * since freeMemoryIfNeeded() only samples the global databases, so
+ * maxmemory can't be set.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "cluster.h"
+#include "atomicvar.h"
+#include <signal.h>
+
+/* Single producer / single consumer queue of clients. The producer only
+ * writes 'tail', the consumer only writes 'head'. A byte is written into
+ * the wake up pipe, registered in the event loop of the consumer, only if
+ * the consumer did not already get one ('notified' is clear): this way
+ * a burst of commands costs a single write() / read() pair. */
+typedef struct shardQueue {
+    client **items;
+    unsigned long size;     /* Power of two. */
+    unsigned long head;     /* Next item to pop. */
+    unsigned long tail;     /* Next item to push. */
+    int notified;           /* A wake up byte is pending in the pipe. */
+    int fds[2];             /* Wake up pipe: read end, write end. */
+    pthread_mutex_t head_mutex;
+    pthread_mutex_t tail_mutex;
+    pthread_mutex_t notified_mutex;
+} shardQueue;
+
+typedef struct redisShard {
+    int id;
+    pthread_t thread;
+    aeEventLoop *el;
+    redisDb *db;            /* server.dbnum databases, keys of owned slots. */
+    shardQueue in;          /* Main thread -> shard: commands to execute. */
+    shardQueue out;         /* Shard -> main thread: executed commands. */
+    long long stat_commands;    /* Commands executed by this shard. */
+    long long stat_usec;        /* Time spent executing commands. */
+    long long stat_expired;     /* Keys expired by the shard cron. */
+    threadStats stats;          /* Global counters updated by the shard
+                                   cron, merged while the shards are
+                                   paused. */
+} redisShard;
+
+static redisShard *shards = NULL;
+static int shards_running = 0;      /* True once the threads are started. */
+static uint16_t slot_owner[CLUSTER_SLOTS];
+static pthread_key_t shard_key;
+
+/* Stop the world: shardsPause() sets 'pause_requested' and waits for all
+ * the shards to be counted in 'paused', shardsResume() clears it. */
+static pthread_mutex_t pause_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pause_cond = PTHREAD_COND_INITIALIZER;
+static int pause_requested = 0;
+pthread_mutex_t pause_requested_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int paused = 0;
+static int pause_depth = 0;  /* Nested shardsPause() calls, main thread. */
+
+/* How processCommand() executes a command in sharded mode. */
+#define SHARD_EXEC_LOCAL 0      /* Main thread, shards keep running. */
+#define SHARD_EXEC_GLOBAL 1     /* Main thread, shards stopped. */
+#define SHARD_EXEC_OWNER 2      /* Forwarded to the shard owning the keys. */
+#define SHARD_EXEC_CROSSSLOT 3  /* Keys owned by different shards. */
+#define SHARD_EXEC_DENIED 4     /* Not available in sharded mode. */
+
+/* -----------------------------------------------------------------------------
+ * Queues
+ * -------------------------------------------------------------------------- */
+
+static int shardQueueInit(shardQueue *q, unsigned long minsize) {
+    q->size = 1;
+    while (q->size < minsize) q->size <<= 1;
+    q->items = zmalloc(sizeof(client*)*q->size);
+    q->head = q->tail = 0;
+    q->notified = 0;
+    pthread_mutex_init(&q->head_mutex,NULL);
+    pthread_mutex_init(&q->tail_mutex,NULL);
+    pthread_mutex_init(&q->notified_mutex,NULL);
+    if (pipe(q->fds) == -1) return C_ERR;
+    anetNonBlock(NULL,q->fds[0]);
+    anetNonBlock(NULL,q->fds[1]);
+    return C_OK;
+}
+
+static void shardQueueWakeup(shardQueue *q) {
+    /* If the pipe is full a wake up is already pending: nothing to do. */
+    if (write(q->fds[1],"x",1) == -1) return;
+}
+
+/* Called by the producer. */
+static void shardQueuePush(shardQueue *q, client *c) {
+    unsigned long head, tail = q->tail;
+    int notified;
+
+    atomicGetWithSync(q->head,head);
+    serverAssert(tail-head < q->size);
+    q->items[tail & (q->size-1)] = c;
+    atomicSetWithSync(q->tail,tail+1);
+
+    /* If the consumer cleared 'notified' after we published the item, it
+     * will need a new byte. Otherwise it is still going to drain the queue
+     * and will find the item. */
+    atomicGetWithSync(q->notified,notified);
+    if (!notified) {
+        atomicSetWithSync(q->notified,1);
+        shardQueueWakeup(q);
+    }
+}
+
+/* Called by the consumer. Returns NULL if the queue is empty. */
+static client *shardQueuePop(shardQueue *q) {
+    unsigned long tail, head = q->head;
+    client *c;
+
+    atomicGetWithSync(q->tail,tail);
+    if (head == tail) return NULL;
+    c = q->items[head & (q->size-1)];
+    atomicSetWithSync(q->head,head+1);
+    return c;
+}
+
+/* Called by the consumer when the pipe is readable, before draining the
+ * queue. */
+static void shardQueueAck(shardQueue *q) {
+    char buf[64];
+
+    while (read(q->fds[0],buf,sizeof(buf)) > 0);
+    atomicSetWithSync(q->notified,0);
+}
+
+/* -----------------------------------------------------------------------------
+ * Stop the world
+ * -------------------------------------------------------------------------- */
+
+/* Stop all the shard threads at a command boundary, so that the main thread
+ * can access every database. Calls can be nested. In a forked child there
+ * are no shard threads at all, so this is a no-op. */
+void shardsPause(void) {
+    int j;
+
+    if (!shards_running || getpid() != server.pid) return;
+    if (pause_depth++) return;
+
+    pthread_mutex_lock(&pause_mutex);
+    atomicSetWithSync(pause_requested,1);
+    for (j = 0; j < server.shard_threads; j++)
+        shardQueueWakeup(&shards[j].in);
+    while (paused != server.shard_threads)
+        pthread_cond_wait(&pause_cond,&pause_mutex);
+    pthread_mutex_unlock(&pause_mutex);
+
+    for (j = 0; j < server.shard_threads; j++)
+        mergeThreadStats(&shards[j].stats);
+}
+
+void shardsResume(void) {
+    if (!shards_running || getpid() != server.pid) return;
+    serverAssert(pause_depth > 0);
+    if (--pause_depth) return;
+
+    pthread_mutex_lock(&pause_mutex);
+    atomicSetWithSync(pause_requested,0);
+    pthread_cond_broadcast(&pause_cond);
+    pthread_mutex_unlock(&pause_mutex);
+}
+
+/* Called by the shard threads between commands. */
+static void shardCheckPause(void) {
+    int requested;
+
+    atomicGetWithSync(pause_requested,requested);
+    if (!requested) return;
+
+    pthread_mutex_lock(&pause_mutex);
+    paused++;
+    pthread_cond_broadcast(&pause_cond);
+    while (pause_requested) pthread_cond_wait(&pause_cond,&pause_mutex);
+    paused--;
+    pthread_mutex_unlock(&pause_mutex);
+}
+
+/* -----------------------------------------------------------------------------
+ * Shard threads
+ * -------------------------------------------------------------------------- */
+
+static redisShard *shardCurrent(void) {
+    return shards ? pthread_getspecific(shard_key) : NULL;
+}
+
+/* Return true if the caller is a shard thread. */
+int shardIsShardThread(void) {
+    return shardCurrent() != NULL;
+}
+
+/* Return the database 'id' the caller should use: the shard copy when
+ * called by a shard thread, the global one otherwise. */
+redisDb *shardSelectDb(int id) {
+    redisShard *s = shardCurrent();
+
+    return s ? s->db+id : server.db+id;
+}
+
+/* Return the database 'dbid' of the shard 'shard'. */
+redisDb *shardGetDb(int shard, int dbid) {
+    return shards[shard].db+dbid;
+}
+
+/* Return the database 'dbid' of the shard owning 'key'. */
+redisDb *shardGetDbForKey(int dbid, robj *key) {
+    int slot = keyHashSlot(key->ptr,sdslen(key->ptr));
+
+    return shardGetDb(slot_owner[slot],dbid);
+}
+
+static void shardExecuteCommand(redisShard *s, client *c) {
+    long long start = ustime(), duration;
+
+    /* The counters updated by the command are merged into the global ones
+     * by unblockClientFromThread(), once the client is handed back. */
+    c->db = s->db+c->db->id;
+    thread_stats = &c->bpop.thread_stats;
+    c->cmd->proc(c);
+    thread_stats = &s->stats;
+    /* The command may have switched DB, as MOVE does. */
+    c->db = server.db+c->db->id;
+    duration = ustime()-start;
+    c->bpop.thread_usec = duration;
+    s->stat_commands++;
+    s->stat_usec += duration;
+}
+
+/* Readable handler of the input queue pipe, shard thread side. */
+static void shardReadQueue(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisShard *s = privdata;
+    client *c;
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(mask);
+
+    shardQueueAck(&s->in);
+    while (1) {
+        shardCheckPause();
+        if ((c = shardQueuePop(&s->in)) == NULL) break;
+        shardExecuteCommand(s,c);
+        shardQueuePush(&s->out,c);
+    }
+}
+
+/* Expire keys and resize the hash tables of the shard databases. This is a
+ * simplified version of activeExpireCycle() and databasesCron(), that only
+ * operate on the global databases. */
+static int shardCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
+    redisShard *s = clientData;
+    long long start = ustime(), timelimit;
+    int j;
+    UNUSED(eventLoop);
+    UNUSED(id);
+
+    timelimit = 1000000*ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC/server.hz/100;
+    if (timelimit <= 0) timelimit = 1;
+
+    for (j = 0; j < server.dbnum; j++) {
+        redisDb *db = s->db+j;
+        int expired;
+
+        if (server.active_expire_enabled) {
+            do {
+                unsigned long num = dictSize(db->expires);
+                long long now = mstime();
+
+                expired = 0;
+                if (num == 0) {
+                    db->avg_ttl = 0;
+                    break;
+                }
+                if (num > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP)
+                    num = ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP;
+                while (num--) {
+                    dictEntry *de = dictGetRandomKey(db->expires);
+                    long long ttl = dictGetSignedIntegerVal(de)-now;
+
+                    if (activeExpireCycleTryExpire(db,de,now)) expired++;
+                    else if (ttl > 0) {
+                        if (db->avg_ttl == 0) db->avg_ttl = ttl;
+                        db->avg_ttl = (db->avg_ttl/50)*49 + (ttl/50);
+                    }
+                }
+                s->stat_expired += expired;
+            } while (expired > ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP/4 &&
+                     ustime()-start < timelimit);
+        }
+
+        if (htNeedsResize(db->dict)) dictResize(db->dict);
+        if (htNeedsResize(db->expires)) dictResize(db->expires);
+        if (server.activerehashing) {
+            dictRehashMilliseconds(db->dict,1);
+            dictRehashMilliseconds(db->expires,1);
+        }
+    }
+    return 1000/server.hz;
+}
+
+static void shardBeforeSleep(struct aeEventLoop *eventLoop) {
+    UNUSED(eventLoop);
+    shardCheckPause();
+}
+
+static void *shardThreadMain(void *arg) {
+    redisShard *s = arg;
+    sigset_t sigset;
+
+    /* Only the main thread should receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset,SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK,&sigset,NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in shard thread: %s",
+            strerror(errno));
+
+    pthread_setspecific(shard_key,s);
+    thread_stats = &s->stats;
+    aeSetBeforeSleepProc(s->el,shardBeforeSleep);
+    aeMain(s->el);
+    return NULL;
+}
+
+/* -----------------------------------------------------------------------------
+ * Main thread side
+ * -------------------------------------------------------------------------- */
+
+/* Readable handler of the output queue pipe, main thread side. */
+static void shardReadDoneQueue(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisShard *s = privdata;
+    client *c;
+    UNUSED(el);
+    UNUSED(fd);
+    UNUSED(mask);
+
+    shardQueueAck(&s->out);
+    while ((c = shardQueuePop(&s->out)) != NULL) unblockClientFromThread(c);
+}
+
+/* Return how the command of the client should be executed. For
+ * SHARD_EXEC_OWNER the owner shard is stored into *shard. */
+static int shardCommandTarget(client *c, int *shard) {
+    struct redisCommand *cmd = c->cmd;
+    int *keys, numkeys, j, owner = -1;
+
+    if (cmd->proc == multiCommand || cmd->proc == execCommand ||
+        cmd->proc == discardCommand || cmd->proc == watchCommand ||
+        cmd->proc == unwatchCommand || cmd->proc == evalCommand ||
+        cmd->proc == evalShaCommand || cmd->proc == blpopCommand ||
+        cmd->proc == brpopCommand || cmd->proc == brpoplpushCommand ||
+        cmd->proc == waitCommand || cmd->proc == syncCommand ||
+        cmd->proc == slaveofCommand || cmd->proc == monitorCommand ||
+        cmd->proc == bgrewriteaofCommand || cmd->proc == moduleCommand ||
+        cmd->proc == debugCommand || cmd->proc == sortCommand ||
+        cmd->proc == migrateCommand || cmd->proc == swapdbCommand ||
+        cmd->proc == scanCommand || cmd->proc == randomkeyCommand)
+    {
+        return SHARD_EXEC_DENIED;
+    }
+
+    /* MEMORY USAGE is the only keyless command taking a key argument
+     * (PFDEBUG has its key in the command table): it must run in the shard
+     * owning the key, not against the empty global databases. */
+    if (cmd->proc == memoryCommand && c->argc >= 3 &&
+        !strcasecmp(c->argv[1]->ptr,"usage"))
+    {
+        robj *key = c->argv[2];
+
+        *shard = slot_owner[keyHashSlot(key->ptr,sdslen(key->ptr))];
+        return SHARD_EXEC_OWNER;
+    }
+
+    if (cmd->getkeys_proc == NULL && cmd->firstkey == 0) {
+        if (cmd->flags & (CMD_WRITE|CMD_READONLY|CMD_ADMIN) ||
+            cmd->proc == infoCommand) return SHARD_EXEC_GLOBAL;
+        return SHARD_EXEC_LOCAL;
+    }
+
+    keys = getKeysFromCommand(cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys; j++) {
+        robj *key = c->argv[keys[j]];
+        int slot = keyHashSlot(key->ptr,sdslen(key->ptr));
+
+        if (owner == -1) {
+            owner = slot_owner[slot];
+        } else if (owner != slot_owner[slot]) {
+            getKeysFreeResult(keys);
+            return SHARD_EXEC_CROSSSLOT;
+        }
+    }
+    getKeysFreeResult(keys);
+
+    /* Commands with a syntax error may not report any key: let the first
+     * shard reply with the error. */
+    *shard = owner == -1 ? 0 : owner;
+    return SHARD_EXEC_OWNER;
+}
+
+/* Execute the command of the client, already checked by processCommand(),
+ * in sharded mode. */
+void shardCall(client *c) {
+    int shard;
+
+    switch(shardCommandTarget(c,&shard)) {
+    case SHARD_EXEC_DENIED:
+        addReplyErrorFormat(c,"'%s' is not supported when shard-threads "
+                              "is enabled", c->cmd->name);
+        break;
+    case SHARD_EXEC_CROSSSLOT:
+        addReplySds(c,sdsnew("-CROSSSLOT Keys in request don't hash to "
+                             "slots owned by the same shard thread\r\n"));
+        break;
+    case SHARD_EXEC_LOCAL:
+        call(c,CMD_CALL_FULL);
+        break;
+    case SHARD_EXEC_GLOBAL:
+        shardsPause();
+        call(c,CMD_CALL_FULL);
+        shardsResume();
+        break;
+    case SHARD_EXEC_OWNER:
+        blockClientForThread(c);
+        shardQueuePush(&shards[shard].in,c);
+        break;
+    }
+}
+
+/* Remove the keys of database 'dbnum' (or all the databases if -1) from
+ * the shards. Called by emptyDb(). Returns the number of keys removed. */
+long long shardsEmptyDb(int dbnum, int async, void(callback)(void*)) {
+    long long removed = 0;
+    int j, k;
+
+    shardsPause();
+    for (j = 0; j < server.shard_threads; j++) {
+        for (k = 0; k < server.dbnum; k++) {
+            redisDb *db = shards[j].db+k;
+
+            if (dbnum != -1 && dbnum != k) continue;
+            removed += dictSize(db->dict);
+            moduleNotifyDbUnlink(db);
+            if (async) {
+                emptyDbAsync(db);
+            } else {
+                dictEmpty(db->dict,callback);
+                dictEmpty(db->expires,callback);
+            }
+        }
+    }
+    shardsResume();
+    return removed;
+}
+
+/* Get the number of keys and keys with an expire of database 'dbid' summed
+ * across all the shards, and their average TTL. */
+void shardsGetDbStats(int dbid, long long *keys, long long *vkeys,
+                      long long *avg_ttl)
+{
+    long long ttl_sum = 0;
+    int j, ttl_dbs = 0;
+
+    *keys = *vkeys = 0;
+    for (j = 0; j < server.shard_threads; j++) {
+        redisDb *db = shards[j].db+dbid;
+
+        *keys += dictSize(db->dict);
+        *vkeys += dictSize(db->expires);
+        if (db->avg_ttl) {
+            ttl_sum += db->avg_ttl;
+            ttl_dbs++;
+        }
+    }
+    *avg_ttl = ttl_dbs ? ttl_sum/ttl_dbs : 0;
+}
+
+/* The "Shards" section of INFO. */
+sds genShardsInfoString(sds info) {
+    int j, k;
+
+    info = sdscatprintf(info,"shard_threads:%d\r\n",server.shard_threads);
+    for (j = 0; j < server.shard_threads; j++) {
+        redisShard *s = shards+j;
+        long long keys = 0;
+        int first = -1, last = -1;
+
+        /* The slots are assigned as contiguous ranges. */
+        for (k = 0; k < CLUSTER_SLOTS; k++) {
+            if (slot_owner[k] != j) continue;
+            if (first == -1) first = k;
+            last = k;
+        }
+        for (k = 0; k < server.dbnum; k++) keys += dictSize(s->db[k].dict);
+        info = sdscatprintf(info,
+            "shard%d:slots=%d-%d,keys=%lld,commands=%lld,usec=%lld,"
+            "usec_per_call=%.2f,expired_keys=%lld\r\n",
+            j, first, last, keys, s->stat_commands, s->stat_usec,
+            s->stat_commands ?
+                (double)s->stat_usec/s->stat_commands : 0,
+            s->stat_expired);
+    }
+    return info;
+}
+
+/* Create the shards and their databases. Called by initServer(), before
+ * the data is loaded from disk, so that keys can be loaded directly into
+ * the shard owning them. */
+void shardsInit(void) {
+    int j, k;
+    char *incompatible = NULL;
+
+    if (server.sentinel_mode) {
+        server.shard_threads = 0;
+        return;
+    }
+    if (server.cluster_enabled) incompatible = "cluster-enabled";
+    else if (server.aof_state != AOF_OFF) incompatible = "appendonly";
+    else if (server.masterhost) incompatible = "slaveof";
+    else if (listLength(server.loadmodule_queue)) incompatible = "loadmodule";
+    else if (server.notify_keyspace_events)
+        incompatible = "notify-keyspace-events";
+    else if (server.maxmemory) incompatible = "maxmemory";
+    if (incompatible) {
+        serverLog(LL_WARNING,
+            "shard-threads can't be used together with %s. Exiting.",
+            incompatible);
+        exit(1);
+    }
+
+    pthread_key_create(&shard_key,NULL);
+    shards = zcalloc(sizeof(redisShard)*server.shard_threads);
+    for (k = 0; k < CLUSTER_SLOTS; k++)
+        slot_owner[k] = (long long)k*server.shard_threads/CLUSTER_SLOTS;
+
+    for (j = 0; j < server.shard_threads; j++) {
+        redisShard *s = shards+j;
+
+        s->id = j;
+        s->el = aeCreateEventLoop(server.maxclients+CONFIG_FDSET_INCR);
+        if (s->el == NULL ||
+            shardQueueInit(&s->in,server.maxclients+CONFIG_FDSET_INCR)
+                == C_ERR ||
+            shardQueueInit(&s->out,server.maxclients+CONFIG_FDSET_INCR)
+                == C_ERR)
+        {
+            serverLog(LL_WARNING,"Can't initialize shard %d: %s",
+                j, strerror(errno));
+            exit(1);
+        }
+        s->db = zmalloc(sizeof(redisDb)*server.dbnum);
+        for (k = 0; k < server.dbnum; k++) {
+            s->db[k].dict = dictCreate(&dbDictType,NULL);
+            s->db[k].expires = dictCreate(&keyptrDictType,NULL);
+            s->db[k].blocking_keys = dictCreate(&keylistDictType,NULL);
+            s->db[k].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
+            s->db[k].watched_keys = dictCreate(&keylistDictType,NULL);
+            s->db[k].locked_keys = NULL;
+            s->db[k].id = k;
+            s->db[k].avg_ttl = 0;
+        }
+    }
+}
+
+/* Start the shard threads. Called once the data is loaded. */
+void shardsStart(void) {
+    int j;
+
+    for (j = 0; j < server.shard_threads; j++) {
+        redisShard *s = shards+j;
+
+        if (aeCreateFileEvent(s->el,s->in.fds[0],AE_READABLE,
+                shardReadQueue,s) == AE_ERR ||
+            aeCreateFileEvent(server.el,s->out.fds[0],AE_READABLE,
+                shardReadDoneQueue,s) == AE_ERR ||
+            aeCreateTimeEvent(s->el,1,shardCron,s,NULL) == AE_ERR ||
+            pthread_create(&s->thread,NULL,shardThreadMain,s) != 0)
+        {
+            serverLog(LL_WARNING,"Can't start shard thread %d.",j);
+            exit(1);
+        }
+    }
+    shards_running = 1;
+    serverLog(LL_NOTICE,"Keyspace split among %d shard threads.",
+        server.shard_threads);
+}
@@ -0,0 +1,442 @@
+/* shmring.c -- Shared memory ring transport for local clients.
+ *
+ * Clients running on the same host as the server can switch their Unix
+ * socket connection to a pair of single producer / single consumer rings
+ * living in a shared memory area, exchanging the usual RESP protocol
+ * without a read(2) or write(2) for every request and reply.
+ *
+ * The server creates the area with memfd_create(), plus two eventfds, and
+ * passes the three file descriptors to the client over the Unix socket.
+ * The layout of the area is:
+ *
+ *   +--------------------+-----------------------+-----------------------+
+ *   | header (4096 bytes)| requests ring (size)  | replies ring (size)   |
+ *   +--------------------+-----------------------+-----------------------+
+ *
+ * Every ring has a head (advanced by the consumer) and a tail (advanced by
+ * the producer) that only grow, so the used space is always tail-head. A
+ * consumer that finds its ring empty sets the consumer_waiting flag and
+ * sleeps on its eventfd, so a producer signals the eventfd only when the
+ * consumer is sleeping. In the same way a producer that finds the ring full
+ * sets producer_waiting, and is signaled once the consumer freed half of
+ * the ring. The waiting flags are set before checking the ring state one
+ * last time, and checked after the ring state is updated, with full
+ * barriers in between, so a wakeup is never lost.
+ *
+ * The peer is not trusted: the server validates the positions it reads
+ * from the shared memory, and the area is sealed so that the client can't
+ * shrink it under our feet.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shmring.h"
+#include "zmalloc.h"
+
+#ifdef HAVE_SHMRING
+#include <sys/eventfd.h>
+#include <linux/memfd.h>
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+#endif
+
+#define SHMRING_MAGIC 0x314753524d485352ULL /* "RSHMRSG1" */
+
+/* Shared state of a ring. Head and tail are on different cache lines,
+ * since they are written by different processes. */
+typedef struct shmRingState {
+    uint64_t head;
+    char pad1[56];
+    uint64_t tail;
+    char pad2[56];
+    uint32_t consumer_waiting;
+    uint32_t producer_waiting;
+    char pad3[56];
+} shmRingState;
+
+typedef struct shmHeader {
+    uint64_t magic;
+    uint64_t size;              /* Size of every ring. */
+    char pad[48];
+    shmRingState ring[2];       /* Requests and replies rings. */
+} shmHeader;
+
+#ifdef HAVE_SHMRING
+
+static size_t shmRoundSize(size_t size) {
+    size_t s = SHMRING_MIN_SIZE;
+
+    while (s < size && s < SHMRING_MAX_SIZE) s <<= 1;
+    return s;
+}
+
+/* Setup the private view 'r' of the ring 'idx' of the mapping. */
+static void shmRingInit(shmConn *conn, shmRing *r, int idx, size_t size) {
+    shmHeader *hdr = conn->map;
+
+    r->state = &hdr->ring[idx];
+    r->data = (unsigned char*)conn->map+SHMRING_HEADER_SIZE+size*idx;
+    r->size = size;
+    r->pos = 0;
+}
+
+static shmConn *shmConnMap(int memfd, size_t size, int create) {
+    shmConn *conn;
+    size_t maplen = SHMRING_HEADER_SIZE+size*2;
+    void *map;
+
+    map = mmap(NULL,maplen,PROT_READ|PROT_WRITE,MAP_SHARED,memfd,0);
+    if (map == MAP_FAILED) return NULL;
+    conn = zmalloc(sizeof(*conn));
+    conn->map = map;
+    conn->maplen = maplen;
+    conn->wait_fd = conn->notify_fd = -1;
+    /* The requests ring is the first one: the server consumes it. */
+    shmRingInit(conn,&conn->in,create ? 0 : 1,size);
+    shmRingInit(conn,&conn->out,create ? 1 : 0,size);
+    return conn;
+}
+
+/* Create the shared memory area of a new connection with rings of 'size'
+ * bytes (rounded to the next power of two), and the two eventfds. On
+ * success the returned connection is the server side one, and the file
+ * descriptor of the area, to pass to the client and then close, is stored
+ * in '*memfd'. On error NULL is returned and errno is set. */
+shmConn *shmConnCreate(size_t size, int *memfd) {
+    shmConn *conn;
+    shmHeader *hdr;
+    int fd, efd1 = -1, efd2 = -1;
+
+    size = shmRoundSize(size);
+    fd = syscall(__NR_memfd_create,"redis-shmring",
+                 MFD_CLOEXEC|MFD_ALLOW_SEALING);
+    if (fd == -1) return NULL;
+    if (ftruncate(fd,SHMRING_HEADER_SIZE+size*2) == -1 ||
+        fcntl(fd,F_ADD_SEALS,F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) == -1 ||
+        (efd1 = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC)) == -1 ||
+        (efd2 = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC)) == -1 ||
+        (conn = shmConnMap(fd,size,1)) == NULL)
+    {
+        int saved_errno = errno;
+
+        if (efd1 != -1) close(efd1);
+        if (efd2 != -1) close(efd2);
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+    hdr = conn->map;
+    hdr->magic = SHMRING_MAGIC;
+    hdr->size = size;
+    /* The server starts waiting for requests. */
+    hdr->ring[0].consumer_waiting = 1;
+    conn->wait_fd = efd1;
+    conn->notify_fd = efd2;
+    *memfd = fd;
+    return conn;
+}
+
+/* Client side: map the area created by the server, waiting on 'wait_fd'
+ * and signaling the server with 'notify_fd'. The connection owns the two
+ * eventfds from now on, while 'memfd' can be closed by the caller. */
+shmConn *shmConnAttach(int memfd, int wait_fd, int notify_fd) {
+    shmConn *conn;
+    struct stat st;
+    shmHeader hdr;
+    size_t size;
+
+    if (fstat(memfd,&st) == -1 ||
+        pread(memfd,&hdr,sizeof(hdr),0) != (ssize_t)sizeof(hdr)) return NULL;
+    size = hdr.size;
+    if (hdr.magic != SHMRING_MAGIC || size < SHMRING_MIN_SIZE ||
+        size > SHMRING_MAX_SIZE || (size & (size-1)) ||
+        (size_t)st.st_size != SHMRING_HEADER_SIZE+size*2)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((conn = shmConnMap(memfd,size,0)) == NULL) return NULL;
+    conn->wait_fd = wait_fd;
+    conn->notify_fd = notify_fd;
+    return conn;
+}
+
+void shmConnFree(shmConn *conn) {
+    munmap(conn->map,conn->maplen);
+    if (conn->wait_fd != -1) close(conn->wait_fd);
+    if (conn->notify_fd != -1) close(conn->notify_fd);
+    zfree(conn);
+}
+
+static void shmSignal(int fd) {
+    uint64_t one = 1;
+
+    /* On EAGAIN the counter is already non zero: the peer will wake up. */
+    if (write(fd,&one,sizeof(one)) == -1) return;
+}
+
+/* Wake up the peer if it is sleeping on the flag 'waiting'. Called after
+ * the ring positions are published. */
+static void shmNotifyPeer(shmConn *conn, uint32_t *waiting) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting,__ATOMIC_RELAXED) &&
+        __atomic_exchange_n(waiting,0,__ATOMIC_SEQ_CST))
+    {
+        shmSignal(conn->notify_fd);
+    }
+}
+
+/* Write at most 'len' bytes of 'buf' in the ring we produce. Returns the
+ * number of bytes written, zero if the ring is full, or -1 with errno set
+ * to EPROTO if the peer corrupted the ring state. */
+ssize_t shmConnWrite(shmConn *conn, const void *buf, size_t len) {
+    shmRing *r = &conn->out;
+    uint64_t head = __atomic_load_n(&r->state->head,__ATOMIC_ACQUIRE);
+    size_t used = r->pos-head, off, first;
+
+    if (used > r->size) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (len > r->size-used) len = r->size-used;
+    if (len == 0) return 0;
+
+    off = r->pos & (r->size-1);
+    first = r->size-off;
+    if (first > len) first = len;
+    memcpy(r->data+off,buf,first);
+    memcpy(r->data,(const char*)buf+first,len-first);
+    r->pos += len;
+    __atomic_store_n(&r->state->tail,r->pos,__ATOMIC_RELEASE);
+    shmNotifyPeer(conn,&r->state->consumer_waiting);
+    return len;
+}
+
+/* Read at most 'len' bytes from the ring we consume into 'buf'. Returns the
+ * number of bytes read, zero if the ring is empty, or -1 with errno set to
+ * EPROTO if the peer corrupted the ring state. */
+ssize_t shmConnRead(shmConn *conn, void *buf, size_t len) {
+    shmRing *r = &conn->in;
+    uint64_t tail = __atomic_load_n(&r->state->tail,__ATOMIC_ACQUIRE);
+    size_t avail = tail-r->pos, off, first;
+
+    if (avail > r->size) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (len > avail) len = avail;
+    if (len == 0) return 0;
+
+    off = r->pos & (r->size-1);
+    first = r->size-off;
+    if (first > len) first = len;
+    memcpy(buf,r->data+off,first);
+    memcpy((char*)buf+first,r->data,len-first);
+    r->pos += len;
+    __atomic_store_n(&r->state->head,r->pos,__ATOMIC_RELEASE);
+    /* Wake up a producer waiting for room only once half of the ring is
+     * free, instead of for every chunk we read: the consumer always keeps
+     * reading until the ring is empty, so this can't stall it. */
+    if (tail-r->pos <= r->size/2)
+        shmNotifyPeer(conn,&r->state->producer_waiting);
+    return len;
+}
+
+/* Called when the ring we consume was found empty: ask the peer to signal
+ * our eventfd on new data. Returns 1 if data arrived in the meantime (the
+ * caller should read again instead of sleeping), otherwise 0. */
+int shmConnWaitReadable(shmConn *conn) {
+    shmRing *r = &conn->in;
+
+    __atomic_store_n(&r->state->consumer_waiting,1,__ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->state->tail,__ATOMIC_ACQUIRE) != r->pos) {
+        __atomic_store_n(&r->state->consumer_waiting,0,__ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+/* Called when the ring we produce was found full: ask the peer to signal
+ * our eventfd when it makes room. Returns 1 if there is room already (the
+ * caller should write again instead of sleeping), otherwise 0. */
+int shmConnWaitWritable(shmConn *conn) {
+    shmRing *r = &conn->out;
+
+    __atomic_store_n(&r->state->producer_waiting,1,__ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (r->pos-__atomic_load_n(&r->state->head,__ATOMIC_ACQUIRE) < r->size) {
+        __atomic_store_n(&r->state->producer_waiting,0,__ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+/* Reset our eventfd once woken up. */
+void shmConnClearEvent(shmConn *conn) {
+    uint64_t count;
+
+    if (read(conn->wait_fd,&count,sizeof(count)) == -1) return;
+}
+
+/* Signal our own eventfd, to be called again by the event loop. */
+void shmConnWakeup(shmConn *conn) {
+    shmSignal(conn->wait_fd);
+}
+
+#else /* !HAVE_SHMRING */
+
+shmConn *shmConnCreate(size_t size, int *memfd) {
+    (void)size; (void)memfd;
+    errno = ENOSYS;
+    return NULL;
+}
+
+shmConn *shmConnAttach(int memfd, int wait_fd, int notify_fd) {
+    (void)memfd; (void)wait_fd; (void)notify_fd;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void shmConnFree(shmConn *conn) { (void)conn; }
+
+ssize_t shmConnWrite(shmConn *conn, const void *buf, size_t len) {
+    (void)conn; (void)buf; (void)len;
+    errno = ENOSYS;
+    return -1;
+}
+
+ssize_t shmConnRead(shmConn *conn, void *buf, size_t len) {
+    (void)conn; (void)buf; (void)len;
+    errno = ENOSYS;
+    return -1;
+}
+
+int shmConnWaitReadable(shmConn *conn) { (void)conn; return 0; }
+int shmConnWaitWritable(shmConn *conn) { (void)conn; return 0; }
+void shmConnClearEvent(shmConn *conn) { (void)conn; }
+void shmConnWakeup(shmConn *conn) { (void)conn; }
+
+#endif /* HAVE_SHMRING */
+
+/* Size of the shared memory area of the connection. */
+size_t shmConnMemory(shmConn *conn) {
+    return conn->maplen;
+}
+
+/* Send 'len' bytes of 'buf' on the Unix socket 'sock' together with the
+ * 'numfds' file descriptors 'fds'. Returns 0 on success, -1 on error. */
+int shmSendFds(int sock, const void *buf, size_t len, int *fds, int numfds) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int)*SHMRING_NUM_FDS)];
+
+    if (numfds > SHMRING_NUM_FDS) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&msg,0,sizeof(msg));
+    memset(control,0,sizeof(control));
+    iov.iov_base = (void*)buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int)*numfds);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int)*numfds);
+    memcpy(CMSG_DATA(cmsg),fds,sizeof(int)*numfds);
+    if (sendmsg(sock,&msg,0) != (ssize_t)len) {
+        if (errno == 0) errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+/* Receive up to 'len' bytes in 'buf' from the Unix socket 'sock', and
+ * 'numfds' file descriptors in 'fds'. Returns the number of bytes received,
+ * or -1 on error. When the message carries no file descriptors (like an
+ * error reply) 'fds' is filled with -1. */
+ssize_t shmRecvFds(int sock, void *buf, size_t len, int *fds, int numfds) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int)*SHMRING_NUM_FDS)];
+    ssize_t nread;
+
+    if (numfds > SHMRING_NUM_FDS) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&msg,0,sizeof(msg));
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if ((nread = recvmsg(sock,&msg,0)) <= 0) return -1;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL) {
+        int j;
+
+        for (j = 0; j < numfds; j++) fds[j] = -1;
+        return nread;
+    }
+    if (cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(int)*numfds))
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(fds,CMSG_DATA(cmsg),sizeof(int)*numfds);
+    return nread;
+}
@@ -0,0 +1,87 @@
+/* shmring.c -- Shared memory ring transport for local clients.
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SHMRING_H
+#define __SHMRING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#if defined(__NR_memfd_create)
+#define HAVE_SHMRING 1
+#endif
+#endif
+
+#define SHMRING_HEADER_SIZE 4096
+#define SHMRING_MIN_SIZE (4*1024)
+#define SHMRING_MAX_SIZE (1024*1024*1024)
+
+/* Number of file descriptors passed to the client with the reply of
+ * CLIENT SHM: the shared memory, the eventfd the client waits on, and the
+ * eventfd the client uses to wake up the server. */
+#define SHMRING_NUM_FDS 3
+
+/* One direction of the connection, as seen by one of the two peers. The
+ * position of the local side is kept in private memory, so that a peer
+ * messing with the shared state can't make us access memory outside the
+ * ring. */
+typedef struct shmRing {
+    struct shmRingState *state; /* Shared head, tail and waiting flags. */
+    unsigned char *data;        /* Shared ring buffer. */
+    size_t size;                /* Ring size, a power of two. */
+    uint64_t pos;               /* Our position: tail if producer, head if
+                                   consumer. */
+} shmRing;
+
+typedef struct shmConn {
+    void *map;                  /* Shared memory mapping. */
+    size_t maplen;
+    shmRing in;                 /* Ring we consume. */
+    shmRing out;                /* Ring we produce. */
+    int wait_fd;                /* Eventfd signaled by the peer. */
+    int notify_fd;              /* Eventfd used to signal the peer. */
+} shmConn;
+
+shmConn *shmConnCreate(size_t size, int *memfd);
+shmConn *shmConnAttach(int memfd, int wait_fd, int notify_fd);
+void shmConnFree(shmConn *conn);
+ssize_t shmConnWrite(shmConn *conn, const void *buf, size_t len);
+ssize_t shmConnRead(shmConn *conn, void *buf, size_t len);
+int shmConnWaitReadable(shmConn *conn);
+int shmConnWaitWritable(shmConn *conn);
+void shmConnClearEvent(shmConn *conn);
+void shmConnWakeup(shmConn *conn);
+size_t shmConnMemory(shmConn *conn);
+int shmSendFds(int sock, const void *buf, size_t len, int *fds, int numfds);
+ssize_t shmRecvFds(int sock, void *buf, size_t len, int *fds, int numfds);
+
+#endif
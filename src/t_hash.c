@@ -386,6 +386,10 @@ unsigned long hashTypeLength(const robj *o) {
     } else if (o->encoding == OBJ_ENCODING_HT) {
         //获取hash表结构中元素的数量
         length = dictSize((const dict*)o->ptr);
+    } else if (o->encoding == OBJ_ENCODING_COMPRESSED) {
+        robj *d = compressionDecodeObject((robj*)o);
+        length = ziplistLen(d->ptr) / 2;
+        decrRefCount(d);
     } else {
         serverPanic("Unknown hash encoding");
     }
@@ -674,7 +678,7 @@ void hsetnxCommand(client *c) {
 		//发送触发对应命令的通知
         notifyKeyspaceEvent(NOTIFY_HASH,"hset",c->argv[1],c->db->id);
 		//增加脏计数值
-        server.dirty++;
+        incrDirty(1);
     }
 }
 
@@ -724,7 +728,7 @@ void hsetCommand(client *c) {
 	//发送执行对应命令通知
     notifyKeyspaceEvent(NOTIFY_HASH,"hset",c->argv[1],c->db->id);
 	//增加脏数据计数值
-    server.dirty++;
+    incrDirty(1);
 }
 
 /* 用于为哈希表中的字段值加上指定增量值
@@ -791,7 +795,7 @@ void hincrbyCommand(client *c) {
 	//发送执行命令通知
     notifyKeyspaceEvent(NOTIFY_HASH,"hincrby",c->argv[1],c->db->id);
 	//增加脏数据计数值
-    server.dirty++;
+    incrDirty(1);
 }
 
 /*
@@ -855,7 +859,7 @@ void hincrbyfloatCommand(client *c) {
 	//发送进行操作相关命令的通知
     notifyKeyspaceEvent(NOTIFY_HASH,"hincrbyfloat",c->argv[1],c->db->id);
 	//增加脏数据计数值
-    server.dirty++;
+    incrDirty(1);
 
     /* Always replicate HINCRBYFLOAT as an HSET command with the final value
      * in order to make sure that differences in float pricision or formatting
@@ -1013,7 +1017,7 @@ void hdelCommand(client *c) {
 			//发送删除对应键值对的通知
             notifyKeyspaceEvent(NOTIFY_GENERIC,"del",c->argv[1],c->db->id);
 		//增加脏数据计数值
-        server.dirty += deleted;
+        incrDirty(deleted);
     }
 	//向客户端返回删除对应字段的数量值
     addReplyLongLong(c,deleted);
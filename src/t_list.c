@@ -269,7 +269,7 @@ void pushGenericCommand(client *c, int where) {
         notifyKeyspaceEvent(NOTIFY_LIST,event,c->argv[1],c->db->id);
     }
 	//触发整体redis对应的脏数据计数
-    server.dirty += pushed;
+    incrDirty(pushed);
 }
 
 /*
@@ -323,7 +323,7 @@ void pushxGenericCommand(client *c, int where) {
         notifyKeyspaceEvent(NOTIFY_LIST,event,c->argv[1],c->db->id);
     }
 	//触发整体redis对应的脏数据计数
-    server.dirty += pushed;
+    incrDirty(pushed);
 }
 
 /*
@@ -401,7 +401,7 @@ void linsertCommand(client *c) {
         signalModifiedKey(c->db,c->argv[1]);
         notifyKeyspaceEvent(NOTIFY_LIST,"linsert",c->argv[1],c->db->id);
 	    //redis服务记录脏数据次数
-        server.dirty++;
+        incrDirty(1);
     } else {
         /* Notify client of a failed insert */
 	    //向客户端返回没有插入成功的响应处理
@@ -515,7 +515,7 @@ void lsetCommand(client *c) {
 			//发送执行操作命令的通知
             notifyKeyspaceEvent(NOTIFY_LIST,"lset",c->argv[1],c->db->id);
 			//增加脏数据计数
-            server.dirty++;
+            incrDirty(1);
         }
     } else {
         serverPanic("Unknown list encoding");
@@ -556,7 +556,7 @@ void popGenericCommand(client *c, int where) {
 		//通知键值对空间变化信号
         signalModifiedKey(c->db,c->argv[1]);
 		//改变脏数据计数
-        server.dirty++;
+        incrDirty(1);
     }
 }
 
@@ -729,7 +729,7 @@ void ltrimCommand(client *c) {
 	//发送键值对空间数据变化的通知
     signalModifiedKey(c->db,c->argv[1]);
 	//增加脏计数值
-    server.dirty++;
+    incrDirty(1);
 	//返回进行截取对应范围数据成功的响应
     addReply(c,shared.ok);
 }
@@ -778,7 +778,7 @@ void lremCommand(client *c) {
 			//在List列表中删除本元素
             listTypeDelete(li, &entry);
 			//增加脏计数值
-            server.dirty++;
+            incrDirty(1);
 		    //增加删除元素数量
             removed++;
 			//检测是否还需要继续进行删除操作处理
@@ -898,7 +898,7 @@ void rpoplpushCommand(client *c) {
 		//减少对应的引用计数
         decrRefCount(touchedkey);
 		//增加脏数据计数值
-        server.dirty++;
+        incrDirty(1);
     }
 }
 
@@ -1211,7 +1211,7 @@ void blockingPopGenericCommand(client *c, int where) {
                         notifyKeyspaceEvent(NOTIFY_GENERIC,"del", c->argv[j],c->db->id);
                     }
                     signalModifiedKey(c->db,c->argv[j]);
-                    server.dirty++;
+                    incrDirty(1);
 
                     /* Replicate it as an [LR]POP instead of B[LR]POP. */
                     rewriteClientCommandVector(c,2, (where == LIST_HEAD) ? shared.lpop : shared.rpop, c->argv[j]);
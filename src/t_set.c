@@ -364,7 +364,7 @@ void saddCommand(client *c) {
         notifyKeyspaceEvent(NOTIFY_SET,"sadd",c->argv[1],c->db->id);
     }
 	//增加脏计数值
-    server.dirty += added;
+    incrDirty(added);
 	//返回插入元素的数量值
     addReplyLongLong(c,added);
 }
@@ -414,7 +414,7 @@ void sremCommand(client *c) {
 			//发送操作对应命令通知
             notifyKeyspaceEvent(NOTIFY_GENERIC,"del",c->argv[1],c->db->id);
 		//进行脏数据计数增加
-        server.dirty += deleted;
+        incrDirty(deleted);
     }
 	//向客户端返回删除的元素个数
     addReplyLongLong(c,deleted);
@@ -488,13 +488,13 @@ void smoveCommand(client *c) {
     signalModifiedKey(c->db,c->argv[1]);
     signalModifiedKey(c->db,c->argv[2]);
 	//增加脏计数值
-    server.dirty++;
+    incrDirty(1);
 
     /* An extra key has changed when ele was successfully added to dstset */
 	//检测是否将元素插入到目的集合对象成功
     if (setTypeAdd(dstset,ele->ptr)) {
 		//增加脏计数值
-        server.dirty++;
+        incrDirty(1);
 		//发送对应的命令通知
         notifyKeyspaceEvent(NOTIFY_SET,"sadd",c->argv[2],c->db->id);
     }
@@ -589,7 +589,7 @@ void spopWithCountCommand(client *c) {
 	//发送触发对应命令的通知
     notifyKeyspaceEvent(NOTIFY_SET,"spop",c->argv[1],c->db->id);
 	//设置对应的脏计数值---------------->注意这个地方为什么是直接加的是count值的个数呢----->如果没有那么多元素呢
-    server.dirty += count;
+    incrDirty(count);
 
     /* 第一种处理情况,需要弹出的元素数量大于总的元素数量---->需要弹出整个集合,并删除对应的键值对
      * CASE 1:
@@ -611,7 +611,7 @@ void spopWithCountCommand(client *c) {
 		//发送键值对空间变化的信号
         signalModifiedKey(c->db,c->argv[1]);
 		//增加对应的脏计数值
-        server.dirty++;
+        incrDirty(1);
         return;
     }
 
@@ -742,7 +742,7 @@ void spopWithCountCommand(client *c) {
 	//发送键值对空间变化的信号
     signalModifiedKey(c->db,c->argv[1]);
 	//增加对应的脏计数值
-    server.dirty++;
+    incrDirty(1);
 }
 
 /*
@@ -819,7 +819,7 @@ void spopCommand(client *c) {
 	//发送键值对空间变化的信号
     signalModifiedKey(c->db,c->argv[1]);
 	//增加对应的脏计数值
-    server.dirty++;
+    incrDirty(1);
 }
 
 /* 
@@ -1088,7 +1088,7 @@ void sinterGenericCommand(client *c, robj **setkeys, unsigned long setnum, robj
                 if (dbDelete(c->db,dstkey)) {
 					//发送键值对空间变化的信号
                     signalModifiedKey(c->db,dstkey);
-                    server.dirty++;
+                    incrDirty(1);
                 }
 				//向客户端返回0响应
                 addReply(c,shared.czero);
@@ -1212,7 +1212,7 @@ void sinterGenericCommand(client *c, robj **setkeys, unsigned long setnum, robj
         }
 		//发送键值对空间变化的信号
         signalModifiedKey(c->db,dstkey);
-        server.dirty++;
+        incrDirty(1);
     } else {
 		//最后将对应的交集的元素个数响应给客户端
         setDeferredMultiBulkLength(c,replylen,cardinality);
@@ -1458,7 +1458,7 @@ void sunionDiffGenericCommand(client *c, robj **setkeys, int setnum, robj *dstke
         }
 		//发送键值对空间变化的信号
         signalModifiedKey(c->db,dstkey);
-        server.dirty++;
+        incrDirty(1);
     }
 	//释放对应的集合空间
     zfree(sets);
@@ -79,7 +79,7 @@ void setGenericCommand(client *c, int flags, robj *key, robj *val, robj *expire,
 	//此处是真正的核心,用于将对应的字符串数据设置到键值对对象上--------->核心操作
     setKey(c->db,key,val);
 	//增加脏数据计数值
-    server.dirty++;
+    incrDirty(1);
 	//检测是否设置了过期时间
     if (expire) 
 		//给对应的键值对设置过期时间值
@@ -202,7 +202,7 @@ int getGenericCommand(client *c) {
         return C_ERR;
     } else {
 		//向客户端返回对应的值对象的响应
-        addReplyBulk(c,o);
+        replyCacheAddReplyBulk(c,c->argv[1],o);
         return C_OK;
     }
 }
@@ -236,7 +236,7 @@ void getsetCommand(client *c) {
 	//发送触发相关命令的通知
     notifyKeyspaceEvent(NOTIFY_STRING,"set",c->argv[1],c->db->id);
 	//增加对应的脏数据计数
-    server.dirty++;
+    incrDirty(1);
 }
 
 /* 
@@ -320,7 +320,7 @@ void setrangeCommand(client *c) {
 		//发送触发对应命令的通知
         notifyKeyspaceEvent(NOTIFY_STRING,"setrange",c->argv[1],c->db->id);
 		//增加脏计数值
-        server.dirty++;
+        incrDirty(1);
     }
 	//向客户端返回操作之后字符串对象的长度值
     addReplyLongLong(c,sdslen(o->ptr));
@@ -419,7 +419,7 @@ void mgetCommand(client *c) {
                 addReply(c,shared.nullbulk);
             } else {
                 //设置对应的字符串对象
-                addReplyBulk(c,o);
+                replyCacheAddReplyBulk(c,c->argv[j],o);
             }
         }
     }
@@ -459,7 +459,7 @@ void msetGenericCommand(client *c, int nx) {
         notifyKeyspaceEvent(NOTIFY_STRING,"set",c->argv[j],c->db->id);
     }
 	//增加脏数据计数
-    server.dirty += (c->argc-1)/2;
+    incrDirty((c->argc-1)/2);
 	//向客户端发送对应的响应结果
     addReply(c, nx ? shared.cone : shared.ok);
 }
@@ -534,7 +534,7 @@ void incrDecrCommand(client *c, long long incr) {
 	//发送触发对应命令的通知
     notifyKeyspaceEvent(NOTIFY_STRING,"incrby",c->argv[1],c->db->id);
 	//脏数据计数增加
-    server.dirty++;
+    incrDirty(1);
 	//设置需要返回客户端的响应信息-------------->注意下面是分别配置传输的协议参数
     addReply(c,shared.colon);
     addReply(c,new);
@@ -647,7 +647,7 @@ void incrbyfloatCommand(client *c) {
 	//发送触发对应命令通知
     notifyKeyspaceEvent(NOTIFY_STRING,"incrbyfloat",c->argv[1],c->db->id);
 	//增加脏数据计数
-    server.dirty++;
+    incrDirty(1);
 	//向客户端返回增量后的新数据
     addReplyBulk(c,new);
 
@@ -713,7 +713,7 @@ void appendCommand(client *c) {
 	//发送触发对应命令的通知
     notifyKeyspaceEvent(NOTIFY_STRING,"append",c->argv[1],c->db->id);
 	//增加脏数据计数
-    server.dirty++;
+    incrDirty(1);
 	//向客户端返回对应的长度值
     addReplyLongLong(c,totlen);
 }
@@ -1563,7 +1563,7 @@ void zaddGenericCommand(client *c, int flags) {
 			processed++;
         score = newscore;
     }
-    server.dirty += (added+updated);
+    incrDirty((added+updated));
 
 reply_to_client:
     if (incr) { /* ZINCRBY or INCR option. */
@@ -1640,7 +1640,7 @@ void zremCommand(client *c) {
         if (keyremoved)
             notifyKeyspaceEvent(NOTIFY_GENERIC,"del",key,c->db->id);
         signalModifiedKey(c->db,key);
-        server.dirty += deleted;
+        incrDirty(deleted);
     }
     addReplyLongLong(c,deleted);
 }
@@ -1742,7 +1742,7 @@ void zremrangeGenericCommand(client *c, int rangetype) {
         if (keyremoved)
             notifyKeyspaceEvent(NOTIFY_GENERIC,"del",key,c->db->id);
     }
-    server.dirty += deleted;
+    incrDirty(deleted);
     addReplyLongLong(c,deleted);
 
 cleanup:
@@ -2365,14 +2365,14 @@ void zunionInterGenericCommand(client *c, robj *dstkey, int op) {
         notifyKeyspaceEvent(NOTIFY_ZSET,
             (op == SET_OP_UNION) ? "zunionstore" : "zinterstore",
             dstkey,c->db->id);
-        server.dirty++;
+        incrDirty(1);
     } else {
         decrRefCount(dstobj);
         addReply(c,shared.czero);
         if (touched) {
             signalModifiedKey(c->db,dstkey);
             notifyKeyspaceEvent(NOTIFY_GENERIC,"del",dstkey,c->db->id);
-            server.dirty++;
+            incrDirty(1);
         }
     }
     zfree(src);
@@ -0,0 +1,326 @@
+/* Sampled command tracing.
+ *
+ * When "trace-sample-rate" is greater than zero, one command every
+ * "trace-sample-rate" (on average) is traced: the time at which the command
+ * reaches the different steps of its execution (command lookup, eviction
+ * performed by freeMemoryIfNeeded(), execution, AOF / replication
+ * propagation, reply queued) is recorded into a ring buffer holding the
+ * latest "trace-max-len" traced commands.
+ *
+ * Only the commands executed by the main thread are sampled (the ones
+ * handed to a shard or offload thread are skipped), so the ring buffer does
+ * not need any locking. The TRACE command returns the entries, or dumps
+ * them as JSON lines or in the Chrome trace event format, so that they can
+ * be inspected with chrome://tracing or similar tools.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "trace.h"
+
+static traceEntry *ring = NULL;     /* Ring buffer of traced commands. */
+static unsigned long ring_size = 0; /* Number of slots in the ring. */
+static unsigned long ring_len = 0;  /* Number of used slots. */
+static unsigned long ring_idx = 0;  /* Slot of the next entry. */
+static long long trace_entry_id = 0;
+static long long trace_countdown = 0;
+
+static traceEntry current;          /* Command being traced. */
+static long long current_reply_bytes;
+static long long current_mark;      /* Start of the eviction / propagation. */
+
+/* Return the number of bytes accumulated in the client output buffers. */
+static long long traceClientReplyBytes(client *c) {
+    return c->bufpos + c->reply_bytes;
+}
+
+/* Called before processCommand() if "trace-sample-rate" is non zero. Starts
+ * tracing the command if it is sampled. The countdown is randomized in
+ * order to avoid aliasing with periodic patterns. */
+void traceCommandStart(client *c) {
+    if (--trace_countdown > 0) return;
+    trace_countdown = 1;
+    if (server.trace_sample_rate > 1)
+        trace_countdown += random() % (server.trace_sample_rate*2-1);
+
+    current.client_id = c->id;
+    current.dbid = c->db->id;
+    current.lookup = current.evict_start = current.exec_start =
+        current.prop_start = current.end = -1;
+    current.evict = current.exec = current.prop = 0;
+    current_reply_bytes = traceClientReplyBytes(c);
+    server.trace_active = 1;
+    current.start = ustime();
+}
+
+/* Record the time at which the traced command reached the specified point
+ * of its execution. Only called if server.trace_active is true. */
+void traceMark(int mark) {
+    long long now = ustime();
+    int elapsed = now - current.start;
+
+    switch(mark) {
+    case TRACE_MARK_LOOKUP: current.lookup = elapsed; break;
+    case TRACE_MARK_EXEC_START: current.exec_start = elapsed; break;
+    case TRACE_MARK_EXEC_END: current.exec = elapsed-current.exec_start; break;
+    case TRACE_MARK_EVICT_START:
+        if (current.evict_start == -1) current.evict_start = elapsed;
+        current_mark = now;
+        break;
+    case TRACE_MARK_EVICT_END: current.evict += now-current_mark; break;
+    case TRACE_MARK_PROP_START:
+        if (current.prop_start == -1) current.prop_start = elapsed;
+        current_mark = now;
+        break;
+    case TRACE_MARK_PROP_END: current.prop += now-current_mark; break;
+    }
+}
+
+/* Called after processCommand() returned: the reply of the command (if any)
+ * is now queued, so the entry is complete and is stored in the ring. 'c' is
+ * NULL if the client was freed while processing the command. */
+void traceCommandEnd(client *c) {
+    traceEntry *te;
+
+    if (!server.trace_active) return;
+    server.trace_active = 0;
+
+    /* Commands handed to a shard or offload thread are executed later,
+     * while other commands are traced: don't sample them, sample the next
+     * command instead. The read threads never run traced commands. */
+    if (c && c->flags & CLIENT_BLOCKED && c->btype == BLOCKED_THREAD) {
+        trace_countdown = 1;
+        return;
+    }
+    current.end = ustime()-current.start;
+    current.reply_bytes = c ? traceClientReplyBytes(c)-current_reply_bytes : 0;
+
+    /* Recreate the ring if "trace-max-len" changed in the meantime. */
+    if (ring_size != server.trace_max_len) {
+        traceReset();
+        ring_size = server.trace_max_len;
+        ring = ring_size ? zmalloc(sizeof(traceEntry)*ring_size) : NULL;
+    }
+    if (ring_size == 0) return;
+
+    te = ring+ring_idx;
+    if (ring_len == ring_size) sdsfree(te->cmd);
+    else ring_len++;
+    *te = current;
+    te->id = trace_entry_id++;
+    if (c == NULL)
+        te->cmd = sdsnew("unknown");
+    else if (c->cmd)
+        te->cmd = sdsnew(c->cmd->name);
+    else
+        te->cmd = sdsnewlen(c->argv[0]->ptr,sdslen(c->argv[0]->ptr));
+    ring_idx = (ring_idx+1) % ring_size;
+}
+
+/* Remove all the entries from the ring. */
+void traceReset(void) {
+    unsigned long j;
+
+    for (j = 0; j < ring_len; j++) sdsfree(ring[j].cmd);
+    zfree(ring);
+    ring = NULL;
+    ring_size = ring_len = ring_idx = 0;
+}
+
+/* Return the entry 'j', where 0 is the most recent entry. */
+static traceEntry *traceGetEntry(unsigned long j) {
+    return ring + (ring_idx+ring_size-1-j) % ring_size;
+}
+
+/* --------------------------------- Export -------------------------------- */
+
+/* Append 'p' as a JSON string, with quotes. */
+static sds traceCatJsonString(sds s, const char *p, size_t len) {
+    s = sdscatlen(s,"\"",1);
+    while(len--) {
+        unsigned char ch = *p++;
+        if (ch == '"' || ch == '\\') {
+            s = sdscatprintf(s,"\\%c",ch);
+        } else if (ch < 0x20 || ch >= 0x7f) {
+            s = sdscatprintf(s,"\\u%04x",ch);
+        } else {
+            s = sdscatlen(s,(char*)&ch,1);
+        }
+    }
+    return sdscatlen(s,"\"",1);
+}
+
+/* One JSON object per line, with the duration of every phase. */
+static sds traceCatJsonLine(sds s, traceEntry *te) {
+    s = sdscatprintf(s,"{\"id\":%lld,\"ts\":%lld,\"client\":%llu,"
+                       "\"db\":%d,\"cmd\":",
+        te->id, te->start, (unsigned long long)te->client_id, te->dbid);
+    s = traceCatJsonString(s,te->cmd,sdslen(te->cmd));
+    if (te->lookup != -1) s = sdscatprintf(s,",\"lookup_us\":%d",te->lookup);
+    if (te->evict_start != -1) s = sdscatprintf(s,",\"evict_us\":%d",te->evict);
+    if (te->exec_start != -1) s = sdscatprintf(s,",\"exec_us\":%d",te->exec);
+    if (te->prop_start != -1) s = sdscatprintf(s,",\"propagate_us\":%d",te->prop);
+    s = sdscatprintf(s,",\"total_us\":%d,\"reply_bytes\":%lld}\n",
+        te->end, te->reply_bytes);
+    return s;
+}
+
+/* A "complete" event of the Chrome trace event format. Every client is
+ * shown as a different thread. */
+static sds traceCatChromeEvent(sds s, traceEntry *te, const char *name,
+                               size_t namelen, int start, int dur, int toplevel)
+{
+    if (sdslen(s) > 1) s = sdscatlen(s,",\n",2);
+    s = sdscatlen(s,"{\"name\":",8);
+    s = traceCatJsonString(s,name,namelen);
+    s = sdscatprintf(s,",\"ph\":\"X\",\"ts\":%lld,\"dur\":%d,"
+                       "\"pid\":%ld,\"tid\":%llu",
+        te->start+start, dur, (long)server.pid,
+        (unsigned long long)te->client_id);
+    if (toplevel) {
+        s = sdscatprintf(s,",\"args\":{\"id\":%lld,\"db\":%d,"
+                           "\"reply_bytes\":%lld}",
+            te->id, te->dbid, te->reply_bytes);
+    }
+    return sdscatlen(s,"}",1);
+}
+
+static sds traceCatChromeEvents(sds s, traceEntry *te) {
+    s = traceCatChromeEvent(s,te,te->cmd,sdslen(te->cmd),0,te->end,1);
+    if (te->lookup != -1)
+        s = traceCatChromeEvent(s,te,"lookup",6,0,te->lookup,0);
+    if (te->evict_start != -1)
+        s = traceCatChromeEvent(s,te,"evict",5,te->evict_start,te->evict,0);
+    if (te->exec_start != -1)
+        s = traceCatChromeEvent(s,te,"exec",4,te->exec_start,te->exec,0);
+    if (te->prop_start != -1)
+        s = traceCatChromeEvent(s,te,"propagate",9,te->prop_start,te->prop,0);
+    return s;
+}
+
+/* ----------------------------- TRACE command ----------------------------- */
+
+/* TRACE GET [<count>]
+ * TRACE DUMP [JSON|CHROME] [<count>]
+ * TRACE LEN
+ * TRACE RESET
+ * TRACE HELP */
+void traceCommand(client *c) {
+    if (!strcasecmp(c->argv[1]->ptr,"get") && c->argc <= 3) {
+        long count = 10;
+        unsigned long j;
+
+        if (c->argc == 3 &&
+            getLongFromObjectOrReply(c,c->argv[2],&count,NULL) != C_OK)
+            return;
+        if (count < 0 || (unsigned long)count > ring_len) count = ring_len;
+        addReplyMultiBulkLen(c,count);
+        for (j = 0; j < (unsigned long)count; j++) {
+            traceEntry *te = traceGetEntry(j);
+            int phases = (te->lookup != -1) + (te->evict_start != -1) +
+                         (te->exec_start != -1) + (te->prop_start != -1);
+
+            addReplyMultiBulkLen(c,8);
+            addReplyLongLong(c,te->id);
+            addReplyLongLong(c,te->start);
+            addReplyLongLong(c,te->client_id);
+            addReplyLongLong(c,te->dbid);
+            addReplyBulkCBuffer(c,te->cmd,sdslen(te->cmd));
+            addReplyLongLong(c,te->end);
+            addReplyLongLong(c,te->reply_bytes);
+            addReplyMultiBulkLen(c,phases*2);
+            if (te->lookup != -1) {
+                addReplyBulkCString(c,"lookup");
+                addReplyLongLong(c,te->lookup);
+            }
+            if (te->evict_start != -1) {
+                addReplyBulkCString(c,"evict");
+                addReplyLongLong(c,te->evict);
+            }
+            if (te->exec_start != -1) {
+                addReplyBulkCString(c,"exec");
+                addReplyLongLong(c,te->exec);
+            }
+            if (te->prop_start != -1) {
+                addReplyBulkCString(c,"propagate");
+                addReplyLongLong(c,te->prop);
+            }
+        }
+    } else if (!strcasecmp(c->argv[1]->ptr,"dump") && c->argc <= 4) {
+        int chrome = 0, j = 2;
+        long count = -1;
+        long i;
+        sds s;
+
+        if (j < c->argc && !strcasecmp(c->argv[j]->ptr,"chrome")) {
+            chrome = 1;
+            j++;
+        } else if (j < c->argc && !strcasecmp(c->argv[j]->ptr,"json")) {
+            j++;
+        }
+        if (j < c->argc &&
+            getLongFromObjectOrReply(c,c->argv[j++],&count,NULL) != C_OK)
+            return;
+        if (j != c->argc) {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        if (count < 0 || (unsigned long)count > ring_len) count = ring_len;
+
+        /* Oldest entries first, as expected by trace viewers. */
+        s = sdsnew(chrome ? "[" : "");
+        for (i = count-1; i >= 0; i--) {
+            traceEntry *te = traceGetEntry(i);
+            s = chrome ? traceCatChromeEvents(s,te) : traceCatJsonLine(s,te);
+        }
+        if (chrome) s = sdscat(s,"]\n");
+        addReplyBulkSds(c,s);
+    } else if (!strcasecmp(c->argv[1]->ptr,"len") && c->argc == 2) {
+        addReplyLongLong(c,ring_len);
+    } else if (!strcasecmp(c->argv[1]->ptr,"reset") && c->argc == 2) {
+        traceReset();
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"help") && c->argc == 2) {
+        addReplyMultiBulkLen(c,5);
+        addReplyBulkCString(c,
+"TRACE GET [<count>]                    - Show the latest traced commands");
+        addReplyBulkCString(c,
+"TRACE DUMP [JSON|CHROME] [<count>]     - Export as JSON lines or Chrome trace");
+        addReplyBulkCString(c,
+"TRACE LEN                              - Number of traced commands");
+        addReplyBulkCString(c,
+"TRACE RESET                            - Remove all the traced commands");
+        addReplyBulkCString(c,
+"TRACE HELP                             - Show this help");
+    } else {
+        addReplyError(c,"Syntax error. Try TRACE HELP");
+    }
+}
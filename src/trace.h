@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+/* Points of the command timeline recorded by traceMark(). */
+#define TRACE_MARK_LOOKUP 0         /* Command table lookup done. */
+#define TRACE_MARK_EVICT_START 1    /* freeMemoryIfNeeded() called. */
+#define TRACE_MARK_EVICT_END 2      /* freeMemoryIfNeeded() returned. */
+#define TRACE_MARK_EXEC_START 3     /* Command implementation called. */
+#define TRACE_MARK_EXEC_END 4       /* Command implementation returned. */
+#define TRACE_MARK_PROP_START 5     /* propagate() called. */
+#define TRACE_MARK_PROP_END 6       /* propagate() returned. */
+
+/* A traced command. Times are in microseconds, relative to 'start', or -1
+ * if the command never reached that point (for instance because it was
+ * rejected, or queued inside MULTI). Eviction and propagation may happen
+ * multiple times per command: their durations are summed. */
+typedef struct traceEntry {
+    long long id;           /* Unique entry identifier. */
+    long long start;        /* Unix time in microseconds of processCommand(). */
+    uint64_t client_id;
+    int dbid;
+    sds cmd;                /* Command name, or argv[0] if unknown. */
+    int lookup;             /* Command lookup done. */
+    int evict_start, evict; /* Eviction start and total time. */
+    int exec_start, exec;   /* Execution start and time. */
+    int prop_start, prop;   /* Propagation start and total time. */
+    int end;                /* processCommand() returned: reply queued. */
+    long long reply_bytes;  /* Bytes added to the client output buffers. */
+} traceEntry;
+
+/* Exported API */
+void traceCommandStart(client *c);
+void traceCommandEnd(client *c);
+void traceMark(int mark);
+void traceReset(void);
+
+/* Exported commands */
+void traceCommand(client *c);
+
+#endif /* __TRACE_H */
@@ -0,0 +1,365 @@
+/* Server assisted client side caching.
+ *
+ * A client enabling CLIENT TRACKING can cache locally the values it reads:
+ * the server remembers the keys read by the client and sends it an
+ * invalidation message when any of them is modified, expired or evicted,
+ * so that the client drops them from its local cache.
+ *
+ * The keys read by the tracking clients are remembered in the tracking
+ * table, a radix tree mapping every key to the radix tree of the IDs of the
+ * clients that read it (the clients may be gone meanwhile, the IDs are
+ * resolved only when sending the messages). When the key is modified the
+ * messages are sent and the key is removed from the table: the clients are
+ * tracked again for the key only when they read it again. The number of
+ * keys in the table is bounded by "tracking-table-max-keys": when exceeded,
+ * random keys are invalidated as if they were modified.
+ *
+ * In broadcasting mode (BCAST) the keys read are not remembered at all:
+ * the client subscribes to one or more key prefixes, and receives the
+ * invalidation messages of all the modified keys matching them. The
+ * modified keys are accumulated per prefix and sent once per event loop
+ * iteration, in beforeSleep().
+ *
+ * Tracking is not aware of the DB: the keys are tracked by name only.
+ *
+ * The RESP2 protocol has no out of band messages, so the invalidation
+ * messages are sent as Pub/Sub messages of the __redis__:invalidate channel,
+ * whose payload is the array of the invalidated keys, or a null array when
+ * all the keys are invalidated by FLUSHDB/FLUSHALL. The messages are sent to
+ * the client itself if it is in Pub/Sub mode, otherwise to the client
+ * specified with REDIRECT, which usually is a connection of the same
+ * application subscribed to the channel.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+
+#define TRACKING_CHANNEL "__redis__:invalidate"
+
+/* Max number of keys invalidated by trackingLimitUsedKeys() per call. */
+#define TRACKING_EVICTION_EFFORT 1000
+
+/* State of a prefix of the broadcasting mode. */
+typedef struct bcastState {
+    rax *keys;          /* Keys modified in the current event loop cycle. */
+    rax *clients;       /* Clients subscribed to the prefix: ID -> client. */
+} bcastState;
+
+static rax *TrackingTable = NULL;   /* Key -> rax of client IDs. */
+static rax *PrefixTable = NULL;     /* Prefix -> bcastState. */
+static robj *TrackingChannel = NULL;
+
+/* -----------------------------------------------------------------------------
+ * Enabling and disabling tracking
+ * -------------------------------------------------------------------------- */
+
+static void trackingInit(void) {
+    if (TrackingTable) return;
+    TrackingTable = raxNew();
+    PrefixTable = raxNew();
+    TrackingChannel = createStringObject(TRACKING_CHANNEL,
+                                         strlen(TRACKING_CHANNEL));
+}
+
+/* Subscribe the client to the prefix in broadcasting mode. */
+static void trackingAddPrefix(client *c, unsigned char *prefix, size_t len) {
+    bcastState *bs = raxFind(PrefixTable,prefix,len);
+
+    if (bs == raxNotFound) {
+        bs = zmalloc(sizeof(*bs));
+        bs->keys = raxNew();
+        bs->clients = raxNew();
+        raxInsert(PrefixTable,prefix,len,bs,NULL);
+    }
+    if (raxInsert(bs->clients,(unsigned char*)&c->id,sizeof(c->id),c,NULL))
+        raxInsert(c->tracking_prefixes,prefix,len,NULL,NULL);
+}
+
+/* Disable tracking for the client. The client IDs in the tracking table
+ * are not removed: they are skipped when sending the messages. */
+void disableTracking(client *c) {
+    if (!(c->flags & CLIENT_TRACKING)) return;
+
+    if (c->flags & CLIENT_TRACKING_BCAST) {
+        raxIterator ri;
+
+        raxStart(&ri,c->tracking_prefixes);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri)) {
+            bcastState *bs = raxFind(PrefixTable,ri.key,ri.key_len);
+
+            raxRemove(bs->clients,(unsigned char*)&c->id,sizeof(c->id),NULL);
+            if (raxSize(bs->clients) == 0) {
+                raxFree(bs->clients);
+                raxFree(bs->keys);
+                zfree(bs);
+                raxRemove(PrefixTable,ri.key,ri.key_len,NULL);
+            }
+        }
+        raxStop(&ri);
+        raxFree(c->tracking_prefixes);
+        c->tracking_prefixes = NULL;
+    }
+    c->flags &= ~(CLIENT_TRACKING|CLIENT_TRACKING_BCAST);
+    c->tracking_redirection = 0;
+    server.tracking_clients--;
+}
+
+/* Enable tracking for the client, sending the messages to the client with
+ * ID 'redirect_to' if not zero. In broadcasting mode the client subscribes
+ * to the 'prefixes', or to all the keys if there are none. */
+void enableTracking(client *c, uint64_t redirect_to, int bcast,
+                    robj **prefixes, size_t numprefixes)
+{
+    size_t j;
+
+    trackingInit();
+    disableTracking(c);
+    c->flags |= CLIENT_TRACKING;
+    c->tracking_redirection = redirect_to;
+    server.tracking_clients++;
+    if (bcast) {
+        c->flags |= CLIENT_TRACKING_BCAST;
+        c->tracking_prefixes = raxNew();
+        if (numprefixes == 0) trackingAddPrefix(c,NULL,0);
+        for (j = 0; j < numprefixes; j++)
+            trackingAddPrefix(c,prefixes[j]->ptr,sdslen(prefixes[j]->ptr));
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Invalidation messages
+ * -------------------------------------------------------------------------- */
+
+/* Return the client the messages of 'c' are sent to, NULL if they can't
+ * be delivered. */
+static client *trackingGetTarget(client *c) {
+    client *target = c;
+
+    if (c->tracking_redirection) {
+        target = lookupClientByID(c->tracking_redirection);
+        if (target == NULL) return NULL;
+    }
+    return (target->flags & CLIENT_PUBSUB) ? target : NULL;
+}
+
+/* Send the invalidation message of the 'numkeys' keys. A NULL 'keys'
+ * means that all the keys are invalidated. */
+static void trackingSendMessage(client *c, unsigned char **keys,
+                                size_t *lens, size_t numkeys)
+{
+    client *target = trackingGetTarget(c);
+    size_t j;
+
+    if (target == NULL) return;
+    addReply(target,shared.mbulkhdr[3]);
+    addReply(target,shared.messagebulk);
+    addReplyBulk(target,TrackingChannel);
+    if (keys == NULL) {
+        addReply(target,shared.nullmultibulk);
+        return;
+    }
+    addReplyMultiBulkLen(target,numkeys);
+    for (j = 0; j < numkeys; j++)
+        addReplyBulkCBuffer(target,keys[j],lens[j]);
+}
+
+/* Remember the keys of the read only command just executed on behalf of
+ * the client, in order to invalidate them later. */
+void trackingRememberKeys(client *c) {
+    int *keys, numkeys, j;
+
+    keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys; j++) {
+        sds key = c->argv[keys[j]]->ptr;
+        rax *ids = raxFind(TrackingTable,(unsigned char*)key,sdslen(key));
+
+        if (ids == raxNotFound) {
+            ids = raxNew();
+            raxInsert(TrackingTable,(unsigned char*)key,sdslen(key),ids,NULL);
+        }
+        raxInsert(ids,(unsigned char*)&c->id,sizeof(c->id),NULL,NULL);
+    }
+    getKeysFreeResult(keys);
+}
+
+/* Send the messages of the key to the clients tracking it and remove it
+ * from the tracking table. */
+static void trackingInvalidateKeyRaw(unsigned char *key, size_t len) {
+    rax *ids = raxFind(TrackingTable,key,len);
+    raxIterator ri;
+
+    if (ids == raxNotFound) return;
+    raxStart(&ri,ids);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        uint64_t id;
+        client *c;
+
+        memcpy(&id,ri.key,sizeof(id));
+        c = lookupClientByID(id);
+        if (c == NULL || !(c->flags & CLIENT_TRACKING) ||
+            c->flags & CLIENT_TRACKING_BCAST) continue;
+        trackingSendMessage(c,&key,&len,1);
+    }
+    raxStop(&ri);
+    raxFree(ids);
+    raxRemove(TrackingTable,key,len,NULL);
+}
+
+/* Called when a key is modified, expired or evicted. */
+void trackingInvalidateKey(robj *keyobj) {
+    sds key;
+    size_t len;
+
+    if (TrackingTable == NULL || inCommandThread()) return;
+    keyobj = getDecodedObject(keyobj);
+    key = keyobj->ptr;
+    len = sdslen(key);
+
+    /* Accumulate the key for the broadcasting clients of the matching
+     * prefixes, see trackingBroadcastInvalidationMessages(). */
+    if (raxSize(PrefixTable)) {
+        raxIterator ri;
+
+        raxStart(&ri,PrefixTable);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri)) {
+            if (ri.key_len > len || memcmp(ri.key,key,ri.key_len) != 0)
+                continue;
+            raxInsert(((bcastState*)ri.data)->keys,
+                         (unsigned char*)key,len,NULL,NULL);
+        }
+        raxStop(&ri);
+    }
+    if (raxSize(TrackingTable))
+        trackingInvalidateKeyRaw((unsigned char*)key,len);
+    decrRefCount(keyobj);
+}
+
+/* Called by FLUSHDB/FLUSHALL: all the tracking clients drop all their
+ * keys, whatever the DB flushed, since tracking is not aware of the DB. */
+void trackingInvalidateKeysOnFlush(int dbid) {
+    listNode *ln;
+    listIter li;
+
+    if (TrackingTable == NULL) return;
+    if (server.tracking_clients) {
+        listRewind(server.clients,&li);
+        while ((ln = listNext(&li)) != NULL) {
+            client *c = listNodeValue(ln);
+
+            if (c->flags & CLIENT_TRACKING)
+                trackingSendMessage(c,NULL,NULL,0);
+        }
+    }
+
+    /* After FLUSHALL nothing is left to track. */
+    if (dbid == -1) {
+        raxIterator ri;
+
+        raxStart(&ri,TrackingTable);
+        raxSeek(&ri,"^",NULL,0);
+        while(raxNext(&ri)) raxFree(ri.data);
+        raxStop(&ri);
+        raxFree(TrackingTable);
+        TrackingTable = raxNew();
+    }
+}
+
+/* Called by beforeSleep(): send to the broadcasting clients the keys of
+ * their prefixes modified in this event loop cycle. */
+void trackingBroadcastInvalidationMessages(void) {
+    raxIterator ri, ri2;
+
+    if (PrefixTable == NULL || raxSize(PrefixTable) == 0) return;
+    raxStart(&ri,PrefixTable);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        bcastState *bs = ri.data;
+        unsigned char **keys;
+        size_t *lens, numkeys = raxSize(bs->keys), j = 0;
+
+        if (numkeys == 0) continue;
+        keys = zmalloc(sizeof(unsigned char*)*numkeys);
+        lens = zmalloc(sizeof(size_t)*numkeys);
+        raxStart(&ri2,bs->keys);
+        raxSeek(&ri2,"^",NULL,0);
+        while(raxNext(&ri2)) {
+            keys[j] = zmalloc(ri2.key_len);
+            memcpy(keys[j],ri2.key,ri2.key_len);
+            lens[j++] = ri2.key_len;
+        }
+        raxStop(&ri2);
+
+        raxStart(&ri2,bs->clients);
+        raxSeek(&ri2,"^",NULL,0);
+        while(raxNext(&ri2))
+            trackingSendMessage(ri2.data,keys,lens,numkeys);
+        raxStop(&ri2);
+
+        for (j = 0; j < numkeys; j++) zfree(keys[j]);
+        zfree(keys);
+        zfree(lens);
+        raxFree(bs->keys);
+        bs->keys = raxNew();
+    }
+    raxStop(&ri);
+}
+
+/* Called by serverCron(): invalidate random keys while the tracking table
+ * holds more than "tracking-table-max-keys" keys. */
+void trackingLimitUsedKeys(void) {
+    raxIterator ri;
+    int effort = TRACKING_EVICTION_EFFORT;
+
+    if (TrackingTable == NULL ||
+        raxSize(TrackingTable) <= (uint64_t)server.tracking_table_max_keys)
+        return;
+    raxStart(&ri,TrackingTable);
+    while (effort-- && raxSize(TrackingTable) >
+                       (uint64_t)server.tracking_table_max_keys)
+    {
+        raxSeek(&ri,"^",NULL,0);
+        raxRandomWalk(&ri,0);
+        if (raxEOF(&ri)) break;
+        trackingInvalidateKeyRaw(ri.key,ri.key_len);
+    }
+    raxStop(&ri);
+}
+
+uint64_t trackingGetTotalKeys(void) {
+    return TrackingTable ? raxSize(TrackingTable) : 0;
+}
+
+uint64_t trackingGetTotalPrefixes(void) {
+    return PrefixTable ? raxSize(PrefixTable) : 0;
+}
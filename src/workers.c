@@ -0,0 +1,194 @@
+/* Worker thread pools.
+ *
+ * The read threads and the offload threads execute commands on behalf of
+ * the main thread in the same way: the main thread queues a job, one of
+ * the workers executes it, and the main thread is woken up through a pipe
+ * registered in its event loop to hand the job back, as the client can
+ * only be replied to and released by the main thread.
+ *
+ * ----------------------------------------------------------------------------
+ *
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "server.h"
+#include "bio.h"
+#include "workers.h"
+#include <signal.h>
+
+/* The pool of the calling thread, NULL in the main thread. */
+static __thread workerPool *current_pool = NULL;
+
+static void *workerMain(void *arg) {
+    workerPool *wp = arg;
+    sigset_t sigset;
+
+    /* Only the main thread should receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset,SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK,&sigset,NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in %s thread: %s",
+            wp->name, strerror(errno));
+    current_pool = wp;
+
+    pthread_mutex_lock(&wp->mutex);
+    while(1) {
+        listNode *ln;
+        void *job;
+
+        if (listLength(wp->jobs) == 0) {
+            pthread_cond_wait(&wp->jobs_cond,&wp->mutex);
+            continue;
+        }
+        ln = listFirst(wp->jobs);
+        job = ln->value;
+        listDelNode(wp->jobs,ln);
+        pthread_mutex_unlock(&wp->mutex);
+
+        wp->execute(job);
+
+        pthread_mutex_lock(&wp->mutex);
+        listAddNodeTail(wp->jobs_done,job);
+        if (--wp->inflight == 0) pthread_cond_broadcast(&wp->idle_cond);
+        if (!wp->done_notified) {
+            wp->done_notified = 1;
+            if (write(wp->done_pipe[1],"x",1) == -1) {
+                /* Nothing to do: the pipe can't be full, a single byte
+                 * is pending at most. */
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Readable handler of the pipe, main thread side: hand the executed jobs
+ * back. */
+static void workerPoolDone(aeEventLoop *el, int fd, void *privdata, int mask) {
+    workerPool *wp = privdata;
+    char buf[64];
+    list *done;
+    listNode *ln;
+    UNUSED(el);
+    UNUSED(mask);
+
+    while (read(fd,buf,sizeof(buf)) > 0);
+    pthread_mutex_lock(&wp->mutex);
+    done = wp->jobs_done;
+    wp->jobs_done = listCreate();
+    wp->done_notified = 0;
+    pthread_mutex_unlock(&wp->mutex);
+
+    while ((ln = listFirst(done)) != NULL) {
+        void *job = ln->value;
+
+        listDelNode(done,ln);
+        wp->done(job);
+    }
+    listRelease(done);
+    if (wp->drained) wp->drained();
+}
+
+/* Create a pool of 'numthreads' workers calling 'execute' for every job
+ * queued with workerPoolSubmit(). The main thread calls 'done' for every
+ * executed job, then 'drained' if not NULL. Exits on error, since it is
+ * only called at startup. */
+workerPool *workerPoolCreate(char *name, int numthreads,
+                             void (*execute)(void *job),
+                             void (*done)(void *job), void (*drained)(void))
+{
+    workerPool *wp = zcalloc(sizeof(*wp));
+    pthread_attr_t attr;
+    size_t stacksize;
+    int j;
+
+    wp->name = name;
+    wp->numthreads = numthreads;
+    wp->execute = execute;
+    wp->done = done;
+    wp->drained = drained;
+    pthread_mutex_init(&wp->mutex,NULL);
+    pthread_cond_init(&wp->jobs_cond,NULL);
+    pthread_cond_init(&wp->idle_cond,NULL);
+    wp->jobs = listCreate();
+    wp->jobs_done = listCreate();
+    if (pipe(wp->done_pipe) == -1 ||
+        anetNonBlock(NULL,wp->done_pipe[0]) == ANET_ERR ||
+        anetNonBlock(NULL,wp->done_pipe[1]) == ANET_ERR ||
+        aeCreateFileEvent(server.el,wp->done_pipe[0],AE_READABLE,
+            workerPoolDone,wp) == AE_ERR)
+    {
+        serverLog(LL_WARNING,"Can't initialize the %s threads: %s",
+            name, strerror(errno));
+        exit(1);
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_getstacksize(&attr,&stacksize);
+    if (!stacksize) stacksize = 1;
+    while (stacksize < REDIS_THREAD_STACK_SIZE) stacksize *= 2;
+    pthread_attr_setstacksize(&attr,stacksize);
+
+    wp->threads = zmalloc(sizeof(pthread_t)*numthreads);
+    for (j = 0; j < numthreads; j++) {
+        if (pthread_create(wp->threads+j,&attr,workerMain,wp) != 0) {
+            serverLog(LL_WARNING,"Can't create %s thread %d.",name,j);
+            exit(1);
+        }
+    }
+    return wp;
+}
+
+/* Queue a job for execution by a worker. Main thread only. */
+void workerPoolSubmit(workerPool *wp, void *job) {
+    pthread_mutex_lock(&wp->mutex);
+    listAddNodeTail(wp->jobs,job);
+    wp->inflight++;
+    pthread_cond_signal(&wp->jobs_cond);
+    pthread_mutex_unlock(&wp->mutex);
+}
+
+/* Wait for the workers to execute all the queued jobs. The executed jobs
+ * are handed back later, from the event loop. Returns 1 if there was some
+ * job in flight, 0 otherwise. */
+int workerPoolWaitIdle(workerPool *wp) {
+    int waited = 0;
+
+    pthread_mutex_lock(&wp->mutex);
+    while (wp->inflight) {
+        waited = 1;
+        pthread_cond_wait(&wp->idle_cond,&wp->mutex);
+    }
+    pthread_mutex_unlock(&wp->mutex);
+    return waited;
+}
+
+/* Return true if the caller is a worker of the pool. */
+int workerPoolIsWorker(workerPool *wp) {
+    return wp && current_pool == wp;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __WORKERS_H
+#define __WORKERS_H
+
+#include <pthread.h>
+#include "adlist.h"
+
+/* A pool of threads executing the jobs queued by the main thread, that are
+ * handed back to the main thread once executed. Used by the read threads
+ * and the offload threads. */
+typedef struct workerPool {
+    char *name;                 /* "read", "offload", ... for the logs. */
+    pthread_t *threads;
+    int numthreads;
+    void (*execute)(void *job); /* Called by the workers. */
+    void (*done)(void *job);    /* Called by the main thread, afterwards. */
+    void (*drained)(void);      /* Called by the main thread after handing
+                                   back a batch of jobs, or NULL. */
+
+    /* The jobs to execute and the executed ones are protected by 'mutex'
+     * together with the number of jobs in flight. A byte is written into
+     * the pipe to wake up the main thread only if one is not already
+     * pending ('done_notified'). */
+    pthread_mutex_t mutex;
+    pthread_cond_t jobs_cond;   /* Signaled when a job is queued. */
+    pthread_cond_t idle_cond;   /* Signaled when no job is in flight. */
+    list *jobs;
+    list *jobs_done;
+    unsigned long inflight;     /* Queued or executing jobs. */
+    int done_notified;
+    int done_pipe[2];
+} workerPool;
+
+workerPool *workerPoolCreate(char *name, int numthreads,
+                             void (*execute)(void *job),
+                             void (*done)(void *job), void (*drained)(void));
+void workerPoolSubmit(workerPool *wp, void *job);
+int workerPoolWaitIdle(workerPool *wp);
+int workerPoolIsWorker(workerPool *wp);
+
+#endif
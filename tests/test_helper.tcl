@@ -58,6 +58,19 @@ set ::all_tests {
     unit/hyperloglog
     unit/lazyfree
     unit/wait
+    unit/hotkeys
+    unit/memreport
+    unit/trace
+    unit/shard
+    unit/readthreads
+    unit/offload
+    unit/replycache
+    unit/tracking
+    unit/shm
+    unit/handover
+    unit/lazyload
+    unit/compression
+    unit/modules
 }
 # Index to the next test to run in the ::all_tests list.
 set ::next_test 0
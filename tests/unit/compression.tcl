@@ -0,0 +1,224 @@
+proc compressible_value {n} {
+    set v {}
+    for {set j 0} {$j < $n} {incr j} {
+        append v "{\"id\":$j,\"name\":\"user:$j\",\"tags\":\[\"a\",\"b\"\]},"
+    }
+    return $v
+}
+
+start_server {tags {"compression"} overrides {value-compression yes value-compression-cache-memory 0}} {
+    set ::big [compressible_value 200]
+
+    test {Value compression: big values are stored compressed} {
+        r config resetstat
+        r set big $::big
+        set res [list [r object encoding big]]
+        lappend res [expr {[r get big] eq $::big}] [r strlen big]
+        lappend res [r object encoding big]
+        lappend res [s compressions] [s decompressions] [s compressed_values]
+    } [list compressed 1 [string length $::big] compressed 3 2 1]
+
+    test {Value compression: small and incompressible values are not compressed} {
+        r set small [string repeat x 100]
+        set random {}
+        for {set j 0} {$j < 3000} {incr j} {
+            append random [format %c [expr {int(rand()*256)}]]
+        }
+        r set random $random
+        r config set value-compression-min-savings 99
+        r set hardly $::big
+        set res [list [r object encoding small] [r object encoding random] \
+                      [r object encoding hardly]]
+        r config set value-compression-min-savings 20
+        r del small random hardly
+        set res
+    } {raw raw raw}
+
+    test {Value compression: in place modifications of compressed values} {
+        r set big $::big
+        assert_equal compressed [r object encoding big]
+        r append big "tail"
+        set res [list [r getrange big -4 -1]]
+        r setrange big 0 "XY"
+        lappend res [r getrange big 0 1] [r strlen big]
+        lappend res [r object encoding big]
+        r del big
+        lappend res [r exists big] [s compressed_values]
+    } [list tail XY [expr {[string length $::big]+4}] compressed 0 0]
+
+    test {Value compression: recently accessed values are kept uncompressed} {
+        r config set value-compression-cache-memory 1mb
+        r set big $::big
+        set res [list [r object encoding big]]
+        lappend res [expr {[s compression_cache_memory] >= [string length $::big]}]
+        r config set value-compression-cache-memory 0
+        lappend res [r object encoding big] [s compression_cache_memory]
+    } {raw 1 compressed 0}
+
+    test {Value compression: the least recently added values are compressed first} {
+        r flushall
+        set limit [expr {[string length $::big]*3}]
+        r config set value-compression-cache-memory $limit
+        for {set j 0} {$j < 5} {incr j} {
+            r set key:$j $::big
+        }
+        set res {}
+        for {set j 0} {$j < 5} {incr j} {
+            lappend res [r object encoding key:$j]
+        }
+        r config set value-compression-cache-memory 0
+        set res
+    } {compressed compressed raw raw raw}
+
+    test {Value compression: RDB keeps the values compressed} {
+        r flushall
+        r set big $::big
+        r set other [compressible_value 100]
+        set digest [r debug digest]
+        set compressions [s compressions]
+        r debug reload
+        list [expr {[s compressions] == $compressions}] \
+             [r object encoding big] [r object encoding other] \
+             [expr {[r debug digest] eq $digest}] [s compressed_values]
+    } {1 compressed compressed 1 2}
+
+    test {Value compression: DUMP / RESTORE} {
+        set dump [r dump big]
+        r del big
+        r restore big 0 $dump
+        list [r object encoding big] [expr {[r get big] eq $::big}]
+    } {compressed 1}
+
+    test {Value compression: AOF rewrite} {
+        set digest [r debug digest]
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r debug loadaof
+        r config set appendonly no
+        list [expr {[r debug digest] eq $digest}] [r object encoding big]
+    } {1 compressed}
+
+    test {Value compression: values written while disabled are compressed in background} {
+        r config set value-compression no
+        r set later $::big
+        set res [list [r object encoding later]]
+        r config set value-compression yes
+        wait_for_condition 50 100 {
+            [r object encoding later] eq {compressed}
+        } else {
+            fail "Value not compressed in background"
+        }
+        lappend res [expr {[r get later] eq $::big}]
+    } {raw 1}
+
+    test {Value compression: MEMORY STATS and MEMORY USAGE report the savings} {
+        r flushall
+        r set big $::big
+        set stats [r memory stats]
+        list [dict get $stats compression.values] \
+             [expr {[dict get $stats compression.saved] > [string length $::big]/2}] \
+             [expr {[dict get $stats compression.cpu-usec] >= 0}] \
+             [expr {[r memory usage big] < [string length $::big]/2}]
+    } {1 1 1 1}
+}
+
+proc small_json_value {j} {
+    format {{"id":%d,"username":"user%d","email":"user%d@example.com","status":"%s","preferences":{"theme":"dark","notifications":true,"language":"en-US"},"score":%d}} \
+        $j $j $j [lindex {active inactive pending} [expr {$j%3}]] [expr {$j*7919%100000}]
+}
+
+start_server {tags {"compression"} overrides {value-compression yes value-compression-cache-memory 0}} {
+    test {Dictionary compression: a dictionary is trained for small values} {
+        set total 0
+        for {set j 0} {$j < 1000} {incr j} {
+            set v [small_json_value $j]
+            incr total [string length $v]
+            r set user:$j $v
+            if {$j < 500} {
+                r hmset h:$j name user$j email user$j@example.com \
+                        status active country US city Springfield plan premium
+            }
+        }
+        wait_for_condition 100 100 {
+            [s compression_dict_version] > 0 && [s compressed_values] == 1500
+        } else {
+            fail "Small values not compressed with a dictionary"
+        }
+        set res [list [s compression_dicts] [s compression_dict_trainings]]
+        lappend res [r object encoding user:10]
+        lappend res [expr {[s compression_saved_bytes]*2 >= $total}]
+        lappend res [expr {[r get user:10] eq [small_json_value 10]}]
+        lappend res [r object encoding user:10]
+        set fd [open [srv 0 stdout]]
+        set log [read $fd]
+        close $fd
+        lappend res [string match {*Value compression dictionary 1 trained*} $log]
+    } {1 1 compressed 1 1 compressed 1}
+
+    test {Dictionary compression: new small values are compressed} {
+        r set user:new [small_json_value 5000]
+        r append user:10 ""
+        list [r object encoding user:new] [r object encoding user:10] \
+             [expr {[r get user:new] eq [small_json_value 5000]}]
+    } {compressed compressed 1}
+
+    test {Dictionary compression: small hashes} {
+        set res [list [r object encoding h:1] [r hget h:1 city] [r hlen h:1]]
+        r hset h:1 plan basic
+        lappend res [r object encoding h:1] [r hget h:1 plan]
+        lappend res [lsort [r hkeys h:1]]
+    } {compressed Springfield 6 compressed basic {city country email name plan status}}
+
+    test {Dictionary compression: DEBUG RELOAD keeps the dictionary} {
+        set digest [r debug digest]
+        set values [s compressed_values]
+        set compressions [s compressions]
+        r debug reload
+        list [expr {[r debug digest] eq $digest}] \
+             [s compression_dict_version] [s compression_dicts] \
+             [expr {[s compressed_values] == $values}] \
+             [expr {[s compressions]-$compressions == $values}] \
+             [r object encoding user:20] [r object encoding h:1]
+    } {1 1 1 1 1 compressed compressed}
+
+    test {Dictionary compression: DUMP / RESTORE and AOF rewrite} {
+        set dump [r dump h:1]
+        r del h:1
+        r restore h:1 0 $dump
+        set res [list [r object encoding h:1] [r hget h:1 name]]
+        set digest [r debug digest]
+        r config set appendonly yes
+        waitForBgrewriteaof r
+        r debug loadaof
+        r config set appendonly no
+        lappend res [expr {[r debug digest] eq $digest}] [r object encoding h:1]
+    } {compressed user1 1 compressed}
+
+    test {Dictionary compression: old dictionaries are released} {
+        r config set value-compression-dict-train-period 1
+        wait_for_condition 100 100 {
+            [s compression_dict_version] > 1
+        } else {
+            fail "Dictionary not trained again"
+        }
+        r config set value-compression-dict-train-period 0
+        wait_for_condition 100 100 {
+            [s compression_dicts] == 1
+        } else {
+            fail "Old dictionaries not released"
+        }
+        expr {[r get user:30] eq [small_json_value 30]}
+    } {1}
+
+    test {Dictionary compression: can be disabled} {
+        r config set value-compression-dict-size 0
+        wait_for_condition 50 100 {
+            [s compression_dict_version] == 0
+        } else {
+            fail "Dictionary not dropped"
+        }
+        r set user:other [small_json_value 6000]
+        list [r object encoding user:other] \
+             [expr {[r get user:40] eq [small_json_value 40]}]
+    } {raw 1}
+}
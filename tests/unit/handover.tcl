@@ -0,0 +1,84 @@
+proc wait_handover_restart {} {
+    wait_for_condition 100 100 {
+        [catch {reconnect; r ping}] == 0
+    } else {
+        fail "Server not restarted after SHUTDOWN HANDOVER"
+    }
+}
+
+start_server {tags {"handover"}} {
+    test {SHUTDOWN HANDOVER keeps the dataset without on disk persistence} {
+        r config set save ""
+        r config set appendonly no
+        file delete [file join [lindex [r config get dir] 1] dump.rdb]
+        r flushall
+        r set str foo
+        r set num 12345
+        r rpush list a b c
+        r sadd set 1 2 3
+        r hset hash f1 v1 f2 v2
+        r zadd zset 1 a 2 b
+        r set big [string repeat x 100000]
+        r setex volatile 1000 v
+        r select 10
+        r set other bar
+        r select 9
+        set digest [r debug digest]
+        set pid [s process_id]
+        catch {r shutdown handover}
+        wait_handover_restart
+        set res [expr {[r debug digest] eq $digest}]
+        lappend res [expr {[s process_id] == $pid}]
+        lappend res [expr {[r ttl volatile] > 900}]
+        lappend res [r lrange list 0 -1] [r get num]
+        r select 10
+        lappend res [r get other]
+        r select 9
+        set res
+    } {1 1 1 {a b c} 12345 bar}
+
+    test {SHUTDOWN HANDOVER loads the image instead of the files} {
+        set fd [open [srv 0 stdout]]
+        set log [read $fd]
+        close $fd
+        list [string match {*Dataset handed over*} $log] \
+             [string match {*DB loaded from the handover image*} $log] \
+             [file exists [file join [lindex [r config get dir] 1] dump.rdb]]
+    } {1 1 0}
+
+    test {SHUTDOWN HANDOVER rewrites the configuration} {
+        r config set maxmemory-samples 7
+        catch {r shutdown handover}
+        wait_handover_restart
+        lindex [r config get maxmemory-samples] 1
+    } {7}
+
+    test {SHUTDOWN HANDOVER saves the RDB too when save points are set} {
+        # The new executable may not accept the image: the RDB it falls
+        # back to must be up to date.
+        set rdb [file join [lindex [r config get dir] 1] dump.rdb]
+        file delete $rdb
+        r config set save "900 1"
+        r set saved yes
+        catch {r shutdown handover}
+        wait_handover_restart
+        r config set save ""
+        list [file exists $rdb] [r get saved]
+    } {1 yes}
+
+    test {SHUTDOWN with a wrong argument is refused} {
+        catch {r shutdown foo} e
+        set e
+    } {ERR*syntax*}
+}
+
+set ::env(REDIS_HANDOVER_FD) 1000
+start_server {tags {"handover"}} {
+    unset ::env(REDIS_HANDOVER_FD)
+
+    test {A missing handover image falls back to the normal loading} {
+        r ping
+        string match {*handover image is not available*} \
+            [exec tail -20 < [srv 0 stdout]]
+    } {1}
+}
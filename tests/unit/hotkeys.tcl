@@ -0,0 +1,73 @@
+start_server {tags {"hotkeys"}} {
+    test {HOTKEYS is empty when tracking is disabled} {
+        r set foo bar
+        r get foo
+        list [r hotkeys reads] [r hotkeys writes]
+    } {{} {}}
+
+    test {HOTKEYS READS reports the most read keys} {
+        r config set hotkeys-tracking yes
+        r config set hotkeys-sample-rate 1
+        r hotkeys reset
+        for {set j 0} {$j < 100} {incr j} {
+            r set key:$j $j
+        }
+        for {set j 0} {$j < 100} {incr j} {
+            r get key:$j
+            if {$j % 10 == 0} {
+                for {set i 0} {$i < 50} {incr i} {r get key:$j}
+            }
+        }
+        for {set i 0} {$i < 200} {incr i} {r get key:42}
+        set top [r hotkeys reads 3]
+        assert_equal 3 [llength $top]
+        lassign [lindex $top 0] key db count
+        assert_equal key:42 $key
+        assert_equal 9 $db
+        assert {$count >= 201}
+        lindex [lindex $top 1] 2
+    } {51}
+
+    test {HOTKEYS WRITES tracks write lookups separately} {
+        r hotkeys reset
+        for {set i 0} {$i < 20} {incr i} {r incr counter}
+        r get counter
+        list [lindex [r hotkeys writes] 0] [r hotkeys reads]
+    } {{counter 9 19} {{counter 9 1}}}
+
+    test {HOTKEYS tracks the DB of the key} {
+        r hotkeys reset
+        r select 10
+        r set foo bar
+        r get foo
+        r select 9
+        r get foo
+        lsort [r hotkeys reads]
+    } {{foo 10 1} {foo 9 1}}
+
+    test {HOTKEYS top-K is bounded by hotkeys-max-keys} {
+        r config set hotkeys-max-keys 5
+        for {set j 0} {$j < 100} {incr j} {
+            r get key:$j
+        }
+        llength [r hotkeys reads 100]
+    } {5}
+
+    test {HOTKEYS estimate is scaled by the sample rate} {
+        r config set hotkeys-max-keys 32
+        r config set hotkeys-sample-rate 10
+        r hotkeys reset
+        for {set i 0} {$i < 1000} {incr i} {r get key:1}
+        lassign [lindex [r hotkeys reads] 0] key db count
+        assert_equal key:1 $key
+        assert {$count >= 700 && $count <= 1300}
+    }
+
+    test {HOTKEYS RESET and errors} {
+        r hotkeys reset
+        assert_equal {} [r hotkeys reads]
+        assert_error "*greater than 0*" {r hotkeys reads 0}
+        assert_error "*Syntax error*" {r hotkeys foo}
+        r config set hotkeys-tracking no
+    } {OK}
+}
@@ -20,4 +20,24 @@ start_server {tags {"introspection"}} {
         r set key2 2
         r touch key0 key1 key2 key3
     } 2
+
+    test {INFO latencystats reports per command percentiles} {
+        r config resetstat
+        for {set j 0} {$j < 100} {incr j} {r set foo bar}
+        r debug sleep 0.1
+        set info [r info latencystats]
+        assert_match {*latency_percentiles_usec_set:p50=*,p99=*,p99.9=*} $info
+        regexp {latency_percentiles_usec_debug:p50=(\d+),p99=(\d+)} $info - p50
+        assert {$p50 >= 100000 && $p50 < 120000}
+    }
+
+    test {CONFIG RESETSTAT resets the latency histograms} {
+        r config resetstat
+        r info latencystats
+    } {*latency_percentiles_usec_config:*}
+
+    test {Only called commands are reported in INFO latencystats} {
+        r config resetstat
+        string match {*usec_set:*} [r info latencystats]
+    } {0}
 }
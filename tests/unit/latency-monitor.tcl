@@ -25,14 +25,18 @@ start_server {tags {"latency-monitor"}} {
     }
 
     test {LATENCY LATEST output is ok} {
+        # The event loop phases (eventloop-cycle, ...) are reported too:
+        # check the command event, whatever its position.
+        set found 0
         foreach event [r latency latest] {
             lassign $event eventname time latency max
-            assert {$eventname eq "command"}
+            if {$eventname ne "command"} continue
             assert {$max >= 450 & $max <= 650}
             assert {$time == $last_time}
-            break
+            set found 1
         }
-    }
+        set found
+    } {1}
 
     test {LATENCY HISTORY / RESET with wrong event name is fine} {
         assert {[llength [r latency history blabla]] == 0}
@@ -61,4 +65,21 @@ start_server {tags {"latency-monitor"}} {
         after 500
         assert_match {*expire-cycle*} [r latency latest]
     }
+    test {LATENCY of event loop cycles is correctly collected} {
+        r config set latency-monitor-threshold 200
+        r latency reset
+        r debug sleep 0.3
+        assert_match {*eventloop-cycle*} [r latency latest]
+    }
+
+    test {INFO eventloop reports the event loop phases} {
+        r config resetstat
+        r debug sleep 0.2
+        set info [r info eventloop]
+        foreach phase {cycle poll file_events commands before_sleep} {
+            assert_match "*eventloop_$phase:calls=*" $info
+        }
+        regexp {eventloop_commands:calls=\d+,usec=\d+,usec_per_call=[0-9.]+,max_usec=(\d+)} $info - max
+        assert {$max >= 200000}
+    }
 }
@@ -0,0 +1,116 @@
+proc lazy_restart {} {
+    catch {r debug restart}
+    wait_for_condition 100 100 {
+        [catch {reconnect; r ping}] == 0
+    } else {
+        fail "Server not restarted after DEBUG RESTART"
+    }
+}
+
+start_server {tags {"lazyload"} overrides {rdb-lazy-load yes rdb-lazy-load-cycle-us 0}} {
+    test {Lazy loading: keys are loaded on access} {
+        r flushall
+        for {set j 0} {$j < 100} {incr j} {
+            r set key:$j val:$j
+        }
+        r rpush list a b c
+        r hset hash f v
+        r setex volatile 1000 v
+        r select 10
+        r set other bar
+        r select 9
+        set digest [r debug digest]
+        lazy_restart
+        set res [list [s lazy_loading] [s lazy_loading_total_keys] \
+                      [s lazy_loading_pending_keys]]
+        lappend res [r get key:10] [r lrange list 0 -1] [r hget hash f]
+        lappend res [expr {[r ttl volatile] > 900}] [r get nokey]
+        lappend res [s lazy_loading_pending_keys] \
+                    [s lazy_loading_on_demand_keys]
+        r select 10
+        lappend res [r get other] [s lazy_loading_pending_keys]
+        r select 9
+        lappend res [expr {[r debug digest] eq $digest}] [s lazy_loading]
+    } {1 104 104 val:10 {a b c} v 1 {} 100 4 bar 99 1 0}
+
+    test {Lazy loading: the log reports the index} {
+        set fd [open [srv 0 stdout]]
+        set log [read $fd]
+        close $fd
+        list [string match {*RDB key index loaded: 104 keys*} $log] \
+             [string match {*DB lazy loading completed*} $log]
+    } {1 1}
+
+    test {Lazy loading: writes replace the keys on disk} {
+        lazy_restart
+        r set key:1 new
+        r del key:2
+        r append key:3 x
+        r rename key:4 key:5
+        set res [list [r get key:1] [r exists key:2] [r get key:3]]
+        lappend res [r get key:5] [r exists key:4] [r mget key:6 key:7]
+        lappend res [s lazy_loading_pending_keys] [r dbsize] [r get key:2]
+    } {new 0 val:3x val:4 0 {val:6 val:7} 97 101 {}}
+
+    test {Lazy loading: KEYS loads every pending key} {
+        lazy_restart
+        set res [list [s lazy_loading_pending_keys]]
+        lappend res [llength [r keys key:*]] [s lazy_loading]
+    } {102 98 0}
+
+    test {Lazy loading: FLUSHDB and FLUSHALL drop the pending keys} {
+        lazy_restart
+        r flushdb
+        set res [list [s lazy_loading] [s lazy_loading_pending_keys]]
+        lappend res [r dbsize]
+        r select 10
+        lappend res [r get other]
+        r select 9
+        r set key:1 x
+        lazy_restart
+        r flushall
+        lappend res [s lazy_loading] [r get key:1]
+        r select 10
+        lappend res [r dbsize]
+        r select 9
+        set res
+    } {1 1 0 bar 0 {} 0}
+
+    test {Lazy loading: the background loader loads every key} {
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j val:$j
+        }
+        set digest [r debug digest]
+        lazy_restart
+        set res [list [s lazy_loading]]
+        r config set rdb-lazy-load-cycle-us 1000
+        wait_for_condition 100 50 {
+            [s lazy_loading] == 0
+        } else {
+            fail "Lazy loading not completed"
+        }
+        lappend res [s lazy_loading_on_demand_keys]
+        r config set rdb-lazy-load-cycle-us 0
+        lappend res [expr {[r debug digest] eq $digest}]
+    } {1 0 1}
+
+    test {Lazy loading: expired keys are not loaded} {
+        r flushall
+        r set persistent x
+        r psetex expiring 500 y
+        lazy_restart
+        after 600
+        list [r dbsize] [r get persistent]
+    } {1 x}
+
+    test {Lazy loading: files without the index are loaded as usual} {
+        r flushall
+        r set foo bar
+        r config set rdb-lazy-load no
+        r save
+        r config set rdb-lazy-load yes
+        r config set save ""
+        lazy_restart
+        list [s lazy_loading] [s lazy_loading_total_keys] [r get foo]
+    } {0 0 bar}
+}
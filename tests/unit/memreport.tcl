@@ -0,0 +1,89 @@
+start_server {tags {"memreport"}} {
+    proc wait_for_memory_report {} {
+        wait_for_condition 100 50 {
+            [dict exists [r memory report] last-scan-end]
+        } else {
+            fail "Memory report scan not completed"
+        }
+    }
+
+    test {MEMORY REPORT is disabled by default} {
+        dict get [r memory report] status
+    } {disabled}
+
+    test {MEMORY REPORT accounts memory per prefix, type and biggest keys} {
+        for {set j 0} {$j < 200} {incr j} {
+            r set user:$j [string repeat x 10]
+        }
+        for {set j 0} {$j < 10} {incr j} {
+            r rpush queue:$j a b c
+        }
+        r set nodelimiter foo
+        r set bigkey [string repeat x 100000]
+        r select 10
+        r hset session:1 a b
+        r select 9
+        r config set memory-report-top-keys 3
+        r config set memory-report-period 1000
+        wait_for_memory_report
+        set rep [r memory report]
+        assert_equal 213 [dict get $rep keys]
+
+        set prefixes {}
+        foreach p [dict get $rep prefixes] {
+            lassign $p prefix keys bytes
+            dict set prefixes $prefix $keys
+        }
+        assert_equal 200 [dict get $prefixes user]
+        assert_equal 10 [dict get $prefixes queue]
+        assert_equal 1 [dict get $prefixes session]
+        assert_equal 2 [dict get $prefixes (none)]
+        # The prefix holding 'bigkey' comes first.
+        assert_equal (none) [lindex [dict get $rep prefixes] 0 0]
+
+        set types {}
+        foreach t [dict get $rep types] {
+            lassign $t type keys bytes
+            dict set types $type $keys
+        }
+        assert_equal {string 202 list 10 hash 1} $types
+
+        set biggest [dict get $rep biggest-keys]
+        assert_equal 3 [llength $biggest]
+        lassign [lindex $biggest 0] key db type bytes
+        assert_equal {bigkey 9 string} [list $key $db $type]
+        assert {$bytes >= 100000}
+    }
+
+    test {MEMORY REPORT count limits the number of prefixes} {
+        llength [dict get [r memory report 2] prefixes]
+    } {2}
+
+    test {MEMORY REPORT uses memory-report-delimiter} {
+        r config set memory-report-period 0
+        r flushall
+        r set a.b 1
+        r set a.c 1
+        r set a:b 1
+        r config set memory-report-delimiter .
+        r config set memory-report-period 1
+        after 1100
+        wait_for_condition 100 50 {
+            [dict get [r memory report] keys] == 3
+        } else {
+            fail "Memory report scan not completed"
+        }
+        set prefixes {}
+        foreach p [dict get [r memory report] prefixes] {
+            lappend prefixes [lindex $p 0] [lindex $p 1]
+        }
+        lsort -stride 2 $prefixes
+    } {(none) 1 a 2}
+
+    test {MEMORY REPORT errors} {
+        assert_error "*negative*" {r memory report -1}
+        assert_error "*syntax*" {r memory report 1 2}
+        catch {r config set memory-report-delimiter ""} e
+        assert_match {*Invalid argument*} $e
+    }
+}
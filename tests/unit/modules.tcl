@@ -0,0 +1,49 @@
+# The example modules are not built by the default make target.
+exec make -C src/modules hellolazy.so
+set hellolazy [file normalize src/modules/hellolazy.so]
+
+proc hellolazy_stat {name} {
+    dict get [r hellolazy.stats] $name
+}
+
+start_server {tags {"modules"}} {
+    r module load $hellolazy defrag-step 10
+
+    test {Module type: UNLINK frees the large values in background} {
+        r hellolazy.push small 10
+        r hellolazy.push large 10000
+        assert_equal 2 [r unlink small large]
+        wait_for_condition 50 100 {
+            [hellolazy_stat freed] == 2
+        } else {
+            fail "The values were not freed"
+        }
+        list [hellolazy_stat unlinked] [hellolazy_stat freed-async]
+    } {2 1}
+
+    test {Module type: the unlink method is called when flushing the db} {
+        r hellolazy.push a 100
+        r hellolazy.push b 100
+        r flushdb
+        list [hellolazy_stat unlinked] [hellolazy_stat freed]
+    } {4 4}
+
+    if {[string match {*jemalloc*} [s mem_allocator]]} {
+        test {Module type: the defrag method is resumed with the cursor} {
+            r hellolazy.push vec 1000
+            r config set active-defrag-threshold-lower 0
+            r config set active-defrag-ignore-bytes 1
+            r config set activedefrag yes
+            # With a step of 10 elements, a pass over the value is made of
+            # one call and 99 resumed calls.
+            wait_for_condition 100 100 {
+                [hellolazy_stat defrag-resumed] >= 99
+            } else {
+                fail "The defrag method was not resumed"
+            }
+            r config set activedefrag no
+            assert {[hellolazy_stat defrag-calls] > [hellolazy_stat defrag-resumed]}
+            r hellolazy.len vec
+        } {1000}
+    }
+}
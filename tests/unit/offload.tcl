@@ -0,0 +1,150 @@
+start_server {tags {"offload"} overrides {offload-threads 2 offload-threshold 100}} {
+    proc create_big_set {key start count} {
+        r eval {
+            for i=tonumber(ARGV[1]),tonumber(ARGV[1])+tonumber(ARGV[2])-1 do
+                redis.call('sadd',KEYS[1],i)
+            end
+        } 1 $key $start $count
+    }
+
+    test {Offload: set operations are executed by the offload threads} {
+        r config resetstat
+        create_big_set s1 0 1000
+        create_big_set s2 500 1000
+        set res {}
+        lappend res [r sunionstore dst1 s1 s2]
+        lappend res [r sinterstore dst2 s1 s2]
+        lappend res [r sdiffstore dst3 s1 s2]
+        lappend res [llength [r sunion s1 s2]]
+        lappend res [llength [r sinter s1 s2]]
+        lappend res [llength [r sdiff s1 s2]]
+        lappend res [r scard dst1] [r scard dst2] [r scard dst3]
+        lappend res [s offloaded_commands]
+    } {1500 500 500 1500 500 500 1500 500 500 6}
+
+    test {Offload: the changes of an offloaded command are counted once} {
+        r config resetstat
+        r save
+        r sunionstore dst1 s1 s2
+        r sunion s1 s2
+        list [s offloaded_commands] [s rdb_changes_since_last_save]
+    } {2 1}
+
+    test {Offload: small inputs are executed by the main thread} {
+        r config resetstat
+        r sadd small1 a b c
+        r sadd small2 c d
+        list [r sunionstore smalldst small1 small2] [s offloaded_commands]
+    } {4 0}
+
+    test {Offload: ZUNIONSTORE, ZINTERSTORE and SORT STORE} {
+        r config resetstat
+        r del z1 z2
+        for {set j 0} {$j < 200} {incr j} {
+            r zadd z1 $j m$j
+            r zadd z2 [expr {$j*2}] m$j
+        }
+        set res {}
+        lappend res [r zunionstore zdst 2 z1 z2]
+        lappend res [r zscore zdst m10]
+        lappend res [r zinterstore zdst 2 z1 z2 weights 1 0]
+        lappend res [r zscore zdst m10]
+        lappend res [r sort s1 store sorted limit 0 5]
+        lappend res [r lrange sorted 0 -1]
+        lappend res [s offloaded_commands]
+    } {200 30 200 10 5 {0 1 2 3 4} 3}
+
+    test {Offload: SORT with BY or GET is executed by the main thread} {
+        r config resetstat
+        r sort s1 by nosort limit 0 1
+        r sort s1 get # limit 0 1
+        s offloaded_commands
+    } {0}
+
+    test {Offload: the destination key is overwritten and loses its TTL} {
+        r set dst1 string
+        r expire dst1 100
+        r sunionstore dst1 s1 s2
+        list [r type dst1] [r ttl dst1] [r scard dst1]
+    } {set -1 1500}
+
+    test {Offload: empty result deletes the destination key} {
+        r sadd dst2 x
+        r sinterstore dst2 s1 nokey
+        r exists dst2
+    } {0}
+
+    test {Offload: pipelined commands observe the offloaded command} {
+        set rd [redis_deferring_client]
+        $rd sunionstore dst4 s1 s2
+        $rd scard dst4
+        $rd srem dst4 0
+        $rd scard dst4
+        set res [list [$rd read] [$rd read] [$rd read] [$rd read]]
+        $rd close
+        set res
+    } {1500 1500 1 1499}
+
+    test {Offload: commands of other clients on the locked keys} {
+        r del big
+        create_big_set big 0 200000
+        set rd1 [redis_deferring_client]
+        set rd2 [redis_deferring_client]
+        $rd1 sunionstore dst5 big s1
+        $rd2 sadd dst5 extra
+        $rd2 scard dst5
+        set res [list [$rd1 read] [$rd2 read] [$rd2 read]]
+        $rd1 close
+        $rd2 close
+        # The SADD is executed either after the SUNIONSTORE, or before it
+        # and then overwritten.
+        expr {$res eq {200000 1 200001} || $res eq {200000 1 200000}}
+    } {1}
+
+    test {Offload: FLUSHALL waits for the offloaded commands} {
+        set rd [redis_deferring_client]
+        $rd sunionstore dst6 big s1
+        r flushall
+        set res [$rd read]
+        $rd close
+        list $res [r dbsize]
+    } {200000 0}
+
+    test {Offload: the command is propagated once committed} {
+        create_big_set s1 0 1000
+        # No periodic PING in the stream, the test may run slowly.
+        r config set repl-ping-slave-period 3600
+        set repl [attach_to_replication_stream]
+        r sunionstore dst7 s1 s1
+        r sunion s1 s1
+        r set foo bar
+        assert_replication_stream $repl {
+            {select *}
+            {sunionstore dst7 s1 s1}
+            {set foo bar}
+        }
+        close_replication_stream $repl
+        r config set repl-ping-slave-period 10
+    }
+
+    test {Offload: keyspace events are emitted once committed} {
+        r config set notify-keyspace-events KEA
+        set rd [redis_deferring_client]
+        $rd psubscribe "__keyspace@9__:dst8"
+        $rd read
+        r sunionstore dst8 s1 s1
+        set res [$rd read]
+        $rd close
+        r config set notify-keyspace-events ""
+        set res
+    } {pmessage __keyspace@9__:dst8 __keyspace@9__:dst8 sunionstore}
+
+    test {Offload: offload-threshold can be changed at runtime} {
+        r config set offload-threshold 100000
+        r config resetstat
+        r sunionstore dst9 s1 s1
+        set res [s offloaded_commands]
+        r config set offload-threshold 100
+        list $res [lindex [r config get offload-threshold] 1]
+    } {0 100}
+}
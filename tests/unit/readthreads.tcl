@@ -0,0 +1,142 @@
+start_server {tags {"readthreads"} overrides {read-threads 4}} {
+    test {Read threads: read only commands are executed by the threads} {
+        r config resetstat
+        r set foo bar
+        r hset myhash field value
+        r zadd myzset 1 a 2 b 3 c
+        r rpush mylist 1 2 3
+        list [r get foo] [r hget myhash field] [r zscore myzset b] \
+             [r zrange myzset 0 -1] [r lrange mylist 0 -1] [r exists nokey] \
+             [s threaded_reads_processed]
+    } {bar value 2 {a b c} {1 2 3} 0 6}
+
+    test {Read threads: reads observe the writes that precede them} {
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 1000} {incr j} {
+            $rd incr counter
+            $rd get counter
+        }
+        set err 0
+        for {set j 1} {$j <= 1000} {incr j} {
+            if {[$rd read] != $j} {incr err}
+            if {[$rd read] != $j} {incr err}
+        }
+        $rd close
+        set err
+    } {0}
+
+    test {Read threads: concurrent clients} {
+        r del counter
+        set clients {}
+        for {set j 0} {$j < 5} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        for {set i 0} {$i < 200} {incr i} {
+            foreach rd $clients {
+                $rd incr counter
+                $rd get counter
+                $rd mget counter foo
+            }
+        }
+        foreach rd $clients {
+            for {set i 0} {$i < 600} {incr i} {$rd read}
+            $rd close
+        }
+        r get counter
+    } {1000}
+
+    test {Read threads: expired keys are reported as missing} {
+        r debug set-active-expire 0
+        r psetex volatile 1 value
+        after 10
+        set v [r get volatile]
+        r debug set-active-expire 1
+        set v
+    } {}
+
+    test {Read threads: MULTI/EXEC is executed by the main thread} {
+        r config resetstat
+        r multi
+        r get foo
+        r set foo baz
+        r get foo
+        list [r exec] [s threaded_reads_processed]
+    } {{bar OK baz} 0}
+
+    test {Read threads: MONITOR sees the threaded commands} {
+        set rd [redis_deferring_client]
+        $rd monitor
+        assert_match {*OK*} [$rd read]
+        r get foo
+        set line [$rd read]
+        $rd close
+        set line
+    } {*"get" "foo"*}
+
+    test {Read threads: slow reads are logged into the slowlog} {
+        r config set slowlog-log-slower-than 0
+        r slowlog reset
+        r get foo
+        set entry [lindex [r slowlog get] 0]
+        r config set slowlog-log-slower-than 10000
+        lindex $entry 3
+    } {get foo}
+
+    test {Read threads: client killed while its command is executing} {
+        for {set j 0} {$j < 10} {incr j} {
+            set rd [redis_deferring_client]
+            for {set i 0} {$i < 100} {incr i} {$rd zrange myzset 0 -1}
+            $rd close
+        }
+        r ping
+    } {PONG}
+}
+
+start_server {tags {"readthreads repl"}} {
+    start_server {overrides {read-threads 4}} {
+        set master [srv -1 client]
+        set master_host [srv -1 host]
+        set master_port [srv -1 port]
+        set replica [srv 0 client]
+
+        $master debug populate 100000 key 100
+        $replica slaveof $master_host $master_port
+        wait_for_condition 100 100 {
+            [status $replica master_link_status] eq {up}
+        } else {
+            fail "Replica not synchronized"
+        }
+
+        test {Read threads: full resync of a replica serving reads} {
+            set clients {}
+            for {set j 0} {$j < 4} {incr j} {
+                lappend clients [redis_deferring_client]
+            }
+            foreach lazy {no yes} {
+                $replica config set slave-lazy-flush $lazy
+                set syncs [status $master sync_full]
+                $replica slaveof no one
+                $replica slaveof $master_host $master_port
+                # Keep the read threads busy until the new data is loaded,
+                # so that some reads are in flight when the replica flushes
+                # its old data.
+                set loops 0
+                while {[status $master sync_full] == $syncs ||
+                       [status $replica master_link_status] ne {up}} {
+                    foreach rd $clients {
+                        for {set i 0} {$i < 100} {incr i} {
+                            $rd get key:[randomInt 100000]
+                        }
+                    }
+                    foreach rd $clients {
+                        for {set i 0} {$i < 100} {incr i} {catch {$rd read}}
+                    }
+                    if {[incr loops] == 5000} {fail "Full resync not completed"}
+                }
+            }
+            foreach rd $clients {$rd close}
+            list [$replica ping] \
+                 [expr {[$master debug digest] eq [$replica debug digest]}]
+        } {PONG 1}
+    }
+}
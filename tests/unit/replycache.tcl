@@ -0,0 +1,100 @@
+start_server {tags {"replycache"} overrides {reply-cache-max-memory 1mb reply-cache-min-size 1024}} {
+    test {Reply cache: big values are served from the cache} {
+        r config resetstat
+        set big [string repeat x 4000]
+        r set big $big
+        set res {}
+        lappend res [expr {[r get big] eq $big}]
+        lappend res [expr {[r get big] eq $big}]
+        lappend res [expr {[r get big] eq $big}]
+        lappend res [s reply_cache_misses] [s reply_cache_hits]
+        lappend res [s reply_cache_entries]
+    } {1 1 1 1 2 1}
+
+    test {Reply cache: small values are not cached} {
+        r config resetstat
+        r set small abc
+        r get small
+        r get small
+        list [s reply_cache_misses] [s reply_cache_hits]
+    } {0 0}
+
+    test {Reply cache: the cache memory is reported} {
+        set mem [s reply_cache_memory]
+        set stats [r memory stats]
+        list [expr {$mem > 4000}] [expr {[dict get $stats reply.cache] == $mem}]
+    } {1 1}
+
+    test {Reply cache: writes invalidate the cached reply} {
+        set res {}
+        r set big [string repeat y 3000]
+        lappend res [string length [r get big]] [string index [r get big] 0]
+        r append big z
+        lappend res [string length [r get big]] [string index [r get big] end]
+        r setrange big 0 w
+        lappend res [string index [r get big] 0]
+        r del big
+        lappend res [r get big]
+    } {3000 y 3001 z w {}}
+
+    test {Reply cache: MGET and GETSET use the cache} {
+        r config resetstat
+        set a [string repeat a 2000]
+        set b [string repeat b 2000]
+        r mset ka $a kb $b
+        set res {}
+        lappend res [expr {[r mget ka kb nokey] eq [list $a $b {}]}]
+        lappend res [expr {[r mget ka kb] eq [list $a $b]}]
+        lappend res [expr {[r getset ka new] eq $a}]
+        lappend res [r get ka]
+        lappend res [s reply_cache_hits]
+    } {1 1 1 new 3}
+
+    test {Reply cache: FLUSHALL, SWAPDB and RENAME drop the cached replies} {
+        set v1 [string repeat 1 2000]
+        set v2 [string repeat 2 2000]
+        r set k $v1
+        r get k
+        r flushall
+        r set k $v2
+        set res [expr {[r get k] eq $v2}]
+        r select 10
+        r set k $v1
+        r get k
+        r select 9
+        r get k
+        r swapdb 9 10
+        lappend res [expr {[r get k] eq $v1}]
+        r select 10
+        lappend res [expr {[r get k] eq $v2}]
+        r select 9
+        r set k2 $v2
+        r get k
+        r rename k2 k
+        lappend res [expr {[r get k] eq $v2}]
+    } {1 1 1 1}
+
+    test {Reply cache: DEBUG RELOAD drops the cached replies} {
+        r flushall
+        set v [string repeat v 2000]
+        r set k $v
+        r get k
+        r debug reload
+        r get k
+    } [string repeat v 2000]
+
+    test {Reply cache: the memory limit is enforced} {
+        r flushall
+        r config set reply-cache-max-memory 20000
+        for {set j 0} {$j < 20} {incr j} {
+            r set key:$j [string repeat x 2000]
+            r get key:$j
+        }
+        set res [expr {[s reply_cache_memory] <= 20000}]
+        lappend res [expr {[s reply_cache_entries] < 20}]
+        r config set reply-cache-max-memory 0
+        lappend res [s reply_cache_memory] [s reply_cache_entries]
+        r config set reply-cache-max-memory 1mb
+        set res
+    } {1 1 0 0}
+}
@@ -0,0 +1,138 @@
+start_server {tags {"shard"} overrides {shard-threads 4 notify-keyspace-events {""}}} {
+    test {Sharded mode: basic commands on many keys} {
+        for {set j 0} {$j < 1000} {incr j} {
+            r set key:$j $j
+            r rpush list:$j a b c
+        }
+        set err 0
+        for {set j 0} {$j < 1000} {incr j} {
+            if {[r get key:$j] ne $j} {incr err}
+            if {[r llen list:$j] != 3} {incr err}
+        }
+        list $err [r dbsize] [llength [r keys key:*]]
+    } {0 2000 1000}
+
+    test {Sharded mode: INFO reports every shard} {
+        set info [r info shards]
+        set n 0
+        foreach line [split $info "\r\n"] {
+            if {[string match shard*:slots=* $line]} {incr n}
+        }
+        list $n [regexp {db9:keys=2000,} [r info keyspace]]
+    } {4 1}
+
+    test {Sharded mode: multi-key commands need keys owned by one shard} {
+        catch {r mset a 1 b 2 c 3 d 4 e 5 f 6 g 7 h 8} e
+        assert_match {CROSSSLOT*} $e
+        r mset "{user1}.name" foo "{user1}.age" 30
+        r mget "{user1}.name" "{user1}.age"
+    } {foo 30}
+
+    test {Sharded mode: unsupported commands are rejected} {
+        foreach cmd {{multi} {eval "return 1" 0} {blpop mylist 1}} {
+            catch {r {*}$cmd} e
+            assert_match {*not supported when shard-threads is enabled*} $e
+        }
+        catch {r config set appendonly yes} e
+        assert_match {*AOF is not supported*} $e
+        catch {r config set maxmemory 100mb} e
+        assert_match {*maxmemory is not supported*} $e
+        assert_equal 0 [lindex [r config get maxmemory] 1]
+        r ping
+    } {PONG}
+
+    test {Sharded mode: SELECT, MOVE and FLUSHDB work per database} {
+        r select 9
+        r set foo bar
+        r move foo 10
+        r select 10
+        set v [r get foo]
+        r flushdb
+        r select 9
+        list $v [r exists foo] [r select 10; r dbsize] [r select 9]
+    } {bar 0 0 OK}
+
+    test {Sharded mode: keys expire in the shards} {
+        for {set j 0} {$j < 100} {incr j} {
+            r psetex vol:$j 100 x
+        }
+        after 300
+        # Active expire runs inside each shard, lazy expire on access.
+        set remaining 0
+        for {set j 0} {$j < 100} {incr j} {
+            if {[r exists vol:$j]} {incr remaining}
+        }
+        set remaining
+    } {0}
+
+    test {Sharded mode: global counters include the shard commands} {
+        r config resetstat
+        r save
+        for {set j 0} {$j < 100} {incr j} {
+            r set stat:$j x
+            r get stat:$j
+            r get missing:$j
+        }
+        for {set j 0} {$j < 10} {incr j} {
+            r psetex expiring:$j 10 x
+        }
+        wait_for_condition 50 100 {
+            [s expired_keys] == 10
+        } else {
+            fail "Keys not expired by the shard cron"
+        }
+        list [s rdb_changes_since_last_save] [s keyspace_hits] \
+             [s keyspace_misses]
+    } {110 100 100}
+
+    test {Sharded mode: keyless commands with a key argument} {
+        r set usage:key [string repeat x 1000]
+        r pfadd usage:hll a b c
+        list [expr {[r memory usage usage:key] > 1000}] \
+             [r pfdebug encoding usage:hll] [r object encoding usage:key]
+    } {1 sparse raw}
+
+    test {Sharded mode: concurrent clients} {
+        set clients {}
+        for {set j 0} {$j < 5} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        for {set i 0} {$i < 200} {incr i} {
+            foreach rd $clients {
+                $rd incr counter:[expr {$i % 10}]
+            }
+        }
+        foreach rd $clients {
+            for {set i 0} {$i < 200} {incr i} {$rd read}
+            $rd close
+        }
+        set sum 0
+        for {set j 0} {$j < 10} {incr j} {
+            incr sum [r get counter:$j]
+        }
+        set sum
+    } {1000}
+
+    test {Sharded mode: RDB can be loaded with a different number of shards} {
+        r flushall
+        for {set j 0} {$j < 500} {incr j} {
+            r set key:$j $j
+        }
+        r expire key:0 1000
+        r save
+        set dir [lindex [r config get dir] 1]
+        start_server [list overrides [list dir $dir shard-threads 3 notify-keyspace-events {""}]] {
+            set err 0
+            for {set j 0} {$j < 500} {incr j} {
+                if {[r get key:$j] ne $j} {incr err}
+            }
+            set res [list $err [r dbsize] [expr {[r ttl key:0] > 0}]]
+        }
+        set res
+    } {0 500 1}
+
+    test {Sharded mode: FLUSHALL empties every shard} {
+        r flushall
+        r dbsize
+    } {0}
+}
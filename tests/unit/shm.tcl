@@ -0,0 +1,58 @@
+set ::shm_socket [file normalize tests/tmp/redis-shm-[pid].sock]
+start_server [list tags {"shm"} overrides [list unixsocket $::shm_socket unixsocket-shm-size 64kb]] {
+    proc shm_benchmark {args} {
+        exec src/redis-benchmark -s $::shm_socket --shm --dbnum 9 -q {*}$args
+    }
+
+    test {CLIENT SHM is refused on TCP connections} {
+        catch {r client shm} e
+        set e
+    } {*only available via the Unix socket*}
+
+    test {Shared memory clients: commands and replies} {
+        r flushall
+        r config resetstat
+        set out [shm_benchmark -n 10000 -c 5 -t set,get,lpush,lrange_100]
+        list [string match {*SET:*GET:*LRANGE_100*} $out] \
+             [r get key:__rand_int__] [r llen mylist] \
+             [expr {[s total_commands_processed] >= 40000}]
+    } {1 xxx 20000 1}
+
+    test {Shared memory clients: values larger than the rings} {
+        r flushall
+        shm_benchmark -n 20 -c 2 -P 2 -d 300000 -t set,get
+        r strlen key:__rand_int__
+    } {300000}
+
+    test {Shared memory clients: pipelining} {
+        r del counter
+        shm_benchmark -n 20000 -c 3 -P 50 incr counter
+        # The benchmark may send a few more pipelines than needed, but every
+        # pipeline must be executed as a whole.
+        set n [r get counter]
+        list [expr {$n >= 20000}] [expr {$n % 50}]
+    } {1 0}
+
+    test {Shared memory clients are released on disconnection} {
+        wait_for_condition 50 100 {
+            [s shm_clients] == 0
+        } else {
+            fail "Shared memory clients still connected"
+        }
+        s connected_clients
+    } {1}
+
+    test {CLIENT SHM is refused when unixsocket-shm-size is 0} {
+        r config set unixsocket-shm-size 0
+        catch {shm_benchmark -n 1 -t ping} e
+        r config set unixsocket-shm-size 64kb
+        set e
+    } {*shared memory transport is disabled*}
+
+    test {unixsocket-shm-size can be changed at runtime} {
+        r config set unixsocket-shm-size 1mb
+        set res [lindex [r config get unixsocket-shm-size] 1]
+        shm_benchmark -n 1000 -t ping
+        set res
+    } {1048576}
+}
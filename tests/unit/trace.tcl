@@ -0,0 +1,87 @@
+start_server {tags {"trace"}} {
+    test {TRACE is empty when tracing is disabled} {
+        r set foo bar
+        r trace len
+    } {0}
+
+    test {TRACE GET returns the traced commands timeline} {
+        r config set trace-sample-rate 1
+        r set foo bar
+        r get foo
+        set entries [r trace get]
+        assert_equal 2 [llength $entries]
+        lassign [lindex $entries 0] id ts client db cmd total replybytes phases
+        assert_equal {get 9 9} [list $cmd $db $replybytes]
+        assert_equal {lookup exec} [dict keys $phases]
+        assert {$total >= [dict get $phases exec]}
+        lassign [lindex $entries 1] id ts client db cmd total replybytes phases
+        set cmd
+    } {set}
+
+    test {TRACE tracks propagation and rejected commands} {
+        r trace reset
+        r config set appendonly yes
+        r trace reset
+        r incr counter
+        catch {r nosuchcommand} e
+        set entries [r trace get 2]
+        lassign [lindex $entries 0] id ts client db cmd total replybytes phases
+        assert_equal {nosuchcommand lookup} [list $cmd [dict keys $phases]]
+        lassign [lindex $entries 1] id ts client db cmd total replybytes phases
+        r config set appendonly no
+        list $cmd [dict keys $phases]
+    } {incr {lookup exec propagate}}
+
+    test {TRACE DUMP JSON returns one JSON object per line} {
+        r trace reset
+        r ping
+        r ping
+        # The TRACE RESET call itself is traced after the reset.
+        set lines [split [string trim [r trace dump json]] "\n"]
+        assert_equal 3 [llength $lines]
+        assert_match {{"id":*,"ts":*,"client":*,"db":9,"cmd":"ping",*"total_us":*}} [lindex $lines 2]
+        llength [split [string trim [r trace dump json 1]] "\n"]
+    } {1}
+
+    test {TRACE DUMP CHROME returns trace events} {
+        r trace reset
+        r ping
+        set dump [r trace dump chrome]
+        assert_match {\[*\]} [string trim $dump]
+        assert_match {*"name":"ping","ph":"X",*"args":*} $dump
+        assert_match {*"name":"exec","ph":"X",*} $dump
+    }
+
+    test {TRACE ring is bounded by trace-max-len} {
+        r config set trace-max-len 5
+        for {set j 0} {$j < 20} {incr j} {r ping}
+        r trace len
+    } {5}
+
+    test {TRACE samples commands with trace-sample-rate} {
+        r config set trace-max-len 10000
+        r config set trace-sample-rate 10
+        r trace reset
+        for {set j 0} {$j < 1000} {incr j} {r ping}
+        set len [r trace len]
+        r config set trace-sample-rate 0
+        assert {$len > 50 && $len < 200}
+    }
+
+    test {TRACE errors} {
+        assert_error "*Syntax error*" {r trace foo}
+        assert_error "*Syntax error*" {r trace dump json 1 2}
+        assert_error "*syntax*" {r trace dump 1 2}
+    }
+}
+
+start_server {tags {"trace"} overrides {shard-threads 2 notify-keyspace-events {""}}} {
+    test {TRACE does not sample the commands executed by another thread} {
+        r config set trace-sample-rate 1
+        r set foo bar
+        r dbsize
+        set cmds {}
+        foreach entry [r trace get] {lappend cmds [lindex $entry 4]}
+        set cmds
+    } {dbsize}
+}
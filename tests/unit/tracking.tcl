@@ -0,0 +1,126 @@
+start_server {tags {"tracking"}} {
+    # The connection receiving the invalidation messages.
+    set rd_redir [redis_deferring_client]
+    $rd_redir client id
+    set redir [$rd_redir read]
+    $rd_redir subscribe __redis__:invalidate
+    $rd_redir read
+
+    test {CLIENT ID returns a unique id for each connection} {
+        set id1 [r client id]
+        set rd [redis_deferring_client]
+        $rd client id
+        set id2 [$rd read]
+        $rd close
+        list [string is integer $id1] [expr {$id1 != $id2}]
+    } {1 1}
+
+    test {Tracking: modified keys are invalidated} {
+        r client tracking on redirect $redir
+        r set a 1
+        r get a
+        r set a 2
+        $rd_redir read
+    } {message __redis__:invalidate a}
+
+    test {Tracking: keys are invalidated only once} {
+        r set a 3
+        r get b
+        r set b 1
+        $rd_redir read
+    } {message __redis__:invalidate b}
+
+    test {Tracking: keys read by multi key commands are invalidated} {
+        r mget c d
+        r del c d
+        r set c 1
+        r set d 1
+        set res [$rd_redir read]
+        lappend res {*}[$rd_redir read]
+    } {message __redis__:invalidate c message __redis__:invalidate d}
+
+    test {Tracking: expired keys are invalidated} {
+        r debug set-active-expire 0
+        r set e 1 px 10
+        r get e
+        after 50
+        r exists e
+        r debug set-active-expire 1
+        $rd_redir read
+    } {message __redis__:invalidate e}
+
+    test {Tracking: FLUSHALL invalidates all the keys} {
+        r get f
+        r flushall
+        $rd_redir read
+    } {message __redis__:invalidate {}}
+
+    test {Tracking: CLIENT GETREDIR and CLIENT LIST} {
+        set res [r client getredir]
+        lappend res [string match {*flags=t*} [r client list]]
+        r client tracking off
+        lappend res [r client getredir]
+        set tr [r client tracking on]
+        lappend res $tr [r client getredir]
+        r client tracking off
+        set res
+    } [list $redir 1 -1 OK 0]
+
+    test {Tracking: keys read after tracking is disabled are not tracked} {
+        r client tracking on redirect $redir
+        r client tracking off
+        r get g
+        r set g 1
+        r client tracking on redirect $redir
+        r get h
+        r set h 1
+        r client tracking off
+        $rd_redir read
+    } {message __redis__:invalidate h}
+
+    test {Tracking: BCAST mode with prefixes} {
+        r client tracking on redirect $redir bcast prefix user: prefix obj:
+        r set user:1 a
+        r set other b
+        r set obj:2 c
+        set res [$rd_redir read]
+        lappend res {*}[$rd_redir read]
+        r client tracking off
+        set res
+    } {message __redis__:invalidate user:1 message __redis__:invalidate obj:2}
+
+    test {Tracking: BCAST mode batches the keys modified by a command} {
+        r client tracking on redirect $redir bcast
+        r mset k1 1 k2 2
+        set res [$rd_redir read]
+        r client tracking off
+        lsort [lindex $res 2]
+    } {k1 k2}
+
+    test {Tracking: invalid options} {
+        set res {}
+        catch {r client tracking on prefix foo} e
+        lappend res [string match {*BCAST*} $e]
+        catch {r client tracking on redirect 999999999} e
+        lappend res [string match {*does not exist*} $e]
+        catch {r client tracking maybe} e
+        lappend res [string match {*syntax*} $e]
+    } {1 1 1}
+
+    test {Tracking: the tracking table is bounded} {
+        r config set tracking-table-max-keys 10
+        r client tracking on redirect $redir
+        for {set j 0} {$j < 100} {incr j} {
+            r get key:$j
+        }
+        wait_for_condition 50 100 {
+            [s tracking_total_keys] <= 10
+        } else {
+            fail "The tracking table was not trimmed"
+        }
+        r client tracking off
+        r config set tracking-table-max-keys 1000000
+    } {OK}
+
+    $rd_redir close
+}
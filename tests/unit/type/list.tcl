@@ -395,6 +395,28 @@ start_server {
       $rd read
     } {}
 
+    test {Blocking timeouts are served on time regardless of hz} {
+        set old_hz [lindex [r config get hz] 1]
+        r config set hz 1
+        set clients {}
+        for {set j 0} {$j < 10} {incr j} {
+            lappend clients [redis_deferring_client]
+        }
+        set start [clock milliseconds]
+        set j 0
+        foreach rd $clients {
+            $rd blpop nolist[incr j] 1
+        }
+        foreach rd $clients {
+            assert_equal {} [$rd read]
+            $rd close
+        }
+        set elapsed [expr {[clock milliseconds]-$start}]
+        r config set hz $old_hz
+        assert {$elapsed >= 1000 && $elapsed < 1400}
+        assert_equal 0 [s blocked_clients]
+    }
+
     test "BLPOP when new key is moved into place" {
         set rd [redis_deferring_client]
 
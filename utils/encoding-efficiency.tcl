@@ -0,0 +1,276 @@
+#!/usr/bin/env tclsh8.5
+# Copyright (C) 2011 Salvatore Sanfilippo
+# Released under the BSD license like Redis itself
+#
+# Memory efficiency and latency of every type and encoding.
+#
+# A local server is started, and for every type, encoding, element count and
+# element size a number of keys are populated, so that about --elements
+# elements are stored. For every combination the script reports:
+#
+#   bytes/elem     The used_memory increase divided by the number of elements
+#                  stored, including the overhead of the keys.
+#   usage/elem     The same, computed with MEMORY USAGE on a sample of keys.
+#   write us/elem  Server side time of the populating commands per element.
+#   read us        Server side time of a single element read (HGET, ZSCORE,
+#                  LINDEX or SISMEMBER), from INFO commandstats.
+#
+# The encoding is forced setting the *-max-ziplist-* and set-max-intset-entries
+# thresholds, and is verified with OBJECT ENCODING. The output helps picking
+# the thresholds from data, and new encodings can be added to the matrix and
+# compared in the same way.
+#
+# Examples (run from the utils directory):
+#
+#   ./encoding-efficiency.tcl
+#   ./encoding-efficiency.tcl --types hash,zset --counts 64,128,256,512 --csv
+
+source ../tests/support/redis.tcl
+
+set ::server ../src/redis-server
+set ::port 21211
+set ::types {hash zset list set}
+set ::counts {1 8 32 64 128 256 512 1024}
+set ::sizes {8 16 32 64 128}
+set ::elements 50000
+set ::reads 20000
+set ::csv 0
+
+# Encodings of every type: name, and configuration forcing it, where
+# $count is replaced with the element count.
+set ::encodings {
+    hash {
+        ziplist {hash-max-ziplist-entries $count hash-max-ziplist-value 1024}
+        hashtable {hash-max-ziplist-entries 0}
+    }
+    zset {
+        ziplist {zset-max-ziplist-entries $count zset-max-ziplist-value 1024}
+        skiplist {zset-max-ziplist-entries 0}
+    }
+    list {
+        quicklist-8kb {list-max-ziplist-size -2 list-compress-depth 0}
+        quicklist-4kb {list-max-ziplist-size -1 list-compress-depth 0}
+        quicklist-128 {list-max-ziplist-size 128 list-compress-depth 0}
+        quicklist-8kb-lzf {list-max-ziplist-size -2 list-compress-depth 1}
+    }
+    set {
+        intset {set-max-intset-entries $count}
+        hashtable-int {set-max-intset-entries 0}
+        hashtable {set-max-intset-entries 0}
+    }
+}
+
+proc info-field {r field {section default}} {
+    if {[regexp "\r\n$field:(.*?)\r\n" [$r info $section] -> value]} {
+        return $value
+    }
+    return 0
+}
+
+# Server side microseconds per call of the specified command.
+proc usec-per-call {r cmd} {
+    set line [info-field $r cmdstat_$cmd commandstats]
+    if {[regexp {usec_per_call=([0-9.]+)} $line -> usec]} {
+        return $usec
+    }
+    return 0
+}
+
+# The j-th element of a key, 'size' bytes long. Integer sets use small
+# integers instead.
+proc element {j size encoding} {
+    if {$encoding in {intset hashtable-int}} {return [expr {$j*7}]}
+    string range "e$j[string repeat x $size]" 0 [expr {$size-1}]
+}
+
+# The command adding the elements of a key, and the command reading one.
+proc write-command {type key elements} {
+    switch $type {
+        hash {
+            set args {}
+            foreach e $elements {lappend args $e $e}
+            return [list hmset $key {*}$args]
+        }
+        zset {
+            set args {}
+            set score 0
+            foreach e $elements {lappend args [incr score] $e}
+            return [list zadd $key {*}$args]
+        }
+        list {return [list rpush $key {*}$elements]}
+        set {return [list sadd $key {*}$elements]}
+    }
+}
+
+proc read-command {type key count size encoding} {
+    set j [expr {int(rand()*$count)}]
+    switch $type {
+        hash {return [list hget $key [element $j $size $encoding]]}
+        zset {return [list zscore $key [element $j $size $encoding]]}
+        list {return [list lindex $key $j]}
+        set {return [list sismember $key [element $j $size $encoding]]}
+    }
+}
+
+# Send the commands pipelined, reading the replies every 1000 commands.
+proc pipeline {rd commands} {
+    set pending 0
+    foreach cmd $commands {
+        $rd {*}$cmd
+        if {[incr pending] == 1000} {
+            while {$pending} {$rd read; incr pending -1}
+        }
+    }
+    while {$pending} {$rd read; incr pending -1}
+}
+
+proc measure {r rd type encoding settings count size} {
+    $r flushall
+    $r config resetstat
+    foreach {name value} [string map [list \$count $count] $settings] {
+        $r config set $name $value
+    }
+    set keys [expr {($::elements+$count-1)/$count}]
+    set elements {}
+    for {set j 0} {$j < $count} {incr j} {
+        lappend elements [element $j $size $encoding]
+    }
+
+    # Populate the keys in batches of at most 128 elements per command.
+    set base [info-field $r used_memory]
+    set commands {}
+    for {set k 0} {$k < $keys} {incr k} {
+        for {set j 0} {$j < $count} {incr j 128} {
+            lappend commands [write-command $type key:$k \
+                [lrange $elements $j [expr {$j+127}]]]
+        }
+    }
+    pipeline $rd $commands
+    set used [expr {[info-field $r used_memory]-$base}]
+    set total [expr {$keys*$count}]
+    set wcmd [lindex $commands 0 0]
+    set calls_per_key [expr {($count+127)/128}]
+    set write_usec [expr {[usec-per-call $r $wcmd]*$calls_per_key/$count}]
+
+    set actual [$r object encoding key:0]
+    set usage 0
+    set samples [expr {$keys < 10 ? $keys : 10}]
+    for {set k 0} {$k < $samples} {incr k} {
+        incr usage [$r memory usage key:$k samples 0]
+    }
+
+    set commands {}
+    for {set j 0} {$j < $::reads} {incr j} {
+        lappend commands [read-command $type key:[expr {$j%$keys}] \
+            $count $size $encoding]
+    }
+    pipeline $rd $commands
+    set read_usec [usec-per-call $r [lindex $commands 0 0]]
+
+    list $actual [expr {double($used)/$total}] \
+        [expr {double($usage)/($samples*$count)}] $write_usec $read_usec
+}
+
+proc main {} {
+    set pid [exec echo "port $::port\nsave \"\"\nloglevel warning\n" | \
+        $::server - > /dev/null 2> /dev/null &]
+    after 500
+    if {[catch {
+        set r [redis 127.0.0.1 $::port]
+        set rd [redis 127.0.0.1 $::port 1]
+    } err]} {
+        puts "Can't connect to the server: $err"
+        catch {exec kill -9 {*}$pid}
+        exit 1
+    }
+
+    if {$::csv} {
+        puts "type,encoding,elements,size,bytes_per_elem,usage_per_elem,write_usec_per_elem,read_usec"
+    } else {
+        puts [format "%-5s %-18s %8s %5s %11s %11s %14s %8s" type encoding \
+            elements size bytes/elem usage/elem "write us/elem" "read us"]
+    }
+    foreach type $::types {
+        foreach {encoding settings} [dict get $::encodings $type] {
+            set sizes $::sizes
+            if {$encoding in {intset hashtable-int}} {set sizes int}
+            foreach count $::counts {
+                foreach size $sizes {
+                    lassign [measure $r $rd $type $encoding $settings \
+                        $count $size] actual bytes usage wusec rusec
+                    # Single element keys may use a smaller encoding: report
+                    # what was actually measured.
+                    if {![string match $actual* $encoding]} {
+                        set encoding_name "$encoding ($actual)"
+                    } else {
+                        set encoding_name $encoding
+                    }
+                    if {$::csv} {
+                        puts [format "%s,%s,%d,%s,%.2f,%.2f,%.3f,%.2f" \
+                            $type $encoding_name $count $size $bytes $usage \
+                            $wusec $rusec]
+                    } else {
+                        puts [format "%-5s %-18s %8d %5s %11.2f %11.2f %14.3f %8.2f" \
+                            $type $encoding_name $count $size $bytes $usage \
+                            $wusec $rusec]
+                    }
+                    flush stdout
+                }
+            }
+        }
+    }
+    catch {$r shutdown nosave}
+}
+
+proc usage {} {
+    puts {Usage: ./encoding-efficiency.tcl [options]
+
+ --types <list>     Comma separated types among hash, zset, list and set.
+ --counts <list>    Comma separated element counts per key.
+ --sizes <list>     Comma separated element sizes in bytes.
+ --elements <n>     Elements stored for every measure (default 50000).
+ --reads <n>        Reads performed for every measure (default 20000).
+ --csv              Output in CSV format.
+ --port <port>      Port of the server started (default 21211).
+ --server <path>    Server executable (default ../src/redis-server).}
+    exit 1
+}
+
+# Force the user to run the script from the 'utils' directory.
+if {![file exists encoding-efficiency.tcl]} {
+    puts "Please make sure to run encoding-efficiency.tcl while inside /utils."
+    puts "Example: cd utils; ./encoding-efficiency.tcl"
+    exit 1
+}
+
+# parse arguments
+for {set j 0} {$j < [llength $argv]} {incr j} {
+    set opt [lindex $argv $j]
+    set arg [lindex $argv [expr $j+1]]
+    if {$opt in {--types --counts --sizes}} {
+        set ::[string range $opt 2 end] [split $arg ,]
+        incr j
+    } elseif {$opt in {--elements --reads --port --server}} {
+        set ::[string range $opt 2 end] $arg
+        incr j
+    } elseif {$opt eq {--csv}} {
+        set ::csv 1
+    } else {
+        usage
+    }
+}
+
+foreach type $::types {
+    if {![dict exists $::encodings $type]} {
+        puts "Unknown type: $type"
+        exit 1
+    }
+}
+
+# Make sure there is not already a server running on the port.
+if {![catch {redis 127.0.0.1 $::port} r]} {
+    puts "Sorry, you have a running server on port $::port"
+    exit 1
+}
+
+main
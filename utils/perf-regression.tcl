@@ -0,0 +1,513 @@
+#!/usr/bin/env tclsh8.5
+# Copyright (C) 2011 Salvatore Sanfilippo
+# Released under the BSD license like Redis itself
+#
+# End to end performance regression harness.
+#
+# Every revision is built in a temporary directory (the working tree is never
+# touched), then local servers are started with a few configurations, and a
+# fixed matrix of redis-benchmark workloads is run against them, followed by
+# a persistence phase timing BGSAVE, RDB loading, AOF rewrite and AOF loading.
+# Throughput, latency percentiles, RSS and persistence times are collected,
+# every measure being the median of --runs runs.
+#
+# Results can be saved as a baseline and later compared against a new run:
+# a change is flagged as a regression only if it exceeds both the threshold
+# and the noise observed in the two runs (the spread between the fastest and
+# the slowest run), and the script exits with an error in that case.
+#
+# Examples (run from the utils directory):
+#
+#   ./perf-regression.tcl --rev 4.0.10 --rev HEAD
+#   ./perf-regression.tcl --rev HEAD --save baseline.txt
+#   ./perf-regression.tcl --rev . --baseline baseline.txt
+#
+# The redis-benchmark executable of the working tree is used for every
+# revision, so that the load generator is the same; build it first.
+
+source ../tests/support/redis.tcl
+
+set ::root [file normalize ..]
+set ::benchmark [file join $::root src redis-benchmark]
+set ::workdir /tmp/perf-regression.[pid]
+set ::port 21111
+set ::revs {}
+set ::configs {default aof maxmemory cluster persistence}
+set ::runs 3
+set ::requests 100000
+set ::clients 50
+set ::keyspace 100000
+set ::datasize 64
+set ::keys 1000000
+set ::threshold 5
+set ::make_args {}
+set ::save {}
+set ::baseline {}
+set ::pids {}
+set ::dirs {}
+
+# Workloads of the matrix: name, redis-benchmark tests and extra options.
+set ::workloads {
+    simple {set,get,incr,lpush,lpop,sadd,hset,spop,lrange_100,mset} {}
+    pipeline {set,get} {-P 16}
+}
+
+# Extra configuration of every server configuration.
+set ::server_configs {
+    default {}
+    aof {{appendonly yes} {appendfsync everysec}}
+    maxmemory {{maxmemory 32mb} {maxmemory-policy allkeys-lru}}
+    cluster {{cluster-enabled yes}}
+    persistence {}
+}
+
+# Metrics where a lower value is better, the others being throughputs.
+proc lower-is-better metric {
+    expr {$metric ne {rps}}
+}
+
+proc log msg {
+    puts $msg
+    flush stdout
+}
+
+proc median values {
+    set values [lsort -real $values]
+    lindex $values [expr {[llength $values]/2}]
+}
+
+# Spread of the measures of a metric, as a percentage of the median.
+proc spread values {
+    set values [lsort -real $values]
+    set m [median $values]
+    if {$m == 0} {return 0}
+    expr {([lindex $values end]-[lindex $values 0])*100.0/$m}
+}
+
+############################### Building ######################################
+
+# Build the specified revision and return the path of its redis-server. The
+# revision "." is the working tree, which is used as it is.
+proc build-revision rev {
+    if {$rev eq {.}} {
+        set server [file join $::root src redis-server]
+        if {![file exists $server]} {
+            error "$server not found, please build the working tree first."
+        }
+        return $server
+    }
+    set dir [file join $::workdir build-[string map {/ _} $rev]]
+    file mkdir $dir
+    log "Building $rev in $dir..."
+    exec git -C $::root archive --format=tar $rev | tar -x -C $dir
+    if {[catch {
+        exec -ignorestderr make -C [file join $dir src] {*}$::make_args \
+            redis-server > [file join $dir build.log] 2>@1
+    }]} {
+        error "building $rev failed, see [file join $dir build.log]"
+    }
+    file join $dir src redis-server
+}
+
+################################ Servers ######################################
+
+# Start a server with the specified extra configuration lines, wait for it
+# to accept commands, and return a client connected to it.
+proc start-server {bin name port extra} {
+    set dir [file join $::workdir $name-$port]
+    file mkdir $dir
+    lappend ::dirs $dir
+    set fd [open [file join $dir redis.conf] w]
+    puts $fd "port $port"
+    puts $fd "dir $dir"
+    puts $fd "logfile [file join $dir redis.log]"
+    puts $fd "save \"\""
+    puts $fd "cluster-config-file nodes-$port.conf"
+    foreach line $extra {puts $fd $line}
+    close $fd
+    set pid [exec $bin [file join $dir redis.conf] > /dev/null 2> /dev/null &]
+    lappend ::pids $pid
+    wait-server $port
+}
+
+# Wait for the server to accept connections and to finish loading.
+proc wait-server port {
+    for {set j 0} {$j < 6000} {incr j} {
+        if {![catch {redis 127.0.0.1 $port} r]} {
+            if {![catch {$r ping}]} {return $r}
+            catch {$r close}
+        }
+        after 10
+    }
+    error "Server on port $port is not ready after 60 seconds."
+}
+
+proc kill-servers {} {
+    foreach pid $::pids {catch {exec kill -9 $pid}}
+    set ::pids {}
+    after 200
+}
+
+proc info-field {r field} {
+    if {[regexp "\r\n$field:(.*?)\r\n" [$r info] -> value]} {
+        return $value
+    }
+    return 0
+}
+
+# Poll the specified INFO field every 10 milliseconds until it reaches the
+# specified value, and return the milliseconds elapsed since 'start'.
+proc wait-info {r field value start} {
+    while {[info-field $r $field] ne $value} {after 10}
+    expr {[clock milliseconds]-$start}
+}
+
+# Start three masters serving a third of the slots each, and return the
+# clients connected to them once the cluster state is ok.
+proc start-cluster bin {
+    set clients {}
+    for {set j 0} {$j < 3} {incr j} {
+        set r [start-server $bin cluster [expr {$::port+$j}] \
+            [dict get $::server_configs cluster]]
+        $r cluster reset hard
+        set first [expr {$j*16384/3}]
+        set last [expr {($j+1)*16384/3-1}]
+        set slots {}
+        for {set slot $first} {$slot <= $last} {incr slot} {
+            lappend slots $slot
+        }
+        $r cluster addslots {*}$slots
+        lappend clients $r
+    }
+    foreach r [lrange $clients 1 end] {
+        $r cluster meet 127.0.0.1 $::port
+    }
+    foreach r $clients {
+        for {set j 0} {$j < 1000} {incr j} {
+            if {[info-field $r cluster_state] eq {ok} &&
+                [llength [split [string trim [$r cluster nodes]] "\n"]] == 3} {
+                break
+            }
+            after 10
+        }
+    }
+    return $clients
+}
+
+############################### Benchmarks ####################################
+
+# Run redis-benchmark and return a dictionary mapping every test to the
+# list of its rps, p50, p99 and p99.9 latencies in microseconds.
+proc run-benchmark {port tests options} {
+    set output [exec $::benchmark -p $port -n $::requests -c $::clients \
+        -r $::keyspace -d $::datasize -t $tests --csv -q {*}$options]
+    set results {}
+    foreach line [split $output "\n"] {
+        set fields [split [string map {\" {}} $line] ,]
+        if {[llength $fields] != 9 || [lindex $fields 0] eq {test}} continue
+        lassign $fields test rps avg min p50 p99 p999
+        # Skip the per node statistics of the cluster mode.
+        if {[string match {*:*} $test]} continue
+        set test [lindex [split $test] 0]
+        dict set results $test [list $rps $p50 $p99 $p999]
+    }
+    return $results
+}
+
+# Add a measure to the results of the run in progress.
+proc record {key value} {
+    dict lappend ::measures $key $value
+}
+
+proc record-benchmark {config workload results} {
+    dict for {test values} $results {
+        lassign $values rps p50 p99 p999
+        set prefix $config/$workload-$test
+        record $prefix/rps $rps
+        record $prefix/p50 $p50
+        record $prefix/p99 $p99
+        record $prefix/p99.9 $p999
+    }
+}
+
+proc run-matrix {bin config} {
+    if {$config eq {cluster}} {
+        set clients [start-cluster $bin]
+        set options --cluster
+    } else {
+        set clients [list [start-server $bin $config $::port \
+            [dict get $::server_configs $config]]]
+        set options {}
+    }
+    foreach {workload tests extra} $::workloads {
+        set results [run-benchmark $::port $tests [concat $options $extra]]
+        record-benchmark $config $workload $results
+    }
+    set rss 0
+    foreach r $clients {incr rss [info-field $r used_memory_rss]}
+    record $config/rss $rss
+    kill-servers
+    delete-dirs
+}
+
+# Remove the directories of the servers started so far, so that the next
+# run doesn't load their data.
+proc delete-dirs {} {
+    foreach dir [lsort -unique $::dirs] {file delete -force $dir}
+    set ::dirs {}
+}
+
+# Populate the dataset, then time BGSAVE, the loading of the RDB file,
+# BGREWRITEAOF and the loading of the AOF file.
+proc run-persistence bin {
+    set r [start-server $bin persistence $::port {}]
+    $r debug populate $::keys key $::datasize
+    record persistence/rss [info-field $r used_memory_rss]
+
+    set start [clock milliseconds]
+    $r bgsave
+    record persistence/bgsave-ms \
+        [wait-info $r rdb_bgsave_in_progress 0 $start]
+    if {[info-field $r rdb_last_bgsave_status] ne {ok}} {
+        error "BGSAVE failed"
+    }
+
+    set start [clock milliseconds]
+    $r bgrewriteaof
+    after 10
+    record persistence/aofrw-ms \
+        [wait-info $r aof_rewrite_in_progress 0 $start]
+    if {[info-field $r aof_last_bgrewrite_status] ne {ok}} {
+        error "BGREWRITEAOF failed"
+    }
+    kill-servers
+
+    # Load the RDB file, then the AOF file written by the rewrite, reading
+    # the loading time from the log.
+    set dir [file join $::workdir persistence-$::port]
+    foreach {metric extra pattern} {
+        rdb-load-ms {} {DB loaded from disk: ([0-9.]+) seconds}
+        aof-load-ms {{appendonly yes}}
+            {DB loaded from append only file: ([0-9.]+) seconds}
+    } {
+        file delete [file join $dir redis.log]
+        start-server $bin persistence $::port $extra
+        set fd [open [file join $dir redis.log]]
+        set log [read $fd]
+        close $fd
+        if {![regexp $pattern $log -> seconds]} {
+            error "Loading time not found in $dir/redis.log"
+        }
+        record persistence/$metric [expr {round($seconds*1000)}]
+        kill-servers
+    }
+    delete-dirs
+}
+
+# Run the whole matrix --runs times with the specified server, and return a
+# dictionary mapping every measure to the list of its median and spread.
+proc run-revision bin {
+    set ::measures {}
+    for {set run 1} {$run <= $::runs} {incr run} {
+        foreach config $::configs {
+            log "  run $run/$::runs: $config"
+            if {$config eq {persistence}} {
+                run-persistence $bin
+            } else {
+                run-matrix $bin $config
+            }
+        }
+    }
+    set results {}
+    dict for {key values} $::measures {
+        dict set results $key [list [median $values] [spread $values]]
+    }
+    return $results
+}
+
+############################### Comparison ####################################
+
+proc save-results {results filename rev} {
+    set fd [open $filename w]
+    puts $fd "# perf-regression results of $rev, [clock format [clock seconds]]"
+    puts $fd "# runs=$::runs requests=$::requests clients=$::clients\
+keyspace=$::keyspace datasize=$::datasize keys=$::keys"
+    puts $fd "# measure median spread%"
+    dict for {key values} $results {
+        puts $fd [format "%s %s %.1f" $key {*}$values]
+    }
+    close $fd
+}
+
+proc load-results filename {
+    set fd [open $filename]
+    set results {}
+    foreach line [split [read $fd] "\n"] {
+        if {$line eq {} || [string index $line 0] eq {#}} continue
+        lassign $line key median spread
+        dict set results $key [list $median $spread]
+    }
+    close $fd
+    return $results
+}
+
+# Compare two results, returning the number of regressions. A change is
+# only considered significant if it exceeds both the threshold and the sum
+# of the spreads observed in the two runs.
+proc compare-results {old new oldname newname} {
+    set regressions 0
+    log [format "\n%-40s %14s %14s %8s %6s" measure $oldname $newname \
+        change noise]
+    dict for {key values} $new {
+        lassign $values newval newspread
+        if {![dict exists $old $key]} {
+            log [format "%-40s %14s %14s" $key - $newval]
+            continue
+        }
+        lassign [dict get $old $key] oldval oldspread
+        if {$oldval == 0} continue
+        set change [expr {($newval-$oldval)*100.0/$oldval}]
+        set noise [expr {$oldspread+$newspread}]
+        set limit [expr {$noise > $::threshold ? $noise : $::threshold}]
+        set metric [lindex [split $key /] end]
+        set worse [expr {[lower-is-better $metric] ? $change : -$change}]
+        set flag {}
+        if {$worse > $limit} {
+            set flag REGRESSION
+            incr regressions
+        } elseif {$worse < -$limit} {
+            set flag improvement
+        }
+        log [format "%-40s %14s %14s %+7.1f%% %5.1f%% %s" $key $oldval \
+            $newval $change $noise $flag]
+    }
+    return $regressions
+}
+
+################################## Main #######################################
+
+proc usage {} {
+    puts {Usage: ./perf-regression.tcl [options]
+
+ --rev <rev>          Git revision to build and measure, "." being the
+                      working tree as it is. Use twice to compare two
+                      revisions.
+ --save <file>        Save the results of the last revision as a baseline.
+ --baseline <file>    Compare the results of the last revision with the
+                      specified baseline.
+ --configs <list>     Comma separated configurations among default, aof,
+                      maxmemory, cluster and persistence (default all).
+ --runs <n>           Runs of every measure, the median is used (default 3).
+ --requests <n>       Requests of every benchmark (default 100000).
+ --clients <n>        Benchmark clients (default 50).
+ --keyspace <n>       Keyspace of the benchmarks (default 100000).
+ --datasize <n>       Value size in bytes (default 64).
+ --keys <n>           Keys of the persistence dataset (default 1000000).
+ --threshold <pct>    Minimum change considered significant (default 5).
+ --make-args <args>   Extra arguments of make, for example "MALLOC=libc".
+ --port <port>        First port used by the servers (default 21111).}
+    exit 1
+}
+
+proc main {} {
+    if {![file exists $::benchmark]} {
+        puts "$::benchmark not found, please build the working tree first."
+        exit 1
+    }
+    foreach config $::configs {
+        if {![dict exists $::server_configs $config]} {
+            puts "Unknown configuration: $config"
+            exit 1
+        }
+    }
+    if {$::revs eq {}} {
+        puts "Please specify at least one revision with --rev."
+        exit 1
+    }
+    for {set j 0} {$j < 3} {incr j} {
+        if {![catch {redis 127.0.0.1 [expr {$::port+$j}]} r]} {
+            $r close
+            puts "Sorry, you have a running server on port\
+                [expr {$::port+$j}]"
+            exit 1
+        }
+    }
+
+    file mkdir $::workdir
+    set all {}
+    if {[catch {
+        foreach rev $::revs {
+            set bin [build-revision $rev]
+            log "Benchmarking $rev: [exec $bin -v]"
+            lappend all $rev [run-revision $bin]
+        }
+    } err]} {
+        kill-servers
+        puts "Error: $err"
+        exit 1
+    }
+    file delete -force $::workdir
+
+    set lastrev [lindex $all end-1]
+    set last [lindex $all end]
+    if {$::save ne {}} {
+        save-results $last $::save $lastrev
+        log "Results of $lastrev saved to $::save"
+    }
+
+    set regressions 0
+    if {[llength $::revs] > 1} {
+        incr regressions [compare-results [lindex $all end-2] $last \
+            [lindex $all end-3] $lastrev]
+    }
+    if {$::baseline ne {}} {
+        incr regressions [compare-results [load-results $::baseline] $last \
+            baseline $lastrev]
+    }
+    if {$::baseline eq {} && [llength $::revs] == 1} {
+        dict for {key values} $last {
+            log [format "%-40s %14s %5.1f%%" $key {*}$values]
+        }
+    }
+    if {$regressions} {
+        log "\n$regressions regression(s) found."
+        exit 1
+    }
+}
+
+# Force the user to run the script from the 'utils' directory.
+if {![file exists perf-regression.tcl]} {
+    puts "Please make sure to run perf-regression.tcl while inside /utils."
+    puts "Example: cd utils; ./perf-regression.tcl --rev HEAD"
+    exit 1
+}
+
+# parse arguments
+for {set j 0} {$j < [llength $argv]} {incr j} {
+    set opt [lindex $argv $j]
+    set arg [lindex $argv [expr $j+1]]
+    if {$opt eq {--rev}} {
+        lappend ::revs $arg
+        incr j
+    } elseif {$opt eq {--save}} {
+        set ::save $arg
+        incr j
+    } elseif {$opt eq {--baseline}} {
+        set ::baseline $arg
+        incr j
+    } elseif {$opt eq {--configs}} {
+        set ::configs [split $arg ,]
+        incr j
+    } elseif {$opt in {--runs --requests --clients --keyspace --datasize
+                       --keys --threshold --port}} {
+        set ::[string range $opt 2 end] $arg
+        incr j
+    } elseif {$opt eq {--make-args}} {
+        set ::make_args $arg
+        incr j
+    } else {
+        usage
+    }
+}
+
+main